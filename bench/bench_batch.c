@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <gsl/gsl_odeiv2.h>
+#include <gsl/gsl_errno.h>
+#include "batch.h"
+#include "jacobian.h"
+#include "network.h"
+#include "ode_rhs.h"
+#include "param.h"
+#include "step_sbsimp.h"
+
+/* Zones per second for the batched multi-zone solver vs. looping over
+ * zones with the scalar GSL path (evolve + control + step_sbsimp, the
+ * same method). Each zone gets its own temperature between 15 and 30
+ * MK so they need different numbers of steps.
+ *
+ * usage: bench_batch [n_zone [t_stop]] */
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const int n_zone = argc > 1 ? atoi (argv[1]) : 4096;
+  const double t_stop = argc > 2 ? atof (argv[2]) : 1.0e+15;
+  const double eps_abs = 1.0e-8, eps_rel = 0.0, h0 = 1.0e-8;
+  struct network net;
+  struct batch_solver *b;
+  double *y_batch, *y_scalar, *T, *rho, t0, t_batch, t_scalar;
+  double max_diff = 0.0;
+  int n_iso, i, z, h1, c12;
+
+  if (network_cno_init (&net) != GSL_SUCCESS)
+    return 1;
+  n_iso = net.n_iso;
+  h1 = network_find_isotope (&net, "h1");
+  c12 = network_find_isotope (&net, "c12");
+  y_batch = malloc ((size_t) n_iso * n_zone * sizeof (double));
+  y_scalar = malloc ((size_t) n_iso * n_zone * sizeof (double));
+  T = malloc (n_zone * sizeof (double));
+  rho = malloc (n_zone * sizeof (double));
+  for (z = 0; z < n_zone; ++z)
+    {
+      T[z] = 15.0e+06 + 15.0e+06 * z / (n_zone > 1 ? n_zone - 1 : 1);
+      rho[z] = 150.0;
+      for (i = 0; i < n_iso; ++i)
+	y_batch[i * n_zone + z] = 1.0e-20 * rho[z] / net.iso[i].molar_mass;
+      y_batch[h1 * n_zone + z] = 0.99 * rho[z] / net.iso[h1].molar_mass;
+      y_batch[c12 * n_zone + z] = 0.01 * rho[z] / net.iso[c12].molar_mass;
+    }
+  for (i = 0; i < n_iso * n_zone; ++i)
+    y_scalar[i] = y_batch[i];
+
+  b = batch_alloc (&net, 256);
+  if (b == NULL)
+    return 1;
+  t0 = now ();
+  batch_integrate (b, n_zone, y_batch, T, rho, t_stop, h0, eps_abs, eps_rel);
+  t_batch = now () - t0;
+
+  {
+    struct param params;
+    gsl_odeiv2_step *step = gsl_odeiv2_step_alloc (step_sbsimp, n_iso);
+    gsl_odeiv2_control *control = gsl_odeiv2_control_y_new (eps_abs,
+							    eps_rel);
+    gsl_odeiv2_evolve *evolve = gsl_odeiv2_evolve_alloc (n_iso);
+    gsl_odeiv2_system sys = { ode_rhs, jacobian, n_iso, &params };
+    double y[n_iso];
+    params.net = &net;
+    params.n_iso = n_iso;
+    params.traj = NULL;
+    params.instr = NULL;
+    params.jac_ad = 0;
+    params.energy = 0;
+
+    t0 = now ();
+    for (z = 0; z < n_zone; ++z)
+      {
+	double t = 0.0, h = h0;
+	params.T = T[z];
+	params.rho = rho[z];
+	rate_state_init (&params.rates);
+	gsl_odeiv2_evolve_reset (evolve);
+	for (i = 0; i < n_iso; ++i)
+	  y[i] = y_scalar[i * n_zone + z];
+	while (t < t_stop)
+	  {
+	    if (gsl_odeiv2_evolve_apply (evolve, control, step, &sys, &t,
+					 t_stop, &h, y) != GSL_SUCCESS)
+	      break;
+	  }
+	for (i = 0; i < n_iso; ++i)
+	  y_scalar[i * n_zone + z] = y[i];
+      }
+    t_scalar = now () - t0;
+    gsl_odeiv2_step_free (step);
+    gsl_odeiv2_control_free (control);
+    gsl_odeiv2_evolve_free (evolve);
+  }
+
+  for (i = 0; i < n_iso * n_zone; ++i)
+    {
+      const double d = fabs (y_batch[i] - y_scalar[i]);
+      if (d > max_diff)
+	max_diff = d;
+    }
+
+  printf ("%-8s %10s %14s %12s %12s\n", "path", "zones", "zones/s",
+	  "steps", "rejects");
+  printf ("%-8s %10d %14.1f %12ld %12ld\n", "batch", n_zone,
+	  n_zone / t_batch, b->stats.n_zone_steps, b->stats.n_zone_rejects);
+  printf ("%-8s %10d %14.1f %12s %12s\n", "scalar", n_zone,
+	  n_zone / t_scalar, "-", "-");
+  printf ("speedup %.2f, max |y_batch - y_scalar| = %.3e mol/cm^3\n",
+	  t_scalar / t_batch, max_diff);
+
+  batch_free (b);
+  network_free (&net);
+  free (y_batch);
+  free (y_scalar);
+  free (T);
+  free (rho);
+  return 0;
+}
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <gsl/gsl_odeiv2.h>
+#include <gsl/gsl_errno.h>
+#include "jacobian.h"
+#include "network.h"
+#include "ode_rhs.h"
+#include "param.h"
+#include "rate_coeffs.h"
+#include "schedule.h"
+#include "steppers.h"
+
+/* Work-precision diagrams: what every stepper gets right, and what it
+ * costs, at every tolerance. main.c runs bsimp at eps_abs = 1e-8 and
+ * eps_rel = 0 because that's what worked when it was written; this is
+ * what the next choice should be based on.
+ *
+ * For each problem (T, rho, 99% H1 and 1% C12, like main.c's, to
+ * t_stop) we first work out a reference solution with sbsimp at a
+ * tolerance well below the tightest one we test (--ref-eps), and check
+ * it against ros4 at the same tolerance: they're different methods, so
+ * where they agree we believe them, and their difference is the
+ * smallest error the table can resolve (it's printed as "ref. check").
+ * Then every stepper runs the problem at every eps_abs from --eps-max
+ * down to --eps-min a decade at a time (eps_rel is eps_abs times
+ * --eps-rel, 0 by default like main.c), landing on --n-out log-spaced
+ * output times, where the mass fractions are compared with the
+ * reference's. The same cut-off of dead isotopes as main.c's is
+ * applied after every step, so these are the errors a production run
+ * would have.
+ *
+ * For every run we record
+ *   err_final  max |X_i - X_ref_i| over the isotopes at t_stop
+ *   err_max    the same, the largest over all output times
+ *   mass_err   the largest relative change in the number of nucleons,
+ *              sum Y_i A_i, over the output times: what the network
+ *              conserves exactly (sum X_i doesn't quite, the binding
+ *              energy goes into the mass fractions' molar masses)
+ * against the median wall time over --repeats runs and the steps,
+ * rejected steps, and RHS and Jacobian calls (with the linker's --wrap,
+ * as in bench_suite.c; 0 without). A run that fails, or takes more
+ * than BENCH_MAX_STEPS steps, gets its GSL status and no errors.
+ *
+ * The table goes to stdout, and one row per run to --output (default
+ * work_precision.dat) for plotting err_max against seconds or rhs,
+ * a line per stepper and a panel per problem. Steppers that aren't
+ * there (e.g. a GSL without msbdf) are skipped.
+ *
+ * usage: bench_precision [--eps-min E] [--eps-max E] [--eps-rel R]
+ *                        [--ref-eps E] [--t-stop SEC] [--n-out N]
+ *                        [--repeats N] [--filter STEPPER]
+ *                        [--output FILE] */
+
+// give up on a run after this many steps, like a sweep does
+#define BENCH_MAX_STEPS 1000000
+// longest stepper name in stepper_names
+#define BENCH_NAME_LEN 16
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+// counters, only incremented if the wrappers below are linked in
+static long n_rhs, n_jac;
+
+#ifdef BENCH_WRAP
+int __real_ode_rhs (double t, const double y[], double dydt[], void *params);
+int __real_jacobian (double t, const double y[], double *dfdy,
+		     double dfdt[], void *params);
+int __real_jacobian_sparse (double t, const double y[], double jac_val[],
+			    double dfdt[], void *params);
+
+int
+__wrap_ode_rhs (double t, const double y[], double dydt[], void *params)
+{
+  ++n_rhs;
+  return __real_ode_rhs (t, y, dydt, params);
+}
+
+int
+__wrap_jacobian (double t, const double y[], double *dfdy, double dfdt[],
+		 void *params)
+{
+  ++n_jac;
+  return __real_jacobian (t, y, dfdy, dfdt, params);
+}
+
+int
+__wrap_jacobian_sparse (double t, const double y[], double jac_val[],
+			double dfdt[], void *params)
+{
+  ++n_jac;
+  return __real_jacobian_sparse (t, y, jac_val, dfdt, params);
+}
+#endif
+
+/* the problems: the corners of where CNO burning happens, from the
+ * Sun's core to a massive star's, and around main.c's 25 MK, 150 g/cc */
+struct problem
+{
+  double T, rho;
+};
+
+static const struct problem problems[] = {
+  {15.0e+06, 150.0},
+  {25.0e+06, 10.0},
+  {25.0e+06, 150.0},
+  {25.0e+06, 1000.0},
+  {40.0e+06, 50.0},
+  {80.0e+06, 10.0},
+};
+
+// one integration of a problem, and what came out of it
+struct run
+{
+  int status;
+  long n_steps, n_rejected, n_rhs, n_jac;
+  double seconds;
+  double nucleons;		// sum Y_i A_i / rho at the start
+};
+
+/* Integrates problem p with step_type at (eps_abs, eps_rel), landing
+ * on each of the output times in out, and leaves the mass fractions
+ * there in x (n_iso per time). */
+static void
+integrate (const struct network *net, const struct problem *p,
+	   const gsl_odeiv2_step_type *step_type, double eps_abs,
+	   double eps_rel, const struct schedule *out, double x[],
+	   struct run *r)
+{
+  const int n_iso = net->n_iso;
+  const int h1 = network_find_isotope (net, "h1");
+  const int c12 = network_find_isotope (net, "c12");
+  struct param params;
+  double y[n_iso], t = 0.0, h = 1.0e-8, t0;
+  long rhs0 = n_rhs, jac0 = n_jac;
+  int i, j;
+
+  params.net = net;
+  params.n_iso = n_iso;
+  params.T = p->T;
+  params.rho = p->rho;
+  params.traj = NULL;
+  params.traj_pos = 0;
+  params.instr = NULL;
+  params.jac_ad = 0;
+  params.energy = 0;
+  rate_state_init (&params.rates);
+  for (i = 0; i < n_iso; ++i)
+    y[i] = 1.0e-20 * (p->rho / net->iso[i].molar_mass);
+  y[h1] = 0.99 * (p->rho / net->iso[h1].molar_mass);
+  y[c12] = 0.01 * (p->rho / net->iso[c12].molar_mass);
+  r->nucleons = 0.0;
+  for (i = 0; i < n_iso; ++i)
+    r->nucleons += y[i] * net->iso[i].A / p->rho;
+
+  t0 = now ();
+  gsl_odeiv2_system sys = { ode_rhs, jacobian, n_iso, &params };
+  gsl_odeiv2_driver *driver =
+    gsl_odeiv2_driver_alloc_y_new (&sys, step_type, h, eps_abs, eps_rel);
+  r->status = driver != NULL ? GSL_SUCCESS : GSL_ENOMEM;
+  for (j = 0; j < out->n && r->status == GSL_SUCCESS; ++j)
+    {
+      while (t < out->t[j])
+	{
+	  if (driver->e->count == BENCH_MAX_STEPS)
+	    {
+	      r->status = GSL_EMAXITER;
+	      break;
+	    }
+	  r->status = gsl_odeiv2_evolve_apply (driver->e, driver->c,
+					       driver->s, &sys, &t,
+					       out->t[j], &h, y);
+	  if (r->status != GSL_SUCCESS)
+	    break;
+	  for (i = 0; i < n_iso; ++i)
+	    if (y[i] * net->iso[i].molar_mass / p->rho < 1.0e-20)
+	      y[i] = 0.0;
+	}
+      for (i = 0; i < n_iso; ++i)
+	x[j * n_iso + i] = y[i] * net->iso[i].molar_mass / p->rho;
+    }
+  r->seconds = now () - t0;
+  r->n_steps = driver != NULL ? (long) driver->e->count : 0;
+  r->n_rejected = driver != NULL ? (long) driver->e->failed_steps : 0;
+  r->n_rhs = n_rhs - rhs0;
+  r->n_jac = n_jac - jac0;
+  if (driver != NULL)
+    gsl_odeiv2_driver_free (driver);
+}
+
+/* the errors of x (n_iso mass fractions at each of n_out times)
+ * against x_ref: the largest |x - x_ref| at the last time, the largest
+ * at any time, and the largest relative change in the nucleons from
+ * the nucleons at the start */
+static void
+errors (const struct network *net, int n_out, const double x[],
+	const double x_ref[], double nucleons, double *err_final,
+	double *err_max, double *mass_err)
+{
+  const int n_iso = net->n_iso;
+  int i, j;
+  *err_final = *err_max = *mass_err = 0.0;
+  for (j = 0; j < n_out; ++j)
+    {
+      double err = 0.0, sum = 0.0;
+      for (i = 0; i < n_iso; ++i)
+	{
+	  const double d = fabs (x[j * n_iso + i] - x_ref[j * n_iso + i]);
+	  if (d > err)
+	    err = d;
+	  sum += x[j * n_iso + i] * net->iso[i].A / net->iso[i].molar_mass;
+	}
+      if (err > *err_max)
+	*err_max = err;
+      if (fabs (sum / nucleons - 1.0) > *mass_err)
+	*mass_err = fabs (sum / nucleons - 1.0);
+      if (j == n_out - 1)
+	*err_final = err;
+    }
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const int n_problem = sizeof (problems) / sizeof (problems[0]);
+  double eps_min = 1.0e-12, eps_max = 1.0e-4, eps_rel = 0.0;
+  double ref_eps = 1.0e-13, t_stop = 1.0e+22;
+  int n_out = 40, repeats = 3, arg;
+  const char *filter = NULL, *out_path = "work_precision.dat";
+  char names[BENCH_NAME_LEN * 8], *name[8], *tok;
+  struct network net;
+  struct schedule out;
+  int n_name = 0, n_iso, p, s, k, i;
+  FILE *fp;
+
+  for (arg = 1; arg < argc; ++arg)
+    {
+      if (strcmp (argv[arg], "--eps-min") == 0 && arg + 1 < argc)
+	eps_min = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--eps-max") == 0 && arg + 1 < argc)
+	eps_max = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--eps-rel") == 0 && arg + 1 < argc)
+	eps_rel = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--ref-eps") == 0 && arg + 1 < argc)
+	ref_eps = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--t-stop") == 0 && arg + 1 < argc)
+	t_stop = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--n-out") == 0 && arg + 1 < argc)
+	n_out = atoi (argv[++arg]);
+      else if (strcmp (argv[arg], "--repeats") == 0 && arg + 1 < argc)
+	repeats = atoi (argv[++arg]);
+      else if (strcmp (argv[arg], "--filter") == 0 && arg + 1 < argc)
+	filter = argv[++arg];
+      else if (strcmp (argv[arg], "--output") == 0 && arg + 1 < argc)
+	out_path = argv[++arg];
+      else
+	{
+	  fprintf (stderr, "usage: %s [--eps-min E] [--eps-max E] "
+		   "[--eps-rel R] [--ref-eps E]\n"
+		   "       %*s [--t-stop SEC] [--n-out N] [--repeats N] "
+		   "[--filter STEPPER]\n       %*s [--output FILE]\n",
+		   argv[0], (int) strlen (argv[0]), "",
+		   (int) strlen (argv[0]), "");
+	  return 1;
+	}
+    }
+  if (repeats < 1)
+    repeats = 1;
+  if (eps_min <= 0.0 || eps_max < eps_min || ref_eps <= 0.0)
+    {
+      fprintf (stderr, "need 0 < --eps-min <= --eps-max, --ref-eps > 0\n");
+      return 1;
+    }
+  if (ref_eps >= eps_min)
+    fprintf (stderr, "warning: --ref-eps %.1e isn't below --eps-min "
+	     "%.1e, the smallest errors will be the reference's\n", ref_eps,
+	     eps_min);
+
+  // every stepper that's there, in stepper_names order
+  strncpy (names, stepper_names, sizeof (names) - 1);
+  names[sizeof (names) - 1] = '\0';
+  for (tok = strtok (names, "|"); tok != NULL && n_name < 8;
+       tok = strtok (NULL, "|"))
+    if (stepper_by_name (tok) != NULL
+	&& (filter == NULL || strcmp (tok, filter) == 0))
+      name[n_name++] = tok;
+
+  if (network_cno_init (&net) != GSL_SUCCESS)
+    return 1;
+  n_iso = net.n_iso;
+  // the output times, from 1 sec: nothing much happens before that
+  if (schedule_log (&out, 1.0, t_stop, n_out) != GSL_SUCCESS)
+    {
+      fprintf (stderr, "bad --t-stop or --n-out\n");
+      network_free (&net);
+      return 1;
+    }
+  fp = fopen (out_path, "w");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "can't write %s\n", out_path);
+      schedule_free (&out);
+      network_free (&net);
+      return 1;
+    }
+  fprintf (fp, "%12s %12s %8s %12s %12s %6s %10s %10s %10s %10s %12s "
+	   "%12s %12s %12s\n", "T", "rho", "stepper", "eps_abs", "eps_rel",
+	   "status", "steps", "rejected", "rhs", "jac", "seconds",
+	   "err_final", "err_max", "mass_err");
+
+  double *x_ref = malloc ((size_t) n_out * n_iso * sizeof (double));
+  double *x_chk = malloc ((size_t) n_out * n_iso * sizeof (double));
+  double *x = malloc ((size_t) n_out * n_iso * sizeof (double));
+  double sec[repeats];
+  if (x_ref == NULL || x_chk == NULL || x == NULL)
+    return 1;
+
+  for (p = 0; p < n_problem; ++p)
+    {
+      struct run ref, chk;
+      double err_final, err_max, mass_err, chk_err, ref_mass;
+
+      integrate (&net, &problems[p], stepper_by_name ("sbsimp"), ref_eps,
+		 ref_eps * eps_rel, &out, x_ref, &ref);
+      integrate (&net, &problems[p], stepper_by_name ("ros4"), ref_eps,
+		 ref_eps * eps_rel, &out, x_chk, &chk);
+      printf ("\nT = %.3e K, rho = %.3e g/cm^3, to %.3e sec\n",
+	      problems[p].T, problems[p].rho, t_stop);
+      if (ref.status != GSL_SUCCESS)
+	{
+	  printf ("reference failed: %s\n", gsl_strerror (ref.status));
+	  continue;
+	}
+      errors (&net, n_out, x_chk, x_ref, ref.nucleons, &err_final, &chk_err,
+	      &mass_err);
+      errors (&net, n_out, x_ref, x_ref, ref.nucleons, &err_final, &err_max,
+	      &ref_mass);
+      printf ("reference: sbsimp at %.1e, %ld steps, mass error %.2e; "
+	      "ref. check (ros4) %.2e%s\n", ref_eps, ref.n_steps, ref_mass,
+	      chk_err, chk.status == GSL_SUCCESS ? "" : " (failed)");
+      printf ("%8s %10s %6s %8s %8s %10s %8s %11s %10s %10s %10s\n",
+	      "stepper", "eps_abs", "status", "steps", "rejected", "rhs",
+	      "jac", "seconds", "err_final", "err_max", "mass_err");
+
+      for (s = 0; s < n_name; ++s)
+	{
+	  const gsl_odeiv2_step_type *type = stepper_by_name (name[s]);
+	  double eps;
+	  // a decade at a time, loose to tight, landing on eps_min
+	  for (eps = eps_max; eps >= eps_min * (1.0 - 1.0e-9); eps /= 10.0)
+	    {
+	      struct run r;
+	      for (k = 0; k < repeats; ++k)
+		{
+		  integrate (&net, &problems[p], type, eps, eps * eps_rel,
+			     &out, x, &r);
+		  sec[k] = r.seconds;
+		}
+	      // the counts are the same every time, the clock isn't
+	      qsort (sec, repeats, sizeof (double), compare_double);
+	      r.seconds = sec[repeats / 2];
+	      if (r.status == GSL_SUCCESS)
+		errors (&net, n_out, x, x_ref, r.nucleons, &err_final,
+			&err_max, &mass_err);
+	      else
+		err_final = err_max = mass_err = NAN;
+	      printf ("%8s %10.1e %6d %8ld %8ld %10ld %8ld %11.4e %10.2e "
+		      "%10.2e %10.2e\n", name[s], eps, r.status, r.n_steps,
+		      r.n_rejected, r.n_rhs, r.n_jac, r.seconds, err_final,
+		      err_max, mass_err);
+	      fprintf (fp, "%12.4e %12.4e %8s %12.4e %12.4e %6d %10ld %10ld "
+		       "%10ld %10ld %12.4e %12.4e %12.4e %12.4e\n",
+		       problems[p].T, problems[p].rho, name[s], eps,
+		       eps * eps_rel, r.status, r.n_steps, r.n_rejected,
+		       r.n_rhs, r.n_jac, r.seconds, err_final, err_max,
+		       mass_err);
+	    }
+	}
+    }
+
+  i = fclose (fp);
+  free (x_ref);
+  free (x_chk);
+  free (x);
+  schedule_free (&out);
+  network_free (&net);
+  if (i != 0)
+    {
+      fprintf (stderr, "error writing %s\n", out_path);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <time.h>
+#include "ode_rhs.h"
+#include "jacobian.h"
+#include "network.h"
+#include "rate_coeffs.h"
+#include "param.h"
+
+/* Times the RHS and Jacobian with and without the precomputed rate
+ * vector. "legacy" is the old RHS, which called the lambda_ij*()
+ * functions for every term, so it redid each CF88 fit several times
+ * per call. "uncached" throws the rate vector away before every call
+ * (i.e. what happens if T changes every call), and "cached" is what
+ * the integrator sees during a constant-T run. "hand-written" is the
+ * cached RHS with the CNO network hard-coded the way it was before the
+ * generic network kernels, and "network_rhs" the generic kernel alone
+ * on the same rate vector, so the two of them show what the generality
+ * costs and the cached line what ode_rhs() adds around it. */
+
+#define N_ISO 13
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+// the RHS as it was before struct rate_state existed
+static void legacy_rhs_impl (const double y[], double dydt[], double T);
+static void (*volatile legacy_rhs) (const double[], double[], double) =
+  legacy_rhs_impl;
+
+static void
+legacy_rhs_impl (const double y[], double dydt[], double T)
+{
+  dydt[0] = lambda_ijT_avg (6, 12, T, 'a') * y[6] * y[12]
+    + lambda_ijT_avg (9, 12, T, 'a') * y[9] * y[12]
+    + lambda_ijT (11, 12, T) * y[11] * y[12];
+  dydt[1] = -lambda_ijT (1, 12, T) * y[1] * y[12]
+    + lambda_ijT_avg (6, 12, T, 'a') * y[6] * y[12];
+  dydt[2] = lambda_ijT (1, 12, T) * y[1] * y[12] - lambda_ij_beta (2) * y[2];
+  dydt[3] = lambda_ij_beta (2) * y[2] - lambda_ijT (3, 12, T) * y[3] * y[12];
+  dydt[4] = -lambda_ijT (4, 12, T) * y[4] * y[12]
+    + lambda_ijT (3, 12, T) * y[3] * y[12]
+    + lambda_ijT_avg (9, 12, T, 'a') * y[9] * y[12];
+  dydt[5] = -lambda_ij_beta (5) * y[5] + lambda_ijT (4, 12, T) * y[4] * y[12];
+  dydt[6] = lambda_ij_beta (5) * y[5]
+    - lambda_ijT_avg (6, 12, T, 'a') * y[6] * y[12]
+    - lambda_ijT_avg (6, 12, T, 'g') * y[6] * y[12]
+    + lambda_ijT (11, 12, T) * y[11] * y[12];
+  dydt[7] = lambda_ijT_avg (6, 12, T, 'g') * y[6] * y[12]
+    - lambda_ijT (7, 12, T) * y[7] * y[12];
+  dydt[8] = lambda_ijT (7, 12, T) * y[7] * y[12] - lambda_ij_beta (8) * y[8];
+  dydt[9] = lambda_ij_beta (8) * y[8]
+    - lambda_ijT_avg (9, 12, T, 'g') * y[9] * y[12]
+    - lambda_ijT_avg (9, 12, T, 'a') * y[9] * y[12];
+  dydt[10] = lambda_ijT_avg (9, 12, T, 'g') * y[9] * y[12]
+    - lambda_ij_beta (10) * y[10];
+  dydt[11] = lambda_ij_beta (10) * y[10]
+    - lambda_ijT (11, 12, T) * y[11] * y[12];
+  dydt[12] = -lambda_ijT (1, 12, T) * y[1] * y[12]
+    - lambda_ijT (3, 12, T) * y[3] * y[12]
+    - lambda_ijT (4, 12, T) * y[4] * y[12]
+    - lambda_ijT_avg (6, 12, T, 'a') * y[6] * y[12]
+    - lambda_ijT_avg (6, 12, T, 'g') * y[6] * y[12]
+    - lambda_ijT (7, 12, T) * y[7] * y[12]
+    - lambda_ijT_avg (9, 12, T, 'a') * y[9] * y[12]
+    - lambda_ijT_avg (9, 12, T, 'g') * y[9] * y[12]
+    - lambda_ijT (11, 12, T) * y[11] * y[12];
+}
+
+/* the CNO RHS hard-coded against the rate vector. called through a
+ * volatile pointer so the compiler can't inline it and hoist the whole
+ * thing out of the timing loop */
+static void handwritten_rhs_impl (const double y[], double dydt[],
+				  const double lambda[]);
+static void (*volatile handwritten_rhs) (const double[], double[],
+					 const double[]) =
+  handwritten_rhs_impl;
+
+static void
+handwritten_rhs_impl (const double y[], double dydt[], const double lambda[])
+{
+  const double f_c12_pg = lambda[R_C12_P_G_N13] * y[1] * y[12];
+  const double f_c13_pg = lambda[R_C13_P_G_N14] * y[3] * y[12];
+  const double f_n14_pg = lambda[R_N14_P_G_O15] * y[4] * y[12];
+  const double f_n15_pa = lambda[R_N15_P_A_C12] * y[6] * y[12];
+  const double f_n15_pg = lambda[R_N15_P_G_O16] * y[6] * y[12];
+  const double f_o16_pg = lambda[R_O16_P_G_F17] * y[7] * y[12];
+  const double f_o17_pa = lambda[R_O17_P_A_N14] * y[9] * y[12];
+  const double f_o17_pg = lambda[R_O17_P_G_F18] * y[9] * y[12];
+  const double f_o18_pa = lambda[R_O18_P_A_N15] * y[11] * y[12];
+  const double f_n13_b = lambda[R_N13_E_NU] * y[2];
+  const double f_o15_b = lambda[R_O15_E_NU] * y[5];
+  const double f_f17_b = lambda[R_F17_E_NU] * y[8];
+  const double f_f18_b = lambda[R_F18_E_NU] * y[10];
+
+  dydt[0] = f_n15_pa + f_o17_pa + f_o18_pa;
+  dydt[1] = -f_c12_pg + f_n15_pa;
+  dydt[2] = f_c12_pg - f_n13_b;
+  dydt[3] = f_n13_b - f_c13_pg;
+  dydt[4] = -f_n14_pg + f_c13_pg + f_o17_pa;
+  dydt[5] = -f_o15_b + f_n14_pg;
+  dydt[6] = f_o15_b - f_n15_pa - f_n15_pg + f_o18_pa;
+  dydt[7] = f_n15_pg - f_o16_pg;
+  dydt[8] = f_o16_pg - f_f17_b;
+  dydt[9] = f_f17_b - f_o17_pg - f_o17_pa;
+  dydt[10] = f_o17_pg - f_f18_b;
+  dydt[11] = f_f18_b - f_o18_pa;
+  dydt[12] =
+    -f_c12_pg - f_c13_pg - f_n14_pg - f_n15_pa - f_n15_pg - f_o16_pg -
+    f_o17_pa - f_o17_pg - f_o18_pa;
+}
+
+// network_rhs() behind the same kind of pointer, to compare fairly
+static void (*volatile generic_rhs) (const struct network *, const double[],
+				     const double[], double[]) = network_rhs;
+
+int
+main (int argc, char *argv[])
+{
+  const long n_calls = 200000;
+  struct param params;
+  struct network net;
+  double y[N_ISO], dydt[N_ISO], dfdy[N_ISO * N_ISO], dfdt[N_ISO];
+  double t0, t_legacy, t_uncached, t_cached, t_hand, t_generic,
+    t_jac;
+  // keeps the compiler from throwing the loops away
+  volatile double sink = 0.0;
+  long n;
+  int i;
+
+  if (network_cno_init (&net) != 0)
+    return 1;
+  params.net = &net;
+  params.n_iso = N_ISO;
+  params.T = 25.0e+06;
+  params.rho = 150.0;
+  params.traj = NULL;
+  params.instr = NULL;
+  params.jac_ad = 0;
+  params.energy = 0;
+  rate_state_init (&params.rates);
+  for (i = 0; i < N_ISO; ++i)
+    y[i] = 1.0e-3 * (i + 1);
+
+  t0 = now ();
+  for (n = 0; n < n_calls; ++n)
+    {
+      legacy_rhs (y, dydt, params.T);
+      sink += dydt[12];
+    }
+  t_legacy = now () - t0;
+
+  t0 = now ();
+  for (n = 0; n < n_calls; ++n)
+    {
+      rate_state_init (&params.rates);
+      ode_rhs (0.0, y, dydt, &params);
+      sink += dydt[12];
+    }
+  t_uncached = now () - t0;
+
+  t0 = now ();
+  for (n = 0; n < n_calls; ++n)
+    {
+      ode_rhs (0.0, y, dydt, &params);
+      sink += dydt[12];
+    }
+  t_cached = now () - t0;
+
+  t0 = now ();
+  for (n = 0; n < n_calls; ++n)
+    {
+      handwritten_rhs (y, dydt, params.rates.lambda);
+      sink += dydt[12];
+    }
+  t_hand = now () - t0;
+
+  t0 = now ();
+  for (n = 0; n < n_calls; ++n)
+    {
+      generic_rhs (&net, params.rates.lambda, y, dydt);
+      sink += dydt[12];
+    }
+  t_generic = now () - t0;
+
+  t0 = now ();
+  for (n = 0; n < n_calls; ++n)
+    {
+      jacobian (0.0, y, dfdy, dfdt, &params);
+      sink += dfdy[N_ISO * N_ISO - 1];
+    }
+  t_jac = now () - t0;
+
+  printf ("%-22s %12s %10s\n", "benchmark", "ns/call", "speedup");
+  printf ("%-22s %12.1f %10.2f\n", "ode_rhs (legacy)",
+	  1.0e9 * t_legacy / n_calls, 1.0);
+  printf ("%-22s %12.1f %10.2f\n", "ode_rhs (uncached)",
+	  1.0e9 * t_uncached / n_calls, t_legacy / t_uncached);
+  printf ("%-22s %12.1f %10.2f\n", "ode_rhs (cached)",
+	  1.0e9 * t_cached / n_calls, t_legacy / t_cached);
+  printf ("%-22s %12.1f %10.2f\n", "ode_rhs (hand-written)",
+	  1.0e9 * t_hand / n_calls, t_legacy / t_hand);
+  printf ("%-22s %12.1f %10.2f\n", "network_rhs",
+	  1.0e9 * t_generic / n_calls, t_legacy / t_generic);
+  printf ("%-22s %12.1f %10s\n", "jacobian (cached)",
+	  1.0e9 * t_jac / n_calls, "-");
+  network_free (&net);
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "network.h"
+#include "rate_coeffs.h"
+#include "sparse_lu.h"
+
+/* How the sparse LU scales with network size. The networks are made
+ * up: a long chain of proton captures and beta-decays with an (p,a)
+ * branch every few isotopes that cycles back down the chain, which is
+ * roughly the shape of the CNO cycles repeated over and over. For each
+ * size we time one numeric factorization of I - h*J plus one solve,
+ * which is what the stiff stepper does per substep sequence. */
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+static int
+build_chain (struct network *net, int n_chain)
+{
+  int i, h1, he4, first;
+  char name[32];
+  network_init (net);
+  h1 = network_add_isotope (net, "h1", 1, 1, 1.00794);
+  he4 = network_add_isotope (net, "he4", 2, 4, 4.002602);
+  first = net->n_iso;
+  for (i = 0; i < n_chain; ++i)
+    {
+      snprintf (name, sizeof (name), "x%d", i);
+      network_add_isotope (net, name, 6 + i / 2, 12 + i, 12.0 + i);
+    }
+  for (i = 0; i + 1 < n_chain; ++i)
+    {
+      const int in[] = { first + i, h1 };
+      const int next = first + i + 1;
+      if (network_add_reaction (net, i % N_RATES, 2, in, 1, &next) < 0)
+	return -1;
+      if (i % 2 == 1
+	  && network_add_reaction (net, R_N13_E_NU, 1, &in[0], 1, &next) < 0)
+	return -1;
+      if (i % 4 == 3)
+	{
+	  const int out[] = { first + i - 3, he4 };
+	  if (network_add_reaction (net, R_N15_P_A_C12, 2, in, 2, out) < 0)
+	    return -1;
+	}
+    }
+  return network_finalize (net);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const int sizes[] = { 13, 50, 100, 200, 500, 1000, 2000 };
+  const int n_sizes = sizeof (sizes) / sizeof (sizes[0]);
+  struct rate_state rs;
+  const double *lambda;
+  int s, i, k;
+
+  rate_state_init (&rs);
+  lambda = rate_state_update (&rs, 25.0e+06, 150.0);
+
+  printf ("%8s %8s %8s %10s %14s %14s\n", "n_iso", "nnz", "nnz_lu",
+	  "setup_us", "factor_ns", "ns/isotope");
+  for (s = 0; s < n_sizes; ++s)
+    {
+      struct network net;
+      struct sparse_lu *lu;
+      double *y, *jac, *a, *b, t0, t_setup, t_factor;
+      const double h = 1.0e+10;
+      int n_calls, n;
+
+      if (build_chain (&net, sizes[s]) != 0)
+	return 1;
+      n = net.n_iso;
+      y = malloc (n * sizeof (double));
+      b = malloc (n * sizeof (double));
+      jac = malloc (net.jac_nnz * sizeof (double));
+      a = malloc (net.jac_nnz * sizeof (double));
+      for (i = 0; i < n; ++i)
+	{
+	  y[i] = 1.0e-3;
+	  b[i] = 1.0;
+	}
+      y[0] = 1.0;
+      network_jacobian_sparse (&net, lambda, y, jac);
+      for (k = 0; k < net.jac_nnz; ++k)
+	a[k] = -h * jac[k];
+      for (i = 0; i < n; ++i)
+	{
+	  for (k = net.jac_row_ptr[i]; k < net.jac_row_ptr[i + 1]; ++k)
+	    {
+	      if (net.jac_col[k] == i)
+		a[k] += 1.0;
+	    }
+	}
+
+      t0 = now ();
+      lu = sparse_lu_alloc (n, net.jac_row_ptr, net.jac_col);
+      t_setup = now () - t0;
+      if (lu == NULL)
+	return 1;
+
+      n_calls = 2000000 / n + 1;
+      t0 = now ();
+      for (k = 0; k < n_calls; ++k)
+	{
+	  sparse_lu_factor (lu, a);
+	  sparse_lu_solve (lu, b, y);
+	}
+      t_factor = (now () - t0) / n_calls;
+
+      printf ("%8d %8d %8d %10.1f %14.1f %14.2f\n", n, net.jac_nnz,
+	      lu->nnz_lu, 1.0e6 * t_setup, 1.0e9 * t_factor,
+	      1.0e9 * t_factor / n);
+
+      sparse_lu_free (lu);
+      network_free (&net);
+      free (y);
+      free (b);
+      free (jac);
+      free (a);
+    }
+  return 0;
+}
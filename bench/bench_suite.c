@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gsl/gsl_odeiv2.h>
+#include <gsl/gsl_errno.h>
+#include "equilibrium.h"
+#include "jacobian.h"
+#include "network.h"
+#include "nn_solver.h"
+#include "ode_rhs.h"
+#include "param.h"
+#include "rate_coeffs.h"
+#include "rate_kernel.h"
+#include "step_bdf.h"
+#include "step_ros4.h"
+#include "step_sbsimp.h"
+
+/* The benchmark suite: every lambda_* fit, ode_rhs, the Jacobians and
+ * full integrations to t_stop, timed the same way so numbers from
+ * different builds can be compared.
+ *
+ * Each benchmark is first calibrated (the number of calls per sample
+ * is doubled until a sample takes at least --min-time), then sampled
+ * --repeats times. We report the median time per call, which doesn't
+ * care about the odd sample that got interrupted, the minimum, and the
+ * median absolute deviation as a measure of the noise; if the MAD is
+ * more than a few percent of the median, don't trust a difference of
+ * that size between two runs.
+ *
+ * With the linker's --wrap (see CMakeLists.txt; BENCH_WRAP) we also
+ * count calls to malloc/calloc/realloc and to ode_rhs, jacobian and
+ * jacobian_sparse made by our code, and report them per call: an
+ * allocation in a hot path, or an integration that suddenly needs more
+ * RHS evaluations, is a regression even when the clock doesn't notice.
+ *
+ * usage: bench_suite [--repeats N] [--min-time SEC] [--filter TEXT]
+ *                    [--json FILE] */
+
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE "unknown"
+#endif
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+// counters, only incremented if the wrappers below are linked in
+static long n_alloc, n_rhs, n_jac;
+
+#ifdef BENCH_WRAP
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t n, size_t size);
+void *__real_realloc (void *p, size_t size);
+int __real_ode_rhs (double t, const double y[], double dydt[], void *params);
+int __real_jacobian (double t, const double y[], double *dfdy,
+		     double dfdt[], void *params);
+int __real_jacobian_sparse (double t, const double y[], double jac_val[],
+			    double dfdt[], void *params);
+
+void *
+__wrap_malloc (size_t size)
+{
+  ++n_alloc;
+  return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t n, size_t size)
+{
+  ++n_alloc;
+  return __real_calloc (n, size);
+}
+
+void *
+__wrap_realloc (void *p, size_t size)
+{
+  ++n_alloc;
+  return __real_realloc (p, size);
+}
+
+int
+__wrap_ode_rhs (double t, const double y[], double dydt[], void *params)
+{
+  ++n_rhs;
+  return __real_ode_rhs (t, y, dydt, params);
+}
+
+int
+__wrap_jacobian (double t, const double y[], double *dfdy, double dfdt[],
+		 void *params)
+{
+  ++n_jac;
+  return __real_jacobian (t, y, dfdy, dfdt, params);
+}
+
+int
+__wrap_jacobian_sparse (double t, const double y[], double jac_val[],
+			double dfdt[], void *params)
+{
+  ++n_jac;
+  return __real_jacobian_sparse (t, y, jac_val, dfdt, params);
+}
+#endif
+
+// what every benchmark gets: the network and a state to work on
+struct bench_ctx
+{
+  struct network net;
+  struct param params;
+  double *y, *dydt, *dfdy, *dfdt, *jac_val;
+  double T;
+  volatile double sink;		// keeps the compiler from dropping calls
+  long n_steps;			// steps taken by the integration benchmarks
+  struct nn_solver *solver;	// for the library benchmark
+};
+
+/* the fits, called through volatile pointers so the compiler can't
+ * see through them and hoist the call out of the loop */
+typedef double (*fit_T) (double);
+typedef double (*fit_const) ();
+
+struct bench
+{
+  const char *name;
+  void (*run) (struct bench_ctx * ctx, long n, const struct bench * b);
+  fit_T fit;			// lambda_* benchmarks
+  fit_const fit0;
+  const gsl_odeiv2_step_type *const *type;	// integrations
+};
+
+struct bench_result
+{
+  const char *name;
+  long calls;			// per sample
+  double ns_median, ns_min, ns_mad;
+  double allocs, rhs, jac, steps;	// per call
+};
+
+static void
+run_fit_T (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  fit_T volatile f = b->fit;
+  long i;
+  for (i = 0; i < n; ++i)
+    ctx->sink += f (ctx->T);
+}
+
+static void
+run_fit_const (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  fit_const volatile f = b->fit0;
+  long i;
+  for (i = 0; i < n; ++i)
+    ctx->sink += f ();
+}
+
+// every T-dependent rate at one temperature (the rate kernel)
+static void
+run_fits_all (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  double lambda[N_RATES_T];
+  long i;
+  for (i = 0; i < n; ++i)
+    {
+      rate_eval_fits (ctx->T * (1.0 + 1.0e-12 * (i & 1)), lambda);
+      ctx->sink += lambda[0];
+    }
+}
+
+/* the rate kernel on an array of temperatures, e.g. the zones of a
+ * batch; one call does BENCH_N_TEMP of them */
+#define BENCH_N_TEMP 64
+
+static void
+run_fits_array (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  double T[BENCH_N_TEMP], lambda[N_RATES_T * BENCH_N_TEMP];
+  long i;
+  int k;
+  for (k = 0; k < BENCH_N_TEMP; ++k)
+    T[k] = ctx->T * (1.0 + 0.01 * k);
+  for (i = 0; i < n; ++i)
+    {
+      T[0] = ctx->T * (1.0 + 1.0e-12 * (i & 1));
+      rate_eval_fits_n (BENCH_N_TEMP, T, lambda, BENCH_N_TEMP, 1);
+      ctx->sink += lambda[0];
+    }
+}
+
+// ode_rhs at a fixed temperature: the rates come out of the cache
+static void
+run_rhs_cached (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  long i;
+  for (i = 0; i < n; ++i)
+    {
+      ode_rhs (0.0, ctx->y, ctx->dydt, &ctx->params);
+      ctx->sink += ctx->dydt[0];
+    }
+}
+
+/* the same with the energy generation added up on the way (energy.c);
+ * should cost next to nothing on top */
+static void
+run_rhs_energy (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  ctx->params.energy = 1;
+  run_rhs_cached (ctx, n, b);
+  ctx->sink += ctx->params.eps_nuc;
+  ctx->params.energy = 0;
+}
+
+// ode_rhs when every call is at a new temperature (all fits evaluated)
+static void
+run_rhs_new_T (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  long i;
+  for (i = 0; i < n; ++i)
+    {
+      ctx->params.T = ctx->T * (1.0 + 1.0e-12 * (i & 1));
+      ode_rhs (0.0, ctx->y, ctx->dydt, &ctx->params);
+      ctx->sink += ctx->dydt[0];
+    }
+  ctx->params.T = ctx->T;
+}
+
+static void
+run_jacobian (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  long i;
+  for (i = 0; i < n; ++i)
+    {
+      jacobian (0.0, ctx->y, ctx->dfdy, ctx->dfdt, &ctx->params);
+      ctx->sink += ctx->dfdy[0];
+    }
+}
+
+static void
+run_jacobian_sparse (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  long i;
+  for (i = 0; i < n; ++i)
+    {
+      jacobian_sparse (0.0, ctx->y, ctx->jac_val, ctx->dfdt, &ctx->params);
+      ctx->sink += ctx->jac_val[0];
+    }
+}
+
+// the same, differentiated out of the RHS (network_ad.c)
+static void
+run_jacobian_ad (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  ctx->params.jac_ad = 1;
+  run_jacobian_sparse (ctx, n, b);
+  ctx->params.jac_ad = 0;
+}
+
+/* one zone through one hydro step with the library (nn_solver.h), the
+ * solver allocated up front like a hydro code would. every call starts
+ * from the same composition; T alternates so the rates get redone.
+ * this should show 0 allocations per call */
+static void
+run_advance (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  const int n_iso = nn_solver_n_iso (ctx->solver);
+  struct nn_stats before, after;
+  double x[n_iso];
+  long i;
+  int k;
+  nn_solver_stats (ctx->solver, &before);
+  for (i = 0; i < n; ++i)
+    {
+      for (k = 0; k < n_iso; ++k)
+	x[k] = 1.0e-20;
+      x[network_find_isotope (&ctx->net, "h1")] = 0.99;
+      x[network_find_isotope (&ctx->net, "c12")] = 0.01;
+      nn_advance (ctx->solver, ctx->T * (1.0 + 1.0e-3 * (i & 1)), 150.0, x,
+		  1.0e+10);
+      ctx->sink += x[0];
+    }
+  nn_solver_stats (ctx->solver, &after);
+  ctx->n_steps += after.n_steps - before.n_steps;
+}
+
+/* the whole of main.c's run, 99% H1 and 1% C12 at 25 MK and 150 g/cc
+ * to 1e22 sec, including setting up and tearing down the integrator */
+static void
+run_integrate (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  const gsl_odeiv2_step_type *const *type = b->type;
+  const int n_iso = ctx->net.n_iso;
+  const int h1 = network_find_isotope (&ctx->net, "h1");
+  const int c12 = network_find_isotope (&ctx->net, "c12");
+  double y[n_iso];
+  long i;
+  int k;
+
+  for (i = 0; i < n; ++i)
+    {
+      struct param params = ctx->params;
+      double t = 0.0, h = 1.0e-8;
+      gsl_odeiv2_system sys = { ode_rhs, jacobian, n_iso, &params };
+      gsl_odeiv2_driver *driver =
+	gsl_odeiv2_driver_alloc_y_new (&sys, *type, h, 1.0e-8, 0.0);
+
+      rate_state_init (&params.rates);
+      for (k = 0; k < n_iso; ++k)
+	y[k] = 1.0e-20 * (params.rho / ctx->net.iso[k].molar_mass);
+      y[h1] = 0.99 * (params.rho / ctx->net.iso[h1].molar_mass);
+      y[c12] = 0.01 * (params.rho / ctx->net.iso[c12].molar_mass);
+      while (t < 1.0e+22)
+	{
+	  if (gsl_odeiv2_evolve_apply (driver->e, driver->c, driver->s, &sys,
+				       &t, 1.0e+22, &h, y) != GSL_SUCCESS)
+	    break;
+	  for (k = 0; k < n_iso; ++k)
+	    if (y[k] * ctx->net.iso[k].molar_mass / params.rho < 1.0e-20)
+	      y[k] = 0.0;
+	}
+      ctx->n_steps += driver->e->count;
+      ctx->sink += y[0];
+      gsl_odeiv2_driver_free (driver);
+    }
+}
+
+/* the same end state by solving for it (equilibrium.c): 99% H1 and 1%
+ * C12, T alternating so the rates get redone. "steps" are the
+ * iterations */
+static void
+run_equilibrium (struct bench_ctx *ctx, long n, const struct bench *b)
+{
+  const int n_iso = ctx->net.n_iso;
+  const int h1 = network_find_isotope (&ctx->net, "h1");
+  const int c12 = network_find_isotope (&ctx->net, "c12");
+  struct param params = ctx->params;
+  struct equil_stats eq;
+  double y[n_iso];
+  long i;
+  int k;
+
+  rate_state_init (&params.rates);
+  for (i = 0; i < n; ++i)
+    {
+      params.T = ctx->T * (1.0 + 1.0e-3 * (i & 1));
+      for (k = 0; k < n_iso; ++k)
+	y[k] = 1.0e-20 * (params.rho / ctx->net.iso[k].molar_mass);
+      y[h1] = 0.99 * (params.rho / ctx->net.iso[h1].molar_mass);
+      y[c12] = 0.01 * (params.rho / ctx->net.iso[c12].molar_mass);
+      equilibrium_solve (&params, y, &eq);
+      ctx->n_steps += eq.n_newton + eq.n_ptc;
+      ctx->sink += y[c12];
+    }
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static struct bench_result
+measure (struct bench_ctx *ctx, const struct bench *b, int repeats,
+	 double min_time)
+{
+  struct bench_result r;
+  double ns[repeats], dev[repeats];
+  long calls = 1;
+  int k;
+
+  // warm up, and find how many calls make a long enough sample
+  for (;;)
+    {
+      const double t0 = now ();
+      b->run (ctx, calls, b);
+      if (now () - t0 >= min_time || calls >= (1L << 40))
+	break;
+      calls *= 2;
+    }
+
+  n_alloc = n_rhs = n_jac = 0;
+  ctx->n_steps = 0;
+  for (k = 0; k < repeats; ++k)
+    {
+      const double t0 = now ();
+      b->run (ctx, calls, b);
+      ns[k] = 1.0e9 * (now () - t0) / calls;
+    }
+  r.name = b->name;
+  r.calls = calls;
+  r.allocs = (double) n_alloc / (calls * repeats);
+  r.rhs = (double) n_rhs / (calls * repeats);
+  r.jac = (double) n_jac / (calls * repeats);
+  r.steps = (double) ctx->n_steps / (calls * repeats);
+
+  qsort (ns, repeats, sizeof (double), compare_double);
+  r.ns_min = ns[0];
+  r.ns_median = ns[repeats / 2];
+  for (k = 0; k < repeats; ++k)
+    dev[k] = ns[k] > r.ns_median ? ns[k] - r.ns_median : r.ns_median - ns[k];
+  qsort (dev, repeats, sizeof (double), compare_double);
+  r.ns_mad = dev[repeats / 2];
+  return r;
+}
+
+static const gsl_odeiv2_step_type *stepper_sbsimp;
+static const gsl_odeiv2_step_type *stepper_bsimp;
+static const gsl_odeiv2_step_type *stepper_ros4;
+static const gsl_odeiv2_step_type *stepper_bdf;
+
+int
+main (int argc, char *argv[])
+{
+  static struct bench_ctx ctx;
+  const char *filter = NULL, *json = NULL;
+  int repeats = 21, arg, i, n_run = 0;
+  double min_time = 0.01;
+
+  for (arg = 1; arg < argc; ++arg)
+    {
+      if (strcmp (argv[arg], "--repeats") == 0 && arg + 1 < argc)
+	repeats = atoi (argv[++arg]);
+      else if (strcmp (argv[arg], "--min-time") == 0 && arg + 1 < argc)
+	min_time = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--filter") == 0 && arg + 1 < argc)
+	filter = argv[++arg];
+      else if (strcmp (argv[arg], "--json") == 0 && arg + 1 < argc)
+	json = argv[++arg];
+      else
+	{
+	  fprintf (stderr, "usage: %s [--repeats N] [--min-time SEC] "
+		   "[--filter TEXT] [--json FILE]\n", argv[0]);
+	  return 1;
+	}
+    }
+  if (repeats < 1)
+    repeats = 1;
+
+  stepper_sbsimp = step_sbsimp;
+  stepper_bsimp = gsl_odeiv2_step_bsimp;
+  stepper_ros4 = step_ros4;
+  stepper_bdf = step_bdf;
+  const struct bench benches[] = {
+    {"lambda_C12_P_G_N13", run_fit_T, lambda_C12_P_G_N13},
+    {"lambda_C13_P_G_N14", run_fit_T, lambda_C13_P_G_N14},
+    {"lambda_N14_P_G_O15", run_fit_T, lambda_N14_P_G_O15},
+    {"lambda_N15_P_A_C12", run_fit_T, lambda_N15_P_A_C12},
+    {"lambda_N15_P_G_O16", run_fit_T, lambda_N15_P_G_O16},
+    {"lambda_O16_P_G_F17", run_fit_T, lambda_O16_P_G_F17},
+    {"lambda_O17_P_A_N14", run_fit_T, lambda_O17_P_A_N14},
+    {"lambda_O17_P_G_F18", run_fit_T, lambda_O17_P_G_F18},
+    {"lambda_O18_P_A_N15", run_fit_T, lambda_O18_P_A_N15},
+    {"lambda_N13_e_nu", run_fit_const, NULL, lambda_N13_e_nu},
+    {"lambda_O15_e_nu", run_fit_const, NULL, lambda_O15_e_nu},
+    {"lambda_F17_e_nu", run_fit_const, NULL, lambda_F17_e_nu},
+    {"lambda_F18_e_nu", run_fit_const, NULL, lambda_F18_e_nu},
+    {"rate_eval_fits (all rates)", run_fits_all},
+    {"rate_eval_fits_n (64 T)", run_fits_array},
+    {"ode_rhs (cached rates)", run_rhs_cached},
+    {"ode_rhs (energy)", run_rhs_energy},
+    {"ode_rhs (new T)", run_rhs_new_T},
+    {"jacobian", run_jacobian},
+    {"jacobian_sparse", run_jacobian_sparse},
+    {"jacobian_sparse (AD)", run_jacobian_ad},
+    {"integrate (sbsimp)", run_integrate, NULL, NULL, &stepper_sbsimp},
+    {"integrate (bsimp)", run_integrate, NULL, NULL, &stepper_bsimp},
+    {"integrate (ros4)", run_integrate, NULL, NULL, &stepper_ros4},
+    {"integrate (bdf)", run_integrate, NULL, NULL, &stepper_bdf},
+    {"nn_advance (1e10 s)", run_advance},
+    {"equilibrium_solve", run_equilibrium},
+  };
+  const int n_bench = sizeof (benches) / sizeof (benches[0]);
+  struct bench_result result[n_bench];
+
+  if (network_cno_init (&ctx.net) != GSL_SUCCESS)
+    return 1;
+  const int n_iso = ctx.net.n_iso;
+  ctx.T = 25.0e+06;
+  ctx.params.net = &ctx.net;
+  ctx.params.n_iso = n_iso;
+  ctx.params.T = ctx.T;
+  ctx.params.rho = 150.0;
+  ctx.params.traj = NULL;
+  ctx.params.traj_pos = 0;
+  ctx.params.instr = NULL;
+  ctx.params.jac_ad = 0;
+  ctx.params.energy = 0;
+  rate_state_init (&ctx.params.rates);
+  ctx.y = malloc (n_iso * sizeof (double));
+  ctx.dydt = malloc (n_iso * sizeof (double));
+  ctx.dfdt = malloc (n_iso * sizeof (double));
+  ctx.dfdy = malloc (n_iso * n_iso * sizeof (double));
+  ctx.jac_val = malloc (ctx.net.jac_nnz * sizeof (double));
+  for (i = 0; i < n_iso; ++i)
+    ctx.y[i] = 1.0e-3 * (i + 1);
+  ctx.solver = nn_solver_alloc (NULL, 1.0e-8, 0.0);
+  if (ctx.solver == NULL)
+    return 1;
+
+#ifndef __OPTIMIZE__
+  fprintf (stderr, "warning: this is an unoptimized build (%s); "
+	   "configure with -DCMAKE_BUILD_TYPE=Release\n", BENCH_BUILD_TYPE);
+#endif
+  printf ("%-24s %12s %12s %8s %10s %8s %8s %8s\n", "benchmark", "ns/call",
+	  "min", "mad%", "allocs", "rhs", "jac", "steps");
+  for (i = 0; i < n_bench; ++i)
+    {
+      if (filter != NULL && strstr (benches[i].name, filter) == NULL)
+	continue;
+      struct bench_result *r = &result[n_run++];
+      *r = measure (&ctx, &benches[i], repeats, min_time);
+      printf ("%-24s %12.1f %12.1f %8.2f %10.2f %8.1f %8.1f %8.1f\n",
+	      r->name, r->ns_median, r->ns_min,
+	      100.0 * r->ns_mad / r->ns_median, r->allocs, r->rhs, r->jac,
+	      r->steps);
+    }
+
+  if (json != NULL)
+    {
+      FILE *fp = fopen (json, "w");
+      if (fp == NULL)
+	{
+	  fprintf (stderr, "can't write %s\n", json);
+	  return 1;
+	}
+      fprintf (fp, "{\n  \"build_type\": \"%s\",\n", BENCH_BUILD_TYPE);
+#ifdef __OPTIMIZE__
+      fprintf (fp, "  \"optimized\": true,\n");
+#else
+      fprintf (fp, "  \"optimized\": false,\n");
+#endif
+#ifdef BENCH_WRAP
+      fprintf (fp, "  \"counters\": true,\n");
+#else
+      fprintf (fp, "  \"counters\": false,\n");
+#endif
+      fprintf (fp, "  \"repeats\": %d,\n  \"benchmarks\": [\n", repeats);
+      for (i = 0; i < n_run; ++i)
+	fprintf (fp,
+		 "    {\"name\": \"%s\", \"calls_per_sample\": %ld, "
+		 "\"ns_per_call\": %.6g, \"ns_per_call_min\": %.6g, "
+		 "\"ns_per_call_mad\": %.6g, \"allocs_per_call\": %.6g, "
+		 "\"rhs_per_call\": %.6g, \"jac_per_call\": %.6g, "
+		 "\"steps_per_call\": %.6g}%s\n", result[i].name,
+		 result[i].calls, result[i].ns_median, result[i].ns_min,
+		 result[i].ns_mad, result[i].allocs, result[i].rhs,
+		 result[i].jac, result[i].steps, i + 1 < n_run ? "," : "");
+      fprintf (fp, "  ]\n}\n");
+      fclose (fp);
+    }
+
+  nn_solver_free (ctx.solver);
+  free (ctx.y);
+  free (ctx.dydt);
+  free (ctx.dfdt);
+  free (ctx.dfdy);
+  free (ctx.jac_val);
+  network_free (&ctx.net);
+  return 0;
+}
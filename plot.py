@@ -1,12 +1,47 @@
-from matplotlib.mlab import *
 from matplotlib.font_manager import FontProperties
 import numpy as np
+import os
 import pylab as plt
 
 fontP = FontProperties()
 fontP.set_size('small')
 
-data = csv2rec('build/results.dat', delimiter=' ')
+# results.bin (nuclear_network --binary, see src/output.h): a 64 byte
+# header, the column names, then one little-endian array of doubles,
+# n_col to a row. nothing gets parsed; numpy maps the file and the
+# pages get read as the plot touches them
+OUT_MAGIC = b'NNREC\0\0\0'
+OUT_NAME_LEN = 16
+header_t = np.dtype([('magic', 'S8'), ('version', '<u4'), ('n_col', '<u4'),
+                     ('iso_col', '<u4'), ('n_iso', '<u4'),
+                     ('data_offset', '<u8'), ('T', '<f8'), ('rho', '<f8'),
+                     ('pad', 'V16')])
+
+def load_results(path):
+    """the rows of a results file as a record array, one field per
+    column ('tnow', 'h1', ...); a read-only memmap for results.bin or
+    sweep.bin, read in from the text for results.dat"""
+    if not path.endswith('.bin'):
+        return np.genfromtxt(path, names=True)
+    hdr = np.fromfile(path, header_t, 1)[0]
+    if hdr['magic'] != OUT_MAGIC.rstrip(b'\0') or hdr['version'] != 2:
+        raise ValueError('%s is not a nuclear_network results file' % path)
+    n_col = int(hdr['n_col'])
+    names = np.fromfile(path, 'S%d' % OUT_NAME_LEN, n_col,
+                        offset=header_t.itemsize)
+    row_t = np.dtype([(n.decode(), '<f8') for n in names])
+    # a row the solver didn't get to finish doesn't count
+    n_rows = (os.path.getsize(path) - int(hdr['data_offset'])) // row_t.itemsize
+    # e.g. a run stopped before the first output time; numpy won't map
+    # zero bytes
+    if n_rows == 0:
+        return np.empty(0, row_t)
+    return np.memmap(path, row_t, 'r', int(hdr['data_offset']), (n_rows,))
+
+if os.path.exists('build/results.bin'):
+    data = load_results('build/results.bin')
+else:
+    data = load_results('build/results.dat')
 plt.plot(data['tnow'], data['he4'], 'b-'  , \
          data['tnow'], data['c12'], 'g-'  , \
 	 data['tnow'], data['n13'], 'r-'  , \
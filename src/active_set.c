@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include "active_set.h"
+
+/* main.c used to set every isotope whose mass fraction dropped below
+ * 1e-20 to zero after each step. The integrator still carried all of
+ * them, and every time one got zeroed its abundance jumped, which the
+ * error control then had to cope with on the next step (and the next
+ * step made it again from nothing, so it got zeroed again...).
+ *
+ * Instead, an isotope that has dropped below ACTIVE_X_OFF and isn't
+ * being made fast enough to get back above it leaves the system
+ * altogether: the integrator gets a network (network_subset()) with
+ * only the active isotopes and the reactions between them, and is
+ * started over on that. A reaction that would make an inactive isotope
+ * still uses up its reactants; the product just isn't tracked. After
+ * every step we look at what the reactions would be making of each
+ * inactive isotope, and once that's enough to get it above
+ * ACTIVE_X_ON, a hundred times the cut-off so it doesn't flip back and
+ * forth, it's put back in (starting from zero).
+ *
+ * "Enough" is the production rate P times the step size h: how much
+ * of it the reactions make during a step. That's also what keeps an
+ * isotope in: O15 or N13 at 25 MK never get anywhere near 1e-20 (they
+ * beta decay within minutes), but all of the CNO cycling goes through
+ * them, so they stay as long as that flow is more than the cut-off
+ * per step. Dropping them would make the N14(p,g) flow vanish instead
+ * of coming out as N15.
+ *
+ * For the 13 isotopes of the CNO network that doesn't save much; it's
+ * for big networks where most of the isotopes are asleep most of the
+ * time, so the linear algebra can be a lot smaller than the network. */
+
+// renumber the active isotopes, rebuild the network and gather their y
+static int
+rebuild (struct active_set *as, const double y[])
+{
+  int i, k = 0;
+
+  for (i = 0; i < as->full->n_iso; ++i)
+    if (as->pos[i] >= 0)
+      {
+	as->pos[i] = k;
+	as->iso[k++] = i;
+      }
+  as->n = k;
+  network_free (&as->net);
+  if (network_subset (as->full, as->pos, &as->net) != 0)
+    return GSL_ENOMEM;
+  for (k = 0; k < as->n; ++k)
+    as->y[k] = y[as->iso[k]];
+  return GSL_SUCCESS;
+}
+
+/* Starts with the isotopes in y (full network, mol/cm^3) that are above
+ * the cut-off or are being made at all, at the rates lambda; to_x
+ * converts y to mass fractions. Returns GSL_SUCCESS or GSL_ENOMEM. */
+int
+active_set_init (struct active_set *as, const struct network *full,
+		 const double lambda[], double y[], const double to_x[])
+{
+  const int n = full->n_iso;
+  int i, k, changed;
+
+  as->full = full;
+  network_init (&as->net);
+  as->n = 0;
+  as->n_changes = 0;
+  as->iso = malloc (n * sizeof (int));
+  as->pos = malloc (n * sizeof (int));
+  as->diag = malloc (n * sizeof (int));
+  as->y = malloc (n * sizeof (double));
+  as->dydt = malloc (n * sizeof (double));
+  as->jac_val = malloc (full->jac_nnz * sizeof (double));
+  if (as->iso == NULL || as->pos == NULL || as->diag == NULL
+      || as->y == NULL || as->dydt == NULL || as->jac_val == NULL)
+    {
+      active_set_free (as);
+      return GSL_ENOMEM;
+    }
+  // the pattern always has the diagonal
+  for (i = 0; i < n; ++i)
+    for (k = full->jac_row_ptr[i]; k < full->jac_row_ptr[i + 1]; ++k)
+      if (full->jac_col[k] == i)
+	as->diag[i] = k;
+
+  for (i = 0; i < n; ++i)
+    as->pos[i] = (y[i] * to_x[i] >= ACTIVE_X_OFF) ? 0 : -1;
+  // and anything that's made at all, however slowly
+  if (active_set_update (as, lambda, y, to_x, HUGE_VAL, &changed)
+      != GSL_SUCCESS || (!changed && rebuild (as, y) != GSL_SUCCESS))
+    {
+      active_set_free (as);
+      return GSL_ENOMEM;
+    }
+  as->n_changes = 0;
+  return GSL_SUCCESS;
+}
+
+void
+active_set_free (struct active_set *as)
+{
+  network_free (&as->net);
+  free (as->iso);
+  free (as->pos);
+  free (as->diag);
+  free (as->y);
+  free (as->dydt);
+  free (as->jac_val);
+  as->iso = as->pos = as->diag = NULL;
+  as->y = as->dydt = as->jac_val = NULL;
+}
+
+/* After a step of size h: y is the full network's abundances (from
+ * active_set_scatter()), lambda the rates the step was taken with.
+ * Drops the isotopes that have died out (their y becomes 0) and brings
+ * back the ones that are being made again. If anything changed,
+ * *changed is set, as->net and as->y are rebuilt, and the integrator
+ * has to be started over on them. Returns GSL_SUCCESS or GSL_ENOMEM. */
+int
+active_set_update (struct active_set *as, const double lambda[],
+		   double y[], const double to_x[], double h, int *changed)
+{
+  const struct network *full = as->full;
+  double d, p, x_est;
+  int i;
+
+  *changed = 0;
+  // inactive isotopes have y = 0, so their dY/dt is all production
+  network_rhs (full, lambda, y, as->dydt);
+  network_jacobian_sparse (full, lambda, y, as->jac_val);
+  for (i = 0; i < full->n_iso; ++i)
+    {
+      // production = net rate + destruction, which is d * Y_i
+      d = -as->jac_val[as->diag[i]];
+      if (d < 0.0)
+	d = 0.0;
+      p = as->dydt[i] + d * y[i];
+      x_est = p > 0.0 ? p * h * to_x[i] : 0.0;
+      if (as->pos[i] >= 0 && y[i] * to_x[i] < ACTIVE_X_OFF
+	  && x_est < ACTIVE_X_OFF)
+	{
+	  as->pos[i] = -1;
+	  y[i] = 0.0;
+	  *changed = 1;
+	}
+      else if (as->pos[i] < 0 && x_est > ACTIVE_X_ON)
+	{
+	  as->pos[i] = 0;
+	  *changed = 1;
+	}
+    }
+  if (!*changed)
+    return GSL_SUCCESS;
+  ++as->n_changes;
+  return rebuild (as, y);
+}
+
+// copy the active abundances back into the full network's y
+void
+active_set_scatter (const struct active_set *as, double y[])
+{
+  int k;
+  for (k = 0; k < as->n; ++k)
+    y[as->iso[k]] = as->y[k];
+}
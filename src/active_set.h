@@ -0,0 +1,36 @@
+#ifndef ACTIVE_SET_H
+#define ACTIVE_SET_H
+
+#include "network.h"
+
+/* The isotopes that are actually doing something, and the network
+ * between them, which is what the integrator gets to see instead of
+ * the whole thing. See active_set.c. */
+
+// an isotope drops out below this mass fraction...
+#define ACTIVE_X_OFF 1.0e-20
+// ...and comes back once it's being made fast enough to reach this
+#define ACTIVE_X_ON 1.0e-18
+
+struct active_set
+{
+  const struct network *full;
+  struct network net;		// the active isotopes and their reactions
+  int n;			// number of active isotopes (net.n_iso)
+  int *iso;			// active isotope k is full->iso[iso[k]]
+  int *pos;			// full isotope i is active isotope pos[i], or -1
+  double *y;			// abundances of the active isotopes, mol/cm^3
+  double *dydt, *jac_val;	// scratch for the full network
+  int *diag;			// where each diagonal is in full's Jacobian
+  long n_changes;		// times the set has changed
+};
+
+int active_set_init (struct active_set *as, const struct network *full,
+		     const double lambda[], double y[], const double to_x[]);
+void active_set_free (struct active_set *as);
+int active_set_update (struct active_set *as, const double lambda[],
+		       double y[], const double to_x[], double h,
+		       int *changed);
+void active_set_scatter (const struct active_set *as, double y[]);
+
+#endif
@@ -0,0 +1,680 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include "batch.h"
+#include "network.h"
+#include "rate_coeffs.h"
+#include "rate_kernel.h"
+#include "sparse_lu.h"
+
+/* Multi-zone version of the sparse semi-implicit extrapolation stepper
+ * (step_sbsimp.c). See batch.h for the layout. Every kernel below has
+ * the zone loop innermost, over contiguous arrays, with no branches
+ * that depend on the zone, so it vectorizes. The per-zone step size
+ * control at the end of each pass is scalar but cheap. */
+
+// same extrapolation as step_sbsimp.c
+#define BATCH_K 4
+static const int batch_seq[BATCH_K] = { 2, 6, 10, 14 };
+
+// give up on a zone after this many steps
+#define BATCH_MAX_STEPS 100000
+
+// zone counts get padded to this so every row starts vector-aligned
+#define BATCH_ALIGN 8
+
+static double *
+alloc_vec (size_t n)
+{
+  void *p = NULL;
+  if (posix_memalign (&p, 64, (n + 1) * sizeof (double)) != 0)
+    return NULL;
+  memset (p, 0, (n + 1) * sizeof (double));
+  return p;
+}
+
+void
+batch_free (struct batch_solver *b)
+{
+  if (b == NULL)
+    return;
+  sparse_lu_free (b->lu);
+  free (b->diag);
+  free (b->op_ptr);
+  free (b->op_q);
+  free (b->op_t);
+  free (b->zone);
+  free (b->n_steps);
+  free (b->t);
+  free (b->h);
+  free (b->T);
+  free (b->rho);
+  free (b->lambda);
+  free (b->y);
+  free (b->f0);
+  free (b->jac);
+  free (b->lu_val);
+  free (b->del);
+  free (b->yk);
+  free (b->ones);
+  free (b->flux);
+  free (b->tab);
+  free (b->h_sub);
+  free (b->err);
+  free (b->h_free);
+  free (b);
+}
+
+/* Turn the symbolic LU into a flat list of multiply-subtract updates,
+ * so the numeric factorization doesn't need a dense work vector per
+ * zone. Returns 0 or -1 if out of memory. */
+static int
+build_lu_ops (struct batch_solver *b)
+{
+  const struct sparse_lu *lu = b->lu;
+  const int n = lu->n;
+  int *pos = malloc (n * sizeof (int));
+  int i, p, q, n_ops = 0;
+
+  if (pos == NULL)
+    return -1;
+  b->op_ptr = malloc ((lu->nnz_lu + 1) * sizeof (int));
+  if (b->op_ptr == NULL)
+    {
+      free (pos);
+      return -1;
+    }
+  // count first
+  for (i = 0; i < n; ++i)
+    {
+      for (p = lu->lu_row_ptr[i]; p < lu->lu_diag[i]; ++p)
+	{
+	  const int kk = lu->lu_col[p];
+	  n_ops += lu->lu_row_ptr[kk + 1] - lu->lu_diag[kk] - 1;
+	}
+    }
+  b->op_q = malloc ((n_ops + 1) * sizeof (int));
+  b->op_t = malloc ((n_ops + 1) * sizeof (int));
+  if (b->op_q == NULL || b->op_t == NULL)
+    {
+      free (pos);
+      return -1;
+    }
+
+  n_ops = 0;
+  for (i = 0; i < n; ++i)
+    {
+      for (p = lu->lu_row_ptr[i]; p < lu->lu_row_ptr[i + 1]; ++p)
+	pos[lu->lu_col[p]] = p;
+      for (p = lu->lu_row_ptr[i]; p < lu->lu_row_ptr[i + 1]; ++p)
+	{
+	  const int kk = lu->lu_col[p];
+	  b->op_ptr[p] = n_ops;
+	  if (p >= lu->lu_diag[i])
+	    continue;
+	  for (q = lu->lu_diag[kk] + 1; q < lu->lu_row_ptr[kk + 1]; ++q)
+	    {
+	      b->op_q[n_ops] = q;
+	      b->op_t[n_ops++] = pos[lu->lu_col[q]];
+	    }
+	}
+    }
+  b->op_ptr[lu->nnz_lu] = n_ops;
+  free (pos);
+  return 0;
+}
+
+/* Sets up a solver for up to cap zones at a time (more than that is
+ * fine, they just get processed as slots free up). Returns NULL if out
+ * of memory. */
+struct batch_solver *
+batch_alloc (const struct network *net, int cap)
+{
+  struct batch_solver *b = calloc (1, sizeof (struct batch_solver));
+  int i, k;
+  size_t nz;
+
+  if (b == NULL)
+    return NULL;
+  cap = (cap + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN;
+  nz = cap;
+  b->net = net;
+  b->cap = cap;
+  b->n_iso = net->n_iso;
+  b->n_reac = net->n_reac;
+  b->nnz = net->jac_nnz;
+  b->lu = sparse_lu_alloc (net->n_iso, net->jac_row_ptr, net->jac_col);
+  if (b->lu == NULL || build_lu_ops (b) != 0)
+    goto fail;
+  b->nnz_lu = b->lu->nnz_lu;
+
+  b->diag = malloc (b->n_iso * sizeof (int));
+  b->zone = malloc (cap * sizeof (int));
+  b->n_steps = malloc (cap * sizeof (long));
+  b->t = alloc_vec (nz);
+  b->h = alloc_vec (nz);
+  b->T = alloc_vec (nz);
+  b->rho = alloc_vec (nz);
+  b->h_sub = alloc_vec (nz);
+  b->err = alloc_vec (nz);
+  b->h_free = alloc_vec (nz);
+  b->lambda = alloc_vec (N_RATES * nz);
+  b->y = alloc_vec (b->n_iso * nz);
+  b->f0 = alloc_vec (b->n_iso * nz);
+  b->del = alloc_vec (b->n_iso * nz);
+  b->yk = alloc_vec (b->n_iso * nz);
+  b->ones = alloc_vec (nz);
+  b->jac = alloc_vec (b->nnz * nz);
+  b->lu_val = alloc_vec (b->nnz_lu * nz);
+  // fluxes, their derivatives, or the permuted vector in batch_solve
+  b->flux = alloc_vec ((NET_MAX_REACTANTS * b->n_reac + b->n_iso) * nz);
+  b->tab = alloc_vec (BATCH_K * BATCH_K * b->n_iso * nz);
+  if (b->diag == NULL || b->zone == NULL || b->n_steps == NULL
+      || b->t == NULL || b->h == NULL || b->T == NULL || b->rho == NULL
+      || b->h_sub == NULL || b->err == NULL || b->h_free == NULL
+      || b->lambda == NULL
+      || b->y == NULL || b->f0 == NULL || b->del == NULL || b->yk == NULL
+      || b->ones == NULL || b->jac == NULL || b->lu_val == NULL
+      || b->flux == NULL || b->tab == NULL)
+    goto fail;
+
+  for (i = 0; i < b->n_iso; ++i)
+    {
+      for (k = net->jac_row_ptr[i]; k < net->jac_row_ptr[i + 1]; ++k)
+	{
+	  if (net->jac_col[k] == i)
+	    b->diag[i] = k;
+	}
+    }
+  return b;
+
+fail:
+  batch_free (b);
+  return NULL;
+}
+
+// row of y for reactant slot iso, or a row of ones for an unused slot
+#define SLOT_ROW(b, y, ones, iso) \
+  ((iso) < (b)->n_iso ? (y) + (size_t) (iso) * (b)->cap : (ones))
+
+// dY/dt for the first n slots
+static void
+batch_rhs (struct batch_solver *b, int n, const double *y, double *f)
+{
+  const struct network *net = b->net;
+  const size_t cap = b->cap;
+  double *ones = b->ones;
+  int r, i, k, z;
+
+  for (z = 0; z < n; ++z)
+    ones[z] = 1.0;
+
+  for (r = 0; r < b->n_reac; ++r)
+    {
+      const int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+      const double *restrict lam = b->lambda + net->rate_id[r] * cap;
+      const double *restrict ya = SLOT_ROW (b, y, ones, slot[0]);
+      const double *restrict yb = SLOT_ROW (b, y, ones, slot[1]);
+      const double *restrict yc = SLOT_ROW (b, y, ones, slot[2]);
+      double *restrict fl = b->flux + r * cap;
+      for (z = 0; z < n; ++z)
+	fl[z] = lam[z] * ya[z] * yb[z] * yc[z];
+    }
+
+  for (i = 0; i < b->n_iso; ++i)
+    {
+      double *restrict fi = f + i * cap;
+      for (z = 0; z < n; ++z)
+	fi[z] = 0.0;
+      for (k = net->iso_ptr[i]; k < net->iso_ptr[i + 1]; ++k)
+	{
+	  const double c = net->term_coeff[k];
+	  const double *restrict fl = b->flux + net->term_reac[k] * cap;
+	  for (z = 0; z < n; ++z)
+	    fi[z] += c * fl[z];
+	}
+    }
+}
+
+// sparse Jacobian nonzeros for the first n slots
+static void
+batch_jacobian (struct batch_solver *b, int n, const double *y)
+{
+  const struct network *net = b->net;
+  const size_t cap = b->cap;
+  double *ones = b->ones;
+  int r, k, z;
+
+  for (z = 0; z < n; ++z)
+    ones[z] = 1.0;
+
+  for (r = 0; r < b->n_reac; ++r)
+    {
+      const int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+      const double *restrict lam = b->lambda + net->rate_id[r] * cap;
+      const double *restrict ya = SLOT_ROW (b, y, ones, slot[0]);
+      const double *restrict yb = SLOT_ROW (b, y, ones, slot[1]);
+      const double *restrict yc = SLOT_ROW (b, y, ones, slot[2]);
+      double *restrict d0 = b->flux + (NET_MAX_REACTANTS * r) * cap;
+      double *restrict d1 = d0 + cap, *restrict d2 = d1 + cap;
+      for (z = 0; z < n; ++z)
+	{
+	  d0[z] = lam[z] * yb[z] * yc[z];
+	  d1[z] = lam[z] * ya[z] * yc[z];
+	  d2[z] = lam[z] * ya[z] * yb[z];
+	}
+    }
+
+  for (k = 0; k < b->nnz; ++k)
+    {
+      double *restrict jk = b->jac + k * cap;
+      for (z = 0; z < n; ++z)
+	jk[z] = 0.0;
+    }
+  for (k = 0; k < net->n_jac; ++k)
+    {
+      const double c = net->jac_coeff[k];
+      const double *restrict d = b->flux + net->jac_slot[k] * cap;
+      double *restrict jk = b->jac + net->jac_csr[k] * cap;
+      for (z = 0; z < n; ++z)
+	jk[z] += c * d[z];
+    }
+}
+
+/* LU of I - h_sub * J for the first n slots, each with its own
+ * h_sub. no pivoting, see sparse_lu.h */
+static void
+batch_factor (struct batch_solver *b, int n)
+{
+  const struct sparse_lu *lu = b->lu;
+  const size_t cap = b->cap;
+  const double *restrict hs = b->h_sub;
+  int i, k, p, o, z;
+
+  for (p = 0; p < b->nnz_lu; ++p)
+    {
+      double *restrict v = b->lu_val + p * cap;
+      for (z = 0; z < n; ++z)
+	v[z] = 0.0;
+    }
+  for (k = 0; k < b->nnz; ++k)
+    {
+      const double *restrict jk = b->jac + k * cap;
+      double *restrict v = b->lu_val + lu->a_map[k] * cap;
+      for (z = 0; z < n; ++z)
+	v[z] -= hs[z] * jk[z];
+    }
+  for (i = 0; i < b->n_iso; ++i)
+    {
+      double *restrict v = b->lu_val + lu->a_map[b->diag[i]] * cap;
+      for (z = 0; z < n; ++z)
+	v[z] += 1.0;
+    }
+
+  for (i = 0; i < lu->n; ++i)
+    {
+      for (p = lu->lu_row_ptr[i]; p < lu->lu_diag[i]; ++p)
+	{
+	  double *restrict l = b->lu_val + p * cap;
+	  const double *restrict piv =
+	    b->lu_val + lu->lu_diag[lu->lu_col[p]] * cap;
+	  for (z = 0; z < n; ++z)
+	    l[z] /= piv[z];
+	  for (o = b->op_ptr[p]; o < b->op_ptr[p + 1]; ++o)
+	    {
+	      const double *restrict u = b->lu_val + b->op_q[o] * cap;
+	      double *restrict tgt = b->lu_val + b->op_t[o] * cap;
+	      for (z = 0; z < n; ++z)
+		tgt[z] -= l[z] * u[z];
+	    }
+	}
+    }
+}
+
+/* solve (I - h_sub J) x = v in place for the first n slots. the
+ * permuted vector lives in the flux scratch */
+static void
+batch_solve (struct batch_solver *b, int n, double *v)
+{
+  const struct sparse_lu *lu = b->lu;
+  const size_t cap = b->cap;
+  double *x = b->flux;
+  int i, p, z;
+
+  for (i = 0; i < lu->n; ++i)
+    memcpy (x + i * cap, v + lu->perm[i] * cap, n * sizeof (double));
+  for (i = 0; i < lu->n; ++i)
+    {
+      double *restrict xi = x + i * cap;
+      for (p = lu->lu_row_ptr[i]; p < lu->lu_diag[i]; ++p)
+	{
+	  const double *restrict l = b->lu_val + p * cap;
+	  const double *restrict xj = x + lu->lu_col[p] * cap;
+	  for (z = 0; z < n; ++z)
+	    xi[z] -= l[z] * xj[z];
+	}
+    }
+  for (i = lu->n - 1; i >= 0; --i)
+    {
+      double *restrict xi = x + i * cap;
+      const double *restrict d = b->lu_val + lu->lu_diag[i] * cap;
+      for (p = lu->lu_diag[i] + 1; p < lu->lu_row_ptr[i + 1]; ++p)
+	{
+	  const double *restrict u = b->lu_val + p * cap;
+	  const double *restrict xj = x + lu->lu_col[p] * cap;
+	  for (z = 0; z < n; ++z)
+	    xi[z] -= u[z] * xj[z];
+	}
+      for (z = 0; z < n; ++z)
+	xi[z] /= d[z];
+    }
+  for (i = 0; i < lu->n; ++i)
+    memcpy (v + lu->perm[i] * cap, x + i * cap, n * sizeof (double));
+}
+
+/* semi-implicit midpoint rule over each slot's own h with n_sub
+ * substeps, starting from b->y. result goes in out */
+static void
+batch_midpoint (struct batch_solver *b, int n, int n_sub, double *out)
+{
+  const size_t cap = b->cap;
+  const int n_iso = b->n_iso;
+  int i, s, z;
+
+  for (z = 0; z < n; ++z)
+    b->h_sub[z] = b->h[z] / n_sub;
+  batch_factor (b, n);
+
+  for (i = 0; i < n_iso; ++i)
+    {
+      const double *restrict f0 = b->f0 + i * cap, *restrict hs = b->h_sub;
+      double *restrict del = b->del + i * cap;
+      for (z = 0; z < n; ++z)
+	del[z] = hs[z] * f0[z];
+    }
+  batch_solve (b, n, b->del);
+  for (i = 0; i < n_iso; ++i)
+    {
+      const double *restrict y = b->y + i * cap, *restrict del =
+	b->del + i * cap;
+      double *restrict yk = b->yk + i * cap;
+      for (z = 0; z < n; ++z)
+	yk[z] = y[z] + del[z];
+    }
+
+  for (s = 1; s <= n_sub; ++s)
+    {
+      batch_rhs (b, n, b->yk, out);
+      for (i = 0; i < n_iso; ++i)
+	{
+	  const double *restrict hs = b->h_sub, *restrict del =
+	    b->del + i * cap;
+	  double *restrict o = out + i * cap;
+	  for (z = 0; z < n; ++z)
+	    o[z] = hs[z] * o[z] - del[z];
+	}
+      batch_solve (b, n, out);
+      for (i = 0; i < n_iso; ++i)
+	{
+	  double *restrict o = out + i * cap, *restrict del =
+	    b->del + i * cap, *restrict yk = b->yk + i * cap;
+	  if (s < n_sub)
+	    {
+	      for (z = 0; z < n; ++z)
+		{
+		  del[z] += 2.0 * o[z];
+		  yk[z] += del[z];
+		}
+	    }
+	  else
+	    {
+	      // the last substep is a smoothing step
+	      for (z = 0; z < n; ++z)
+		o[z] += yk[z];
+	    }
+	}
+    }
+}
+
+/* evaluate the rates for the n zones that just got put in slots s ...
+ * s + n - 1, or copy them from lambda_in. The kernel writes them
+ * zone-fastest, just like we keep them, so filling every slot at the
+ * start is one call */
+static void
+load_rates (struct batch_solver *b, int s, int n)
+{
+  const size_t cap = b->cap;
+  int k, z;
+  if (b->lambda_in != NULL)
+    {
+      for (k = 0; k < N_RATES; ++k)
+	for (z = s; z < s + n; ++z)
+	  b->lambda[k * cap + z] =
+	    b->lambda_in[(size_t) k * b->n_zone + b->zone[z]];
+      return;
+    }
+  rate_eval_fits_n (n, b->T + s, b->lambda + s, cap, 1);
+  for (z = s; z < s + n; ++z)
+    {
+      b->lambda[R_N13_E_NU * cap + z] = lambda_N13_e_nu ();
+      b->lambda[R_O15_E_NU * cap + z] = lambda_O15_e_nu ();
+      b->lambda[R_F17_E_NU * cap + z] = lambda_F17_e_nu ();
+      b->lambda[R_F18_E_NU * cap + z] = lambda_F18_e_nu ();
+    }
+}
+
+// copy everything that persists between steps from slot from to slot to
+static void
+move_slot (struct batch_solver *b, int from, int to)
+{
+  const size_t cap = b->cap;
+  int i;
+  for (i = 0; i < b->n_iso; ++i)
+    b->y[i * cap + to] = b->y[i * cap + from];
+  for (i = 0; i < N_RATES; ++i)
+    b->lambda[i * cap + to] = b->lambda[i * cap + from];
+  b->t[to] = b->t[from];
+  b->h[to] = b->h[from];
+  b->T[to] = b->T[from];
+  b->rho[to] = b->rho[from];
+  b->zone[to] = b->zone[from];
+  b->n_steps[to] = b->n_steps[from];
+}
+
+// put zone z into slot s, to start at t0
+static void
+load_zone (struct batch_solver *b, int s, int z, const double y[],
+	   const double T[], const double rho[], double t0, double h0,
+	   const double h[])
+{
+  const size_t cap = b->cap;
+  int i;
+  for (i = 0; i < b->n_iso; ++i)
+    b->y[i * cap + s] = y[(size_t) i * b->n_zone + z];
+  b->T[s] = T != NULL ? T[z] : 0.0;
+  b->rho[s] = rho != NULL ? rho[z] : 0.0;
+  b->t[s] = t0;
+  b->h[s] = h != NULL ? h[z] : h0;
+  b->zone[s] = z;
+  b->n_steps[s] = 0;
+}
+
+/* batch_integrate() and batch_integrate_rates(): with h NULL every
+ * zone starts with h0, otherwise with h[zone], which gets the step it
+ * would have taken next (0 if it failed) */
+static int
+batch_run (struct batch_solver *b, int n_zone, double y[], const double T[],
+	   const double rho[], double t0, double t_stop, double h0,
+	   double h[], double eps_abs, double eps_rel)
+{
+  const size_t cap = b->cap;
+  const int n_iso = b->n_iso;
+  const unsigned int order = 2 * (BATCH_K - 1);
+  int next_zone = 0, n_active = 0;
+  int i, j, m, s, z;
+
+  memset (&b->stats, 0, sizeof (b->stats));
+  b->n_zone = n_zone;
+
+  // fill the slots
+  while (n_active < b->cap && next_zone < n_zone)
+    {
+      s = n_active++;
+      load_zone (b, s, next_zone++, y, T, rho, t0, h0, h);
+    }
+  load_rates (b, 0, n_active);
+
+  while (n_active > 0)
+    {
+      const int n = n_active;
+      double *best, *lower;
+
+      // don't step past t_stop
+      for (s = 0; s < n; ++s)
+	{
+	  b->h_free[s] = b->h[s];
+	  if (b->t[s] + b->h[s] > t_stop)
+	    b->h[s] = t_stop - b->t[s];
+	}
+
+      batch_rhs (b, n, b->y, b->f0);
+      batch_jacobian (b, n, b->y);
+
+#define TAB(j, m) (b->tab + ((j) * BATCH_K + (m)) * n_iso * cap)
+      for (j = 0; j < BATCH_K; ++j)
+	{
+	  batch_midpoint (b, n, batch_seq[j], TAB (j, 0));
+	  for (m = 1; m <= j; ++m)
+	    {
+	      const double ratio = (double) batch_seq[j] / batch_seq[j - m];
+	      const double fac = 1.0 / (ratio * ratio - 1.0);
+	      for (i = 0; i < n_iso; ++i)
+		{
+		  const double *restrict cur = TAB (j, m - 1) + i * cap;
+		  const double *restrict prev = TAB (j - 1, m - 1) + i * cap;
+		  double *restrict out = TAB (j, m) + i * cap;
+		  for (z = 0; z < n; ++z)
+		    out[z] = cur[z] + (cur[z] - prev[z]) * fac;
+		}
+	    }
+	}
+      best = TAB (BATCH_K - 1, BATCH_K - 1);
+      lower = TAB (BATCH_K - 1, BATCH_K - 2);
+#undef TAB
+
+      // error ratio, same norm as gsl_odeiv2_control_y
+      for (z = 0; z < n; ++z)
+	b->err[z] = 0.0;
+      for (i = 0; i < n_iso; ++i)
+	{
+	  const double *restrict yb = best + i * cap, *restrict yl =
+	    lower + i * cap;
+	  double *restrict err = b->err;
+	  for (z = 0; z < n; ++z)
+	    {
+	      const double r =
+		fabs (yb[z] - yl[z]) / (eps_abs + eps_rel * fabs (yb[z]));
+	      err[z] = r > err[z] ? r : err[z];
+	    }
+	}
+
+      /* accept or reject each zone, and pick its next step size the
+       * way GSL's standard controller does. a NaN error (singular
+       * matrix) counts as a rejection */
+      for (s = 0; s < n; ++s)
+	{
+	  const double r = b->err[s];
+	  if (!(r <= 1.1))
+	    {
+	      double fac = isfinite (r) ? 0.9 / pow (r, 1.0 / order) : 0.2;
+	      b->h[s] *= fac < 0.2 ? 0.2 : fac;
+	      ++b->stats.n_zone_rejects;
+	      continue;
+	    }
+	  for (i = 0; i < n_iso; ++i)
+	    b->y[i * cap + s] = best[i * cap + s];
+	  // land exactly on t_stop, not a rounding error away from it
+	  if (b->h[s] >= t_stop - b->t[s])
+	    b->t[s] = t_stop;
+	  else
+	    b->t[s] += b->h[s];
+	  ++b->n_steps[s];
+	  ++b->stats.n_zone_steps;
+	  if (r < 0.5)
+	    {
+	      double fac = 0.9 / pow (r > 1.0e-300 ? r : 1.0e-300,
+				      1.0 / (order + 1.0));
+	      fac = fac > 5.0 ? 5.0 : fac;
+	      b->h[s] *= fac < 1.0 ? 1.0 : fac;
+	    }
+	}
+      ++b->stats.n_batch_steps;
+
+      /* retire finished zones. walking backwards means the slot we pull
+       * in from the end has already been looked at */
+      for (s = n - 1; s >= 0; --s)
+	{
+	  const int done = b->t[s] >= t_stop;
+	  const int failed = b->n_steps[s] >= BATCH_MAX_STEPS
+	    || b->t[s] + b->h[s] == b->t[s];
+	  if (!done && !failed)
+	    continue;
+	  if (failed && !done)
+	    ++b->stats.n_failed_zones;
+	  for (i = 0; i < n_iso; ++i)
+	    y[(size_t) i * n_zone + b->zone[s]] = b->y[i * cap + s];
+	  /* the step it ended with was probably cut short to land on
+	   * t_stop; carry on with the one it wanted */
+	  if (h != NULL)
+	    h[b->zone[s]] = done ? fmax (b->h[s], b->h_free[s]) : 0.0;
+
+	  if (next_zone < n_zone)
+	    {
+	      load_zone (b, s, next_zone++, y, T, rho, t0, h0, h);
+	      load_rates (b, s, 1);
+	    }
+	  else
+	    {
+	      move_slot (b, n_active - 1, s);
+	      --n_active;
+	    }
+	}
+    }
+  return b->stats.n_failed_zones > 0 ? GSL_EMAXITER : GSL_SUCCESS;
+}
+
+/* Integrates n_zone zones from t = 0 to t_stop. y[iso * n_zone + zone]
+ * holds the initial abundances and gets the final ones. Every zone
+ * starts with step h0 and uses GSL's "y" error control with eps_abs
+ * and eps_rel. Returns GSL_SUCCESS, or GSL_EMAXITER if any zone needed
+ * more than BATCH_MAX_STEPS steps (that zone's y is left wherever it
+ * got to). Counters go in b->stats. */
+int
+batch_integrate (struct batch_solver *b, int n_zone, double y[],
+		 const double T[], const double rho[], double t_stop,
+		 double h0, double eps_abs, double eps_rel)
+{
+  b->lambda_in = NULL;
+  return batch_run (b, n_zone, y, T, rho, 0.0, t_stop, h0, NULL, eps_abs,
+		    eps_rel);
+}
+
+/* Same as batch_integrate(), from t0 instead of 0, with the rates of
+ * zone z in lambda[k * n_zone + z] (N_RATES of them) instead of
+ * evaluating them at a T. Each zone starts with step h[z], and h[z]
+ * gets the step it would take next, so another call from t_stop
+ * carries on where this one stopped; a zone that failed gets h[z] = 0,
+ * and stays where it is in any later call. */
+int
+batch_integrate_rates (struct batch_solver *b, int n_zone, double y[],
+		       const double lambda[], double t0, double t_stop,
+		       double h[], double eps_abs, double eps_rel)
+{
+  int status;
+  b->lambda_in = lambda;
+  status = batch_run (b, n_zone, y, NULL, NULL, t0, t_stop, 0.0, h,
+		      eps_abs, eps_rel);
+  b->lambda_in = NULL;
+  return status;
+}
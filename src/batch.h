@@ -0,0 +1,71 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+/* Integrates the same network in many zones at once, e.g. every zone
+ * of a hydro grid for one hydro step. Everything is stored
+ * structure-of-arrays, zone index fastest: y[iso * n_zone + zone],
+ * T[zone], rho[zone]. The rates, RHS, Jacobian and LU kernels then
+ * loop over zones in the innermost loop, with every zone doing exactly
+ * the same arithmetic, so the compiler vectorizes them (build with
+ * -DNATIVE_SIMD=ON to let it use AVX2/AVX-512).
+ *
+ * The method is the same semi-implicit extrapolation as step_sbsimp.c,
+ * and every zone keeps its own step size and its own error control.
+ * Zones that reach t_stop are written back and their slot is handed to
+ * the next zone that hasn't started yet, or, near the end, filled with
+ * the last active zone, so the vector lanes stay busy.
+ *
+ * batch_integrate_rates() does the same with rates the caller already
+ * has for every zone instead of evaluating them from T, e.g. for an
+ * ensemble of the same zone with different rates (ensemble.c), and
+ * can carry on from where the last call stopped. */
+
+struct network;
+struct sparse_lu;
+
+struct batch_stats
+{
+  long n_batch_steps;		// passes over all active zones
+  long n_zone_steps;		// accepted steps, summed over zones
+  long n_zone_rejects;		// rejected steps, summed over zones
+  long n_failed_zones;		// zones that hit BATCH_MAX_STEPS
+};
+
+struct batch_solver
+{
+  const struct network *net;
+  struct sparse_lu *lu;		// symbolic factorization of the pattern
+  int n_iso, n_reac, nnz, nnz_lu;
+  int cap;			// zones in flight at once (the stride)
+  int *diag;			// diagonal positions in the Jacobian pattern
+  /* numeric LU as a list of updates: for L entry p, positions
+   * op_q[op_ptr[p] ...] of U are used to update op_t[...] */
+  int *op_ptr, *op_q, *op_t;
+  // per-slot state
+  int *zone;			// caller's zone index in each slot
+  long *n_steps;
+  double *t, *h, *T, *rho;
+  double *lambda;		// N_RATES x cap
+  double *y;			// n_iso x cap
+  // scratch, all zone-fastest
+  double *f0, *jac, *lu_val, *del, *yk, *flux, *tab;
+  double *ones;			// stands in for unused reactant slots
+  double *h_sub, *err;
+  double *h_free;		// each slot's step before cutting it to t_stop
+  /* if not NULL, zone z's rates are lambda_in[k * n_zone + z] instead
+   * of the fits at its T (batch_integrate_rates()) */
+  const double *lambda_in;
+  int n_zone;
+  struct batch_stats stats;
+};
+
+struct batch_solver *batch_alloc (const struct network *net, int cap);
+void batch_free (struct batch_solver *b);
+int batch_integrate (struct batch_solver *b, int n_zone, double y[],
+		     const double T[], const double rho[], double t_stop,
+		     double h0, double eps_abs, double eps_rel);
+int batch_integrate_rates (struct batch_solver *b, int n_zone, double y[],
+			   const double lambda[], double t0, double t_stop,
+			   double h[], double eps_abs, double eps_rel);
+
+#endif
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <gsl/gsl_errno.h>
+#include "checkpoint.h"
+
+/* See checkpoint.h for the layout. A single run's checkpoint gets
+ * rewritten every so often; it's written to a temporary file that is
+ * then renamed over the old one, so if we die in the middle of writing
+ * it the previous checkpoint is still there. */
+
+void
+ckpt_header_init (struct ckpt_header *hdr, int kind, int n_iso,
+		  const char *stepper, double eps_abs, double eps_rel)
+{
+  memset (hdr, 0, sizeof (*hdr));
+  memcpy (hdr->magic, CKPT_MAGIC, sizeof (hdr->magic));
+  hdr->version = CKPT_VERSION;
+  hdr->byte_order = CKPT_BYTE_ORDER;
+  hdr->kind = kind;
+  hdr->n_iso = n_iso;
+  strncpy (hdr->stepper, stepper, CKPT_NAME_LEN - 1);
+  hdr->eps_abs = eps_abs;
+  hdr->eps_rel = eps_rel;
+}
+
+int
+ckpt_write_header (FILE * fp, const struct ckpt_header *hdr)
+{
+  return fwrite (hdr, sizeof (*hdr), 1, fp) == 1 ? GSL_SUCCESS : GSL_EFAILED;
+}
+
+/* Returns GSL_EINVAL if this isn't a checkpoint, or is one from
+ * another version or a machine with the other byte order. */
+int
+ckpt_read_header (FILE * fp, struct ckpt_header *hdr)
+{
+  if (fread (hdr, sizeof (*hdr), 1, fp) != 1)
+    return GSL_EFAILED;
+  if (memcmp (hdr->magic, CKPT_MAGIC, sizeof (hdr->magic)) != 0
+      || hdr->version != CKPT_VERSION || hdr->byte_order != CKPT_BYTE_ORDER)
+    return GSL_EINVAL;
+  hdr->stepper[CKPT_NAME_LEN - 1] = '\0';
+  return GSL_SUCCESS;
+}
+
+int
+ckpt_write_run (const char *path, const struct ckpt_header *hdr,
+		const struct ckpt_run *run, const double y[])
+{
+  char tmp[strlen (path) + 5];
+  FILE *fp;
+  int status = GSL_SUCCESS;
+
+  sprintf (tmp, "%s.tmp", path);
+  fp = fopen (tmp, "wb");
+  if (fp == NULL)
+    return GSL_EFAILED;
+  if (ckpt_write_header (fp, hdr) != GSL_SUCCESS
+      || fwrite (run, sizeof (*run), 1, fp) != 1
+      || fwrite (y, sizeof (double), hdr->n_iso, fp) != hdr->n_iso)
+    status = GSL_EFAILED;
+  if (fclose (fp) != 0)
+    status = GSL_EFAILED;
+  if (status == GSL_SUCCESS && rename (tmp, path) != 0)
+    status = GSL_EFAILED;
+  if (status != GSL_SUCCESS)
+    remove (tmp);
+  return status;
+}
+
+/* Reads a single run's checkpoint for a network of n_iso isotopes (y
+ * needs that many). Returns GSL_EINVAL if the file isn't a single
+ * run's checkpoint, and GSL_EBADLEN if it's for another network size. */
+int
+ckpt_read_run (const char *path, struct ckpt_header *hdr,
+	       struct ckpt_run *run, double y[], int n_iso)
+{
+  FILE *fp = fopen (path, "rb");
+  int status;
+
+  if (fp == NULL)
+    return GSL_EFAILED;
+  status = ckpt_read_header (fp, hdr);
+  if (status == GSL_SUCCESS && hdr->kind != CKPT_RUN)
+    status = GSL_EINVAL;
+  if (status == GSL_SUCCESS && hdr->n_iso != (uint32_t) n_iso)
+    status = GSL_EBADLEN;
+  if (status == GSL_SUCCESS
+      && (fread (run, sizeof (*run), 1, fp) != 1
+	  || fread (y, sizeof (double), n_iso, fp) != (size_t) n_iso))
+    status = GSL_EFAILED;
+  fclose (fp);
+  return status;
+}
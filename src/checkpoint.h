@@ -0,0 +1,74 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Checkpoints, so a long run that dies can pick up where it left off
+ * instead of starting from t = 0 again. Binary, in host byte order:
+ * unlike the results files (output.h, always little-endian) they're
+ * only meant to be read back on the machine that wrote them, and one
+ * from a machine with the other byte order gets refused. There's a
+ * version number too, so an old checkpoint gets refused instead of
+ * misread:
+ *
+ *   struct ckpt_header
+ *   then, for a single run (CKPT_RUN): struct ckpt_run, n_iso doubles y
+ *     (one more, the temperature, if it's integrated too)
+ *   or, for a sweep (CKPT_SWEEP): see sweep.c
+ *
+ * The header says what the checkpoint is good for: the network size,
+ * the stepper and the tolerances. A restart with anything else would
+ * be a different calculation, so it's refused. */
+
+#define CKPT_MAGIC "NNCKPT\0\0"
+#define CKPT_VERSION 2
+#define CKPT_BYTE_ORDER 0x01020304u
+#define CKPT_NAME_LEN 16
+
+enum ckpt_kind
+{
+  CKPT_RUN = 1,			// main.c's single run
+  CKPT_SWEEP = 2		// a parameter sweep, sweep.c
+};
+
+struct ckpt_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;		// CKPT_BYTE_ORDER as written by the host
+  uint32_t kind;		// enum ckpt_kind
+  uint32_t n_iso;		// unknowns, counting T if it's one of them
+  char stepper[CKPT_NAME_LEN];	// as in stepper_by_name(), NUL padded
+  double eps_abs, eps_rel;
+};
+
+/* Everything main.c's loop needs to carry on, taken between two steps.
+ * Together with y that's the whole state of the integration for the
+ * one-step methods (bsimp, sbsimp, ros4), so a restart takes exactly
+ * the same steps the original run would have; the BDF steppers lose
+ * their history and start over at order 1. */
+struct ckpt_run
+{
+  double T, rho;		// at the start; a trajectory has its own
+  double t_now, t_stop;		// sec
+  double h;			// the step size the integrator wants next
+  int64_t n_steps;		// accepted steps so far
+  int64_t n_rejected;
+  int64_t next_out;		// index of the next output time, if scheduled
+  int64_t n_out;		// number of output times, 0 for every step
+  int64_t out_offset;		// bytes of output written up to t_now
+  uint32_t trajectory;		// following a T(t), rho(t) trajectory
+  uint32_t binary;		// output is results.bin, not results.dat
+};
+
+void ckpt_header_init (struct ckpt_header *hdr, int kind, int n_iso,
+		       const char *stepper, double eps_abs, double eps_rel);
+int ckpt_write_header (FILE * fp, const struct ckpt_header *hdr);
+int ckpt_read_header (FILE * fp, struct ckpt_header *hdr);
+int ckpt_write_run (const char *path, const struct ckpt_header *hdr,
+		    const struct ckpt_run *run, const double y[]);
+int ckpt_read_run (const char *path, struct ckpt_header *hdr,
+		   struct ckpt_run *run, double y[], int n_iso);
+
+#endif
@@ -0,0 +1,107 @@
+#include "energy.h"
+#include "network.h"
+#include "param.h"
+#include "rate_coeffs.h"
+
+/* We used to get the energy generation by reading results.dat back into
+ * Python and working out every flux all over again. But ode_rhs() has
+ * the fluxes already, so with params->energy set it adds them up with
+ * the Q-values (rate_q and rate_q_nu in rate_coeffs.c, or a rate
+ * library's, whichever params->rates has) while it's at it,
+ * network_rhs_energy(), and leaves
+ *
+ *   eps_nuc = sum of Q * flux * N_A / rho   (erg/g/s, stays in the gas)
+ *   eps_nu  = the same for the neutrinos    (erg/g/s, gone)
+ *
+ * in params. If the network has the temperature as an unknown
+ * (network_set_temperature(); it's T9, see energy.h), that heat goes
+ * into the gas at constant density and
+ *
+ *   dT/dt = eps_nuc / c_v
+ *
+ * where c_v is for an ideal gas of nuclei and electrons (fully ionized,
+ * not degenerate, which is fine for the core of a main sequence star)
+ * plus radiation:
+ *
+ *   rho c_v = 3/2 R sum over i of (1 + Z_i) Y_i  +  4 a T^3
+ *
+ * Nothing carries the heat away, so this is a box that's burning and
+ * can't cool, i.e. a runaway: fine for checking how sensitive a result
+ * is to the heating, not a model of a star. */
+
+// gas constant, erg/mol/K
+#define R_GAS 8.314462618e+07
+// radiation constant, erg/cm^3/K^4
+#define A_RAD 7.565733e-15
+
+/* rho c_v (erg/cm^3/K) at the abundances y and temperature T, and in
+ * dcv_dy the derivative w.r.t. each abundance */
+static double
+heat_capacity (const struct network *net, const double y[], double T,
+	       double dcv_dy[])
+{
+  double sum = 0.0;
+  int i;
+  for (i = 0; i < net->n_iso; ++i)
+    {
+      dcv_dy[i] = 1.5 * R_GAS * (1 + net->iso[i].Z);
+      sum += dcv_dy[i] * y[i];
+    }
+  return sum + 4.0 * A_RAD * T * T * T;
+}
+
+/* dY/dt into dydt with the rates lambda, and eps_nuc and eps_nu into
+ * params; dT9/dt as well (dydt[n_iso]) if T is an unknown. The caller
+ * (ode_rhs()) has already got the rates at that T. */
+void
+energy_rhs (struct param *params, const double lambda[], const double y[],
+	    double dydt[])
+{
+  const struct network *net = params->net;
+  const int n = net->n_iso;
+  double e, e_nu, dcv_dy[n];
+
+  network_rhs_energy (net, lambda, y, dydt, params->rates.q,
+		      params->rates.q_nu, &e, &e_nu);
+  params->eps_nuc = e * MEV_MOL_TO_ERG / params->rho;
+  params->eps_nu = e_nu * MEV_MOL_TO_ERG / params->rho;
+  if (net->temperature)
+    dydt[n] = e * MEV_MOL_TO_ERG
+      / heat_capacity (net, y, y[n] * ENERGY_T_UNIT, dcv_dy) / ENERGY_T_UNIT;
+}
+
+/* The temperature's column and row of the Jacobian, for T9 = y[n_iso]:
+ * col[i] = d(dY_i/dt)/dT9 for the n_iso abundances, row[j] =
+ * d(dT9/dt)/dY_j and row[n_iso] = d(dT9/dt)/dT9. dT/dt = E / (rho c_v),
+ * with E the heat per volume, so
+ *
+ *   d(dT/dt)/dx = (dE/dx - dT/dt * d(rho c_v)/dx) / (rho c_v)
+ *
+ * The rates only come into dY/dt and E linearly, so their T
+ * derivatives are the same sums with dlambda/dT in place of lambda.
+ * Then it's just the GK to K factors. */
+void
+energy_jacobian (struct param *params, const double lambda[],
+		 const double y[], double col[], double row[])
+{
+  const struct network *net = params->net;
+  const int n = net->n_iso;
+  const double T = y[n] * ENERGY_T_UNIT;
+  const double *dlambda_dT = rate_state_dT (&params->rates);
+  double de_dT, de_nu_dT, e, cv, dT_dt, dcv_dy[n];
+  int j;
+
+  network_rhs_energy (net, dlambda_dT, y, col, params->rates.q,
+		      params->rates.q_nu, &de_dT, &de_nu_dT);
+  e = network_energy_gradient (net, lambda, y, params->rates.q, row)
+    * MEV_MOL_TO_ERG;
+  cv = heat_capacity (net, y, T, dcv_dy);
+  dT_dt = e / cv;
+  for (j = 0; j < n; ++j)
+    {
+      col[j] *= ENERGY_T_UNIT;
+      row[j] = (row[j] * MEV_MOL_TO_ERG - dT_dt * dcv_dy[j])
+	/ cv / ENERGY_T_UNIT;
+    }
+  row[n] = (de_dT * MEV_MOL_TO_ERG - dT_dt * 12.0 * A_RAD * T * T) / cv;
+}
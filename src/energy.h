@@ -0,0 +1,21 @@
+#ifndef ENERGY_H
+#define ENERGY_H
+
+/* Energy generation from the reaction fluxes, and the temperature
+ * following it when it's one of the unknowns. See energy.c. */
+
+struct param;
+
+// MeV per reaction -> erg per mol of reactions
+#define MEV_MOL_TO_ERG (1.602176634e-6 * 6.02214076e23)
+/* the temperature unknown is T9, T in GK: the integrator's absolute
+ * tolerance is the same for every unknown, and 1e-8 makes sense in GK
+ * (10 K) but not in K */
+#define ENERGY_T_UNIT 1.0e9
+
+void energy_rhs (struct param *params, const double lambda[],
+		 const double y[], double dydt[]);
+void energy_jacobian (struct param *params, const double lambda[],
+		      const double y[], double col[], double row[]);
+
+#endif
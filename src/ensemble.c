@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#include "batch.h"
+#include "ensemble.h"
+#include "instrument.h"
+#include "network.h"
+#include "rate_coeffs.h"
+#include "schedule.h"
+
+/* Rate uncertainty ensembles. The file describing one has one keyword
+ * per line, "#" starts a comment:
+ *
+ *   members  4096
+ *   seed     1
+ *   T        2.5e7                  # K
+ *   rho      150                    # g/cm^3
+ *   x_h1     0.99                   # initial mass fractions
+ *   x_c12    0.01
+ *   t_stop   1.0e22                 # sec
+ *   times    log:100                # as for --times
+ *   eps_abs  1.0e-8
+ *   eps_rel  0.0
+ *   percentiles 5 16 50 84 95
+ *   uncertainty n15+h1->c12+he4 2.0 # 1 sigma factor
+ *   uncertainty all 1.1
+ *
+ * Anything left out keeps the default below. A rate is named the way
+ * --sensitivity names it (network_rate_label()), and its uncertainty
+ * is a factor: ln(multiplier) is normal with a standard deviation of
+ * ln(factor), so 2.0 puts two thirds of the members between half and
+ * twice the CF88 rate. "all" sets every rate; later lines win. The
+ * defaults are rough: a factor 2 for the three rates CF88 fudges
+ * (N15(p,a), O17(p,a) and O17(p,g), whose fudge factors of 0.5 stand
+ * for "somewhere between 0 and 1"), 1.3 for the other captures, and
+ * nothing for the beta-decays, which are known far better than any of
+ * those.
+ *
+ * Every member has the same T and rho, so the rates get evaluated
+ * once and each member's are those times its multipliers, drawn in
+ * member order from one generator so they don't depend on the number
+ * of threads. The members are integrated by the batch solver
+ * (batch.c), which keeps a few hundred of them in the lanes of its
+ * vector kernels at once; the members are split into a contiguous
+ * slice per thread, each with a batch solver of its own.
+ *
+ * Nothing is kept per member but its abundances, rates and step size.
+ * All of them are taken from one output time to the next, then the
+ * percentiles of every isotope's mass fraction over the members get
+ * appended to the output as a row: tnow, then h1_p5, h1_p16, ... for
+ * every isotope in turn. So memory goes with the number of members and
+ * the output with the number of output times, and neither with the
+ * product. A member the solver gives up on is left out from then on. */
+
+// members each batch solver works on at once
+#define ENSEMBLE_BATCH_CAP 256
+
+// what one thread integrates
+struct ensemble_slice
+{
+  struct batch_solver *b;
+  int n;			// members in this slice
+  double *y;			// n_iso x n, member fastest
+  double *lambda;		// N_RATES x n
+  double *h;			// each member's next step
+  double t0, t1;		// this interval
+  double eps_abs, eps_rel;
+  long n_steps, n_rejects;
+};
+
+void
+ensemble_spec_default (struct ensemble_spec *spec)
+{
+  int k;
+  spec->n_members = 1000;
+  spec->seed = 1;
+  // the same problem main.c runs
+  spec->T = 25.0e+06;
+  spec->rho = 150.0;
+  spec->x_h1 = 0.99;
+  spec->x_c12 = 0.01;
+  spec->t_stop = 1.0e+22;
+  spec->eps_abs = 1.0e-8;
+  spec->eps_rel = 0.0;
+  strcpy (spec->times, "log:100");
+  for (k = 0; k < N_RATES; ++k)
+    spec->f_unc[k] = (k < N_RATES_T) ? 1.3 : 1.0;
+  spec->f_unc[R_N15_P_A_C12] = 2.0;
+  spec->f_unc[R_O17_P_A_N14] = 2.0;
+  spec->f_unc[R_O17_P_G_F18] = 2.0;
+  spec->n_pct = 5;
+  spec->pct[0] = 5.0;
+  spec->pct[1] = 16.0;
+  spec->pct[2] = 50.0;
+  spec->pct[3] = 84.0;
+  spec->pct[4] = 95.0;
+}
+
+// "uncertainty RATE FACTOR". returns 0, or 1 if it's no good
+static int
+read_uncertainty (const char *rest, const struct network *net,
+		  struct ensemble_spec *spec)
+{
+  char name[64], label[64];
+  double f;
+  int k, found = 0;
+
+  if (sscanf (rest, "%63s %lf", name, &f) != 2 || !(f >= 1.0))
+    return 1;
+  for (k = 0; k < N_RATES; ++k)
+    {
+      network_rate_label (net, k, label, sizeof (label));
+      if (strcmp (name, "all") == 0 || strcmp (name, label) == 0)
+	{
+	  spec->f_unc[k] = f;
+	  found = 1;
+	}
+    }
+  return !found;
+}
+
+// "percentiles P1 P2 ...", increasing, in [0, 100]
+static int
+read_percentiles (const char *rest, struct ensemble_spec *spec)
+{
+  double p;
+  int used, n = 0;
+
+  while (sscanf (rest, "%lf%n", &p, &used) == 1)
+    {
+      if (n == ENSEMBLE_MAX_PCT || p < 0.0 || p > 100.0
+	  || (n > 0 && p <= spec->pct[n - 1]))
+	return 1;
+      spec->pct[n++] = p;
+      rest += used;
+    }
+  if (n == 0)
+    return 1;
+  spec->n_pct = n;
+  return 0;
+}
+
+/* Reads an ensemble description (see the top of the file) on top of
+ * the defaults. The rate names are the ones of net. Returns
+ * GSL_SUCCESS, GSL_EFAILED if the file can't be opened, or GSL_EINVAL
+ * (with the line on stderr) if something in it makes no sense. */
+int
+ensemble_read_spec (const char *path, const struct network *net,
+		    struct ensemble_spec *spec)
+{
+  FILE *fp = fopen (path, "r");
+  char line[512];
+  int line_no = 0;
+
+  if (fp == NULL)
+    return GSL_EFAILED;
+  ensemble_spec_default (spec);
+
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      char key[16];
+      int used, bad = 0;
+      char *hash = strchr (line, '#');
+      ++line_no;
+      if (hash != NULL)
+	*hash = '\0';
+      if (sscanf (line, "%15s%n", key, &used) != 1)
+	continue;		// blank or comment
+      const char *rest = line + used;
+
+      if (strcmp (key, "members") == 0)
+	bad = (sscanf (rest, "%ld", &spec->n_members) != 1
+	       || spec->n_members < 1);
+      else if (strcmp (key, "seed") == 0)
+	bad = (sscanf (rest, "%lu", &spec->seed) != 1);
+      else if (strcmp (key, "T") == 0)
+	bad = (sscanf (rest, "%lf", &spec->T) != 1);
+      else if (strcmp (key, "rho") == 0)
+	bad = (sscanf (rest, "%lf", &spec->rho) != 1);
+      else if (strcmp (key, "x_h1") == 0)
+	bad = (sscanf (rest, "%lf", &spec->x_h1) != 1);
+      else if (strcmp (key, "x_c12") == 0)
+	bad = (sscanf (rest, "%lf", &spec->x_c12) != 1);
+      else if (strcmp (key, "t_stop") == 0)
+	bad = (sscanf (rest, "%lf", &spec->t_stop) != 1);
+      else if (strcmp (key, "times") == 0)
+	bad = (sscanf (rest, "%255s", spec->times) != 1);
+      else if (strcmp (key, "eps_abs") == 0)
+	bad = (sscanf (rest, "%lf", &spec->eps_abs) != 1);
+      else if (strcmp (key, "eps_rel") == 0)
+	bad = (sscanf (rest, "%lf", &spec->eps_rel) != 1);
+      else if (strcmp (key, "percentiles") == 0)
+	bad = read_percentiles (rest, spec);
+      else if (strcmp (key, "uncertainty") == 0)
+	bad = read_uncertainty (rest, net, spec);
+      else
+	bad = 1;
+
+      if (bad)
+	{
+	  fprintf (stderr, "%s:%d: can't make sense of this line\n", path,
+		   line_no);
+	  fclose (fp);
+	  return GSL_EINVAL;
+	}
+    }
+  fclose (fp);
+  return GSL_SUCCESS;
+}
+
+static void *
+slice_worker (void *arg)
+{
+  struct ensemble_slice *sl = arg;
+  /* a member that fails gets h = 0, which is how the caller finds
+   * out, so there's nothing more in the status */
+  batch_integrate_rates (sl->b, sl->n, sl->y, sl->lambda, sl->t0, sl->t1,
+			 sl->h, sl->eps_abs, sl->eps_rel);
+  sl->n_steps += sl->b->stats.n_zone_steps;
+  sl->n_rejects += sl->b->stats.n_zone_rejects;
+  return NULL;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+// percentile p (in %) of the n sorted values in v, interpolated
+static double
+percentile (const double v[], long n, double p)
+{
+  const double pos = p / 100.0 * (n - 1);
+  const long k = (long) pos;
+  if (k >= n - 1)
+    return v[n - 1];
+  return v[k] + (pos - k) * (v[k + 1] - v[k]);
+}
+
+static void
+free_slices (struct ensemble_slice *sl, int n)
+{
+  int i;
+  for (i = 0; i < n; ++i)
+    {
+      batch_free (sl[i].b);
+      free (sl[i].y);
+      free (sl[i].lambda);
+      free (sl[i].h);
+    }
+  free (sl);
+}
+
+/* Runs the ensemble spec describes (see the top of the file) on
+ * n_threads threads (<= 0 means one per core) and writes the
+ * percentiles to out_path as it goes. net has to be the CNO network,
+ * which is what the batch solver does. Returns GSL_SUCCESS, GSL_EINVAL
+ * for bad output times, GSL_ENOMEM, GSL_EFAILED if the output couldn't
+ * be written, or GSL_EMAXITER if every member failed. */
+int
+ensemble_run (const struct ensemble_spec *spec, const struct network *net,
+	      int n_threads, const char *out_path)
+{
+  const int n_iso = net->n_iso;
+  const long n_mem = spec->n_members;
+  const double t_start = instr_now ();
+  struct schedule sched = { 0, NULL };
+  struct rate_state rs;
+  struct ensemble_slice *sl;
+  double *v, t_prev = 0.0;
+  char *failed;
+  long m, n_alive, n_failed = 0, n_steps = 0, n_rejects = 0;
+  int i, j, k, c, status = GSL_SUCCESS;
+  FILE *fp;
+
+  if (schedule_parse (&sched, spec->times, 0.0, spec->t_stop, 0)
+      != GSL_SUCCESS)
+    return GSL_EINVAL;
+  if (n_threads <= 0)
+    n_threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (n_threads <= 0)
+    n_threads = 1;
+  if (n_threads > n_mem)
+    n_threads = n_mem;
+
+  // the same thermodynamics for everybody, so the same rates to start
+  rate_state_init (&rs);
+  const double *lambda = rate_state_update (&rs, spec->T, spec->rho);
+
+  const int h1 = network_find_isotope (net, "h1");
+  const int c12 = network_find_isotope (net, "c12");
+  sl = calloc (n_threads, sizeof (*sl));
+  v = malloc (n_mem * sizeof (double));
+  failed = calloc (n_mem, 1);
+  gsl_rng *rng = gsl_rng_alloc (gsl_rng_mt19937);
+  if (sl == NULL || v == NULL || failed == NULL || rng == NULL)
+    status = GSL_ENOMEM;
+  else
+    gsl_rng_set (rng, spec->seed);
+
+  // contiguous slices of members, and each member's rates
+  for (i = 0, m = 0; i < n_threads && status == GSL_SUCCESS; ++i)
+    {
+      struct ensemble_slice *s = &sl[i];
+      s->n = n_mem / n_threads + (i < n_mem % n_threads);
+      s->b = batch_alloc (net, s->n < ENSEMBLE_BATCH_CAP ? s->n
+			  : ENSEMBLE_BATCH_CAP);
+      s->y = malloc ((size_t) n_iso * s->n * sizeof (double));
+      s->lambda = malloc ((size_t) N_RATES * s->n * sizeof (double));
+      s->h = malloc (s->n * sizeof (double));
+      s->eps_abs = spec->eps_abs;
+      s->eps_rel = spec->eps_rel;
+      if (s->b == NULL || s->y == NULL || s->lambda == NULL || s->h == NULL)
+	{
+	  status = GSL_ENOMEM;
+	  break;
+	}
+      for (j = 0; j < s->n; ++j, ++m)
+	{
+	  /* all of a member's draws, uncertain rates or not, so a member
+	   * is the same whatever the other rates' uncertainties are */
+	  for (k = 0; k < N_RATES; ++k)
+	    s->lambda[(size_t) k * s->n + j] = lambda[k]
+	      * exp (log (spec->f_unc[k]) * gsl_ran_gaussian (rng, 1.0));
+	  // same starting point as main.c
+	  for (c = 0; c < n_iso; ++c)
+	    s->y[(size_t) c * s->n + j] =
+	      1.0e-20 * spec->rho / net->iso[c].molar_mass;
+	  s->y[(size_t) h1 * s->n + j] =
+	    spec->x_h1 * spec->rho / net->iso[h1].molar_mass;
+	  s->y[(size_t) c12 * s->n + j] =
+	    spec->x_c12 * spec->rho / net->iso[c12].molar_mass;
+	  s->h[j] = 1.0e-8;
+	}
+    }
+  if (rng != NULL)
+    gsl_rng_free (rng);
+
+  fp = NULL;
+  if (status == GSL_SUCCESS && (fp = fopen (out_path, "w")) == NULL)
+    {
+      fprintf (stderr, "could not write %s\n", out_path);
+      status = GSL_EFAILED;
+    }
+  if (fp != NULL)
+    {
+      char name[NET_NAME_LEN + 16];
+      fprintf (fp, "%15s", "tnow");
+      for (c = 0; c < n_iso; ++c)
+	for (k = 0; k < spec->n_pct; ++k)
+	  {
+	    snprintf (name, sizeof (name), "%s_p%g", net->iso[c].name,
+		      spec->pct[k]);
+	    fprintf (fp, " %15s", name);
+	  }
+      fprintf (fp, "\n");
+    }
+
+  for (j = 0; j < sched.n && status == GSL_SUCCESS; ++j)
+    {
+      pthread_t tid[n_threads];
+      int started[n_threads];
+      // if there's no thread to be had, this one does it
+      for (i = 0; i < n_threads; ++i)
+	{
+	  sl[i].t0 = t_prev;
+	  sl[i].t1 = sched.t[j];
+	  started[i] = pthread_create (&tid[i], NULL, slice_worker, &sl[i])
+	    == 0;
+	  if (!started[i])
+	    slice_worker (&sl[i]);
+	}
+      for (i = 0; i < n_threads; ++i)
+	if (started[i])
+	  pthread_join (tid[i], NULL);
+      t_prev = sched.t[j];
+
+      // the members that failed so far don't count
+      for (i = 0, m = 0; i < n_threads; ++i)
+	for (k = 0; k < sl[i].n; ++k, ++m)
+	  if (sl[i].h[k] == 0.0 && !failed[m])
+	    {
+	      failed[m] = 1;
+	      ++n_failed;
+	    }
+      if (n_failed == n_mem)
+	{
+	  status = GSL_EMAXITER;
+	  break;
+	}
+
+      fprintf (fp, "%15.4e", sched.t[j]);
+      for (c = 0; c < n_iso; ++c)
+	{
+	  const double to_x = net->iso[c].molar_mass / spec->rho;
+	  for (i = 0, m = 0, n_alive = 0; i < n_threads; ++i)
+	    for (k = 0; k < sl[i].n; ++k, ++m)
+	      if (!failed[m])
+		{
+		  /* the same cut-off as main.c, which also stops the
+		   * slightly negative ones counting as less than zero */
+		  const double x = sl[i].y[(size_t) c * sl[i].n + k] * to_x;
+		  v[n_alive++] = x < 1.0e-20 ? 0.0 : x;
+		}
+	  qsort (v, n_alive, sizeof (double), compare_double);
+	  for (k = 0; k < spec->n_pct; ++k)
+	    fprintf (fp, " %15.4e", percentile (v, n_alive, spec->pct[k]));
+	}
+      fprintf (fp, "\n");
+      // a long run's rows should be there to look at while it's going
+      if (fflush (fp) != 0)
+	status = GSL_EFAILED;
+    }
+  for (i = 0; i < n_threads && sl != NULL; ++i)
+    {
+      n_steps += sl[i].n_steps;
+      n_rejects += sl[i].n_rejects;
+    }
+
+  if (fp != NULL && fclose (fp) != 0 && status == GSL_SUCCESS)
+    status = GSL_EFAILED;
+  if (status == GSL_SUCCESS)
+    printf ("%18s %ld members (%ld failed) on %d threads, %d times, "
+	    "%ld steps, %ld rejected (%.2f sec)\n", "ENSEMBLE:", n_mem,
+	    n_failed, n_threads, sched.n, n_steps, n_rejects,
+	    instr_now () - t_start);
+  if (sl != NULL)
+    free_slices (sl, n_threads);
+  free (v);
+  free (failed);
+  rate_state_free (&rs);
+  schedule_free (&sched);
+  return status;
+}
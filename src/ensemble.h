@@ -0,0 +1,41 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "rate_coeffs.h"
+
+/* Monte Carlo rate uncertainties: the same single run (one T, rho and
+ * starting composition) many times over, every member with its own
+ * draw of every rate from a log-normal around the CF88 value, and the
+ * percentiles of the mass fractions over the members at a list of
+ * output times. See ensemble.c for the file that describes it. */
+
+struct network;
+
+// at most this many percentiles
+#define ENSEMBLE_MAX_PCT 9
+// longest output times spec ("log:N", "lin:N" or a file name)
+#define ENSEMBLE_TIMES_LEN 256
+
+struct ensemble_spec
+{
+  long n_members;
+  unsigned long seed;		// the same seed gives the same members
+  double T, rho, x_h1, x_c12;
+  double t_stop;
+  double eps_abs, eps_rel;
+  char times[ENSEMBLE_TIMES_LEN];	// as for --times
+  /* 1 sigma factor uncertainty of each rate: ln(multiplier) is normal
+   * with a standard deviation of ln(f_unc). 1 means exact */
+  double f_unc[N_RATES];
+  int n_pct;
+  double pct[ENSEMBLE_MAX_PCT];	// in %, increasing
+};
+
+void ensemble_spec_default (struct ensemble_spec *spec);
+int ensemble_read_spec (const char *path, const struct network *net,
+			struct ensemble_spec *spec);
+int ensemble_run (const struct ensemble_spec *spec,
+		  const struct network *net, int n_threads,
+		  const char *out_path);
+
+#endif
@@ -0,0 +1,323 @@
+#include <math.h>
+#include <string.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_linalg.h>
+#include "equilibrium.h"
+#include "jacobian.h"
+#include "network.h"
+#include "ode_rhs.h"
+#include "param.h"
+
+/* Lots of runs only want the end state of the CNO cycles: how much
+ * C12 there is per C13, how much of the CNO has piled up in N14. The
+ * cycles get there long before the hydrogen runs out, and once they
+ * have, every catalyst (everything heavier than He4) is made as fast
+ * as it's destroyed. So instead of integrating for 1e22 sec this
+ * solves
+ *
+ *   dY_i/dt = 0   for every catalyst i
+ *
+ * with H1 and He4 held at what they are in y. Every reaction turns one
+ * catalyst nucleus into another, so the total number of them, Y_CNO,
+ * never changes, and those equations only fix the ratios between
+ * them: their Jacobian is singular (the rows add up to zero). One of
+ * them, for the most abundant catalyst, gets swapped for
+ *
+ *   sum of Y_i = Y_CNO
+ *
+ * and then it's a Newton iteration on ode_rhs() and jacobian(). The
+ * other rows are divided by the destruction rate of their isotope
+ * (-J_ii), which makes them balances in abundance units, about the
+ * size of the constraint row; the rates themselves span tens of orders
+ * of magnitude between the beta decays and the slow proton captures.
+ * With H1 fixed the CNO network is linear in the catalysts, so Newton
+ * is done after one step and a second to confirm it.
+ *
+ * Networks that aren't linear (or a starting point Newton doesn't
+ * like) can make it stall: the residual goes up instead of down. Then
+ * we fall back to pseudo-transient continuation: backward Euler steps
+ * in a fake time, (I/dtau - J) dy = f, with dtau growing as the
+ * residual drops (dtau_new = dtau * old residual / new one, but at least
+ * doubling) until it's long compared to the slowest catalyst, and
+ * Newton gets another go from there. The time scales go from seconds
+ * (the beta decays) to far longer than the age of the universe (O16 at
+ * 10 MK), so dtau has a long way to go. */
+
+// converged when no Newton correction is bigger than this, relative
+#define EQ_TOL 1.0e-10
+/* abundances below this fraction of Y_CNO, the total of the
+ * catalysts, are as good as zero. this is not main.c's 1e-20 cut-off,
+ * which is on mass fractions: the numbers match, the scales don't, so
+ * the two can't be one constant */
+#define EQ_FLOOR 1.0e-20
+#define EQ_MAX_NEWTON 20
+#define EQ_MAX_PTC 500
+// dtau (times the slowest destruction rate) at which to hand back to Newton
+#define EQ_PTC_DONE 1.0e3
+// dtau grows by a factor between these per pseudo-time step
+#define EQ_PTC_MIN_GROWTH 2.0
+#define EQ_PTC_MAX_GROWTH 10.0
+
+struct eq_work
+{
+  struct param *params;
+  int n;			// isotopes
+  int m;			// catalysts
+  const int *cat;		// their indices, m long
+  double y_cno;			// the total that's held fixed
+  double *f, *dfdy, *dfdt;	// RHS and Jacobian of the whole network
+  double *d;			// destruction rates -J_ii of the catalysts
+  double *a, *r, *dy;		// m x m system, right-hand side, solution
+  size_t *perm;
+};
+
+/* RHS and Jacobian at y, and the destruction rates. GSL_ESING if a
+ * catalyst isn't destroyed at all (no H1, or too cold for any rate),
+ * in which case there's no equilibrium to find */
+static int
+eval (struct eq_work *w, const double y[])
+{
+  int a;
+  ode_rhs (0.0, y, w->f, w->params);
+  jacobian (0.0, y, w->dfdy, w->dfdt, w->params);
+  for (a = 0; a < w->m; ++a)
+    {
+      w->d[a] = -w->dfdy[w->cat[a] * w->n + w->cat[a]];
+      if (!(w->d[a] > 0.0))
+	return GSL_ESING;
+    }
+  return GSL_SUCCESS;
+}
+
+/* the largest |dY_i/dt| / (-J_ii), i.e. how much Y_i would still change
+ * in one of its lifetimes, relative to Y_i. for the f and d in w */
+static double
+residual (const struct eq_work *w, const double y[])
+{
+  const double floor = EQ_FLOOR * w->y_cno;
+  double res = 0.0, r;
+  int a;
+  for (a = 0; a < w->m; ++a)
+    {
+      r = fabs (w->f[w->cat[a]]) / w->d[a] / (fabs (y[w->cat[a]]) + floor);
+      if (r > res)
+	res = r;
+    }
+  return res;
+}
+
+// w->dy = w->a \ w->r, destroying w->a
+static int
+solve (struct eq_work *w)
+{
+  gsl_matrix_view a = gsl_matrix_view_array (w->a, w->m, w->m);
+  gsl_vector_view r = gsl_vector_view_array (w->r, w->m);
+  gsl_vector_view dy = gsl_vector_view_array (w->dy, w->m);
+  gsl_permutation perm = { w->m, w->perm };
+  int signum, i;
+
+  gsl_linalg_LU_decomp (&a.matrix, &perm, &signum);
+  // LU_solve would call the GSL error handler, which aborts by default
+  for (i = 0; i < w->m; ++i)
+    if (w->a[i * w->m + i] == 0.0)
+      return GSL_ESING;
+  gsl_linalg_LU_solve (&a.matrix, &perm, &r.vector, &dy.vector);
+  return GSL_SUCCESS;
+}
+
+/* Newton on the catalysts, starting from y (with w evaluated there).
+ * Returns GSL_CONTINUE, with y and w as they were, if it stalls. */
+static int
+newton (struct eq_work *w, double y[], struct equil_stats *stats)
+{
+  const int n = w->n, m = w->m;
+  const double floor = EQ_FLOOR * w->y_cno;
+  double y_try[n], res = residual (w, y), res_try, sum, worst;
+  int it, a, b, c, status;
+
+  for (it = 0; it < EQ_MAX_NEWTON; ++it)
+    {
+      // the constraint replaces the balance of the most abundant one
+      c = 0;
+      sum = 0.0;
+      for (a = 0; a < m; ++a)
+	{
+	  sum += y[w->cat[a]];
+	  if (y[w->cat[a]] > y[w->cat[c]])
+	    c = a;
+	}
+      for (a = 0; a < m; ++a)
+	{
+	  if (a == c)
+	    {
+	      for (b = 0; b < m; ++b)
+		w->a[a * m + b] = 1.0;
+	      w->r[a] = w->y_cno - sum;
+	      continue;
+	    }
+	  for (b = 0; b < m; ++b)
+	    w->a[a * m + b] = w->dfdy[w->cat[a] * n + w->cat[b]] / w->d[a];
+	  w->r[a] = -w->f[w->cat[a]] / w->d[a];
+	}
+      status = solve (w);
+      if (status != GSL_SUCCESS)
+	return status;
+      ++stats->n_newton;
+
+      memcpy (y_try, y, n * sizeof (double));
+      worst = 0.0;
+      for (a = 0; a < m; ++a)
+	{
+	  y_try[w->cat[a]] += w->dy[a];
+	  if (fabs (w->dy[a]) / (fabs (y_try[w->cat[a]]) + floor) > worst)
+	    worst = fabs (w->dy[a]) / (fabs (y_try[w->cat[a]]) + floor);
+	}
+      status = eval (w, y_try);
+      res_try = residual (w, y_try);
+      if (status != GSL_SUCCESS || (res_try > res && worst > EQ_TOL))
+	{
+	  // put w back the way it was for whoever tries next
+	  eval (w, y);
+	  return GSL_CONTINUE;
+	}
+      memcpy (y, y_try, n * sizeof (double));
+      res = res_try;
+      if (worst <= EQ_TOL)
+	return GSL_SUCCESS;
+    }
+  return GSL_EMAXITER;
+}
+
+/* pseudo-transient continuation from y (with w evaluated there) until
+ * dtau is long enough for Newton to take over */
+static int
+ptc (struct eq_work *w, double y[], struct equil_stats *stats)
+{
+  const int n = w->n, m = w->m;
+  double res = residual (w, y), res_new, d_min, d_max, dtau, growth;
+  int k, a, b, status;
+
+  d_min = d_max = w->d[0];
+  for (a = 1; a < m; ++a)
+    {
+      if (w->d[a] < d_min)
+	d_min = w->d[a];
+      if (w->d[a] > d_max)
+	d_max = w->d[a];
+    }
+  // start at the fastest time scale there is
+  dtau = 1.0 / d_max;
+
+  for (k = 0; k < EQ_MAX_PTC; ++k)
+    {
+      if (dtau * d_min > EQ_PTC_DONE)
+	return GSL_SUCCESS;
+      for (a = 0; a < m; ++a)
+	{
+	  for (b = 0; b < m; ++b)
+	    w->a[a * m + b] = -w->dfdy[w->cat[a] * n + w->cat[b]] / w->d[a];
+	  w->a[a * m + a] += 1.0 / (dtau * w->d[a]);
+	  w->r[a] = w->f[w->cat[a]] / w->d[a];
+	}
+      status = solve (w);
+      if (status != GSL_SUCCESS)
+	return status;
+      ++stats->n_ptc;
+      for (a = 0; a < m; ++a)
+	{
+	  y[w->cat[a]] += w->dy[a];
+	  if (y[w->cat[a]] < 0.0)
+	    y[w->cat[a]] = 0.0;
+	}
+      status = eval (w, y);
+      if (status != GSL_SUCCESS)
+	return status;
+      res_new = residual (w, y);
+      /* backward Euler doesn't blow up however long dtau is, so there's
+       * no need to back off when the residual goes up for a while */
+      growth = res_new > 0.0 ? res / res_new : EQ_PTC_MAX_GROWTH;
+      if (growth > EQ_PTC_MAX_GROWTH)
+	growth = EQ_PTC_MAX_GROWTH;
+      if (growth < EQ_PTC_MIN_GROWTH)
+	growth = EQ_PTC_MIN_GROWTH;
+      dtau *= growth;
+      res = res_new;
+    }
+  return GSL_EMAXITER;
+}
+
+/* Replaces the catalyst abundances in y (mol/cm^3, everything heavier
+ * than He4) by their equilibrium values at params->T and params->rho,
+ * with the same total and the H1 and He4 in y. T and rho have to be
+ * constant (no trajectory). Returns GSL_SUCCESS, GSL_EINVAL (no
+ * catalysts, or a trajectory), GSL_ESING (some catalyst isn't being
+ * destroyed, so nothing balances), or GSL_EMAXITER/GSL_ENOPROG if the
+ * iterations didn't get there; y is only changed on success. stats can
+ * be NULL. */
+int
+equilibrium_solve (struct param *params, double y[],
+		   struct equil_stats *stats)
+{
+  const struct network *net = params->net;
+  const int n = net->n_iso;
+  struct equil_stats dummy;
+  struct eq_work w;
+  int cat[n], m = 0, i, status;
+  double f[n], dfdy[n * n], dfdt[n], d[n], a[n * n], r[n], dy[n], y_eq[n];
+  size_t perm[n];
+
+  if (stats == NULL)
+    stats = &dummy;
+  stats->n_newton = 0;
+  stats->n_ptc = 0;
+  stats->residual = 0.0;
+  if (params->traj != NULL)
+    return GSL_EINVAL;
+
+  w.y_cno = 0.0;
+  for (i = 0; i < n; ++i)
+    if (net->iso[i].Z > 2)
+      {
+	cat[m++] = i;
+	w.y_cno += y[i];
+      }
+  if (m == 0 || !(w.y_cno > 0.0))
+    return GSL_EINVAL;
+  w.params = params;
+  w.n = n;
+  w.m = m;
+  w.cat = cat;
+  w.f = f;
+  w.dfdy = dfdy;
+  w.dfdt = dfdt;
+  w.d = d;
+  w.a = a;
+  w.r = r;
+  w.dy = dy;
+  w.perm = perm;
+
+  memcpy (y_eq, y, n * sizeof (double));
+  status = eval (&w, y_eq);
+  if (status == GSL_SUCCESS)
+    status = newton (&w, y_eq, stats);
+  if (status == GSL_CONTINUE)
+    {
+      status = ptc (&w, y_eq, stats);
+      if (status == GSL_SUCCESS)
+	status = newton (&w, y_eq, stats);
+      if (status == GSL_CONTINUE)
+	status = GSL_ENOPROG;
+    }
+  if (status != GSL_SUCCESS)
+    return status;
+
+  /* the trace isotopes can come out a rounding error below zero; as in
+   * main.c, anything that small is nothing */
+  for (i = 0; i < m; ++i)
+    if (y_eq[cat[i]] < EQ_FLOOR * w.y_cno)
+      y_eq[cat[i]] = 0.0;
+  eval (&w, y_eq);
+  stats->residual = residual (&w, y_eq);
+  memcpy (y, y_eq, n * sizeof (double));
+  return GSL_SUCCESS;
+}
@@ -0,0 +1,19 @@
+#ifndef EQUILIBRIUM_H
+#define EQUILIBRIUM_H
+
+/* The abundances the CNO cycles settle into at a given T and rho, found
+ * directly instead of by integrating for 1e22 sec. See equilibrium.c. */
+
+struct param;
+
+struct equil_stats
+{
+  int n_newton;			// Newton iterations
+  int n_ptc;			// pseudo-transient steps, if Newton needed help
+  double residual;		// of the final abundances, see equilibrium.c
+};
+
+int equilibrium_solve (struct param *params, double y[],
+		       struct equil_stats *stats);
+
+#endif
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <float.h>
+#include <gsl/gsl_errno.h>
+#include "event.h"
+#include "network.h"
+#include "schedule.h"
+
+/* Nobody wants the abundances at t = 1e22 sec; they want to know when
+ * the H1 runs out, or when the N14 has taken over the CNO nuclei, and
+ * after that the integrator is just burning time. So a run (or every
+ * point of a sweep) can be given events, each a threshold on
+ * something worked out from the abundances:
+ *
+ *   h1 < 1e-3          the mass fraction of H1 drops below 1e-3
+ *   n14/c12 > 100      the number ratio Y(N14)/Y(C12) rises above 100
+ *
+ * An event file has one per line, "#" starts a comment:
+ *
+ *   stop    h1 < 1e-3
+ *   record  n14/c12 > 100
+ *   record  c12/c13 < 3.5
+ *
+ * "stop" ends the run at the event, "record" just writes the
+ * abundances there (to events.dat, see main.c) and carries on. An
+ * event happens when its threshold gets crossed in the direction of
+ * the "<" or ">", every time it does; a condition that already holds
+ * at the start doesn't count until it stops holding and starts again.
+ *
+ * After every step we look at the ends of the step for a sign change,
+ * which costs a few multiplies. Only when there is one do we find out
+ * where inside the step it happened, on the same cubic Hermite
+ * interpolant the output times use (dense_hermite, schedule.c), by
+ * the Illinois version of regula falsi: a few evaluations of a cubic
+ * get the time to rounding, with no extra RHS calls beyond the two at
+ * the ends of the step. Something that goes over the threshold and
+ * back within one step isn't seen, which is the price of not making
+ * the stepper check every event itself.
+ *
+ * A ratio is compared as Y(a) - value * Y(b), which has the same sign
+ * as Y(a)/Y(b) - value as long as Y(b) > 0, and doesn't blow up when
+ * an isotope that's died out gets set to zero. */
+
+// give up refining an event time after this many iterations
+#define EVENT_MAX_ITER 100
+
+/* the function whose sign change is the event, from the abundances of
+ * a and b */
+static double
+event_g (const struct event *ev, double ya, double yb, const double to_x[])
+{
+  if (ev->b < 0)
+    return ya * to_x[ev->a] - ev->value;
+  return ya - ev->value * yb;
+}
+
+static double
+event_g_at (const struct event *ev, const double y[], const double to_x[])
+{
+  return event_g (ev, y[ev->a], ev->b < 0 ? 0.0 : y[ev->b], to_x);
+}
+
+// g is on the far side of the threshold
+static int
+event_past (const struct event *ev, double g)
+{
+  return ev->dir > 0 ? g > 0.0 : g < 0.0;
+}
+
+/* Adds an event to list, from an expression like "h1 < 1e-3" or
+ * "n14/c12 > 100" on the isotopes of net, stopping the run if
+ * terminal. Returns GSL_EINVAL if it doesn't parse or names an
+ * isotope that isn't in the network, GSL_ENOMEM if the list is full
+ * (EVENT_MAX). */
+int
+event_parse (struct event_list *list, const struct network *net,
+	     int terminal, const char *expr)
+{
+  char lhs[64], name_a[16], name_b[16] = "";
+  const char *op = strpbrk (expr, "<>"), *rest;
+  char *end;
+  struct event ev;
+  int used;
+
+  if (op == NULL || op - expr >= (long) sizeof (lhs))
+    return GSL_EINVAL;
+  memcpy (lhs, expr, op - expr);
+  lhs[op - expr] = '\0';
+
+  // "a" or "a/b", with or without spaces
+  if (sscanf (lhs, " %15[^/ \t]%n", name_a, &used) != 1)
+    return GSL_EINVAL;
+  rest = lhs + used;
+  while (isspace ((unsigned char) *rest))
+    ++rest;
+  if (*rest == '/')
+    {
+      if (sscanf (rest + 1, " %15[^/ \t]%n", name_b, &used) != 1)
+	return GSL_EINVAL;
+      rest += 1 + used;
+      while (isspace ((unsigned char) *rest))
+	++rest;
+    }
+  if (*rest != '\0')
+    return GSL_EINVAL;
+
+  ev.value = strtod (op + 1, &end);
+  if (end == op + 1 || !isfinite (ev.value))
+    return GSL_EINVAL;
+  while (isspace ((unsigned char) *end))
+    ++end;
+  if (*end != '\0')
+    return GSL_EINVAL;
+
+  ev.terminal = terminal;
+  ev.dir = (*op == '>') ? 1 : -1;
+  ev.a = network_find_isotope (net, name_a);
+  ev.b = name_b[0] != '\0' ? network_find_isotope (net, name_b) : -1;
+  if (ev.a < 0 || (name_b[0] != '\0' && ev.b < 0))
+    return GSL_EINVAL;
+  if (ev.b < 0)
+    snprintf (ev.text, sizeof (ev.text), "%s%c%.3e", name_a, *op,
+	      ev.value);
+  else
+    snprintf (ev.text, sizeof (ev.text), "%s/%s%c%.3e", name_a, name_b,
+	      *op, ev.value);
+
+  if (list->n == EVENT_MAX)
+    return GSL_ENOMEM;
+  list->ev[list->n++] = ev;
+  return GSL_SUCCESS;
+}
+
+/* Adds the events in the file at path (see above) to list. Returns
+ * GSL_EFAILED if it can't be read, or GSL_EINVAL, with a message, at
+ * the first line that doesn't make sense. */
+int
+event_read (struct event_list *list, const struct network *net,
+	    const char *path)
+{
+  FILE *fp = fopen (path, "r");
+  char line[256];
+  int line_no = 0;
+
+  if (fp == NULL)
+    return GSL_EFAILED;
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      char key[16];
+      int used, bad = 0;
+      char *hash = strchr (line, '#');
+      char *nl = strchr (line, '\n');
+      ++line_no;
+      if (hash != NULL)
+	*hash = '\0';
+      if (nl != NULL)
+	*nl = '\0';
+      if (sscanf (line, "%15s%n", key, &used) != 1)
+	continue;		// blank or comment
+
+      if (strcmp (key, "stop") == 0)
+	bad = event_parse (list, net, 1, line + used);
+      else if (strcmp (key, "record") == 0)
+	bad = event_parse (list, net, 0, line + used);
+      else
+	bad = 1;
+
+      if (bad)
+	{
+	  fprintf (stderr, "%s:%d: %s\n", path, line_no,
+		   bad == GSL_ENOMEM ? "too many events"
+		   : "can't make sense of this line");
+	  fclose (fp);
+	  return GSL_EINVAL;
+	}
+    }
+  fclose (fp);
+  return GSL_SUCCESS;
+}
+
+/* Whether any event of list happened in the step from y0 to y1 (mol/cm^3,
+ * with to_x turning them into mass fractions), going by the ends of
+ * the step. Cheap enough for every step. */
+int
+event_crossed (const struct event_list *list, const double y0[],
+	       const double y1[], const double to_x[])
+{
+  int k;
+  for (k = 0; k < list->n; ++k)
+    {
+      const struct event *ev = &list->ev[k];
+      if (!event_past (ev, event_g_at (ev, y0, to_x))
+	  && event_past (ev, event_g_at (ev, y1, to_x)))
+	return 1;
+    }
+  return 0;
+}
+
+// the event's g at t inside the step, on the Hermite interpolant
+static double
+event_g_interp (const struct event *ev, double t0, const double y0[],
+		const double f0[], double t1, const double y1[],
+		const double f1[], const double to_x[], double t)
+{
+  double ya, yb = 0.0;
+  dense_hermite (1, t0, &y0[ev->a], &f0[ev->a], t1, &y1[ev->a], &f1[ev->a],
+		 t, &ya);
+  if (ev->b >= 0)
+    dense_hermite (1, t0, &y0[ev->b], &f0[ev->b], t1, &y1[ev->b],
+		   &f1[ev->b], t, &yb);
+  return event_g (ev, ya, yb, to_x);
+}
+
+/* Finds every event of list that happened in the step from (t0, y0) to
+ * (t1, y1), with f0 and f1 the derivatives there: the number of them
+ * is returned, and which[] and t_hit[] get their indices in list and
+ * the times they happened, earliest first. The time is the first one
+ * the interpolant is found past the threshold, to within rounding. */
+int
+event_locate (const struct event_list *list, double t0, const double y0[],
+	      const double f0[], double t1, const double y1[],
+	      const double f1[], const double to_x[], int which[],
+	      double t_hit[])
+{
+  int k, j, n_hit = 0, iter;
+
+  for (k = 0; k < list->n; ++k)
+    {
+      const struct event *ev = &list->ev[k];
+      double t_lo = t0, t_hi = t1;
+      double g_lo = event_g_at (ev, y0, to_x);
+      double g_hi = event_g_at (ev, y1, to_x);
+      int side = 0;
+      if (event_past (ev, g_lo) || !event_past (ev, g_hi))
+	continue;
+
+      /* regula falsi keeps [t_lo, t_hi] around the crossing; when the
+       * same end moves twice in a row, halving g at the other end
+       * (Illinois) stops it from crawling in from one side */
+      for (iter = 0; iter < EVENT_MAX_ITER
+	   && t_hi - t_lo > 4.0 * DBL_EPSILON * fabs (t_hi); ++iter)
+	{
+	  double t = t_lo - g_lo * (t_hi - t_lo) / (g_hi - g_lo);
+	  if (!(t > t_lo && t < t_hi))
+	    t = 0.5 * (t_lo + t_hi);
+	  double g = event_g_interp (ev, t0, y0, f0, t1, y1, f1, to_x, t);
+	  if (event_past (ev, g))
+	    {
+	      t_hi = t;
+	      g_hi = g;
+	      if (side == 1)
+		g_lo *= 0.5;
+	      side = 1;
+	    }
+	  else
+	    {
+	      t_lo = t;
+	      g_lo = g;
+	      if (side == -1)
+		g_hi *= 0.5;
+	      side = -1;
+	    }
+	}
+
+      // in time order, there's only ever a handful
+      for (j = n_hit; j > 0 && t_hit[j - 1] > t_hi; --j)
+	{
+	  t_hit[j] = t_hit[j - 1];
+	  which[j] = which[j - 1];
+	}
+      t_hit[j] = t_hi;
+      which[j] = k;
+      ++n_hit;
+    }
+  return n_hit;
+}
@@ -0,0 +1,42 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+/* Events: the times at which some function of the abundances crosses a
+ * threshold, e.g. "X(H1) < 1e-3", found inside the step that crossed
+ * it instead of wherever the stepper happened to land. An event either
+ * gets recorded or stops the run there. See event.c. */
+
+struct network;
+
+// at most this many events in one run (or sweep)
+#define EVENT_MAX 16
+// room for an event's label, e.g. "n14/c12>1.000e+02"
+#define EVENT_TEXT_LEN 48
+
+struct event
+{
+  int terminal;			// "stop", not just "record"
+  int a, b;			// X(a) if b < 0, else Y(a)/Y(b)
+  int dir;			// +1: crossing value going up, -1: down
+  double value;
+  char text[EVENT_TEXT_LEN];	// no spaces, so it's one output column
+};
+
+struct event_list
+{
+  int n;
+  struct event ev[EVENT_MAX];
+};
+
+int event_parse (struct event_list *list, const struct network *net,
+		 int terminal, const char *expr);
+int event_read (struct event_list *list, const struct network *net,
+		const char *path);
+int event_crossed (const struct event_list *list, const double y0[],
+		   const double y1[], const double to_x[]);
+int event_locate (const struct event_list *list, double t0,
+		  const double y0[], const double f0[], double t1,
+		  const double y1[], const double f1[], const double to_x[],
+		  int which[], double t_hit[]);
+
+#endif
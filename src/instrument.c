@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gsl/gsl_errno.h>
+#include "instrument.h"
+
+/* See instrument.h. Everything here is only called when a run asked
+ * for instrumentation, so none of it needs to be fast except
+ * instr_now() and instr_step(). */
+
+static const char *const phase_name[N_PHASES] = {
+  "rates", "rhs", "jacobian", "linalg", "output"
+};
+
+double
+instr_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/* cap_hist is how many steps of history to keep (0 for none). Returns
+ * GSL_ENOMEM if that much history doesn't fit. */
+int
+instr_init (struct instr *in, int cap_hist)
+{
+  memset (in, 0, sizeof (*in));
+  in->cap_hist = cap_hist > 0 ? cap_hist : 0;
+  if (in->cap_hist > 0)
+    {
+      in->hist = malloc (in->cap_hist * sizeof (struct instr_step));
+      if (in->hist == NULL)
+	return GSL_ENOMEM;
+    }
+  instr_reset (in);
+  return GSL_SUCCESS;
+}
+
+// zero everything for the next run, keeping the history buffer
+void
+instr_reset (struct instr *in)
+{
+  int p;
+  in->n_accepted = in->n_rejected = 0;
+  in->n_rhs = in->n_jac = 0;
+  in->n_lu_factor = in->n_lu_solve = 0;
+  for (p = 0; p < N_PHASES; ++p)
+    in->time[p] = 0.0;
+  in->n_hist = 0;
+  in->stride = 1;
+  in->skip = 0;
+  in->t_start = instr_now ();
+}
+
+void
+instr_free (struct instr *in)
+{
+  free (in->hist);
+  in->hist = NULL;
+  in->cap_hist = in->n_hist = 0;
+}
+
+// record an accepted step of size h that ended at t
+void
+instr_step (struct instr *in, double t, double h)
+{
+  int k;
+  ++in->n_accepted;
+  if (in->cap_hist == 0 || ++in->skip < in->stride)
+    return;
+  in->skip = 0;
+  if (in->n_hist == in->cap_hist)
+    {
+      for (k = 0; 2 * k + 1 < in->n_hist; ++k)
+	in->hist[k] = in->hist[2 * k + 1];
+      in->n_hist = k;
+      in->stride *= 2;
+    }
+  in->hist[in->n_hist].t = t;
+  in->hist[in->n_hist].h = h;
+  ++in->n_hist;
+}
+
+/* One JSON object for the whole run: what was integrated, how it
+ * ended, the counters, where the time went and the step sizes. */
+void
+instr_write_json (const struct instr *in, FILE * fp, const char *stepper,
+		  double T, double rho, double t_end, int status)
+{
+  int p, k;
+  double accounted = 0.0;
+  const double wall = instr_now () - in->t_start;
+
+  fprintf (fp, "{\n");
+  fprintf (fp, "  \"stepper\": \"%s\",\n", stepper);
+  fprintf (fp, "  \"T\": %.17g,\n  \"rho\": %.17g,\n", T, rho);
+  fprintf (fp, "  \"t_end\": %.17g,\n", t_end);
+  fprintf (fp, "  \"status\": %d,\n  \"status_text\": \"%s\",\n", status,
+	   status == GSL_SUCCESS ? "success" : gsl_strerror (status));
+  fprintf (fp, "  \"steps_accepted\": %ld,\n", in->n_accepted);
+  fprintf (fp, "  \"steps_rejected\": %ld,\n", in->n_rejected);
+  fprintf (fp, "  \"rhs_calls\": %ld,\n", in->n_rhs);
+  fprintf (fp, "  \"jacobian_calls\": %ld,\n", in->n_jac);
+  if (in->lu_counted)
+    {
+      fprintf (fp, "  \"lu_factorizations\": %ld,\n", in->n_lu_factor);
+      fprintf (fp, "  \"lu_solves\": %ld,\n", in->n_lu_solve);
+    }
+  else
+    fprintf (fp, "  \"lu_factorizations\": null,\n"
+	     "  \"lu_solves\": null,\n");
+  fprintf (fp, "  \"wall_time\": {\n");
+  for (p = 0; p < N_PHASES; ++p)
+    {
+      // GSL's steppers' linear algebra ends up in "other"
+      if (p == PHASE_LINALG && !in->lu_counted)
+	fprintf (fp, "    \"%s\": null,\n", phase_name[p]);
+      else
+	fprintf (fp, "    \"%s\": %.6e,\n", phase_name[p], in->time[p]);
+      accounted += in->time[p];
+    }
+  // the stepper's own arithmetic, GSL's bookkeeping, ...
+  fprintf (fp, "    \"other\": %.6e,\n", wall - accounted);
+  fprintf (fp, "    \"total\": %.6e\n  },\n", wall);
+  fprintf (fp, "  \"history_stride\": %ld,\n", in->stride);
+  fprintf (fp, "  \"step_history\": [");
+  for (k = 0; k < in->n_hist; ++k)
+    fprintf (fp, "%s\n    [%.10e, %.10e]", k == 0 ? "" : ",", in->hist[k].t,
+	     in->hist[k].h);
+  fprintf (fp, "%s]\n}\n", in->n_hist > 0 ? "\n  " : "");
+}
@@ -0,0 +1,87 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdio.h>
+
+/* Counters and phase timers for one integration, so that when a run
+ * takes far longer than it should there's something to look at. The
+ * hooks are the INSTR_* macros below, sprinkled over ode_rhs.c,
+ * jacobian.c, step_sbsimp.c and main.c. They do something only if the
+ * struct param being passed around has an instr (otherwise it's one
+ * pointer test), and they compile to nothing at all unless
+ * NN_INSTRUMENT is defined (cmake -DINSTRUMENT=OFF to turn it off). */
+
+enum instr_phase
+{
+  PHASE_RATES,			// rate_state_update()
+  PHASE_RHS,			// network_rhs()
+  PHASE_JACOBIAN,		// network_jacobian*() and dfdt
+  PHASE_LINALG,			// LU factorizations and solves
+  PHASE_OUTPUT,			// writing rows
+  N_PHASES
+};
+
+struct instr_step
+{
+  double t;			// time at the end of the step
+  double h;			// size of the step just taken
+};
+
+struct instr
+{
+  long n_accepted;		// steps
+  long n_rejected;
+  long n_rhs;			// ode_rhs() calls
+  long n_jac;			// jacobian() + jacobian_sparse() calls
+  /* LU work: only the native steppers count it and time it (as
+   * PHASE_LINALG). GSL's do theirs out of sight, so for them it's part
+   * of "other", and the counters are written as null, not 0 */
+  int lu_counted;
+  long n_lu_factor;
+  long n_lu_solve;
+  double time[N_PHASES];	// wall time in each phase, sec
+  double t_start;		// wall clock when instr_init() was called
+  /* step size history. when it fills up, every other entry is thrown
+   * away and from then on only every stride-th step is kept, so long
+   * runs get a coarser but complete picture */
+  struct instr_step *hist;
+  int n_hist, cap_hist;
+  long stride, skip;
+};
+
+double instr_now (void);
+int instr_init (struct instr *in, int cap_hist);
+void instr_reset (struct instr *in);
+void instr_free (struct instr *in);
+void instr_step (struct instr *in, double t, double h);
+void instr_write_json (const struct instr *in, FILE * fp,
+		       const char *stepper, double T, double rho,
+		       double t_end, int status);
+
+#ifdef NN_INSTRUMENT
+#define INSTR_COUNT(in, field) \
+  do { if ((in) != NULL) ++(in)->field; } while (0)
+#define INSTR_ADD(in, field, n) \
+  do { if ((in) != NULL) (in)->field += (n); } while (0)
+// start a timer: declares var
+#define INSTR_START(in, var) \
+  double var = ((in) != NULL) ? instr_now () : 0.0
+// charge the time since var to phase, and restart var's clock at now
+#define INSTR_LAP(in, phase, var) \
+  do { if ((in) != NULL) { const double instr_t_ = instr_now (); \
+      (in)->time[phase] += instr_t_ - var; var = instr_t_; } } while (0)
+#define INSTR_STOP(in, phase, var) \
+  do { if ((in) != NULL) (in)->time[phase] += instr_now () - var; } while (0)
+#define INSTR_STEP(in, t, h) \
+  do { if ((in) != NULL) instr_step (in, t, h); } while (0)
+#else
+// nothing left but a (void) so there are no unused variable warnings
+#define INSTR_COUNT(in, field) ((void) (in))
+#define INSTR_ADD(in, field, n) ((void) (in))
+#define INSTR_START(in, var) ((void) (in))
+#define INSTR_LAP(in, phase, var) ((void) (in))
+#define INSTR_STOP(in, phase, var) ((void) (in))
+#define INSTR_STEP(in, t, h) ((void) (in))
+#endif
+
+#endif
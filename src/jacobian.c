@@ -1,12 +1,76 @@
 #include <gsl/gsl_errno.h>
+#include "energy.h"
+#include "network.h"
 #include "rate_coeffs.h"
 #include "param.h"
+#include "trajectory.h"
+#include "instrument.h"
 
-/* Create sparse Jacobian matrix. For this CNO network the matrix is 72%
- * sparse. A sparse solver would be in order here; I tried SuperLU but it's
- * impossible to use and can't do simple things like adding two matrices
- * together. For small jacobians (this only has 13^2 = 169 elements) the
- * performance/memory difference between sparse and full solvers is small. */
+/* Create Jacobian matrix. For the CNO network the matrix is 72%
+ * sparse. I tried SuperLU but it's impossible to use and can't do simple
+ * things like adding two matrices together, so there's now a small
+ * sparse LU solver of our own (sparse_lu.c). GSL's bsimp still wants
+ * the full matrix from jacobian(); the sparse stepper (step_sbsimp.c)
+ * uses jacobian_sparse() instead. For small jacobians (CNO only has
+ * 13^2 = 169 elements) the difference is small, but it matters a lot
+ * for bigger networks.
+ *
+ * The Jacobian normally comes from the fill list network_finalize()
+ * builds (network_jacobian*()). With params->jac_ad it's differentiated
+ * out of the RHS instead (network_ad.c), which is slower but can't
+ * disagree with the RHS; the two should match to the last bit.
+ *
+ * If the temperature is an unknown too (y[n_iso], T9), it gets a full row
+ * and column on top of the isotopes' block, from energy_jacobian(). */
+
+/* Evaluates T and rho at t if we're on a trajectory, and fills in
+ * dfdt, the explicit time dependence of the RHS. With constant T and
+ * rho there isn't any (I ignore the time dependence in the beta-decay
+ * rates; they're so insanely fast compared to the 2-body rates that it
+ * can't make any difference). On a trajectory the rates change with
+ * T(t), and since the RHS is linear in the rates,
+ *
+ *   df/dt = RHS evaluated with dlambda/dt in place of lambda
+ *
+ * plus the compression term y dln(rho)/dt, whose explicit time
+ * derivative is zero because dln(rho)/dt is constant between samples.
+ * Returns the rates and sets *dlnrho_dt for the diagonal. */
+static const double *
+time_dependence (struct param *params, double t, const double y[],
+		 double dfdt[], double *dlnrho_dt)
+{
+  double dlnT_dt = 0.0;
+  unsigned int i;
+  int k;
+
+  INSTR_COUNT (params->instr, n_jac);
+  INSTR_START (params->instr, t0);
+  *dlnrho_dt = 0.0;
+  if (params->traj != NULL)
+    trajectory_eval (params->traj, &params->traj_pos, t, &params->T,
+		     &params->rho, &dlnT_dt, dlnrho_dt);
+  else if (params->net->temperature)
+    params->T = y[params->n_iso] * ENERGY_T_UNIT;
+  // rates are only recomputed if T or rho changed since the last call
+  const double *lambda =
+    rate_state_update (&params->rates, params->T, params->rho);
+  INSTR_LAP (params->instr, PHASE_RATES, t0);
+
+  if (dlnT_dt == 0.0)
+    {
+      for (i = 0; i < params->net->n_var; ++i)
+	dfdt[i] = 0.0;
+      INSTR_STOP (params->instr, PHASE_JACOBIAN, t0);
+      return lambda;
+    }
+  const double *dlambda_dT = rate_state_dT (&params->rates);
+  double dlambda_dt[params->rates.n_rates];
+  for (k = 0; k < params->rates.n_rates; ++k)
+    dlambda_dt[k] = dlambda_dT[k] * params->T * dlnT_dt;
+  network_rhs (params->net, dlambda_dt, y, dfdt);
+  INSTR_STOP (params->instr, PHASE_JACOBIAN, t0);
+  return lambda;
+}
 
 /* the arguments of this function are:
  * t -> time (independent variable)
@@ -15,106 +79,120 @@
  * dfdy -> Jacobian matrix dfdt -> partial derivative of RHS of each ODE w.r.t.
  *         time
  * params -> any arguments that the Jacobian matrix elements may need
- * besides the independent variable (time). In this case the only auxiliary
- * parameter is temperature */
+ * besides the independent variable (time). In this case that's the network,
+ * temperature and density, and the rates evaluated at them */
 int
 jacobian (double t, const double y[], double *dfdy, double dfdt[],
 	  void *params_in)
 {
   // loops
-  unsigned int i;
-  struct param params = *(struct param *) params_in;
-  const int n_iso = params.n_iso;
-  const double T = params.T;
+  unsigned int i, j;
+  struct param *params = (struct param *) params_in;
+  const int n_iso = params->n_iso, n_var = params->net->n_var;
+  double dlnrho_dt;
+  const double *lambda = time_dependence (params, t, y, dfdt, &dlnrho_dt);
+  INSTR_START (params->instr, t0);
+  /* the isotopes' block goes in dfdy as it is, or with the temperature
+   * in a matrix of its own, to be spread out into the bigger one */
+  double block_T[n_var > n_iso ? n_iso * n_iso : 1];
+  double *block = n_var > n_iso ? block_T : dfdy;
+
+  /* GSL expects the Jacobian matrix to be stored in row-major order in a 1-D
+   * vector, so J[i][j] = dfdy[i*DIM + j]. */
+  if (params->jac_ad)
+    {
+      // the AD kernel only does the sparse pattern, so spread it out
+      const struct network *net = params->net;
+      double jac_val[net->jac_nnz];
+      int p;
+      network_jacobian_ad (net, lambda, y, NULL, jac_val);
+      for (i = 0; i < n_iso * n_iso; ++i)
+	block[i] = 0.0;
+      for (i = 0; i < n_iso; ++i)
+	for (p = net->jac_row_ptr[i]; p < net->jac_row_ptr[i + 1]; ++p)
+	  if (net->jac_col[p] < n_iso)
+	    block[i * n_iso + net->jac_col[p]] = jac_val[p];
+    }
+  else
+    network_jacobian (params->net, lambda, y, block);
+  if (dlnrho_dt != 0.0)
+    for (i = 0; i < n_iso; ++i)
+      block[i * n_iso + i] += dlnrho_dt;
+  if (n_var > n_iso)
+    {
+      double col[n_iso];
+      for (i = 0; i < n_iso; ++i)
+	for (j = 0; j < n_iso; ++j)
+	  dfdy[i * n_var + j] = block[i * n_iso + j];
+      energy_jacobian (params, lambda, y, col, &dfdy[n_iso * n_var]);
+      for (i = 0; i < n_iso; ++i)
+	dfdy[i * n_var + n_iso] = col[i];
+    }
+  INSTR_STOP (params->instr, PHASE_JACOBIAN, t0);
+  return GSL_SUCCESS;
+}
+
+/* Same as jacobian() but only the nonzero elements, in the CSR pattern
+ * stored in the network (params->net->jac_row_ptr, jac_col). This is
+ * what the sparse stepper (step_sbsimp.c) uses. */
+int
+jacobian_sparse (double t, const double y[], double jac_val[], double dfdt[],
+		 void *params_in)
+{
+  int i, p;
+  struct param *params = (struct param *) params_in;
+  const struct network *net = params->net;
+  double dlnrho_dt;
+  const double *lambda = time_dependence (params, t, y, dfdt, &dlnrho_dt);
+  INSTR_START (params->instr, t0);
 
-  /* for now I'll ignore the time dependence in the beta-decay rates,
-   * in which case the whole RHS has no explicit time dependence and
-   * these derivatives are all zero. this shouldn't make any
-   * difference since the rates are so insanely fast compared to the
-   * 2-body rates. */
-  for (i = 0; i < params.n_iso; ++i)
+  if (params->jac_ad)
+    network_jacobian_ad (net, lambda, y, NULL, jac_val);
+  else
+    network_jacobian_sparse (net, lambda, y, jac_val);
+  // the pattern always has the diagonal
+  if (dlnrho_dt != 0.0)
+    for (i = 0; i < net->n_iso; ++i)
+      for (p = net->jac_row_ptr[i]; p < net->jac_row_ptr[i + 1]; ++p)
+	if (net->jac_col[p] == i)
+	  jac_val[p] += dlnrho_dt;
+  /* the temperature's column is the last entry of every row, and its
+   * row, the last one, is full */
+  if (net->temperature)
     {
-      dfdt[i] = 0.0;
+      double col[net->n_iso];
+      energy_jacobian (params, lambda, y, col,
+		       &jac_val[net->jac_row_ptr[net->n_iso]]);
+      for (i = 0; i < net->n_iso; ++i)
+	jac_val[net->jac_row_ptr[i + 1] - 1] = col[i];
     }
+  INSTR_STOP (params->instr, PHASE_JACOBIAN, t0);
+  return GSL_SUCCESS;
+}
 
-  /* GSL expects the Jacobian matrix to be stored in row-major order in a 1-D
-   * vector, so J[i][j] = dfdy[i*DIM + j]. Hence the weird notation here. */
-  dfdy[1 * n_iso + 1] = -lambda_ijT (1, 12, T) * y[12];
-  dfdy[2 * n_iso + 1] = lambda_ijT (1, 12, T) * y[12];
-  dfdy[12 * n_iso + 1] = -lambda_ijT (2, 12, T) * y[12];
-  dfdy[2 * n_iso + 2] = -lambda_ij_beta (2);
-  dfdy[3 * n_iso + 2] = lambda_ij_beta (2);
-  dfdy[3 * n_iso + 3] = -lambda_ijT (3, 12, T) * y[12];
-  dfdy[4 * n_iso + 3] = lambda_ijT (3, 12, T) * y[12];
-  dfdy[12 * n_iso + 3] = -lambda_ijT (3, 12, T) * y[12];
-  dfdy[4 * n_iso + 4] = -lambda_ijT (4, 12, T) * y[12];
-  dfdy[5 * n_iso + 4] = lambda_ijT (4, 12, T) * y[12];
-  dfdy[12 * n_iso + 4] = -lambda_ijT (4, 12, T) * y[12];
-  dfdy[5 * n_iso + 5] = -lambda_ij_beta (5);
-  dfdy[6 * n_iso + 5] = lambda_ij_beta (5);
-  dfdy[0 * n_iso + 6] = lambda_ijT_avg (6, 12, T, 'a') * y[12];
-  dfdy[1 * n_iso + 6] = lambda_ijT (6, 12, T) * y[12];
-  dfdy[6 * n_iso + 6] =
-    -lambda_ijT_avg (6, 12, T, 'a') * y[12] - lambda_ijT_avg (6, 12, T,
-							      'g') * y[12];
-  dfdy[7 * n_iso + 6] = lambda_ijT (6, 12, T) * y[12];
-  dfdy[12 * n_iso + 6] =
-    -lambda_ijT_avg (6, 12, T, 'a') * y[12] - lambda_ijT_avg (6, 12, T,
-							      'g') * y[12];
-  dfdy[7 * n_iso + 7] = -lambda_ijT (7, 12, T) * y[12];
-  dfdy[8 * n_iso + 7] = lambda_ijT (7, 12, T) * y[12];
-  dfdy[12 * n_iso + 7] = -lambda_ijT (7, 12, T) * y[12];
-  dfdy[8 * n_iso + 8] = -lambda_ij_beta (8);
-  dfdy[9 * n_iso + 8] = lambda_ij_beta (8);
-  dfdy[0 * n_iso + 9] = lambda_ijT_avg (9, 12, T, 'a') * y[12];
-  dfdy[4 * n_iso + 9] = lambda_ijT (9, 12, T) * y[12];
-  dfdy[9 * n_iso + 9] =
-    -lambda_ijT_avg (9, 12, T, 'g') * y[12] - lambda_ijT_avg (9, 12, T,
-							      'a') * y[12];
-  dfdy[10 * n_iso + 9] = lambda_ijT_avg (9, 12, T, 'g') * y[12];
-  dfdy[12 * n_iso + 9] =
-    -lambda_ijT_avg (9, 12, T, 'a') * y[12] - lambda_ijT_avg (9, 12, T,
-							      'g') * y[12];
-  dfdy[10 * n_iso + 10] = -lambda_ij_beta (10);
-  dfdy[11 * n_iso + 10] = lambda_ij_beta (10);
-  dfdy[0 * n_iso + 11] = lambda_ijT (11, 12, T) * y[12];
-  dfdy[6 * n_iso + 11] = lambda_ijT (11, 12, T) * y[12];
-  dfdy[11 * n_iso + 11] = -lambda_ijT (11, 12, T) * y[12];
-  dfdy[12 * n_iso + 11] = -lambda_ijT (11, 12, T) * y[12];
-  dfdy[0 * n_iso + 12] =
-    lambda_ijT_avg (9, 12, T, 'a') * y[6] + lambda_ijT_avg (9, 12, T,
-							    'a') * y[9] +
-    lambda_ijT (11, 12, T) * y[11];
-  dfdy[1 * n_iso + 12] =
-    -lambda_ijT (1, 12, T) * y[1] + lambda_ijT (6, 12, T) * y[6];
-  dfdy[2 * n_iso + 12] = lambda_ijT (1, 12, T) * y[1];
-  dfdy[3 * n_iso + 12] = -lambda_ijT (3, 12, T) * y[3];
-  dfdy[4 * n_iso + 12] =
-    -lambda_ijT (4, 12, T) * y[4] + lambda_ijT (3, 12,
-						T) * y[3] + lambda_ijT (9, 12,
-									T) *
-    y[9];
-  dfdy[5 * n_iso + 12] = lambda_ijT (4, 12, T) * y[4];
-  dfdy[6 * n_iso + 12] =
-    -lambda_ijT_avg (6, 12, T, 'a') * y[6] - lambda_ijT_avg (6, 12, T,
-							     'g') * y[6] +
-    lambda_ijT (11, 12, T) * y[12];
-  dfdy[7 * n_iso + 12] =
-    lambda_ijT (6, 12, T) * y[6] - lambda_ijT (7, 12, T) * y[7];
-  dfdy[8 * n_iso + 12] = lambda_ijT (7, 12, T) * y[7];
-  dfdy[9 * n_iso + 12] =
-    -lambda_ijT_avg (9, 12, T, 'g') * y[9] - lambda_ijT_avg (9, 12, T,
-							     'a') * y[9];
-  dfdy[10 * n_iso + 12] = lambda_ijT_avg (9, 12, T, 'g') * y[9];
-  dfdy[11 * n_iso + 12] = -lambda_ijT (11, 12, T) * y[11];
-  dfdy[12 * n_iso + 12] =
-    -lambda_ijT (1, 12, T) * y[1] - lambda_ijT (3, 12,
-						T) * y[3] - lambda_ijT (4, 12,
-									T) *
-    y[4] - lambda_ijT_avg (6, 12, T, 'a') * y[6] - lambda_ijT_avg (6, 12, T,
-								   'g') *
-    y[6] - lambda_ijT (7, 12, T) * y[7] - lambda_ijT_avg (9, 12, T,
-							  'g') * y[9] -
-    lambda_ijT_avg (9, 12, T, 'a') * y[9] - lambda_ijT (11, 12, T) * y[11];
+/* d(RHS)/d(ln lambda_k) for every rate k, n_rates columns of n_iso in
+ * dfdp (see network_rate_derivatives()), for the forward sensitivities
+ * the BDF stepper can integrate along with y (step_bdf.c). Only for the
+ * abundances: with the temperature an unknown the rates depend on y,
+ * and that's not done, so it returns GSL_EINVAL. */
+int
+rate_derivatives (double t, const double y[], double dfdp[],
+		  void *params_in)
+{
+  struct param *params = (struct param *) params_in;
+  double dlnT_dt, dlnrho_dt;
+
+  if (params->net->temperature)
+    return GSL_EINVAL;
+  INSTR_START (params->instr, t0);
+  if (params->traj != NULL)
+    trajectory_eval (params->traj, &params->traj_pos, t, &params->T,
+		     &params->rho, &dlnT_dt, &dlnrho_dt);
+  const double *lambda =
+    rate_state_update (&params->rates, params->T, params->rho);
+  INSTR_LAP (params->instr, PHASE_RATES, t0);
+  network_rate_derivatives (params->net, lambda, params->rates.n_rates, y,
+			    dfdp);
+  INSTR_STOP (params->instr, PHASE_JACOBIAN, t0);
   return GSL_SUCCESS;
 }
@@ -1,2 +1,6 @@
 int jacobian (double t, const double y[], double *dfdy, double dfdt[],
 	      void *params_in);
+int jacobian_sparse (double t, const double y[], double jac_val[],
+		     double dfdt[], void *params_in);
+int rate_derivatives (double t, const double y[], double dfdp[],
+		      void *params_in);
@@ -1,89 +1,742 @@
 #define MAIN_FILE
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
 #include <gsl/gsl_odeiv2.h>
 #include <gsl/gsl_errno.h>
+#include "active_set.h"
+#include "checkpoint.h"
+#include "energy.h"
+#include "ensemble.h"
+#include "equilibrium.h"
+#include "event.h"
+#include "network.h"
+#include "output.h"
 #include "ode_rhs.h"
 #include "rate_coeffs.h"
+#include "instrument.h"
 #include "jacobian.h"
 #include "param.h"
+#include "rate_table.h"
+#include "ratelib.h"
+#include "schedule.h"
+#include "step_bdf.h"
+#include "steppers.h"
+#include "sweep.h"
+#include "trajectory.h"
 
 /* A simple CNO nuclear network solver. Thanks Dick Henry for making
  * these projects really open ended! I probably would not have learned
  * nearly as much about nuclear networks otherwise. */
 
-/* Because I'm pretty myopic in general I hard-wired the isotopes into
- * the ODEs, Jacobian, etc. A better way to do this would be to create
- * integer variables called ihe4, ic12, etc. and assign the indices to
- * them. Then if I wanted to add more isotopes later it would be quite
- * simple. Oh well, the deadline for this project is right around the
- * corner. The isotope codes are:
+/* The isotopes and reactions used to be hard-wired into the ODEs,
+ * Jacobian, etc., which meant editing three files in step every time
+ * the network changed. Now they live in a struct network (see
+ * network.h), and the CNO network is built in network_cno.c. */
+
+/* Usage: nuclear_network [--stepper NAME] [--jacobian analytic|ad]
+ *                         [--binary] [--trajectory FILE] [--stats FILE]
+ *                         [--times SPEC [--max-rows N] [--land]]
+ *                         [--sweep GRID [--threads N | --mpi]
+ *                                       [--output FILE]]
+ *                         [--checkpoint FILE [--checkpoint-every SEC]]
+ *                         [--restart FILE] [--equilibrium] [--active-set]
+ *                         [--energy] [--self-heating] [--network LIB]
+ *                         [--sensitivity] [--events FILE] [--stop EXPR]
+ *                         [--ensemble SPEC [--threads N] [--output FILE]]
+ *
+ * NAME is "bsimp" (GSL's dense Bulirsch-Stoer, the default), "sbsimp"
+ * (the same method with the sparse Jacobian and sparse LU solver, see
+ * step_sbsimp.c), "ros4" (Rosenbrock, step_ros4.c), "bdf" (variable
+ * order BDF reusing the Jacobian and LU, step_bdf.c) or "msbdf" (GSL's
+ * dense BDF). See steppers.c.
+ *
+ * --jacobian ad differentiates the RHS to get the Jacobian (forward
+ * mode AD with compressed columns, network_ad.c) instead of using the
+ * fill list the network builds. Same numbers, more work; it's there to
+ * check the other one, and for networks nobody has checked yet.
+ *
+ * --binary writes every step at full precision to results.bin (see
+ * output.h) from a background thread, instead of formatting it into
+ * results.dat: one little-endian array of rows after a short header,
+ * which plot.py maps with numpy.memmap without parsing anything, and
+ * out2txt converts back to text. A sweep with --binary writes its
+ * table the same way, to sweep.bin by default.
+ *
+ * Normally every step the integrator takes gets written. With --times,
+ * only the abundances at the times in SPEC are: "log:N" (N times
+ * log-spaced from 1e-8 sec to the end), "lin:N", or the name of a file
+ * with one time per line; never more than N rows (default 10000, see
+ * schedule.c). The values are interpolated inside the step that
+ * crossed each time, or, with --land, the integrator stops exactly on
+ * every output time.
+ *
+ * --trajectory FILE follows T(t) and rho(t) from a file of (t, T, rho)
+ * samples (see trajectory.c) instead of holding them constant, from
+ * the first sample to the last. The rates come from a table in log T
+ * (rate_table.c), checked against the fits when it is built.
+ *
+ * --stats FILE writes a JSON summary of the run: how it ended, step,
+ * RHS, Jacobian and LU counts, where the wall time went and the step
+ * size history (see instrument.h).
+ *
+ * With --sweep, instead of the single run below, every (T, rho, X(H1),
+ * X(C12)) point of the grid described in the file GRID is integrated
+ * on N threads (default: one per core) and the final abundances go to
+ * FILE (default sweep.dat, or sweep.bin with --binary). See sweep.c
+ * for the grid file format. With --mpi (nuclear_network_mpi, which
+ * gets built if CMake finds an MPI) the points are farmed out to the
+ * ranks of an mpirun instead, which can be on any number of nodes,
+ * and their shards merged into FILE at the end; see sweep_mpi.c.
+ *
+ * --checkpoint FILE saves the state of the run every SEC seconds of
+ * wall time (default 60), and when the run gets SIGTERM or SIGINT,
+ * which is what a batch system sends when the time is up; see
+ * checkpoint.h. --restart FILE carries on from that state, with the
+ * output file cut back to where it was at the checkpoint, and keeps
+ * checkpointing to FILE unless there's a --checkpoint. The stepper
+ * comes from the checkpoint. With bsimp, sbsimp and ros4 the restarted
+ * run takes exactly the steps the original would have taken; the BDF
+ * steppers start over at order 1. A sweep's checkpoint is a log of the
+ * points that are done, and a restarted sweep only runs the others.
+ *
+ * --equilibrium skips the integration and solves for the abundances
+ * the CNO cycles settle into at this T and rho, with the H1 held
+ * fixed (see equilibrium.c), and prints them; with --sweep, that's
+ * what every point of the grid gets.
+ *
+ * --active-set takes the isotopes that have died out (mass fraction
+ * below 1e-20, and not being made) out of the system the integrator
+ * solves, instead of just setting them to zero after every step, and
+ * puts them back when something starts making them again; see
+ * active_set.c. Single runs only.
+ *
+ * --energy adds the energy generation rate to the output, from the
+ * fluxes the RHS works out anyway: eps_nuc (erg/g/s, what stays in the
+ * gas) and eps_nu (what the neutrinos of the beta-decays carry off).
+ * With --self-heating that energy heats the gas, at constant density,
+ * and the temperature is integrated along with the abundances and
+ * written out as well (see energy.c). Not on a trajectory, which says
+ * what T is.
+ *
+ * --network LIB runs the isotopes and reactions of a rate library
+ * instead of the CNO network, with their REACLIB rates and Q-values:
+ * LIB is a REACLIB file compiled by rates2bin, which gets mmap()ed
+ * (see ratelib.c). It has to have H1 and C12, for the initial
+ * abundances. Single runs only.
+ *
+ * --sensitivity also works out how much the final abundances depend on
+ * each rate, dX_i/d(ln lambda_k), by integrating the sensitivity
+ * equations along with the abundances (in the BDF stepper, which is
+ * the stepper it needs, see step_bdf.c) instead of rerunning with every
+ * rate nudged. They go to sensitivity.dat, a row per rate and a column
+ * per isotope. Single runs, without --self-heating, --active-set or
+ * checkpoints.
  *
- * He4 =  0
- * C12 =  1
- * N13 =  2
- * C13 =  3
- * N14 =  4
- * O15 =  5
- * N15 =  6
- * O16 =  7
- * F17 =  8
- * O17 =  9
- * F18 = 10
- * O18 = 11
- * H1  = 12
- */
+ * --events FILE stops the run, or just writes the abundances, when
+ * something crosses a threshold: "stop h1 < 1e-3" ends the run when
+ * X(H1) drops below 1e-3, "record n14/c12 > 100" notes when the number
+ * ratio of N14 to C12 goes over 100 (see event.c). --stop EXPR is the
+ * same as a "stop EXPR" line, and can be given more than once. The
+ * time of each event is found inside the step that crossed it, and
+ * it goes to events.dat with the abundances there. Single runs
+ * without --sensitivity or checkpoints; a sweep takes "stop" lines in
+ * its grid file instead (see sweep.c).
+ *
+ * --ensemble SPEC runs the CNO network many times with every rate
+ * drawn from a log-normal around its CF88 value, as many members, at
+ * the T, rho and composition, with the uncertainties, described in
+ * the file SPEC (see ensemble.c), in vectorized batches on N threads.
+ * What gets written, to FILE (default ensemble.dat), is percentiles of
+ * the mass fractions over the members at a list of output times. */
+static void
+usage (const char *prog)
+{
+  fprintf (stderr,
+	   "usage: %s [--stepper %s] [--jacobian analytic|ad]\n"
+	   "       %*s [--binary] [--trajectory FILE] [--stats FILE]\n"
+	   "       %*s [--times log:N|lin:N|FILE [--max-rows N] [--land]]\n"
+	   "       %*s [--sweep GRID [--threads N | --mpi] [--output FILE]]\n"
+	   "       %*s [--checkpoint FILE [--checkpoint-every SEC]]\n"
+	   "       %*s [--restart FILE] [--equilibrium] [--active-set]\n"
+	   "       %*s [--energy] [--self-heating] [--network LIB]\n"
+	   "       %*s [--sensitivity] [--events FILE] [--stop EXPR]\n"
+	   "       %*s [--ensemble SPEC [--threads N] [--output FILE]]\n",
+	   prog, stepper_names, (int) strlen (prog), "", (int) strlen (prog),
+	   "", (int) strlen (prog), "", (int) strlen (prog), "",
+	   (int) strlen (prog), "", (int) strlen (prog), "",
+	   (int) strlen (prog), "", (int) strlen (prog), "");
+}
+
+// time and mass fractions, for the output
+static void
+fill_row (int n_iso, double t, const double y[], const double to_x[],
+	  double row[])
+{
+  int i;
+  row[0] = t;
+  for (i = 0; i < n_iso; ++i)
+    {
+      row[i + 1] = y[i] * to_x[i];
+      // same cut-off as the main loop, also catches interpolation wiggles
+      if (row[i + 1] < 1.0e-20)
+	row[i + 1] = 0.0;
+    }
+}
+
+/* the columns after the mass fractions: T if it's integrated, then
+ * eps_nuc and eps_nu at (t, y), if we're keeping track of them. like
+ * the mass fractions, those don't count the interpolation wiggling an
+ * abundance below zero (a beta-decay flux out of a negative abundance
+ * is a big negative energy). it's output, not integration, so it
+ * isn't counted as an RHS call */
+static void
+fill_energy (struct param *params, double t, const double y[], double row[])
+{
+  const int n = params->n_iso;
+  double y_pos[params->net->n_var], f[params->net->n_var];
+  int c = n + 1, i;
+  if (params->net->temperature)
+    row[c++] = y[n] * ENERGY_T_UNIT;
+  if (params->energy)
+    {
+      for (i = 0; i < params->net->n_var; ++i)
+	y_pos[i] = (y[i] > 0.0) ? y[i] : 0.0;
+      ode_rhs_uncounted (t, y_pos, f, params);
+      row[c++] = params->eps_nuc;
+      row[c++] = params->eps_nu;
+    }
+}
+
+/* mol/cm^3 -> mass fraction at time t on a trajectory. uses its own
+ * lookup cursor so it doesn't move the integrator's */
+static void
+mass_fraction_factors (const struct param *params, double t,
+		       const double molar_mass[], double to_x[])
+{
+  double T, rho, dlnT_dt, dlnrho_dt;
+  int pos = params->traj_pos, i;
+  trajectory_eval (params->traj, &pos, t, &T, &rho, &dlnT_dt, &dlnrho_dt);
+  for (i = 0; i < params->n_iso; ++i)
+    to_x[i] = molar_mass[i] / rho;
+}
+
+// write a row to whichever output we have
+static int
+save_row (FILE * fp, struct out_writer *out, int n_col, const double row[],
+	  struct instr *in)
+{
+  int c, status = GSL_SUCCESS;
+  INSTR_START (in, t0);
+  if (out != NULL)
+    status = out_append (out, row);
+  else
+    {
+      fprintf (fp, "%15.4e", row[0]);
+      for (c = 1; c < n_col; ++c)
+	fprintf (fp, " %15.4e", row[c]);
+      fprintf (fp, "\n");
+    }
+  INSTR_STOP (in, PHASE_OUTPUT, t0);
+  return status;
+}
+
+// an event's row in events.dat: its label, then what results.dat has
+static void
+write_event (FILE * fp, const struct event *ev, int n_col,
+	     const double row[])
+{
+  int c;
+  fprintf (fp, "%24s", ev->text);
+  for (c = 0; c < n_col; ++c)
+    fprintf (fp, " %15.4e", row[c]);
+  fprintf (fp, "\n");
+}
+
+/* the sensitivities s (n_rates vectors of n_var, see step_bdf.h) as
+ * mass fractions: a row per rate, dX_i/d(ln lambda) for every isotope */
+static int
+write_sensitivity (const char *path, const struct network *net,
+		   int n_rates, const double s[], const double to_x[])
+{
+  char label[64];
+  int i, k;
+  FILE *fp = fopen (path, "w");
+
+  if (fp == NULL)
+    return GSL_EFAILED;
+  fprintf (fp, "%24s", "rate");
+  for (i = 0; i < net->n_iso; ++i)
+    fprintf (fp, " %15s", net->iso[i].name);
+  fprintf (fp, "\n");
+  for (k = 0; k < n_rates; ++k)
+    {
+      network_rate_label (net, k, label, sizeof (label));
+      fprintf (fp, "%24s", label);
+      for (i = 0; i < net->n_iso; ++i)
+	fprintf (fp, " %15.6e", s[k * net->n_var + i] * to_x[i]);
+      fprintf (fp, "\n");
+    }
+  return fclose (fp) == 0 ? GSL_SUCCESS : GSL_EFAILED;
+}
+
+// set by SIGTERM/SIGINT while checkpointing: save and stop
+static volatile sig_atomic_t stop_requested = 0;
+
+static void
+request_stop (int sig)
+{
+  (void) sig;
+  stop_requested = 1;
+}
+
+/* everything written so far has to be in the output file before the
+ * checkpoint says it is */
+static int
+output_offset (FILE * fp, struct out_writer *out, int64_t * offset)
+{
+  if (out != NULL)
+    return out_sync (out, offset);
+  if (fflush (fp) != 0)
+    return GSL_EFAILED;
+  *offset = ftello (fp);
+  return *offset < 0 ? GSL_EFAILED : GSL_SUCCESS;
+}
+
+/* text output of a restarted run: the file as it was at the checkpoint,
+ * positioned for the next row */
+static FILE *
+resume_text (const char *path, int64_t offset)
+{
+  FILE *fp = fopen (path, "r+");
+  if (fp == NULL)
+    return NULL;
+  if (fseeko (fp, 0, SEEK_END) != 0 || ftello (fp) < offset
+      || ftruncate (fileno (fp), offset) != 0
+      || fseeko (fp, offset, SEEK_SET) != 0)
+    {
+      fclose (fp);
+      return NULL;
+    }
+  return fp;
+}
 
 int
-main ()
+main (int argc, char *argv[])
 {
   struct param params;
+  struct network net;
+  const gsl_odeiv2_step_type *step_type = gsl_odeiv2_step_bsimp;
+  const char *step_name = "bsimp";
+  int stepper_given = 0;
+  const char *sweep_file = NULL, *sweep_output = NULL;
+  int n_threads = 0;
+  int mpi = 0;
+  int binary = 0;
+  int jac_ad = 0;
+  const char *times = NULL;
+  int max_rows = 0, land = 0;
+  const char *traj_file = NULL;
+  const char *stats_file = NULL;
+  struct schedule sched = { 0, NULL };
+  const char *ckpt_file = NULL, *restart_file = NULL;
+  double ckpt_every = 60.0;
+  int equilibrium = 0;
+  int active = 0;
+  int energy = 0, heating = 0;
+  const char *lib_file = NULL;
+  struct ratelib lib = { 0 };
+  int sensitivity = 0;
+  const char *ens_file = NULL;
+  const char *event_file = NULL;
+  const char *stop_expr[EVENT_MAX];
+  int n_stop = 0;
+  struct event_list events = { 0 };
+  int arg;
+
+  for (arg = 1; arg < argc; ++arg)
+    {
+      if (strcmp (argv[arg], "--stepper") == 0 && arg + 1 < argc)
+	{
+	  step_name = argv[++arg];
+	  step_type = stepper_by_name (step_name);
+	  if (step_type == NULL)
+	    {
+	      fprintf (stderr, "unknown stepper: %s\n", argv[arg]);
+	      return 1;
+	    }
+	  stepper_given = 1;
+	}
+      else if (strcmp (argv[arg], "--jacobian") == 0 && arg + 1 < argc)
+	{
+	  ++arg;
+	  if (strcmp (argv[arg], "ad") == 0)
+	    jac_ad = 1;
+	  else if (strcmp (argv[arg], "analytic") == 0)
+	    jac_ad = 0;
+	  else
+	    {
+	      fprintf (stderr, "unknown Jacobian: %s\n", argv[arg]);
+	      return 1;
+	    }
+	}
+      else if (strcmp (argv[arg], "--binary") == 0)
+	binary = 1;
+      else if (strcmp (argv[arg], "--times") == 0 && arg + 1 < argc)
+	times = argv[++arg];
+      else if (strcmp (argv[arg], "--max-rows") == 0 && arg + 1 < argc)
+	max_rows = atoi (argv[++arg]);
+      else if (strcmp (argv[arg], "--land") == 0)
+	land = 1;
+      else if (strcmp (argv[arg], "--stats") == 0 && arg + 1 < argc)
+	stats_file = argv[++arg];
+      else if (strcmp (argv[arg], "--trajectory") == 0 && arg + 1 < argc)
+	traj_file = argv[++arg];
+      else if (strcmp (argv[arg], "--sweep") == 0 && arg + 1 < argc)
+	sweep_file = argv[++arg];
+      else if (strcmp (argv[arg], "--threads") == 0 && arg + 1 < argc)
+	n_threads = atoi (argv[++arg]);
+      else if (strcmp (argv[arg], "--mpi") == 0)
+	mpi = 1;
+      else if (strcmp (argv[arg], "--output") == 0 && arg + 1 < argc)
+	sweep_output = argv[++arg];
+      else if (strcmp (argv[arg], "--checkpoint") == 0 && arg + 1 < argc)
+	ckpt_file = argv[++arg];
+      else if (strcmp (argv[arg], "--checkpoint-every") == 0
+	       && arg + 1 < argc)
+	ckpt_every = atof (argv[++arg]);
+      else if (strcmp (argv[arg], "--restart") == 0 && arg + 1 < argc)
+	restart_file = argv[++arg];
+      else if (strcmp (argv[arg], "--equilibrium") == 0)
+	equilibrium = 1;
+      else if (strcmp (argv[arg], "--active-set") == 0)
+	active = 1;
+      else if (strcmp (argv[arg], "--energy") == 0)
+	energy = 1;
+      else if (strcmp (argv[arg], "--self-heating") == 0)
+	energy = heating = 1;
+      else if (strcmp (argv[arg], "--network") == 0 && arg + 1 < argc)
+	lib_file = argv[++arg];
+      else if (strcmp (argv[arg], "--sensitivity") == 0)
+	sensitivity = 1;
+      else if (strcmp (argv[arg], "--ensemble") == 0 && arg + 1 < argc)
+	ens_file = argv[++arg];
+      else if (strcmp (argv[arg], "--events") == 0 && arg + 1 < argc)
+	event_file = argv[++arg];
+      else if (strcmp (argv[arg], "--stop") == 0 && arg + 1 < argc
+	       && n_stop < EVENT_MAX)
+	stop_expr[n_stop++] = argv[++arg];
+      else
+	{
+	  usage (argv[0]);
+	  return 1;
+	}
+    }
+  if (restart_file != NULL && ckpt_file == NULL)
+    ckpt_file = restart_file;
+  if (equilibrium && sweep_file == NULL
+      && (traj_file != NULL || restart_file != NULL))
+    {
+      fprintf (stderr, "--equilibrium needs a constant T and rho, and "
+	       "doesn't integrate anything to restart\n");
+      return 1;
+    }
+  if (mpi && (sweep_file == NULL || ckpt_file != NULL))
+    {
+      fprintf (stderr, "--mpi is for sweeps, without checkpoints\n");
+      return 1;
+    }
+#ifndef NN_MPI
+  if (mpi)
+    {
+      fprintf (stderr, "--mpi needs nuclear_network_mpi, which only gets "
+	       "built where there's an MPI\n");
+      return 1;
+    }
+#endif
+  if (active && sweep_file != NULL)
+    {
+      fprintf (stderr, "--active-set is for single runs\n");
+      return 1;
+    }
+  if (energy && (sweep_file != NULL || equilibrium))
+    {
+      fprintf (stderr, "--energy and --self-heating are for single runs\n");
+      return 1;
+    }
+  if (heating && (traj_file != NULL || active))
+    {
+      fprintf (stderr, "--self-heating can't follow a trajectory or "
+	       "use --active-set\n");
+      return 1;
+    }
+  if (lib_file != NULL && (sweep_file != NULL || equilibrium))
+    {
+      fprintf (stderr, "--network is for single runs\n");
+      return 1;
+    }
+  if (sensitivity && (sweep_file != NULL || equilibrium || heating
+		      || active || ckpt_file != NULL))
+    {
+      fprintf (stderr, "--sensitivity is for single runs, without "
+	       "--self-heating, --active-set or checkpoints\n");
+      return 1;
+    }
+  if ((event_file != NULL || n_stop > 0)
+      && (sweep_file != NULL || equilibrium || sensitivity
+	  || ckpt_file != NULL))
+    {
+      fprintf (stderr, "--events and --stop are for single runs, without "
+	       "--sensitivity or checkpoints\n");
+      return 1;
+    }
+  if (ens_file != NULL
+      && (sweep_file != NULL || equilibrium || active || energy
+	  || lib_file != NULL || sensitivity || traj_file != NULL
+	  || ckpt_file != NULL || binary || event_file != NULL || n_stop > 0))
+    {
+      fprintf (stderr, "--ensemble only goes with --threads and "
+	       "--output\n");
+      return 1;
+    }
+  // the sensitivities come out of the BDF stepper
+  if (sensitivity && !stepper_given)
+    {
+      step_name = "bdf";
+      step_type = step_bdf;
+    }
+  else if (sensitivity && step_type != step_bdf)
+    {
+      fprintf (stderr, "--sensitivity needs --stepper bdf\n");
+      return 1;
+    }
+
+  // build the network: which isotopes, and which reactions connect them
+  if (lib_file != NULL)
+    {
+      const double t0 = instr_now ();
+      int status = ratelib_open (&lib, lib_file);
+      if (status != GSL_SUCCESS)
+	{
+	  fprintf (stderr, "could not open rate library %s: %s\n", lib_file,
+		   status == GSL_EINVAL ? "not a rate library, or from "
+		   "another version" : "can't map it");
+	  return 1;
+	}
+      printf ("%18s %d isotopes, %d reactions, %d sets (%.2e sec)\n",
+	      "RATE LIBRARY:", (int) lib.hdr->n_iso, (int) lib.hdr->n_reac,
+	      (int) lib.hdr->n_sets, instr_now () - t0);
+    }
+  if ((lib_file != NULL ? network_from_ratelib (&net, &lib)
+       : network_cno_init (&net)) != GSL_SUCCESS
+      || (heating && network_set_temperature (&net, 1) != 0))
+    {
+      fprintf (stderr, "could not allocate the network\n");
+      ratelib_close (&lib);
+      return 1;
+    }
+
+  if (ens_file != NULL)
+    {
+      struct ensemble_spec spec;
+      int status = ensemble_read_spec (ens_file, &net, &spec);
+      if (status != GSL_SUCCESS)
+	fprintf (stderr, "could not read ensemble file %s\n", ens_file);
+      else if ((status = ensemble_run (&spec, &net, n_threads,
+				       sweep_output != NULL ? sweep_output
+				       : "ensemble.dat")) != GSL_SUCCESS)
+	fprintf (stderr, "ensemble failed: %s\n", gsl_strerror (status));
+      network_free (&net);
+      return status == GSL_SUCCESS ? 0 : 1;
+    }
+
+  if (sweep_file != NULL)
+    {
+      struct sweep_grid grid;
+      int status;
+      if (sweep_read_grid (sweep_file, &net, &grid) != GSL_SUCCESS)
+	{
+	  fprintf (stderr, "could not read grid file %s\n", sweep_file);
+	  network_free (&net);
+	  return 1;
+	}
+      if (sweep_output == NULL)
+	sweep_output = binary ? "sweep.bin" : "sweep.dat";
+#ifdef NN_MPI
+      if (mpi)
+	status = sweep_run_mpi (&grid, &net, step_type, jac_ad, equilibrium,
+				sweep_output, binary);
+      else
+#endif
+	status = sweep_run (&grid, &net, step_type, jac_ad, equilibrium,
+			    n_threads, sweep_output, binary, ckpt_file,
+			    restart_file != NULL);
+      network_free (&net);
+      return status == GSL_SUCCESS ? 0 : 1;
+    }
+
+  params.net = &net;
   // temperature (constant throughout). units: K
   params.T = 25.0e+06;
   // density (constant throughout). units: g/cm^3
   params.rho = 150.0;
   // number of isotopes to include in network
-  params.n_iso = 13;
+  params.n_iso = net.n_iso;
+  // rates get evaluated the first time the integrator asks for them
+  rate_state_init (&params.rates);
+  if (lib_file != NULL
+      && rate_state_use_library (&params.rates, &lib) != GSL_SUCCESS)
+    {
+      fprintf (stderr, "could not allocate the rates\n");
+      network_free (&net);
+      return 1;
+    }
+  params.traj = NULL;
+  params.traj_pos = 0;
+  // counters and timers, if we're keeping any
+  struct instr stats;
+  params.instr = NULL;
+  params.jac_ad = jac_ad;
+  params.energy = energy;
+  params.eps_nuc = params.eps_nu = 0.0;
+  if (stats_file != NULL)
+    {
+#ifndef NN_INSTRUMENT
+      fprintf (stderr, "warning: built without instrumentation, %s will "
+	       "only have the step counts\n", stats_file);
+#endif
+      if (instr_init (&stats, 4096) != GSL_SUCCESS)
+	{
+	  fprintf (stderr, "could not allocate the step history\n");
+	  network_free (&net);
+	  return 1;
+	}
+      params.instr = &stats;
+    }
+  /* initial and final times. units: sec. the abundances for this problem
+   * should evolve on stellar evolution timescales. for reference,
+   * 1 Gyr ~ 3e16 sec */
+  double t_now = 0.0, t_stop = 1.0e+22;
+
+  /* or follow a T(t), rho(t) history from the start to the end of the
+   * trajectory, with the rates interpolated from a table */
+  struct trajectory traj = { 0, NULL, NULL, NULL };
+  struct rate_table table = { 0 };
+  if (traj_file != NULL)
+    {
+      double dlnT_dt, dlnrho_dt;
+      if (trajectory_read (&traj, traj_file) != GSL_SUCCESS)
+	{
+	  fprintf (stderr, "could not read trajectory %s\n", traj_file);
+	  network_free (&net);
+	  return 1;
+	}
+      params.traj = &traj;
+      t_now = traj.t[0];
+      t_stop = traj.t[traj.n - 1];
+      trajectory_eval (&traj, &params.traj_pos, t_now, &params.T,
+		       &params.rho, &dlnT_dt, &dlnrho_dt);
+    }
+  /* the table only has to cover the temperatures we'll see. a
+   * library's fits are as cheap as the table would be, and come with
+   * their derivatives anyway */
+  if (traj_file != NULL && lib_file == NULL)
+    {
+      double worst_T = 0.0;
+      int worst_rate = 0, k;
+      double lnT_min = traj.ln_T[0], lnT_max = traj.ln_T[0];
+      for (k = 1; k < traj.n; ++k)
+	{
+	  if (traj.ln_T[k] < lnT_min)
+	    lnT_min = traj.ln_T[k];
+	  if (traj.ln_T[k] > lnT_max)
+	    lnT_max = traj.ln_T[k];
+	}
+      int status = rate_table_build (&table, 0.99 * exp (lnT_min),
+				     1.01 * exp (lnT_max), RATE_TABLE_TOL);
+      if (status != GSL_SUCCESS && status != GSL_ETOL)
+	{
+	  fprintf (stderr, "could not build the rate table\n");
+	  trajectory_free (&traj);
+	  network_free (&net);
+	  return 1;
+	}
+      rate_table_check (&table, &worst_T, &worst_rate);
+      printf ("%18s %d nodes, max error %.2e (rate %d at T = %.4e)\n",
+	      "RATE TABLE:", table.n, table.max_rel_err, worst_rate,
+	      worst_T);
+      if (status == GSL_ETOL)
+	fprintf (stderr, "warning: rate table error is above %.1e\n",
+		 RATE_TABLE_TOL);
+      params.rates.table = &table;
+    }
   printf ("%18s %12.4e\n", "TEMPERATURE:", params.T);
   printf ("%18s %12.4e\n", "MASS DENSITY:", params.rho);
-  /* molar masses of each isotope. used to convert from mass fraction to
-   * molar number abundance. units: g/mol */
-  double molar_mass[params.n_iso];
   /* initial time step (sec). This is just an initial guess. The
    * time-stepper will fix it when it starts integrating. */
   double h = 1.0e-8;
-  /* initial and final times. units: sec. the abundances for this problem
-   * should evolve on stellar evolution timescales. for reference,
-   * 1 Gyr ~ 3e16 sec */
-  double t_now = 0.0, t_stop = 1.0e+22;
   /* absolute and relative error requirements for the integrator. smaller means
    * better precision but more computation time */
   const double eps_abs = 1.0e-8, eps_rel = 0.0;
+  // which times to write out, if not every step
+  if (times != NULL
+      && schedule_parse (&sched, times, t_now, t_stop, max_rows)
+      != GSL_SUCCESS)
+    {
+      fprintf (stderr, "bad output times: %s\n", times);
+      network_free (&net);
+      return 1;
+    }
 
-  // number abundances of isotopes. units: mol/cm^3
-  double y[params.n_iso];
-  /* Jacobian matrix. the integrator needs this. fortunately it's
-   * analytic so calculating it is very fast */
-  double dfdy[params.n_iso][params.n_iso];
-  /* time derivatives of the RHS. the integrator needs this. there is
-   * no explicit time dependence in this system of ODEs so these will
-   * all be zero */
-  double dfdt[params.n_iso];
+  /* number abundances of isotopes. units: mol/cm^3. with
+   * --self-heating, the temperature comes after them */
+  const int n_var = net.n_var;
+  double y[n_var];
   // loops
   unsigned int i;
 
-  molar_mass[0] = 4.002602;	// He4
-  molar_mass[1] = 12.0;		// C12
-  molar_mass[2] = 13.005738609;	// N13
-  molar_mass[3] = 13.00335483778;	// C13
-  molar_mass[4] = 14.00307400478;	// N14
-  molar_mass[5] = 15.003065617;	// O15
-  molar_mass[6] = 15.00010889823;	// N15
-  molar_mass[7] = 15.99491461956;	// O16
-  molar_mass[8] = 17.002095237;	// F17
-  molar_mass[9] = 16.999131703;	// O17
-  molar_mass[10] = 18.000937956;	// F18
-  molar_mass[11] = 17.999161001;	// O18
-  molar_mass[12] = 1.00794;	// H1
+  /* molar masses of each isotope. used to convert from mass fraction to
+   * molar number abundance. units: g/mol */
+  double molar_mass[params.n_iso];
+  for (i = 0; i < params.n_iso; ++i)
+    molar_mass[i] = net.iso[i].molar_mass;
+  /* mol/cm^3 -> mass fraction, worked out once instead of every step
+   * (unless rho changes). row[] is what goes into the output: time,
+   * then mass fractions */
+  double to_x[params.n_iso];
+  const int n_col = params.n_iso + 1 + heating + 2 * energy;
+  double row[n_col];
+  for (i = 0; i < params.n_iso; ++i)
+    to_x[i] = molar_mass[i] / params.rho;
+  const int h1 = network_find_isotope (&net, "h1");
+  const int c12 = network_find_isotope (&net, "c12");
+  if (h1 < 0 || c12 < 0)
+    {
+      fprintf (stderr, "the network needs h1 and c12 to start from\n");
+      network_free (&net);
+      return 1;
+    }
+  // and when to stop, or take note, before that
+  if (event_file != NULL
+      && event_read (&events, &net, event_file) != GSL_SUCCESS)
+    {
+      fprintf (stderr, "could not read events from %s\n", event_file);
+      schedule_free (&sched);
+      network_free (&net);
+      return 1;
+    }
+  for (i = 0; i < n_stop; ++i)
+    if (event_parse (&events, &net, 1, stop_expr[i]) != GSL_SUCCESS)
+      {
+	fprintf (stderr, "bad event: %s\n", stop_expr[i]);
+	schedule_free (&sched);
+	network_free (&net);
+	return 1;
+      }
 
   /* set initial abundances. these are sort of arbitrary. I assume the
    * environment is the core of a young star, so 99% H1 (by mass) and
@@ -96,8 +749,82 @@ main ()
       y[i] = 1.0e-20 * (params.rho / molar_mass[i]);
     }
   // set H1 and C12 by hand
-  y[12] = 0.99 * (params.rho / molar_mass[12]);
-  y[1] = 0.01 * (params.rho / molar_mass[1]);
+  y[h1] = 0.99 * (params.rho / molar_mass[h1]);
+  y[c12] = 0.01 * (params.rho / molar_mass[c12]);
+  if (heating)
+    y[params.n_iso] = params.T / ENERGY_T_UNIT;
+
+  // or just where the CNO cycles end up, without getting there
+  if (equilibrium)
+    {
+      struct equil_stats eq;
+      const int c13 = network_find_isotope (&net, "c13");
+      const int n14 = network_find_isotope (&net, "n14");
+      double y_cno = 0.0;
+      int status = equilibrium_solve (&params, y, &eq);
+      if (status == GSL_SUCCESS)
+	{
+	  printf ("%18s %d Newton + %d pseudo-transient iterations, "
+		  "residual %.2e\n", "EQUILIBRIUM:", eq.n_newton, eq.n_ptc,
+		  eq.residual);
+	  for (i = 0; i < params.n_iso; ++i)
+	    {
+	      printf ("%17s: %12.4e\n", net.iso[i].name, y[i] * to_x[i]);
+	      if (net.iso[i].Z > 2)
+		y_cno += y[i];
+	    }
+	  // the number ratios people look for
+	  if (c13 >= 0 && y[c13] > 0.0)
+	    printf ("%18s %12.4e\n", "C12/C13:", y[c12] / y[c13]);
+	  if (n14 >= 0)
+	    printf ("%18s %12.4e\n", "N14/CNO:", y[n14] / y_cno);
+	}
+      else
+	fprintf (stderr, "no equilibrium: %s\n", gsl_strerror (status));
+      if (stats_file != NULL)
+	instr_free (&stats);
+      schedule_free (&sched);
+      network_free (&net);
+      return status == GSL_SUCCESS ? 0 : 1;
+    }
+
+  /* or pick up where a checkpoint left off. it has to be the same
+   * problem, and the same integrator with the same tolerances, or it
+   * would be a different calculation */
+  struct ckpt_header ckpt_hdr;
+  struct ckpt_run ckpt;
+  if (restart_file != NULL)
+    {
+      const char *why = NULL;
+      int status = ckpt_read_run (restart_file, &ckpt_hdr, &ckpt, y,
+				  n_var);
+      if (status != GSL_SUCCESS)
+	why = (status == GSL_EINVAL) ? "not a checkpoint of a single run"
+	  : (status == GSL_EBADLEN) ? "different network" : "unreadable";
+      else if (stepper_given && strcmp (ckpt_hdr.stepper, step_name) != 0)
+	why = "different stepper";
+      else if (stepper_by_name (ckpt_hdr.stepper) == NULL)
+	why = "unknown stepper";
+      else if (ckpt_hdr.eps_abs != eps_abs || ckpt_hdr.eps_rel != eps_rel)
+	why = "different tolerances";
+      else if (ckpt.trajectory != (traj_file != NULL) || ckpt.T != params.T
+	       || ckpt.rho != params.rho)
+	why = "different T, rho";
+      else if (ckpt.n_out != sched.n
+	       || ckpt.t_stop != (sched.n > 0 ? sched.t[sched.n - 1] : t_stop))
+	why = "different output times";
+      else if (ckpt.binary != binary)
+	why = "different output format";
+      if (why != NULL)
+	{
+	  fprintf (stderr, "can't restart from %s: %s\n", restart_file, why);
+	  network_free (&net);
+	  return 1;
+	}
+      step_name = ckpt_hdr.stepper;
+      step_type = stepper_by_name (step_name);
+      printf ("%18s %12.4e\n", "RESTART AT:", ckpt.t_now);
+    }
 
   /* declare integration technology. All this junk is built in to the
    * GNU Scientific Library. I'm using a Bulirsch-Stoer integration
@@ -112,69 +839,421 @@ main ()
    * Runge-Kutta scheme for integrating some system of ODEs, and the
    * Runge-Kutta method takes something like 50,000 time steps to
    * solve the equations, whereas B-S took only 29. */
-  const gsl_odeiv2_step_type *step_type = gsl_odeiv2_step_bsimp;
-  gsl_odeiv2_step *step = gsl_odeiv2_step_alloc (step_type, params.n_iso);
-  // set absolute and relative error tolerances
-  gsl_odeiv2_control *control = gsl_odeiv2_control_y_new (eps_abs, eps_rel);
-  // set number of ODEs to solve
-  gsl_odeiv2_evolve *evolve = gsl_odeiv2_evolve_alloc (params.n_iso);
   /* the integrator needs to know the RHS of the ODEs (ode_rhs), the
    * Jacobian matrix (jacobian), the number of ODEs it's going to
    * solve (n_iso), and any additional parameters (just temperature in
    * this case) */
-  gsl_odeiv2_system sys = { ode_rhs, jacobian, params.n_iso, &params };
+  gsl_odeiv2_system sys = { ode_rhs, jacobian, n_var, &params };
+  /* with --active-set, the integrator only gets the isotopes that are
+   * doing something (as.y), on a network of just those (act_params);
+   * y stays the whole network, and gets them copied back after each
+   * step */
+  struct active_set as;
+  struct param act_params = params;
+  double *y_int = y;
+  if (active)
+    {
+      const double *lambda =
+	rate_state_update (&params.rates, params.T, params.rho);
+      if (active_set_init (&as, &net, lambda, y, to_x) != GSL_SUCCESS)
+	{
+	  fprintf (stderr, "could not allocate the active set\n");
+	  network_free (&net);
+	  return 1;
+	}
+      act_params.net = &as.net;
+      act_params.n_iso = as.n;
+      // its own rates, not the library rates' buffers params has
+      rate_state_init (&act_params.rates);
+      if (lib_file != NULL
+	  && rate_state_use_library (&act_params.rates, &lib) != GSL_SUCCESS)
+	{
+	  fprintf (stderr, "could not allocate the active set\n");
+	  network_free (&net);
+	  return 1;
+	}
+      act_params.rates.table = params.rates.table;
+      sys.dimension = as.n;
+      sys.params = &act_params;
+      y_int = as.y;
+    }
+  /* the driver sets up the stepper, the error control with the
+   * absolute and relative tolerances, and the evolve object for the
+   * number of ODEs, and tells them about each other (the BDF steppers
+   * need that). We still take the steps ourselves below */
+  gsl_odeiv2_driver *driver =
+    gsl_odeiv2_driver_alloc_y_new (&sys, step_type, h, eps_abs, eps_rel);
+  gsl_odeiv2_step *step = driver->s;
+  gsl_odeiv2_control *control = driver->c;
+  gsl_odeiv2_evolve *evolve = driver->e;
+  /* and with --sensitivity, d/d(ln lambda) of every rate, which start
+   * out at zero: the initial abundances don't depend on the rates */
+  const int n_rates = params.rates.n_rates;
+  if (sensitivity
+      && step_bdf_set_sensitivity (step, n_rates, rate_derivatives, &net)
+      != GSL_SUCCESS)
+    {
+      fprintf (stderr, "could not allocate the sensitivities\n");
+      network_free (&net);
+      return 1;
+    }
+  /* steps taken by the drivers before this one (a new one gets
+   * started every time the active set changes) */
+  unsigned long steps_before = 0, rejected_before = 0;
+  const double T_start = params.T, rho_start = params.rho;
+  if (restart_file != NULL)
+    {
+      t_now = ckpt.t_now;
+      h = ckpt.h;
+      evolve->count = ckpt.n_steps;
+      evolve->failed_steps = ckpt.n_rejected;
+    }
 
   // pointer for writing output to a file
-  FILE *fp;
-  fp = fopen ("results.dat", "w");
+  FILE *fp = NULL;
+  struct out_writer *out = NULL;
+  if (restart_file != NULL)
+    {
+      if (binary)
+	out = out_resume ("results.bin", n_col, ckpt.out_offset);
+      else
+	fp = resume_text ("results.dat", ckpt.out_offset);
+    }
+  else if (binary)
+    {
+      const char *name[n_col];
+      int c = params.n_iso + 1;
+      name[0] = "tnow";
+      for (i = 0; i < params.n_iso; ++i)
+	name[i + 1] = net.iso[i].name;
+      if (heating)
+	name[c++] = "T";
+      if (energy)
+	{
+	  name[c++] = "eps_nuc";
+	  name[c++] = "eps_nu";
+	}
+      out = out_open ("results.bin", n_col, name, 1, params.n_iso,
+		      params.T, params.rho, 0);
+    }
+  else
+    fp = fopen ("results.dat", "w");
+  if (fp == NULL && out == NULL)
+    {
+      fprintf (stderr, "could not open the output file\n");
+      network_free (&net);
+      return 1;
+    }
   // print column headers
-  fprintf (fp,
-	   "%15s %15s %15s %15s %15s %15s %15s %15s %15s %15s %15s %15s %15s"
-	   " %15s\n", "tnow", "he4", "c12", "n13", "c13", "n14", "o15", "n15",
-	   "o16", "f17", "o17", "f18", "o18", "h1");
+  if (fp != NULL && restart_file == NULL)
+    {
+      fprintf (fp, "%15s", "tnow");
+      for (i = 0; i < params.n_iso; ++i)
+	fprintf (fp, " %15s", net.iso[i].name);
+      if (heating)
+	fprintf (fp, " %15s", "T");
+      if (energy)
+	fprintf (fp, " %15s %15s", "eps_nuc", "eps_nu");
+      fprintf (fp, "\n");
+    }
+  // the events that happen, with the same columns after their label
+  FILE *ev_fp = NULL;
+  if (events.n > 0)
+    {
+      ev_fp = fopen ("events.dat", "w");
+      if (ev_fp == NULL)
+	{
+	  fprintf (stderr, "could not open events.dat\n");
+	  network_free (&net);
+	  return 1;
+	}
+      fprintf (ev_fp, "%24s %15s", "event", "tnow");
+      for (i = 0; i < params.n_iso; ++i)
+	fprintf (ev_fp, " %15s", net.iso[i].name);
+      if (heating)
+	fprintf (ev_fp, " %15s", "T");
+      if (energy)
+	fprintf (ev_fp, " %15s %15s", "eps_nuc", "eps_nu");
+      fprintf (ev_fp, "\n");
+    }
+  /* with a schedule, stop at the last output time, and keep the state
+   * at the start of each step for interpolating inside it */
+  int next = restart_file != NULL ? ckpt.next_out : 0;
+  /* on a trajectory, the next sample after t_now: dlnT/dt and
+   * dlnrho/dt jump there, which the steppers' error estimates don't
+   * see, so no step is allowed to cross one */
+  int traj_next = 0;
+  if (sched.n > 0)
+    t_stop = sched.t[sched.n - 1];
+  /* checkpoints go out between steps, when it's been long enough since
+   * the last one or we've been asked to stop */
+  double t_ckpt = instr_now ();
+  if (ckpt_file != NULL)
+    {
+      ckpt_header_init (&ckpt_hdr, CKPT_RUN, n_var, step_name,
+			eps_abs, eps_rel);
+      ckpt.T = T_start;
+      ckpt.rho = rho_start;
+      ckpt.t_stop = t_stop;
+      ckpt.n_out = sched.n;
+      ckpt.trajectory = params.traj != NULL;
+      ckpt.binary = binary;
+      signal (SIGTERM, request_stop);
+      signal (SIGINT, request_stop);
+    }
+  double t_prev, y_prev[n_var], f_prev[n_var];
+  double f_now[n_var], y_out[n_var], y_stop[n_var];
+  int status = GSL_SUCCESS;
   // continue loop until we reach t_stop
   while (t_now < t_stop)
     {
+      if (ckpt_file != NULL
+	  && (stop_requested || instr_now () - t_ckpt >= ckpt_every))
+	{
+	  ckpt.t_now = t_now;
+	  ckpt.h = h;
+	  ckpt.n_steps = steps_before + evolve->count;
+	  ckpt.n_rejected = rejected_before + evolve->failed_steps;
+	  ckpt.next_out = next;
+	  status = output_offset (fp, out, &ckpt.out_offset);
+	  if (status == GSL_SUCCESS)
+	    status = ckpt_write_run (ckpt_file, &ckpt_hdr, &ckpt, y);
+	  if (status != GSL_SUCCESS)
+	    {
+	      fprintf (stderr, "could not write checkpoint %s\n", ckpt_file);
+	      break;
+	    }
+	  if (stop_requested)
+	    {
+	      fprintf (stderr, "stopped at t = %.4e sec, checkpoint in %s\n",
+		       t_now, ckpt_file);
+	      break;
+	    }
+	  t_ckpt = instr_now ();
+	}
       /* integrate the equations at time t_now and take a step forward
-       * (t_now will be updated automatically) */
-      int status = gsl_odeiv2_evolve_apply (evolve, control, step, &sys,
-					    &t_now, t_stop, &h, y);
+       * (t_now will be updated automatically). with --land, don't step
+       * past the next output time, and on a trajectory not past the
+       * next sample */
+      double t_target = (sched.n > 0 && land) ? sched.t[next] : t_stop;
+      if (params.traj != NULL)
+	{
+	  while (traj_next < traj.n && traj.t[traj_next] <= t_now)
+	    ++traj_next;
+	  if (traj_next < traj.n && traj.t[traj_next] < t_target)
+	    t_target = traj.t[traj_next];
+	}
+      t_prev = t_now;
+      memcpy (y_prev, y, sizeof (y));
+      status = gsl_odeiv2_evolve_apply (evolve, control, step, &sys,
+					&t_now, t_target, &h, y_int);
       // quit if there's an error
       if (status != GSL_SUCCESS)
 	break;
+      INSTR_STEP (params.instr, t_now, t_now - t_prev);
+      if (active)
+	active_set_scatter (&as, y);
       /* Kill an isotope if its mass fraction drops below some really
        * small value. This helps the integrator move a little faster
        * because otherwise it tries to resolve changes at like 1.0e-58,
        * which is pointless. */
-      for (i = 0; i < params.n_iso; ++i)
+      if (params.traj != NULL)
+	mass_fraction_factors (&params, t_now, molar_mass, to_x);
+      if (active)
+	{
+	  /* or, with --active-set, take it out of the system, and put
+	   * back the ones that are being made again. the integrator has
+	   * to start over on the new system (at the step size it had) */
+	  const double *lambda = rate_state_update (&act_params.rates,
+						    act_params.T,
+						    act_params.rho);
+	  int changed;
+	  status = active_set_update (&as, lambda, y, to_x, t_now - t_prev,
+				      &changed);
+	  if (status != GSL_SUCCESS)
+	    break;
+	  if (changed)
+	    {
+	      steps_before += evolve->count;
+	      rejected_before += evolve->failed_steps;
+	      gsl_odeiv2_driver_free (driver);
+	      act_params.n_iso = as.n;
+	      sys.dimension = as.n;
+	      driver = gsl_odeiv2_driver_alloc_y_new (&sys, step_type, h,
+						      eps_abs, eps_rel);
+	      if (driver == NULL)
+		{
+		  status = GSL_ENOMEM;
+		  break;
+		}
+	      step = driver->s;
+	      control = driver->c;
+	      evolve = driver->e;
+	    }
+	}
+      else
+	{
+	  // a dead isotope stays dead whatever the rates are
+	  double *s = sensitivity ? step_bdf_sensitivity (step) : NULL;
+	  int k;
+	  for (i = 0; i < params.n_iso; ++i)
+	    {
+	      if (y[i] * to_x[i] < 1.0e-20)
+		{
+		  y[i] = 0.0;
+		  for (k = 0; s != NULL && k < n_rates; ++k)
+		    s[k * n_var + i] = 0.0;
+		}
+	    }
+	}
+      /* did anything cross its threshold in this step? then find out
+       * when, on the interpolant the output times use. a stop cuts the
+       * step short at t_end */
+      double t_end = t_now;
+      int have_f = 0, stop = 0;
+      if (events.n > 0 && event_crossed (&events, y_prev, y, to_x))
+	{
+	  int which[EVENT_MAX], n_hit, e;
+	  double t_hit[EVENT_MAX];
+	  ode_rhs_uncounted (t_prev, y_prev, f_prev, &params);
+	  ode_rhs_uncounted (t_now, y, f_now, &params);
+	  have_f = 1;
+	  n_hit = event_locate (&events, t_prev, y_prev, f_prev, t_now, y,
+				f_now, to_x, which, t_hit);
+	  for (e = 0; e < n_hit && !stop; ++e)
+	    {
+	      const struct event *ev = &events.ev[which[e]];
+	      dense_hermite (n_var, t_prev, y_prev, f_prev, t_now, y, f_now,
+			     t_hit[e], y_out);
+	      if (params.traj != NULL)
+		mass_fraction_factors (&params, t_hit[e], molar_mass, to_x);
+	      fill_row (params.n_iso, t_hit[e], y_out, to_x, row);
+	      fill_energy (&params, t_hit[e], y_out, row);
+	      write_event (ev_fp, ev, n_col, row);
+	      printf ("%18s %s at t = %.4e sec\n",
+		      ev->terminal ? "STOP:" : "EVENT:", ev->text, t_hit[e]);
+	      if (ev->terminal)
+		{
+		  stop = 1;
+		  t_end = t_hit[e];
+		  memcpy (y_stop, y_out, sizeof (y));
+		}
+	    }
+	  if (params.traj != NULL)
+	    mass_fraction_factors (&params, t_end, molar_mass, to_x);
+	}
+      // no schedule: save isotope mass fractions at each time step
+      if (sched.n == 0)
+	{
+	  if (stop)
+	    {
+	      t_now = t_end;
+	      memcpy (y, y_stop, sizeof (y));
+	    }
+	  fill_row (params.n_iso, t_now, y, to_x, row);
+	  fill_energy (&params, t_now, y, row);
+	  if (save_row (fp, out, n_col, row, params.instr)
+	      != GSL_SUCCESS || stop)
+	    break;
+	  continue;
+	}
+      // otherwise only if this step got to (or past) the next output time
+      if (t_end < sched.t[next] && !stop)
+	continue;
+      if (!land && !have_f)
 	{
-	  if (y[i] / (params.rho / molar_mass[i]) < 1.0e-20)
-	    y[i] = 0.0;
-	}
-      // print isotope mass fractions at each time step
-      fprintf (fp,
-	       "%15.4e %15.4e %15.4e %15.4e %15.4e %15.4e %15.4e %15.4e %15.4e"
-	       " %15.4e %15.4e %15.4e %15.4e %15.4e\n", t_now,
-	       y[0] / (params.rho / molar_mass[0]),
-	       y[1] / (params.rho / molar_mass[1]),
-	       y[2] / (params.rho / molar_mass[2]),
-	       y[3] / (params.rho / molar_mass[3]),
-	       y[4] / (params.rho / molar_mass[4]),
-	       y[5] / (params.rho / molar_mass[5]),
-	       y[6] / (params.rho / molar_mass[6]),
-	       y[7] / (params.rho / molar_mass[7]),
-	       y[8] / (params.rho / molar_mass[8]),
-	       y[9] / (params.rho / molar_mass[9]),
-	       y[10] / (params.rho / molar_mass[10]),
-	       y[11] / (params.rho / molar_mass[11]),
-	       y[12] / (params.rho / molar_mass[12]));
+	  ode_rhs_uncounted (t_prev, y_prev, f_prev, &params);
+	  ode_rhs_uncounted (t_now, y, f_now, &params);
+	}
+      while (next < sched.n && sched.t[next] <= t_end)
+	{
+	  if (land)
+	    memcpy (y_out, y, sizeof (y));
+	  else
+	    dense_hermite (n_var, t_prev, y_prev, f_prev, t_now, y,
+			   f_now, sched.t[next], y_out);
+	  if (params.traj != NULL)
+	    mass_fraction_factors (&params, sched.t[next], molar_mass, to_x);
+	  fill_row (params.n_iso, sched.t[next], y_out, to_x, row);
+	  fill_energy (&params, sched.t[next], y_out, row);
+	  if (save_row (fp, out, n_col, row, params.instr)
+	      != GSL_SUCCESS)
+	    break;
+	  ++next;
+	}
+      // the output went wrong
+      if (next < sched.n && sched.t[next] <= t_end)
+	break;
+      if (stop)
+	{
+	  t_now = t_end;
+	  memcpy (y, y_stop, sizeof (y));
+	  break;
+	}
     }
 
+  if (status != GSL_SUCCESS)
+    fprintf (stderr, "integration stopped at t = %.4e sec (h = %.4e): %s\n",
+	     t_now, h, gsl_strerror (status));
+  else if (sensitivity)
+    {
+      if (params.traj != NULL)
+	mass_fraction_factors (&params, t_now, molar_mass, to_x);
+      if (write_sensitivity ("sensitivity.dat", &net, n_rates,
+			     step_bdf_sensitivity (step), to_x)
+	  == GSL_SUCCESS)
+	printf ("%18s %d rates at t = %.4e sec, in sensitivity.dat\n",
+		"SENSITIVITY:", n_rates, t_now);
+      else
+	fprintf (stderr, "could not write sensitivity.dat\n");
+    }
+  if (stats_file != NULL)
+    {
+      FILE *sp = fopen (stats_file, "w");
+      if (sp != NULL)
+	{
+	  // GSL keeps these anyway, instrumented or not
+	  stats.n_accepted = steps_before + evolve->count;
+	  stats.n_rejected = rejected_before + evolve->failed_steps;
+	  stats.lu_counted = stepper_counts_linalg (step_type);
+	  instr_write_json (&stats, sp, gsl_odeiv2_step_name (step),
+			    params.T, params.rho, t_now, status);
+	  fclose (sp);
+	}
+      else
+	fprintf (stderr, "could not write %s\n", stats_file);
+      instr_free (&stats);
+    }
+
+  if (active)
+    {
+      printf ("%18s %d of %d isotopes, changed %ld times\n", "ACTIVE SET:",
+	      as.n, params.n_iso, as.n_changes);
+      active_set_free (&as);
+      rate_state_free (&act_params.rates);
+    }
+  if (ev_fp != NULL && fclose (ev_fp) != 0)
+    fprintf (stderr, "error writing events.dat\n");
   // free pointers
-  gsl_odeiv2_step_free (step);
-  gsl_odeiv2_control_free (control);
-  gsl_odeiv2_evolve_free (evolve);
+  if (driver != NULL)
+    gsl_odeiv2_driver_free (driver);
+  schedule_free (&sched);
+  trajectory_free (&traj);
+  rate_table_free (&table);
+  rate_state_free (&params.rates);
+  ratelib_close (&lib);
   // close file
-  fclose (fp);
-  return 0;
+  int out_status = GSL_SUCCESS;
+  if (out != NULL)
+    out_status = out_close (out);
+  else
+    fclose (fp);
+  network_free (&net);
+  if (out_status != GSL_SUCCESS)
+    {
+      fprintf (stderr, "error writing results.bin\n");
+      return 1;
+    }
+  // stopped early: there's more to do from the checkpoint
+  return stop_requested ? 1 : 0;
 }
@@ -0,0 +1,738 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "network.h"
+
+/* Generic reaction network: storage, construction, and the RHS and
+ * Jacobian kernels. None of this knows anything about which isotopes
+ * are in the network; see network_cno.c for the CNO cycle. */
+
+void
+network_init (struct network *net)
+{
+  memset (net, 0, sizeof (*net));
+}
+
+void
+network_free (struct network *net)
+{
+  free (net->iso);
+  free (net->rate_id);
+  free (net->reac_ptr);
+  free (net->reac_iso);
+  free (net->reac_stoich);
+  free (net->prod_ptr);
+  free (net->prod_iso);
+  free (net->prod_stoich);
+  free (net->slot_iso);
+  free (net->iso_ptr);
+  free (net->term_reac);
+  free (net->term_coeff);
+  free (net->rterm_ptr);
+  free (net->rterm_iso);
+  free (net->rterm_coeff);
+  free (net->jac_pos);
+  free (net->jac_slot);
+  free (net->jac_coeff);
+  free (net->jac_row_ptr);
+  free (net->jac_col);
+  free (net->jac_csr);
+  free (net->jac_color);
+  network_init (net);
+}
+
+/* make sure *p has room for at least n ints, growing it by doubling.
+ * returns 0 on success and -1 if we ran out of memory */
+static int
+grow_int (int **p, int *cap, int n)
+{
+  int new_cap = *cap > 0 ? *cap : 16;
+  int *q;
+  if (n <= *cap)
+    return 0;
+  while (new_cap < n)
+    new_cap *= 2;
+  q = realloc (*p, new_cap * sizeof (int));
+  if (q == NULL)
+    return -1;
+  *p = q;
+  *cap = new_cap;
+  return 0;
+}
+
+/* Adds an isotope to the table and returns its index, or -1 if we ran
+ * out of memory. */
+int
+network_add_isotope (struct network *net, const char *name, int Z, int A,
+		     double molar_mass)
+{
+  struct isotope *iso;
+  net->rhs_kernel = NULL;
+  if (net->n_iso == net->cap_iso)
+    {
+      int new_cap = net->cap_iso > 0 ? 2 * net->cap_iso : 16;
+      iso = realloc (net->iso, new_cap * sizeof (struct isotope));
+      if (iso == NULL)
+	return -1;
+      net->iso = iso;
+      net->cap_iso = new_cap;
+    }
+  iso = &net->iso[net->n_iso];
+  strncpy (iso->name, name, NET_NAME_LEN - 1);
+  iso->name[NET_NAME_LEN - 1] = '\0';
+  iso->Z = Z;
+  iso->A = A;
+  iso->molar_mass = molar_mass;
+  return net->n_iso++;
+}
+
+/* append the isotope list in[] (n of them, repeats allowed) to the
+ * CSR arrays iso/stoich, collapsing repeats into a stoichiometric
+ * coefficient. e.g. {h1, h1, c12} becomes (h1, 2), (c12, 1). returns
+ * the number of distinct isotopes written, or -1 if out of memory. */
+static int
+append_terms (int **iso, int **stoich, int *cap, int pos, int n,
+	      const int in[])
+{
+  int i, k, n_terms = 0;
+  int cap_stoich = *cap;
+  // grow stoich first so *cap never claims more room than both have
+  if (grow_int (stoich, &cap_stoich, pos + n) || grow_int (iso, cap, pos + n))
+    return -1;
+  for (i = 0; i < n; ++i)
+    {
+      for (k = 0; k < n_terms; ++k)
+	{
+	  if ((*iso)[pos + k] == in[i])
+	    break;
+	}
+      if (k < n_terms)
+	{
+	  (*stoich)[pos + k] += 1;
+	}
+      else
+	{
+	  (*iso)[pos + n_terms] = in[i];
+	  (*stoich)[pos + n_terms] = 1;
+	  ++n_terms;
+	}
+    }
+  return n_terms;
+}
+
+/* Adds the reaction in[0] + in[1] + ... -> out[0] + out[1] + ...,
+ * whose rate is lambda[rate_id]. An isotope that appears twice (like
+ * the two protons in H1 + H1) gets a stoichiometric coefficient of 2;
+ * any identical-particle factor has to be folded into the rate
+ * itself. At most NET_MAX_REACTANTS reactants are allowed. Returns the
+ * index of the new reaction, or -1 if something went wrong. Call
+ * network_finalize() once all the reactions are in. */
+int
+network_add_reaction (struct network *net, int rate_id, int n_in,
+		      const int in[], int n_out, const int out[])
+{
+  const int r = net->n_reac;
+  int n_terms;
+
+  net->rhs_kernel = NULL;
+  if (n_in < 1 || n_in > NET_MAX_REACTANTS)
+    return -1;
+
+  /* rate_id, reac_ptr and prod_ptr all share cap_reac (the _ptr
+   * arrays need n_reac + 1 entries) */
+  if (r + 2 > net->cap_reac)
+    {
+      int cap_id = net->cap_reac, cap_rp = net->cap_reac,
+	cap_pp = net->cap_reac;
+      if (grow_int (&net->rate_id, &cap_id, r + 2)
+	  || grow_int (&net->reac_ptr, &cap_rp, r + 2)
+	  || grow_int (&net->prod_ptr, &cap_pp, r + 2))
+	return -1;
+      net->cap_reac = cap_id;
+    }
+  if (r == 0)
+    {
+      net->reac_ptr[0] = 0;
+      net->prod_ptr[0] = 0;
+    }
+
+  n_terms = append_terms (&net->reac_iso, &net->reac_stoich,
+			  &net->cap_reac_terms, net->reac_ptr[r], n_in, in);
+  if (n_terms < 0)
+    return -1;
+  net->reac_ptr[r + 1] = net->reac_ptr[r] + n_terms;
+
+  n_terms = append_terms (&net->prod_iso, &net->prod_stoich,
+			  &net->cap_prod_terms, net->prod_ptr[r], n_out, out);
+  if (n_terms < 0)
+    return -1;
+  net->prod_ptr[r + 1] = net->prod_ptr[r] + n_terms;
+
+  net->rate_id[r] = rate_id;
+  return net->n_reac++;
+}
+
+// index of the isotope called name, or -1 if it's not in the network
+int
+network_find_isotope (const struct network *net, const char *name)
+{
+  int i;
+  for (i = 0; i < net->n_iso; ++i)
+    {
+      if (strcmp (net->iso[i].name, name) == 0)
+	return i;
+    }
+  return -1;
+}
+
+/* What to call rate k in output: the first reaction that uses it,
+ * e.g. "n15+h1->c12+he4", or "rate7" if none does. Cut short to fit
+ * len. */
+void
+network_rate_label (const struct network *net, int k, char *label,
+		    size_t len)
+{
+  size_t n = 0;
+  int r, j;
+
+  for (r = 0; r < net->n_reac && net->rate_id[r] != k; ++r)
+    ;
+  if (r == net->n_reac)
+    {
+      snprintf (label, len, "rate%d", k);
+      return;
+    }
+  label[0] = '\0';
+  for (j = net->reac_ptr[r]; j < net->reac_ptr[r + 1] && n < len; ++j)
+    n += snprintf (label + n, len - n, "%s%.0d%s",
+		   j > net->reac_ptr[r] ? "+" : "",
+		   net->reac_stoich[j] > 1 ? net->reac_stoich[j] : 0,
+		   net->iso[net->reac_iso[j]].name);
+  if (n < len)
+    n += snprintf (label + n, len - n, "->");
+  for (j = net->prod_ptr[r]; j < net->prod_ptr[r + 1] && n < len; ++j)
+    n += snprintf (label + n, len - n, "%s%.0d%s",
+		   j > net->prod_ptr[r] ? "+" : "",
+		   net->prod_stoich[j] > 1 ? net->prod_stoich[j] : 0,
+		   net->iso[net->prod_iso[j]].name);
+}
+
+/* net stoichiometry of reaction r, i.e. (products - reactants) for
+ * each isotope it touches. isotopes that cancel (catalysts) are
+ * dropped. iso[] and nu[] need room for all of r's reactant and
+ * product terms. returns how many were written. */
+static int
+net_stoich (const struct network *net, int r, int iso[], double nu[])
+{
+  int k, q, n = 0;
+  for (k = net->reac_ptr[r]; k < net->reac_ptr[r + 1]; ++k)
+    {
+      iso[n] = net->reac_iso[k];
+      nu[n++] = -net->reac_stoich[k];
+    }
+  for (k = net->prod_ptr[r]; k < net->prod_ptr[r + 1]; ++k)
+    {
+      for (q = 0; q < n; ++q)
+	{
+	  if (iso[q] == net->prod_iso[k])
+	    break;
+	}
+      if (q < n)
+	{
+	  nu[q] += net->prod_stoich[k];
+	}
+      else
+	{
+	  iso[n] = net->prod_iso[k];
+	  nu[n++] = net->prod_stoich[k];
+	}
+    }
+  for (q = 0, k = 0; k < n; ++k)
+    {
+      if (nu[k] != 0.0)
+	{
+	  iso[q] = iso[k];
+	  nu[q++] = nu[k];
+	}
+    }
+  return q;
+}
+
+static int
+compare_int (const void *a, const void *b)
+{
+  const int x = *(const int *) a, y = *(const int *) b;
+  return (x > y) - (x < y);
+}
+
+/* the CSR sparsity pattern of the Jacobian: every position in the
+ * fill list plus the diagonal, and with the temperature as an unknown
+ * its row and column (every rate depends on T, and every reaction
+ * releases energy). sorting the row-major positions i*n_var + j puts
+ * them in CSR order for free. returns 0 or -1 if out of memory */
+static int
+build_jac_pattern (struct network *net)
+{
+  const int n = net->n_iso, nv = n + (net->temperature != 0);
+  const int n_keys = net->n_jac + nv + 2 * (nv - n) * n;
+  int *keys = malloc ((n_keys + 1) * sizeof (int));
+  int i, k, key, nnz = 0;
+
+  net->n_var = nv;
+  net->jac_row_ptr = malloc ((nv + 1) * sizeof (int));
+  net->jac_col = malloc ((n_keys + 1) * sizeof (int));
+  net->jac_csr = malloc ((net->n_jac + 1) * sizeof (int));
+  if (keys == NULL || net->jac_row_ptr == NULL || net->jac_col == NULL
+      || net->jac_csr == NULL)
+    {
+      free (keys);
+      return -1;
+    }
+
+  // jac_pos is in the n_iso x n_iso matrix network_jacobian() fills
+  for (k = 0; k < net->n_jac; ++k)
+    keys[k] = net->jac_pos[k] / n * nv + net->jac_pos[k] % n;
+  for (i = 0; i < nv; ++i)
+    keys[net->n_jac + i] = i * nv + i;
+  if (nv > n)
+    for (i = 0; i < n; ++i)
+      {
+	keys[net->n_jac + nv + 2 * i] = i * nv + n;
+	keys[net->n_jac + nv + 2 * i + 1] = n * nv + i;
+      }
+  qsort (keys, n_keys, sizeof (int), compare_int);
+  for (k = 0; k < n_keys; ++k)
+    {
+      if (nnz == 0 || keys[k] != keys[nnz - 1])
+	keys[nnz++] = keys[k];
+    }
+
+  for (i = 0; i <= nv; ++i)
+    net->jac_row_ptr[i] = 0;
+  for (k = 0; k < nnz; ++k)
+    {
+      net->jac_col[k] = keys[k] % nv;
+      ++net->jac_row_ptr[keys[k] / nv + 1];
+    }
+  for (i = 0; i < nv; ++i)
+    net->jac_row_ptr[i + 1] += net->jac_row_ptr[i];
+  for (k = 0; k < net->n_jac; ++k)
+    {
+      key = net->jac_pos[k] / n * nv + net->jac_pos[k] % n;
+      const int *hit = bsearch (&key, keys, nnz, sizeof (int), compare_int);
+      net->jac_csr[k] = hit - keys;
+    }
+  net->jac_nnz = nnz;
+  free (keys);
+  return 0;
+}
+
+/* Builds the arrays the kernels use (slot_iso, the per-isotope term
+ * list, the Jacobian fill list and pattern, and the column coloring)
+ * from the reaction list. Has to be called after the last
+ * network_add_reaction() and before the network is handed to the
+ * integrator. Returns 0, or -1 if out of memory. */
+int
+network_finalize (struct network *net)
+{
+  const int n = net->n_iso, m = net->n_reac;
+  int r, k, q, s, max_terms = 0, n_terms = 0, n_jac = 0;
+
+  for (r = 0; r < m; ++r)
+    {
+      q = net->reac_ptr[r + 1] - net->reac_ptr[r]
+	+ net->prod_ptr[r + 1] - net->prod_ptr[r];
+      if (q > max_terms)
+	max_terms = q;
+    }
+
+  int iso[max_terms + 1];
+  double nu[max_terms + 1];
+
+  free (net->slot_iso);
+  free (net->iso_ptr);
+  free (net->term_reac);
+  free (net->term_coeff);
+  free (net->rterm_ptr);
+  free (net->rterm_iso);
+  free (net->rterm_coeff);
+  free (net->jac_pos);
+  free (net->jac_slot);
+  free (net->jac_coeff);
+  free (net->jac_row_ptr);
+  free (net->jac_col);
+  free (net->jac_csr);
+  net->jac_row_ptr = NULL;
+  net->jac_col = NULL;
+  net->jac_csr = NULL;
+  net->term_reac = NULL;
+  net->term_coeff = NULL;
+  net->rterm_iso = NULL;
+  net->rterm_coeff = NULL;
+  net->jac_pos = NULL;
+  net->jac_slot = NULL;
+  net->jac_coeff = NULL;
+  net->slot_iso = malloc ((NET_MAX_REACTANTS * m + 1) * sizeof (int));
+  net->iso_ptr = calloc (n + 1, sizeof (int));
+  net->rterm_ptr = malloc ((m + 1) * sizeof (int));
+  if (net->slot_iso == NULL || net->iso_ptr == NULL
+      || net->rterm_ptr == NULL)
+    return -1;
+
+  // fill the reactant slots, and count terms per isotope
+  for (r = 0; r < m; ++r)
+    {
+      int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+      s = 0;
+      for (k = net->reac_ptr[r]; k < net->reac_ptr[r + 1]; ++k)
+	{
+	  for (q = 0; q < net->reac_stoich[k]; ++q)
+	    {
+	      if (s == NET_MAX_REACTANTS)
+		return -1;
+	      slot[s++] = net->reac_iso[k];
+	    }
+	}
+      while (s < NET_MAX_REACTANTS)
+	slot[s++] = n;
+
+      q = net_stoich (net, r, iso, nu);
+      for (k = 0; k < q; ++k)
+	++net->iso_ptr[iso[k] + 1];
+      net->rterm_ptr[r] = n_terms;
+      n_terms += q;
+      for (s = 0; s < NET_MAX_REACTANTS; ++s)
+	{
+	  if (slot[s] < n)
+	    n_jac += q;
+	}
+    }
+  net->rterm_ptr[m] = n_terms;
+  for (k = 0; k < n; ++k)
+    net->iso_ptr[k + 1] += net->iso_ptr[k];
+
+  net->term_reac = malloc ((n_terms + 1) * sizeof (int));
+  net->term_coeff = malloc ((n_terms + 1) * sizeof (double));
+  net->rterm_iso = malloc ((n_terms + 1) * sizeof (int));
+  net->rterm_coeff = malloc ((n_terms + 1) * sizeof (double));
+  net->jac_pos = malloc ((n_jac + 1) * sizeof (int));
+  net->jac_slot = malloc ((n_jac + 1) * sizeof (int));
+  net->jac_coeff = malloc ((n_jac + 1) * sizeof (double));
+  if (net->term_reac == NULL || net->term_coeff == NULL
+      || net->rterm_iso == NULL || net->rterm_coeff == NULL
+      || net->jac_pos == NULL || net->jac_slot == NULL
+      || net->jac_coeff == NULL)
+    return -1;
+
+  {
+    /* next free position in each isotope's term list. reactions are
+     * visited in order, so each isotope's terms come out sorted by
+     * reaction */
+    int fill[n + 1];
+    for (k = 0; k <= n; ++k)
+      fill[k] = net->iso_ptr[k];
+    n_jac = 0;
+    for (r = 0; r < m; ++r)
+      {
+	const int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+	q = net_stoich (net, r, iso, nu);
+	for (k = 0; k < q; ++k)
+	  {
+	    net->term_reac[fill[iso[k]]] = r;
+	    net->term_coeff[fill[iso[k]]++] = nu[k];
+	    net->rterm_iso[net->rterm_ptr[r] + k] = iso[k];
+	    net->rterm_coeff[net->rterm_ptr[r] + k] = nu[k];
+	  }
+	for (s = 0; s < NET_MAX_REACTANTS; ++s)
+	  {
+	    if (slot[s] == n)
+	      continue;
+	    for (k = 0; k < q; ++k)
+	      {
+		net->jac_pos[n_jac] = iso[k] * n + slot[s];
+		net->jac_slot[n_jac] = NET_MAX_REACTANTS * r + s;
+		net->jac_coeff[n_jac++] = nu[k];
+	      }
+	  }
+      }
+  }
+  net->n_jac = n_jac;
+  if (build_jac_pattern (net) != 0)
+    return -1;
+  return network_color_columns (net);
+}
+
+/* Builds in sub the part of full that only involves the isotopes with
+ * pos[i] >= 0, which become isotope pos[i] of sub (pos has to number
+ * them 0, 1, ... in the order they're in full). A reaction is kept if
+ * all its reactants are in sub; products that aren't just drop out of
+ * it, so the reactants still get used up at the right rate. sub gets
+ * finalized. Returns 0, or -1 (with sub freed) if out of memory. */
+int
+network_subset (const struct network *full, const int pos[],
+		struct network *sub)
+{
+  int i, r, k, q, n_in, n_out, max_out = 1, status = 0;
+
+  for (r = 0; r < full->n_reac; ++r)
+    {
+      n_out = 0;
+      for (k = full->prod_ptr[r]; k < full->prod_ptr[r + 1]; ++k)
+	n_out += full->prod_stoich[k];
+      if (n_out > max_out)
+	max_out = n_out;
+    }
+
+  int in[NET_MAX_REACTANTS], out[max_out];
+
+  network_init (sub);
+  for (i = 0; i < full->n_iso; ++i)
+    if (pos[i] >= 0
+	&& network_add_isotope (sub, full->iso[i].name, full->iso[i].Z,
+				full->iso[i].A, full->iso[i].molar_mass) < 0)
+      {
+	network_free (sub);
+	return -1;
+      }
+  for (r = 0; r < full->n_reac; ++r)
+    {
+      n_in = 0;
+      for (k = full->reac_ptr[r]; k < full->reac_ptr[r + 1]; ++k)
+	for (q = 0; q < full->reac_stoich[k]; ++q)
+	  in[n_in++] = pos[full->reac_iso[k]];
+      for (q = 0; q < n_in; ++q)
+	if (in[q] < 0)
+	  break;
+      if (q < n_in)
+	continue;		// a reactant is missing, so there's no flux
+      n_out = 0;
+      for (k = full->prod_ptr[r]; k < full->prod_ptr[r + 1]; ++k)
+	if (pos[full->prod_iso[k]] >= 0)
+	  for (q = 0; q < full->prod_stoich[k]; ++q)
+	    out[n_out++] = pos[full->prod_iso[k]];
+      status |= network_add_reaction (sub, full->rate_id[r], n_in, in,
+				      n_out, out);
+    }
+  if (status < 0 || network_finalize (sub) != 0)
+    {
+      network_free (sub);
+      return -1;
+    }
+  return 0;
+}
+
+/* Makes the temperature one of the unknowns (on != 0), after the
+ * abundances, or takes it out again, and rebuilds the Jacobian
+ * pattern for that. Has to be called on a finalized network. Returns
+ * 0, or -1 if out of memory. */
+int
+network_set_temperature (struct network *net, int on)
+{
+  net->temperature = on != 0;
+  return network_finalize (net);
+}
+
+/* dY_i/dt for every isotope. each reaction's flux (mol/cm^3/s) is
+ *
+ *   lambda * prod_{reactants k} y_k^(s_k)
+ *
+ * and dY_i/dt is the sum of the fluxes of the reactions that make or
+ * destroy i, times the net number of i made per reaction.
+ *
+ * this is the hottest loop in the program, so it goes over the
+ * reactions once, working out each flux and adding it straight into
+ * the isotopes it changes (rterm_*), with nothing copied or stored on
+ * the way. the unused reactant slots are skipped instead of pointing
+ * them at a 1.0; multiplying by 1.0 was exact anyway, and each dY_i/dt
+ * still gets its terms added in reaction order, so the result is the
+ * same to the last bit as summing isotope by isotope. */
+void
+network_rhs (const struct network *net, const double lambda[],
+	     const double y[], double dydt[])
+{
+  const int n = net->n_iso, m = net->n_reac;
+  const int *restrict slot = net->slot_iso;
+  const int *restrict rate_id = net->rate_id;
+  const int *restrict ptr = net->rterm_ptr;
+  const int *restrict iso = net->rterm_iso;
+  const double *restrict coeff = net->rterm_coeff;
+  int i, r, k;
+
+  if (net->rhs_kernel != NULL)
+    {
+      net->rhs_kernel (lambda, y, dydt);
+      return;
+    }
+  for (i = 0; i < n; ++i)
+    dydt[i] = 0.0;
+  for (r = 0; r < m; ++r, slot += NET_MAX_REACTANTS)
+    {
+      double f = lambda[rate_id[r]] * y[slot[0]];
+      if (slot[1] < n)
+	f *= y[slot[1]];
+      if (slot[2] < n)
+	f *= y[slot[2]];
+      for (k = ptr[r]; k < ptr[r + 1]; ++k)
+	dydt[iso[k]] += coeff[k] * f;
+    }
+}
+
+/* The derivatives of dY_i/dt w.r.t. the log of each rate, for forward
+ * sensitivities: the RHS is linear in the rates, so column k is just
+ * network_rhs() with every rate but lambda[k] set to zero, i.e. the
+ * terms of the reactions that use rate k. All n_rates columns come out
+ * of one pass over the reactions: dfdp[k * n_iso + i] for rate k. */
+void
+network_rate_derivatives (const struct network *net, const double lambda[],
+			  int n_rates, const double y[], double dfdp[])
+{
+  const int n = net->n_iso, m = net->n_reac;
+  const int *slot = net->slot_iso;
+  int r, k;
+
+  for (k = 0; k < n_rates * n; ++k)
+    dfdp[k] = 0.0;
+  for (r = 0; r < m; ++r, slot += NET_MAX_REACTANTS)
+    {
+      const int id = net->rate_id[r];
+      double f = lambda[id] * y[slot[0]];
+      if (slot[1] < n)
+	f *= y[slot[1]];
+      if (slot[2] < n)
+	f *= y[slot[2]];
+      for (k = net->rterm_ptr[r]; k < net->rterm_ptr[r + 1]; ++k)
+	dfdp[id * n + net->rterm_iso[k]] += net->rterm_coeff[k] * f;
+    }
+}
+
+/* network_rhs(), and on the way the energy the reactions release:
+ *
+ *   *e = sum over reactions of q[rate] * flux,  *e_nu the same with q_nu
+ *
+ * with q and q_nu indexed by rate like lambda, e.g. rate_q and
+ * rate_q_nu (MeV, which makes *e MeV mol/cm^3/s). It's a couple more
+ * multiply-adds per reaction on the fluxes we have anyway. */
+void
+network_rhs_energy (const struct network *net, const double lambda[],
+		    const double y[], double dydt[], const double q[],
+		    const double q_nu[], double *e, double *e_nu)
+{
+  const int n = net->n_iso, m = net->n_reac;
+  const int *restrict slot = net->slot_iso;
+  const int *restrict ptr = net->rterm_ptr;
+  const int *restrict iso = net->rterm_iso;
+  const double *restrict coeff = net->rterm_coeff;
+  int i, r, k;
+  double sum_q = 0.0, sum_nu = 0.0;
+
+  for (i = 0; i < n; ++i)
+    dydt[i] = 0.0;
+  for (r = 0; r < m; ++r, slot += NET_MAX_REACTANTS)
+    {
+      const int id = net->rate_id[r];
+      double f = lambda[id] * y[slot[0]];
+      if (slot[1] < n)
+	f *= y[slot[1]];
+      if (slot[2] < n)
+	f *= y[slot[2]];
+      sum_q += q[id] * f;
+      sum_nu += q_nu[id] * f;
+      for (k = ptr[r]; k < ptr[r + 1]; ++k)
+	dydt[iso[k]] += coeff[k] * f;
+    }
+  *e = sum_q;
+  *e_nu = sum_nu;
+}
+
+/* derivative of each reaction's flux w.r.t. each of its reactant
+ * slots, NET_MAX_REACTANTS per reaction */
+static void
+flux_derivatives (const struct network *net, const double lambda[],
+		  const double y[], double dflux[])
+{
+  const int n = net->n_iso, m = net->n_reac;
+  int r;
+
+  for (r = 0; r < m; ++r)
+    {
+      const int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+      const double rate = lambda[net->rate_id[r]];
+      // an unused slot is a factor of 1
+      const double a = y[slot[0]];
+      const double b = slot[1] < n ? y[slot[1]] : 1.0;
+      const double c = slot[2] < n ? y[slot[2]] : 1.0;
+      double *d = &dflux[NET_MAX_REACTANTS * r];
+      d[0] = rate * b * c;
+      d[1] = rate * a * c;
+      d[2] = rate * a * b;
+    }
+}
+
+/* The energy released, sum of q[rate] * flux like network_rhs_energy(),
+ * and its derivatives w.r.t. each abundance in dedy (n_iso of them),
+ * for the temperature row of the Jacobian */
+double
+network_energy_gradient (const struct network *net, const double lambda[],
+			 const double y[], const double q[], double dedy[])
+{
+  const int n = net->n_iso, m = net->n_reac;
+  int i, r, s;
+  double dflux[NET_MAX_REACTANTS * m + 1];
+  double e = 0.0;
+
+  flux_derivatives (net, lambda, y, dflux);
+  for (i = 0; i < n; ++i)
+    dedy[i] = 0.0;
+  for (r = 0; r < m; ++r)
+    {
+      const int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+      const double qr = q[net->rate_id[r]];
+      for (s = 0; s < NET_MAX_REACTANTS; ++s)
+	if (slot[s] < n)
+	  dedy[slot[s]] += qr * dflux[NET_MAX_REACTANTS * r + s];
+      // flux = d(flux)/d(first slot) * y there; every reaction has one
+      e += qr * dflux[NET_MAX_REACTANTS * r] * y[slot[0]];
+    }
+  return e;
+}
+
+/* Jacobian J[i][j] = d(dY_i/dt)/dY_j, stored row-major in dfdy the way
+ * GSL wants it. we differentiate each reaction's flux w.r.t. each of
+ * its reactant slots (a reactant with stoichiometry 2 sits in two
+ * slots, and the product rule adds them up), and then spread those
+ * derivatives over the matrix with the fill list network_finalize()
+ * built. */
+void
+network_jacobian (const struct network *net, const double lambda[],
+		  const double y[], double *dfdy)
+{
+  const int n = net->n_iso, m = net->n_reac;
+  int i, k;
+  double dflux[NET_MAX_REACTANTS * m + 1];
+
+  flux_derivatives (net, lambda, y, dflux);
+
+  for (i = 0; i < n * n; ++i)
+    dfdy[i] = 0.0;
+  for (k = 0; k < net->n_jac; ++k)
+    dfdy[net->jac_pos[k]] += net->jac_coeff[k] * dflux[net->jac_slot[k]];
+}
+
+/* Same as network_jacobian() but only the nonzeros, in the CSR pattern
+ * jac_row_ptr/jac_col. jac_val needs jac_nnz entries. */
+void
+network_jacobian_sparse (const struct network *net, const double lambda[],
+			 const double y[], double jac_val[])
+{
+  const int m = net->n_reac;
+  int k;
+  double dflux[NET_MAX_REACTANTS * m + 1];
+
+  flux_derivatives (net, lambda, y, dflux);
+
+  for (k = 0; k < net->jac_nnz; ++k)
+    jac_val[k] = 0.0;
+  for (k = 0; k < net->n_jac; ++k)
+    jac_val[net->jac_csr[k]] +=
+      net->jac_coeff[k] * dflux[net->jac_slot[k]];
+}
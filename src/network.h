@@ -0,0 +1,136 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stddef.h>
+
+/* A reaction network is just a list of isotopes and a list of
+ * reactions between them. Each reaction has some reactants, some
+ * products and a rate (an index into the rate vector, see enum
+ * rate_id in rate_coeffs.h). The reactant and product lists of all
+ * the reactions are packed end to end into flat arrays, CSR-style:
+ * the reactants of reaction r are
+ *
+ *   reac_iso[reac_ptr[r]] ... reac_iso[reac_ptr[r+1] - 1]
+ *
+ * with stoichiometric coefficients in reac_stoich[] at the same
+ * positions, and likewise for the products. This way the RHS and
+ * Jacobian are a couple of loops over the reaction list, and adding
+ * an isotope or a reaction doesn't mean editing three files. */
+
+#define NET_NAME_LEN 8
+/* most reactions have 1 or 2 reactants; 3 covers triple-alpha. the
+ * kernels are unrolled for this many */
+#define NET_MAX_REACTANTS 3
+
+struct isotope
+{
+  char name[NET_NAME_LEN];	// lower-case, e.g. "c12"
+  int Z;			// proton number
+  int A;			// mass number
+  double molar_mass;		// g/mol
+};
+
+struct network
+{
+  int n_iso;			// number of isotopes
+  int n_reac;			// number of reactions
+  struct isotope *iso;		// isotope table, n_iso long
+  int *rate_id;			// rate of each reaction, n_reac long
+  int *reac_ptr;		// n_reac + 1 offsets into reac_iso/reac_stoich
+  int *reac_iso;
+  int *reac_stoich;
+  int *prod_ptr;		// n_reac + 1 offsets into prod_iso/prod_stoich
+  int *prod_iso;
+  int *prod_stoich;
+  int cap_iso, cap_reac, cap_reac_terms, cap_prod_terms;	// allocated sizes
+  /* if set (network_set_temperature()), the temperature is one of the
+   * unknowns too, after the abundances: the system is n_iso + 1 long
+   * and its dT/dt comes from the energy the reactions release (see
+   * energy.c) */
+  int temperature;
+
+  /* everything below is derived from the reaction list by
+   * network_finalize() and is what the RHS and Jacobian kernels
+   * actually loop over. */
+  /* reactant slots, NET_MAX_REACTANTS per reaction. a reactant with
+   * stoichiometry 2 takes 2 slots; unused slots hold n_iso, a factor of
+   * 1.0 that the kernels skip */
+  int *slot_iso;
+  /* net production of isotope i, grouped by isotope (CSR again):
+   * dY_i/dt = sum over k in [iso_ptr[i], iso_ptr[i+1]) of
+   * term_coeff[k] * flux[term_reac[k]] */
+  int *iso_ptr;
+  int *term_reac;
+  double *term_coeff;
+  /* the same terms grouped by reaction instead, which is what the RHS
+   * loops over: reaction r adds rterm_coeff[k] * flux to dY/dt of
+   * isotope rterm_iso[k] for k in [rterm_ptr[r], rterm_ptr[r+1]), so
+   * each flux goes straight to its isotopes without being stored */
+  int *rterm_ptr;
+  int *rterm_iso;
+  double *rterm_coeff;
+  /* nonzero Jacobian contributions: dfdy[jac_pos[k]] +=
+   * jac_coeff[k] * d(flux)/d(slot jac_slot[k]) */
+  int n_jac;
+  int *jac_pos;
+  int *jac_slot;
+  double *jac_coeff;
+  /* sparsity pattern of the Jacobian in CSR form (the full diagonal is
+   * always included, since the stiff steppers factor I - h*J), and for
+   * each fill list entry the position of its nonzero in that pattern.
+   * it has n_var rows and columns: n_iso, plus a full last row and
+   * column for the temperature if it's an unknown */
+  int n_var;
+  int jac_nnz;
+  int *jac_row_ptr;
+  int *jac_col;
+  int *jac_csr;
+  /* columns of that pattern colored so that no row has two of the same
+   * color, for the AD Jacobian (network_ad.c) */
+  int n_color;
+  int *jac_color;
+  /* if not NULL, the RHS written out by hand for exactly this reaction
+   * list, which network_rhs() calls instead of looping over it (see
+   * network_cno.c). adding an isotope or reaction drops it */
+  void (*rhs_kernel) (const double lambda[], const double y[],
+		      double dydt[]);
+};
+
+void network_init (struct network *net);
+void network_free (struct network *net);
+int network_add_isotope (struct network *net, const char *name, int Z,
+			 int A, double molar_mass);
+int network_add_reaction (struct network *net, int rate_id, int n_in,
+			  const int in[], int n_out, const int out[]);
+int network_finalize (struct network *net);
+int network_find_isotope (const struct network *net, const char *name);
+void network_rate_label (const struct network *net, int k, char *label,
+			 size_t len);
+int network_subset (const struct network *full, const int pos[],
+		    struct network *sub);
+int network_set_temperature (struct network *net, int on);
+
+void network_rhs (const struct network *net, const double lambda[],
+		  const double y[], double dydt[]);
+void network_rate_derivatives (const struct network *net,
+			       const double lambda[], int n_rates,
+			       const double y[], double dfdp[]);
+void network_rhs_energy (const struct network *net, const double lambda[],
+			 const double y[], double dydt[], const double q[],
+			 const double q_nu[], double *e, double *e_nu);
+double network_energy_gradient (const struct network *net,
+				const double lambda[], const double y[],
+				const double q[], double dedy[]);
+void network_jacobian (const struct network *net, const double lambda[],
+		       const double y[], double *dfdy);
+void network_jacobian_sparse (const struct network *net,
+			      const double lambda[], const double y[],
+			      double jac_val[]);
+int network_color_columns (struct network *net);
+void network_jacobian_ad (const struct network *net, const double lambda[],
+			  const double y[], double dydt[], double jac_val[]);
+
+// the 13-isotope CNO network this code started with
+int network_cno_init (struct network *net);
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include "network.h"
+
+/* The Jacobian by forward-mode automatic differentiation of the RHS.
+ *
+ * network_jacobian() builds J from a fill list that network_finalize()
+ * derives from the stoichiometry, which is a second, separate
+ * derivation of the same equations as network_rhs(); the old
+ * hand-written CNO Jacobian drifted from its RHS exactly that way,
+ * with zero rates and the wrong isotope in places. Here we just run
+ * network_rhs() again on dual numbers, y_j + dy_j e, and carry the
+ * derivative parts along with the values: every flux is a product, so
+ * its derivative is the product rule, and every dY_i/dt is a sum.
+ * Whatever the RHS computes, this differentiates, so it's right by
+ * construction.
+ *
+ * Seeding one column at a time would take n_iso passes. But J is
+ * sparse, and two columns that never have a nonzero in the same row
+ * can share a seed: the derivative in the direction e_j + e_k is
+ * column j in the rows where j has its nonzeros and column k in the
+ * others. So network_color_columns() colors the columns of the pattern
+ * so that no row sees a color twice (Curtis, Powell & Reid 1974), and
+ * the duals carry one derivative lane per color, all of them going
+ * through one pass over the reactions. For the CNO network that's 8
+ * lanes instead of 13: the H1 row has a nonzero for every isotope that
+ * captures a proton, and those 8 columns can't share, but the other 5
+ * fit in between. */
+
+/* Greedy coloring, largest columns first: each column gets the lowest
+ * color not already used by a column it shares a row with. Fills in
+ * n_color and jac_color. Returns 0, or -1 if out of memory. */
+int
+network_color_columns (struct network *net)
+{
+  const int n = net->n_iso;
+  int *count = calloc (n + 1, sizeof (int));
+  int *order = malloc ((n + 1) * sizeof (int));
+  int *used = malloc ((n + 1) * sizeof (int));
+  int i, j, k, p, c, q;
+
+  free (net->jac_color);
+  net->jac_color = malloc ((n + 1) * sizeof (int));
+  if (count == NULL || order == NULL || used == NULL
+      || net->jac_color == NULL)
+    {
+      free (count);
+      free (order);
+      free (used);
+      return -1;
+    }
+
+  for (p = 0; p < net->jac_nnz; ++p)
+    ++count[net->jac_col[p]];
+  // insertion sort by decreasing count; n is small and this runs once
+  for (j = 0; j < n; ++j)
+    {
+      for (k = j; k > 0 && count[order[k - 1]] < count[j]; --k)
+	order[k] = order[k - 1];
+      order[k] = j;
+    }
+
+  // the temperature's column, if it has one, is left to jacobian.c
+  for (j = 0; j <= n; ++j)
+    net->jac_color[j] = -1;
+  net->n_color = 0;
+  for (q = 0; q < n; ++q)
+    {
+      j = order[q];
+      /* used[c] == j marks color c as taken by a neighbour of column j.
+       * rows aren't stored by column, so look at every row that has j */
+      for (c = 0; c < n; ++c)
+	used[c] = -1;
+      for (i = 0; i < n; ++i)
+	{
+	  int has_j = 0;
+	  for (p = net->jac_row_ptr[i]; p < net->jac_row_ptr[i + 1]; ++p)
+	    if (net->jac_col[p] == j)
+	      has_j = 1;
+	  if (!has_j)
+	    continue;
+	  for (p = net->jac_row_ptr[i]; p < net->jac_row_ptr[i + 1]; ++p)
+	    if (net->jac_color[net->jac_col[p]] >= 0)
+	      used[net->jac_color[net->jac_col[p]]] = j;
+	}
+      for (c = 0; used[c] == j; ++c)
+	;
+      net->jac_color[j] = c;
+      if (c + 1 > net->n_color)
+	net->n_color = c + 1;
+    }
+
+  free (count);
+  free (order);
+  free (used);
+  return 0;
+}
+
+/* dY/dt (if dydt isn't NULL) and the Jacobian, in the CSR pattern
+ * jac_row_ptr/jac_col like network_jacobian_sparse(), from one pass of
+ * the RHS on dual numbers with n_color derivative lanes. The lanes are
+ * the innermost loop everywhere, so they vectorize. */
+void
+network_jacobian_ad (const struct network *net, const double lambda[],
+		     const double y[], double dydt[], double jac_val[])
+{
+  const int n = net->n_iso, m = net->n_reac, nc = net->n_color;
+  int i, r, k, l, p;
+  /* the duals: value and nc derivative lanes for every y (plus the
+   * constant 1.0 the unused reactant slots point at), every flux and
+   * every dY/dt */
+  double yy[n + 1], dy[(n + 1) * nc];
+  double flux[m + 1], dflux[(m + 1) * nc];
+  double f, df[nc];
+
+  // seed: y_j moves in lane color[j], the constant doesn't move
+  for (i = 0; i <= n; ++i)
+    {
+      yy[i] = i < n ? y[i] : 1.0;
+      for (l = 0; l < nc; ++l)
+	dy[i * nc + l] = 0.0;
+      if (i < n)
+	dy[i * nc + net->jac_color[i]] = 1.0;
+    }
+
+  // flux = lambda a b c, so dflux = lambda (bc da + ac db + ab dc)
+  for (r = 0; r < m; ++r)
+    {
+      const int *slot = &net->slot_iso[NET_MAX_REACTANTS * r];
+      const double rate = lambda[net->rate_id[r]];
+      const double a = yy[slot[0]], b = yy[slot[1]], c = yy[slot[2]];
+      const double pa = rate * b * c, pb = rate * a * c, pc = rate * a * b;
+      const double *da = &dy[slot[0] * nc], *db = &dy[slot[1] * nc];
+      const double *dc = &dy[slot[2] * nc];
+      flux[r] = rate * a * b * c;
+      for (l = 0; l < nc; ++l)
+	dflux[r * nc + l] = pa * da[l] + pb * db[l] + pc * dc[l];
+    }
+
+  /* dY_i/dt = sum of coeff * flux, and its derivative lanes. each
+   * nonzero (i, j) of the row is lane color[j] */
+  for (i = 0; i < n; ++i)
+    {
+      f = 0.0;
+      for (l = 0; l < nc; ++l)
+	df[l] = 0.0;
+      for (k = net->iso_ptr[i]; k < net->iso_ptr[i + 1]; ++k)
+	{
+	  const double coeff = net->term_coeff[k];
+	  const double *d = &dflux[net->term_reac[k] * nc];
+	  f += coeff * flux[net->term_reac[k]];
+	  for (l = 0; l < nc; ++l)
+	    df[l] += coeff * d[l];
+	}
+      if (dydt != NULL)
+	dydt[i] = f;
+      for (p = net->jac_row_ptr[i]; p < net->jac_row_ptr[i + 1]; ++p)
+	if (net->jac_col[p] < n)
+	  jac_val[p] = df[net->jac_color[net->jac_col[p]]];
+    }
+}
@@ -0,0 +1,111 @@
+#include <gsl/gsl_errno.h>
+#include "network.h"
+#include "rate_coeffs.h"
+
+/* The CNO network this code started out with: 13 isotopes, 9 proton
+ * captures and 4 beta-decays. The isotopes are added in the same order
+ * as the old hard-wired indices (He4 = 0, ..., H1 = 12) so the columns
+ * of results.dat don't move around. */
+
+/* The RHS of the network below written out, which is several times
+ * faster than network_rhs() looping over it (bench/bench_rhs). Each
+ * dY/dt adds up the same terms in the same order (that of the
+ * reactions) as the generic kernel does, so it gets the same numbers.
+ * The isotopes are numbered in the order they're added. */
+static void
+cno_rhs (const double lambda[], const double y[], double dydt[])
+{
+  const double f_c12_pg = lambda[R_C12_P_G_N13] * y[1] * y[12];
+  const double f_n13_b = lambda[R_N13_E_NU] * y[2];
+  const double f_c13_pg = lambda[R_C13_P_G_N14] * y[3] * y[12];
+  const double f_n14_pg = lambda[R_N14_P_G_O15] * y[4] * y[12];
+  const double f_o15_b = lambda[R_O15_E_NU] * y[5];
+  const double f_n15_pa = lambda[R_N15_P_A_C12] * y[6] * y[12];
+  const double f_n15_pg = lambda[R_N15_P_G_O16] * y[6] * y[12];
+  const double f_o16_pg = lambda[R_O16_P_G_F17] * y[7] * y[12];
+  const double f_f17_b = lambda[R_F17_E_NU] * y[8];
+  const double f_o17_pa = lambda[R_O17_P_A_N14] * y[9] * y[12];
+  const double f_o17_pg = lambda[R_O17_P_G_F18] * y[9] * y[12];
+  const double f_f18_b = lambda[R_F18_E_NU] * y[10];
+  const double f_o18_pa = lambda[R_O18_P_A_N15] * y[11] * y[12];
+
+  dydt[0] = f_n15_pa + f_o17_pa + f_o18_pa;
+  dydt[1] = -f_c12_pg + f_n15_pa;
+  dydt[2] = f_c12_pg - f_n13_b;
+  dydt[3] = f_n13_b - f_c13_pg;
+  dydt[4] = f_c13_pg - f_n14_pg + f_o17_pa;
+  dydt[5] = f_n14_pg - f_o15_b;
+  dydt[6] = f_o15_b - f_n15_pa - f_n15_pg + f_o18_pa;
+  dydt[7] = f_n15_pg - f_o16_pg;
+  dydt[8] = f_o16_pg - f_f17_b;
+  dydt[9] = f_f17_b - f_o17_pa - f_o17_pg;
+  dydt[10] = f_o17_pg - f_f18_b;
+  dydt[11] = f_f18_b - f_o18_pa;
+  dydt[12] = -f_c12_pg - f_c13_pg - f_n14_pg - f_n15_pa - f_n15_pg
+    - f_o16_pg - f_o17_pa - f_o17_pg - f_o18_pa;
+}
+
+int
+network_cno_init (struct network *net)
+{
+  int he4, c12, n13, c13, n14, o15, n15, o16, f17, o17, f18, o18, h1;
+  int status = 0;
+
+  network_init (net);
+
+  // molar masses in g/mol
+  he4 = network_add_isotope (net, "he4", 2, 4, 4.002602);
+  c12 = network_add_isotope (net, "c12", 6, 12, 12.0);
+  n13 = network_add_isotope (net, "n13", 7, 13, 13.005738609);
+  c13 = network_add_isotope (net, "c13", 6, 13, 13.00335483778);
+  n14 = network_add_isotope (net, "n14", 7, 14, 14.00307400478);
+  o15 = network_add_isotope (net, "o15", 8, 15, 15.003065617);
+  n15 = network_add_isotope (net, "n15", 7, 15, 15.00010889823);
+  o16 = network_add_isotope (net, "o16", 8, 16, 15.99491461956);
+  f17 = network_add_isotope (net, "f17", 9, 17, 17.002095237);
+  o17 = network_add_isotope (net, "o17", 8, 17, 16.999131703);
+  f18 = network_add_isotope (net, "f18", 9, 18, 18.000937956);
+  o18 = network_add_isotope (net, "o18", 8, 18, 17.999161001);
+  h1 = network_add_isotope (net, "h1", 1, 1, 1.00794);
+  if (h1 < 0)
+    {
+      network_free (net);
+      return GSL_ENOMEM;
+    }
+
+  {
+    // CN cycle
+    const int c12_p[] = { c12, h1 }, c13_p[] = { c13, h1 },
+      n14_p[] = { n14, h1 }, n15_p[] = { n15, h1 };
+    // NO, OF cycles
+    const int o16_p[] = { o16, h1 }, o17_p[] = { o17, h1 },
+      o18_p[] = { o18, h1 };
+    const int c12_he4[] = { c12, he4 }, n14_he4[] = { n14, he4 },
+      n15_he4[] = { n15, he4 };
+
+    status |= network_add_reaction (net, R_C12_P_G_N13, 2, c12_p, 1, &n13);
+    status |= network_add_reaction (net, R_N13_E_NU, 1, &n13, 1, &c13);
+    status |= network_add_reaction (net, R_C13_P_G_N14, 2, c13_p, 1, &n14);
+    status |= network_add_reaction (net, R_N14_P_G_O15, 2, n14_p, 1, &o15);
+    status |= network_add_reaction (net, R_O15_E_NU, 1, &o15, 1, &n15);
+    status |= network_add_reaction (net, R_N15_P_A_C12, 2, n15_p, 2,
+				    c12_he4);
+    status |= network_add_reaction (net, R_N15_P_G_O16, 2, n15_p, 1, &o16);
+    status |= network_add_reaction (net, R_O16_P_G_F17, 2, o16_p, 1, &f17);
+    status |= network_add_reaction (net, R_F17_E_NU, 1, &f17, 1, &o17);
+    status |= network_add_reaction (net, R_O17_P_A_N14, 2, o17_p, 2,
+				    n14_he4);
+    status |= network_add_reaction (net, R_O17_P_G_F18, 2, o17_p, 1, &f18);
+    status |= network_add_reaction (net, R_F18_E_NU, 1, &f18, 1, &o18);
+    status |= network_add_reaction (net, R_O18_P_A_N15, 2, o18_p, 2,
+				    n15_he4);
+  }
+  // network_add_reaction returns -1 on failure, which sets every bit
+  if (status < 0 || network_finalize (net) != 0)
+    {
+      network_free (net);
+      return GSL_ENOMEM;
+    }
+  net->rhs_kernel = cno_rhs;
+  return GSL_SUCCESS;
+}
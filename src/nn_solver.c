@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#include "jacobian.h"
+#include "network.h"
+#include "nn_solver.h"
+#include "ode_rhs.h"
+#include "param.h"
+#include "rate_coeffs.h"
+#include "steppers.h"
+
+/* See nn_solver.h. This is main.c's integration loop with everything
+ * that gets allocated moved into nn_solver_alloc(), so nn_advance()
+ * itself is just arithmetic on memory we already have: the rates get
+ * re-evaluated in place when T changes (rate_state_update()), the
+ * steppers keep their workspace, and the RHS and Jacobian kernels
+ * only use the stack. */
+
+// give up on a zone after this many steps
+#define NN_MAX_STEPS 100000
+
+// first step size, before there's a previous call to learn from
+#define NN_H0 1.0e-8
+
+struct nn_solver
+{
+  struct network net;
+  struct param params;
+  /* the driver keeps a pointer to sys, so it has to stay put, which is
+   * one reason this struct is only ever handed out by pointer */
+  gsl_odeiv2_system sys;
+  gsl_odeiv2_driver *driver;
+  double h;			// step size to start the next call with, 0 for none
+  double *y;			// mol/cm^3 while integrating
+  double *molar_mass;
+  struct nn_stats stats;
+};
+
+/* A solver for the CNO network using the named stepper (see
+ * steppers.c) and GSL's usual error control on y with eps_abs and
+ * eps_rel. NULL means "ros4": in short hydro steps a one-step method
+ * wins, because the BDF stepper has to start over at order 1 in every
+ * zone. Returns NULL if the stepper doesn't exist or we're out of
+ * memory. */
+struct nn_solver *
+nn_solver_alloc (const char *stepper, double eps_abs, double eps_rel)
+{
+  const gsl_odeiv2_step_type *type =
+    stepper_by_name (stepper != NULL ? stepper : "ros4");
+  struct nn_solver *ctx;
+  int i;
+
+  if (type == NULL)
+    return NULL;
+  ctx = calloc (1, sizeof (struct nn_solver));
+  if (ctx == NULL)
+    return NULL;
+  if (network_cno_init (&ctx->net) != GSL_SUCCESS)
+    {
+      free (ctx);
+      return NULL;
+    }
+  ctx->params.net = &ctx->net;
+  ctx->params.n_iso = ctx->net.n_iso;
+  ctx->params.traj = NULL;
+  ctx->params.traj_pos = 0;
+  ctx->params.instr = NULL;
+  ctx->params.jac_ad = 0;
+  ctx->params.energy = 0;
+  rate_state_init (&ctx->params.rates);
+
+  ctx->y = malloc (ctx->net.n_iso * sizeof (double));
+  ctx->molar_mass = malloc (ctx->net.n_iso * sizeof (double));
+  ctx->sys.function = ode_rhs;
+  ctx->sys.jacobian = jacobian;
+  ctx->sys.dimension = ctx->net.n_iso;
+  ctx->sys.params = &ctx->params;
+  ctx->driver = gsl_odeiv2_driver_alloc_y_new (&ctx->sys, type, NN_H0,
+					       eps_abs, eps_rel);
+  if (ctx->y == NULL || ctx->molar_mass == NULL || ctx->driver == NULL)
+    {
+      nn_solver_free (ctx);
+      return NULL;
+    }
+  for (i = 0; i < ctx->net.n_iso; ++i)
+    ctx->molar_mass[i] = ctx->net.iso[i].molar_mass;
+  return ctx;
+}
+
+void
+nn_solver_free (struct nn_solver *ctx)
+{
+  if (ctx == NULL)
+    return;
+  if (ctx->driver != NULL)
+    gsl_odeiv2_driver_free (ctx->driver);
+  free (ctx->y);
+  free (ctx->molar_mass);
+  network_free (&ctx->net);
+  free (ctx);
+}
+
+// number of isotopes, i.e. how long x[] in nn_advance() is
+int
+nn_solver_n_iso (const struct nn_solver *ctx)
+{
+  return ctx->net.n_iso;
+}
+
+// name of isotope i ("h1", "c12", ...), which is x[i] in nn_advance()
+const char *
+nn_solver_isotope (const struct nn_solver *ctx, int i)
+{
+  return ctx->net.iso[i].name;
+}
+
+void
+nn_solver_stats (const struct nn_solver *ctx, struct nn_stats *stats)
+{
+  *stats = ctx->stats;
+}
+
+/* Burns one zone at temperature T (K) and density rho (g/cm^3), both
+ * constant, for dt seconds. x[] holds the mass fractions, in the
+ * order of nn_solver_isotope(), and gets the new ones. Returns
+ * GSL_SUCCESS, GSL_EINVAL for a negative dt, GSL_EMAXITER if the zone
+ * needed more than NN_MAX_STEPS steps, or whatever the stepper
+ * returned; on an error x[] is left as it was.
+ *
+ * The first step is the step size the integrator wanted at the end of
+ * the previous call. In a hydro code that's usually the previous zone,
+ * which is usually a lot like this one, so most of the step size
+ * search the integrator would otherwise do from scratch is skipped. */
+int
+nn_advance (struct nn_solver *ctx, double T, double rho, double x[],
+	    double dt)
+{
+  const int n_iso = ctx->net.n_iso;
+  gsl_odeiv2_driver *d = ctx->driver;
+  double *y = ctx->y;
+  double t = 0.0, t_prev, h, h_try;
+  long n_steps = 0, failed;
+  int i, status = GSL_SUCCESS;
+
+  if (dt < 0.0)
+    return GSL_EINVAL;
+  ++ctx->stats.n_calls;
+  if (dt == 0.0)
+    return GSL_SUCCESS;
+
+  // rates get re-evaluated by the RHS, in place, if T or rho changed
+  ctx->params.T = T;
+  ctx->params.rho = rho;
+  for (i = 0; i < n_iso; ++i)
+    y[i] = x[i] * (rho / ctx->molar_mass[i]);
+
+  /* nothing carries over from the last zone except the step size: the
+   * steppers' saved Jacobians and histories belong to another y */
+  gsl_odeiv2_driver_reset (d);
+  h = ctx->h > 0.0 ? ctx->h : NN_H0;
+  if (h > dt)
+    h = dt;
+
+  while (t < dt)
+    {
+      if (n_steps == NN_MAX_STEPS)
+	{
+	  status = GSL_EMAXITER;
+	  break;
+	}
+      t_prev = t;
+      h_try = h;
+      failed = d->e->failed_steps;
+      status = gsl_odeiv2_evolve_apply (d->e, d->c, d->s, d->sys, &t, dt,
+					&h, y);
+      if (status != GSL_SUCCESS)
+	break;
+      ++n_steps;
+      /* the last step gets cut short to land on dt, and h is then based
+       * on that. if the integrator was happy with h_try, that's the
+       * better guess for the next call */
+      if (t == dt && dt - t_prev < h_try && d->e->failed_steps == failed
+	  && h < h_try)
+	h = h_try;
+      // same cut-off as main.c
+      for (i = 0; i < n_iso; ++i)
+	{
+	  if (y[i] / (rho / ctx->molar_mass[i]) < 1.0e-20)
+	    y[i] = 0.0;
+	}
+    }
+
+  ctx->stats.n_steps += n_steps;
+  ctx->stats.n_rejected += d->e->failed_steps;
+  if (status != GSL_SUCCESS)
+    {
+      // don't let a zone that failed decide where the next one starts
+      ++ctx->stats.n_failed;
+      ctx->h = 0.0;
+      return status;
+    }
+  ctx->h = h;
+  for (i = 0; i < n_iso; ++i)
+    x[i] = y[i] / (rho / ctx->molar_mass[i]);
+  return GSL_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#ifndef NN_SOLVER_H
+#define NN_SOLVER_H
+
+/* The network as a library, for hydro codes that want to burn one zone
+ * at a time (operator splitting). Everything a run needs (the
+ * network, the rates, the stepper and its workspace) lives in a
+ * struct nn_solver that gets allocated once, per thread, and is then
+ * reused for every zone and every hydro step:
+ *
+ *   struct nn_solver *ctx = nn_solver_alloc (NULL, 1.0e-8, 0.0);
+ *   for (every hydro step)
+ *     for (every zone)
+ *       status = nn_advance (ctx, T[z], rho[z], x[z], dt);
+ *   nn_solver_free (ctx);
+ *
+ * nn_advance() doesn't touch any global state and doesn't do any I/O,
+ * so any number of threads can each use their own ctx at the same
+ * time. It doesn't allocate either, except on the first call, which is
+ * when the steppers set up their workspace. The one piece of global
+ * state we can't do anything about is GSL's error handler, which
+ * aborts by default; a program embedding the network should call
+ * gsl_set_error_handler_off() once at startup and look at the status
+ * codes instead. */
+
+struct nn_solver;
+
+// what nn_advance() has done since the solver was allocated
+struct nn_stats
+{
+  long n_calls;			// nn_advance() calls
+  long n_failed;		// calls that returned an error
+  long n_steps;			// accepted steps, all calls together
+  long n_rejected;		// rejected steps
+};
+
+struct nn_solver *nn_solver_alloc (const char *stepper, double eps_abs,
+				   double eps_rel);
+void nn_solver_free (struct nn_solver *ctx);
+int nn_solver_n_iso (const struct nn_solver *ctx);
+const char *nn_solver_isotope (const struct nn_solver *ctx, int i);
+void nn_solver_stats (const struct nn_solver *ctx, struct nn_stats *stats);
+int nn_advance (struct nn_solver *ctx, double T, double rho, double x[],
+		double dt);
+
+#endif
@@ -1,73 +1,75 @@
 #include <gsl/gsl_errno.h>
+#include "energy.h"
+#include "network.h"
 #include "rate_coeffs.h"
 #include "param.h"
+#include "instrument.h"
+#include "trajectory.h"
 
 /* Right-hand side of each ODE, i.e., the side with all the rates and
- * abundances multiplied together. See main.cpp for the isotope codes
- * since I've hard-coded them here. */
+ * abundances multiplied together. Which isotopes and reactions are
+ * involved is up to the network in params (see network.c). */
 
 /* Function arguments are:
  * t = time (independent variable)
  * y[] = vector containing isotope abundances at time t
  * dydt[] = RHS of each ODE
- * params -> all parameters other than time (just temperature in
- *           this case) */
+ * params -> all parameters other than time (the network, temperature
+ *           and density) */
 
-int
-ode_rhs (double t, const double y[], double dydt[], void *params_in)
+/* If the network has the temperature as an unknown, it's y[n_iso] (T9),
+ * and dydt[n_iso] is how fast the energy released heats the gas (see
+ * energy.c). */
+
+/* Along a trajectory, y[] are number densities in a parcel whose
+ * density changes, so on top of the reactions every abundance gets
+ * diluted or compressed along with the gas: dy/dt += y dln(rho)/dt. */
+
+/* the RHS, with in (NULL for nobody) charged for the call */
+static int
+rhs_eval (double t, const double y[], double dydt[], struct param *params,
+	  struct instr *in)
 {
+  double dlnT_dt, dlnrho_dt = 0.0;
+  int i;
 
-  // get the temperature
-  struct param params = *(struct param *) params_in;
-  const double T = params.T;
+  INSTR_COUNT (in, n_rhs);
+  INSTR_START (in, t0);
+  if (params->traj != NULL)
+    trajectory_eval (params->traj, &params->traj_pos, t, &params->T,
+		     &params->rho, &dlnT_dt, &dlnrho_dt);
+  else if (params->net->temperature)
+    params->T = y[params->n_iso] * ENERGY_T_UNIT;
+  /* get the rates. they only get recomputed if the temperature or
+   * density changed since the last call */
+  const double *lambda =
+    rate_state_update (&params->rates, params->T, params->rho);
+  INSTR_LAP (in, PHASE_RATES, t0);
 
-  dydt[0] =
-    lambda_ijT_avg (6, 12, T, 'a') * y[6] * y[12] + lambda_ijT_avg (9, 12, T,
-								    'a') *
-    y[9] * y[12] + lambda_ijT (11, 12, T) * y[11] * y[12];
-  dydt[1] =
-    -lambda_ijT (1, 12, T) * y[1] * y[12] + lambda_ijT_avg (6, 12, T,
-							    'a') * y[6] *
-    y[12];
-  dydt[2] = lambda_ijT (1, 12, T) * y[1] * y[12] - lambda_ij_beta (2) * y[2];
-  dydt[3] = lambda_ij_beta (2) * y[2] - lambda_ijT (3, 12, T) * y[3] * y[12];
-  dydt[4] =
-    -lambda_ijT (4, 12, T) * y[4] * y[12] + lambda_ijT (3, 12,
-							T) * y[3] * y[12] +
-    lambda_ijT_avg (9, 12, T, 'a') * y[9] * y[12];
-  dydt[5] = -lambda_ij_beta (5) * y[5] + lambda_ijT (4, 12, T) * y[4] * y[12];
-  dydt[6] =
-    lambda_ij_beta (5) * y[5] - lambda_ijT_avg (6, 12, T,
-						'a') * y[6] * y[12] -
-    lambda_ijT_avg (6, 12, T, 'g') * y[6] * y[12] + lambda_ijT (11, 12,
-								T) * y[11] *
-    y[12];
-  dydt[7] =
-    lambda_ijT_avg (6, 12, T, 'g') * y[6] * y[12] - lambda_ijT (7, 12,
-								T) * y[7] *
-    y[12];
-  dydt[8] = lambda_ijT (7, 12, T) * y[7] * y[12] - lambda_ij_beta (8) * y[8];
-  dydt[9] =
-    lambda_ij_beta (8) * y[8] - lambda_ijT_avg (9, 12, T,
-						'g') * y[9] * y[12] -
-    lambda_ijT_avg (9, 12, T, 'a') * y[9] * y[12];
-  dydt[10] =
-    lambda_ijT_avg (9, 12, T,
-		    'g') * y[9] * y[12] - lambda_ij_beta (10) * y[10];
-  dydt[11] =
-    lambda_ij_beta (10) * y[10] - lambda_ijT (11, 12, T) * y[11] * y[12];
-  dydt[12] =
-    -lambda_ijT (1, 12, T) * y[1] * y[12] - lambda_ijT (3, 12,
-							T) * y[3] * y[12] -
-    lambda_ijT (4, 12, T) * y[4] * y[12] - lambda_ijT_avg (6, 12, T,
-							   'a') * y[6] *
-    y[12] - lambda_ijT_avg (6, 12, T, 'g') * y[6] * y[12] - lambda_ijT (7, 12,
-									T) *
-    y[7] * y[12] - lambda_ijT_avg (9, 12, T,
-				   'a') * y[9] * y[12] - lambda_ijT_avg (9,
-									 12,
-									 T,
-									 'g')
-    * y[9] * y[12] - lambda_ijT (11, 12, T) * y[11] * y[12];
+  if (params->energy || params->net->temperature)
+    energy_rhs (params, lambda, y, dydt);
+  else
+    network_rhs (params->net, lambda, y, dydt);
+  if (dlnrho_dt != 0.0)
+    for (i = 0; i < params->n_iso; ++i)
+      dydt[i] += y[i] * dlnrho_dt;
+  INSTR_STOP (in, PHASE_RHS, t0);
   return GSL_SUCCESS;
 }
+
+int
+ode_rhs (double t, const double y[], double dydt[], void *params_in)
+{
+  struct param *params = (struct param *) params_in;
+  return rhs_eval (t, y, dydt, params, params->instr);
+}
+
+/* Same as ode_rhs(), for the callers that only want dy/dt for output
+ * (interpolating between steps, events, eps_nuc): the call doesn't go
+ * into params->instr, whose counts and times are the integrator's. */
+int
+ode_rhs_uncounted (double t, const double y[], double dydt[],
+		   void *params_in)
+{
+  return rhs_eval (t, y, dydt, (struct param *) params_in, NULL);
+}
@@ -1 +1,3 @@
 int ode_rhs (double t, const double y[], double dydt[], void *params_in);
+int ode_rhs_uncounted (double t, const double y[], double dydt[],
+		       void *params_in);
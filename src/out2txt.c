@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_errno.h>
+#include "output.h"
+
+/* Turns a binary results file (see output.h) back into the text table
+ * nuclear_network used to write, e.g.
+ *
+ *   out2txt results.bin > results.dat
+ *
+ * so plot.py and friends keep working. With --full every value gets
+ * all 17 significant digits instead of the old 5. */
+int
+main (int argc, char *argv[])
+{
+  struct out_header hdr;
+  const char *path = NULL;
+  int full = 0, bad = 0, arg, status, n_rows, r;
+  uint32_t c;
+  FILE *fp;
+
+  for (arg = 1; arg < argc; ++arg)
+    {
+      if (strcmp (argv[arg], "--full") == 0)
+	full = 1;
+      else if (path == NULL)
+	path = argv[arg];
+      else
+	bad = 1;
+    }
+  if (path == NULL || bad)
+    {
+      fprintf (stderr, "usage: %s [--full] FILE\n", argv[0]);
+      return 1;
+    }
+
+  fp = fopen (path, "rb");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "can't open %s\n", path);
+      return 1;
+    }
+  if (out_read_header (fp, &hdr, NULL) != GSL_SUCCESS)
+    {
+      fprintf (stderr, "%s is not a nuclear_network results file\n", path);
+      fclose (fp);
+      return 1;
+    }
+
+  char (*name)[OUT_NAME_LEN] = malloc (hdr.n_col * OUT_NAME_LEN);
+  double *val = malloc ((size_t) hdr.n_col * OUT_CHUNK_ROWS * sizeof (double));
+  if (name == NULL || val == NULL)
+    {
+      fprintf (stderr, "out of memory\n");
+      return 1;
+    }
+  // the header again, this time with the names
+  rewind (fp);
+  status = out_read_header (fp, &hdr, name);
+
+  const int width = full ? 24 : 15;
+  for (c = 0; c < hdr.n_col && status == GSL_SUCCESS; ++c)
+    printf (c == 0 ? "%*s" : " %*s", width, name[c]);
+  printf ("\n");
+  while (status == GSL_SUCCESS
+	 && (status = out_read_rows (fp, &hdr, val, OUT_CHUNK_ROWS,
+				     &n_rows)) == GSL_SUCCESS)
+    for (r = 0; r < n_rows; ++r)
+      {
+	for (c = 0; c < hdr.n_col; ++c)
+	  printf (c == 0 ? "%*.*e" : " %*.*e", width, full ? 16 : 4,
+		  val[(size_t) r * hdr.n_col + c]);
+	printf ("\n");
+      }
+
+  free (name);
+  free (val);
+  fclose (fp);
+  if (status != GSL_EOF)
+    {
+      fprintf (stderr, "%s is truncated or corrupt\n", path);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,363 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gsl/gsl_errno.h>
+#include "output.h"
+
+/* See output.h for the file layout. The integrator side only ever
+ * copies a row into the chunk being filled; when that chunk is full it
+ * is handed to the writer thread and the integrator carries on with
+ * the other one. It only has to wait if the disk is so slow that the
+ * previous chunk still hasn't been written by the time the next one is
+ * full.
+ *
+ * The file is little-endian so that numpy (or anything else) can map
+ * it without being told where it came from. On the machines we run on
+ * that's what the doubles are anyway and to_le() does nothing; on a
+ * big-endian one every value gets its bytes turned around on the way
+ * in and out. */
+
+static int
+host_is_le (void)
+{
+  const uint16_t one = 1;
+  return *(const unsigned char *) &one == 1;
+}
+
+// n bytes at p, reversed if the host isn't little-endian
+static void
+to_le (void *p, size_t n)
+{
+  unsigned char *b = p, t;
+  size_t k;
+  if (host_is_le ())
+    return;
+  for (k = 0; k < n / 2; ++k)
+    {
+      t = b[k];
+      b[k] = b[n - 1 - k];
+      b[n - 1 - k] = t;
+    }
+}
+
+// the header's numbers to or from little-endian, same thing both ways
+static void
+header_le (struct out_header *hdr)
+{
+  to_le (&hdr->version, sizeof (hdr->version));
+  to_le (&hdr->n_col, sizeof (hdr->n_col));
+  to_le (&hdr->iso_col, sizeof (hdr->iso_col));
+  to_le (&hdr->n_iso, sizeof (hdr->n_iso));
+  to_le (&hdr->data_offset, sizeof (hdr->data_offset));
+  to_le (&hdr->T, sizeof (hdr->T));
+  to_le (&hdr->rho, sizeof (hdr->rho));
+}
+
+static int
+write_chunk (FILE * fp, int n_col, const struct out_buffer *buf)
+{
+  const size_t n = (size_t) n_col * buf->n_rows;
+  if (fwrite (buf->val, sizeof (double), n, fp) != n)
+    return GSL_EFAILED;
+  return GSL_SUCCESS;
+}
+
+static void *
+writer_main (void *arg)
+{
+  struct out_writer *w = arg;
+
+  pthread_mutex_lock (&w->lock);
+  for (;;)
+    {
+      while (w->pending == NULL && !w->closing)
+	pthread_cond_wait (&w->work, &w->lock);
+      if (w->pending == NULL)
+	break;			// closing, and nothing left to write
+      struct out_buffer *buf = w->pending;
+      pthread_mutex_unlock (&w->lock);
+
+      int status = write_chunk (w->fp, w->n_col, buf);
+
+      pthread_mutex_lock (&w->lock);
+      if (status != GSL_SUCCESS && w->status == GSL_SUCCESS)
+	w->status = status;
+      buf->n_rows = 0;
+      w->pending = NULL;
+      pthread_cond_signal (&w->done);
+    }
+  pthread_mutex_unlock (&w->lock);
+  return NULL;
+}
+
+/* give the full chunk to the writer thread and start on the other one.
+ * returns the first write error so far */
+static int
+hand_off (struct out_writer *w)
+{
+  int status;
+  pthread_mutex_lock (&w->lock);
+  while (w->pending != NULL)
+    pthread_cond_wait (&w->done, &w->lock);
+  w->pending = w->fill;
+  w->fill = (w->fill == &w->buf[0]) ? &w->buf[1] : &w->buf[0];
+  pthread_cond_signal (&w->work);
+  status = w->status;
+  pthread_mutex_unlock (&w->lock);
+  return status;
+}
+
+// a writer with its buffers, but no file or thread yet
+static struct out_writer *
+writer_alloc (int n_col, int chunk_rows)
+{
+  struct out_writer *w = calloc (1, sizeof (struct out_writer));
+  if (w == NULL)
+    return NULL;
+  w->n_col = n_col;
+  w->chunk_rows = chunk_rows;
+  w->buf[0].val = malloc ((size_t) n_col * chunk_rows * sizeof (double));
+  w->buf[1].val = malloc ((size_t) n_col * chunk_rows * sizeof (double));
+  return w;
+}
+
+static void
+writer_discard (struct out_writer *w)
+{
+  if (w->fp != NULL)
+    fclose (w->fp);
+  free (w->buf[0].val);
+  free (w->buf[1].val);
+  free (w);
+}
+
+// start the writer thread on w->fp, which is where the next chunk goes
+static int
+writer_start (struct out_writer *w)
+{
+  w->fill = &w->buf[0];
+  w->status = GSL_SUCCESS;
+  pthread_mutex_init (&w->lock, NULL);
+  pthread_cond_init (&w->work, NULL);
+  pthread_cond_init (&w->done, NULL);
+  if (pthread_create (&w->thread, NULL, writer_main, w) != 0)
+    {
+      pthread_mutex_destroy (&w->lock);
+      pthread_cond_destroy (&w->work);
+      pthread_cond_destroy (&w->done);
+      return GSL_EFAILED;
+    }
+  return GSL_SUCCESS;
+}
+
+/* Opens path for writing, writes the header and starts the writer
+ * thread. Columns iso_col ... iso_col + n_iso - 1 are the isotopes.
+ * chunk_rows <= 0 means OUT_CHUNK_ROWS. Returns NULL if the file can't
+ * be opened or memory runs out. */
+struct out_writer *
+out_open (const char *path, int n_col, const char *const name[],
+	  int iso_col, int n_iso, double T, double rho, int chunk_rows)
+{
+  static const char zero[OUT_ALIGN];
+  struct out_header hdr;
+  struct out_writer *w;
+  size_t pad;
+  int c;
+
+  if (chunk_rows <= 0)
+    chunk_rows = OUT_CHUNK_ROWS;
+  w = writer_alloc (n_col, chunk_rows);
+  if (w == NULL)
+    return NULL;
+  w->fp = fopen (path, "wb");
+  if (w->buf[0].val == NULL || w->buf[1].val == NULL || w->fp == NULL)
+    goto fail;
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, OUT_MAGIC, sizeof (hdr.magic));
+  hdr.version = OUT_VERSION;
+  hdr.n_col = n_col;
+  hdr.iso_col = iso_col;
+  hdr.n_iso = n_iso;
+  hdr.data_offset = (sizeof (hdr) + (size_t) n_col * OUT_NAME_LEN
+		     + OUT_ALIGN - 1) / OUT_ALIGN * OUT_ALIGN;
+  pad = hdr.data_offset - sizeof (hdr) - (size_t) n_col * OUT_NAME_LEN;
+  hdr.T = T;
+  hdr.rho = rho;
+  header_le (&hdr);
+  if (fwrite (&hdr, sizeof (hdr), 1, w->fp) != 1)
+    goto fail;
+  for (c = 0; c < n_col; ++c)
+    {
+      char padded[OUT_NAME_LEN];
+      memset (padded, 0, sizeof (padded));
+      strncpy (padded, name[c], OUT_NAME_LEN - 1);
+      if (fwrite (padded, 1, OUT_NAME_LEN, w->fp) != OUT_NAME_LEN)
+	goto fail;
+    }
+  if (pad > 0 && fwrite (zero, 1, pad, w->fp) != pad)
+    goto fail;
+
+  if (writer_start (w) != GSL_SUCCESS)
+    goto fail;
+  return w;
+
+fail:
+  writer_discard (w);
+  return NULL;
+}
+
+/* Reopens a file out_open() started, for a run that is carrying on
+ * from a checkpoint: everything after offset (which out_sync() gave
+ * us) was written after the checkpoint and gets cut off, and the new
+ * rows go on from there. Returns NULL if the file isn't one of ours
+ * with n_col columns, or is shorter than offset. */
+struct out_writer *
+out_resume (const char *path, int n_col, int64_t offset)
+{
+  struct out_header hdr;
+  struct out_writer *w;
+  FILE *fp = fopen (path, "r+b");
+
+  if (fp == NULL)
+    return NULL;
+  if (out_read_header (fp, &hdr, NULL) != GSL_SUCCESS
+      || hdr.n_col != (uint32_t) n_col || offset < (int64_t) hdr.data_offset
+      || fseeko (fp, 0, SEEK_END) != 0 || ftello (fp) < offset
+      || ftruncate (fileno (fp), offset) != 0
+      || fseeko (fp, offset, SEEK_SET) != 0)
+    {
+      fclose (fp);
+      return NULL;
+    }
+  w = writer_alloc (n_col, OUT_CHUNK_ROWS);
+  if (w == NULL)
+    {
+      fclose (fp);
+      return NULL;
+    }
+  w->fp = fp;
+  if (w->buf[0].val == NULL || w->buf[1].val == NULL
+      || writer_start (w) != GSL_SUCCESS)
+    {
+      writer_discard (w);
+      return NULL;
+    }
+  return w;
+}
+
+/* Adds one row of n_col values. Whenever a chunk gets handed off this
+ * returns the first error the writer thread has run into so far, so the
+ * caller can stop early. */
+int
+out_append (struct out_writer *w, const double row[])
+{
+  struct out_buffer *buf = w->fill;
+  double *dst = buf->val + (size_t) buf->n_rows * w->n_col;
+  int c;
+  for (c = 0; c < w->n_col; ++c)
+    {
+      dst[c] = row[c];
+      to_le (&dst[c], sizeof (double));
+    }
+  if (++buf->n_rows == w->chunk_rows)
+    return hand_off (w);
+  return GSL_SUCCESS;
+}
+
+/* Writes out everything appended so far, as a short chunk if need be,
+ * and waits until it's on disk (as far as stdio is concerned), for a
+ * checkpoint. *offset is then where the file ends. Returns the first
+ * write error so far. */
+int
+out_sync (struct out_writer *w, int64_t * offset)
+{
+  int status;
+
+  if (w->fill->n_rows > 0)
+    hand_off (w);
+  pthread_mutex_lock (&w->lock);
+  while (w->pending != NULL)
+    pthread_cond_wait (&w->done, &w->lock);
+  status = w->status;
+  pthread_mutex_unlock (&w->lock);
+  /* the writer thread only touches fp while a chunk is pending, and
+   * only we hand chunks to it */
+  if (fflush (w->fp) != 0 && status == GSL_SUCCESS)
+    status = GSL_EFAILED;
+  *offset = ftello (w->fp);
+  return status;
+}
+
+/* Writes whatever is left, stops the writer thread and closes the
+ * file. Returns GSL_SUCCESS or GSL_EFAILED if anything couldn't be
+ * written. */
+int
+out_close (struct out_writer *w)
+{
+  int status;
+
+  if (w->fill->n_rows > 0)
+    hand_off (w);
+  pthread_mutex_lock (&w->lock);
+  w->closing = 1;
+  pthread_cond_signal (&w->work);
+  pthread_mutex_unlock (&w->lock);
+  pthread_join (w->thread, NULL);
+
+  status = w->status;
+  if (fclose (w->fp) != 0 && status == GSL_SUCCESS)
+    status = GSL_EFAILED;
+  pthread_mutex_destroy (&w->lock);
+  pthread_cond_destroy (&w->work);
+  pthread_cond_destroy (&w->done);
+  free (w->buf[0].val);
+  free (w->buf[1].val);
+  free (w);
+  return status;
+}
+
+/* Reads the header and the column names (name needs room for
+ * hdr->n_col of them, or pass NULL to skip them) and leaves fp at the
+ * first row. Returns GSL_EINVAL if this isn't one of our files, or is
+ * from an older version. */
+int
+out_read_header (FILE * fp, struct out_header *hdr,
+		 char name[][OUT_NAME_LEN])
+{
+  uint32_t c;
+  if (fread (hdr, sizeof (*hdr), 1, fp) != 1)
+    return GSL_EFAILED;
+  header_le (hdr);
+  if (memcmp (hdr->magic, OUT_MAGIC, sizeof (hdr->magic)) != 0
+      || hdr->version != OUT_VERSION || hdr->n_col == 0
+      || hdr->data_offset < sizeof (*hdr) + (uint64_t) hdr->n_col
+      * OUT_NAME_LEN)
+    return GSL_EINVAL;
+  for (c = 0; name != NULL && c < hdr->n_col; ++c)
+    {
+      if (fread (name[c], 1, OUT_NAME_LEN, fp) != OUT_NAME_LEN)
+	return GSL_EFAILED;
+      name[c][OUT_NAME_LEN - 1] = '\0';
+    }
+  if (fseeko (fp, hdr->data_offset, SEEK_SET) != 0)
+    return GSL_EFAILED;
+  return GSL_SUCCESS;
+}
+
+/* Reads the next rows, up to max_rows of them, into val (row after
+ * row, in host byte order). A row the writer didn't get to finish
+ * doesn't count. Returns GSL_EOF after the last row. */
+int
+out_read_rows (FILE * fp, const struct out_header *hdr, double *val,
+	       int max_rows, int *n_rows)
+{
+  const size_t row = (size_t) hdr->n_col * sizeof (double);
+  size_t got = fread (val, row, max_rows, fp), k;
+  if (got == 0)
+    return ferror (fp) ? GSL_EFAILED : GSL_EOF;
+  for (k = 0; k < got * hdr->n_col; ++k)
+    to_le (&val[k], sizeof (double));
+  *n_rows = got;
+  return GSL_SUCCESS;
+}
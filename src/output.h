@@ -0,0 +1,88 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Binary output for long runs. Printing 14 "%15.4e" fields per step
+ * costs more than the step itself once the network is sparse, and
+ * throws away most of the digits. Instead, rows are collected into
+ * chunks of full-precision doubles and a background thread writes each
+ * chunk out while the integrator fills the next one.
+ *
+ * File layout, little-endian whatever the host is:
+ *
+ *   struct out_header (64 bytes)
+ *   n_col names, OUT_NAME_LEN bytes each, NUL padded
+ *   zeros up to data_offset, a multiple of OUT_ALIGN
+ *   the rows: n_col doubles each, one row after the other
+ *
+ * The chunks are only how the rows get to the disk; in the file they
+ * are one n_rows x n_col array, and n_rows is whatever fits in the
+ * file's size (so a run that got killed still leaves a readable file).
+ * That is, it's a numpy.memmap with no parsing at all, see plot.py:
+ *
+ *   np.memmap(path, '<f8', 'r', data_offset).reshape(-1, n_col)
+ *
+ * Columns iso_col ... iso_col + n_iso - 1 are the isotopes' mass
+ * fractions, the rest whatever the name says. out2txt.c turns a file
+ * back into the old results.dat text. */
+
+#define OUT_MAGIC "NNREC\0\0\0"
+#define OUT_VERSION 2
+#define OUT_NAME_LEN 16
+#define OUT_ALIGN 64
+#define OUT_CHUNK_ROWS 4096
+
+struct out_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t n_col;
+  uint32_t iso_col;		// the first isotope column
+  uint32_t n_iso;		// how many isotope columns follow it
+  uint64_t data_offset;		// where the first row starts, bytes
+  double T;			// K, at the start
+  double rho;			// g/cm^3, at the start
+  char pad[16];
+};
+
+struct out_buffer
+{
+  double *val;			// row after row, little-endian already
+  int n_rows;
+};
+
+struct out_writer
+{
+  FILE *fp;
+  int n_col;
+  int chunk_rows;
+  struct out_buffer buf[2];
+  struct out_buffer *fill;	// being filled by the integrator
+  struct out_buffer *pending;	// handed to the writer thread, or NULL
+  int closing;
+  int status;			// first write error, or GSL_SUCCESS
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;		// pending was set, or closing
+  pthread_cond_t done;		// pending was cleared
+};
+
+struct out_writer *out_open (const char *path, int n_col,
+			     const char *const name[], int iso_col,
+			     int n_iso, double T, double rho,
+			     int chunk_rows);
+struct out_writer *out_resume (const char *path, int n_col, int64_t offset);
+int out_append (struct out_writer *w, const double row[]);
+int out_sync (struct out_writer *w, int64_t * offset);
+int out_close (struct out_writer *w);
+
+// reading
+int out_read_header (FILE * fp, struct out_header *hdr,
+		     char name[][OUT_NAME_LEN]);
+int out_read_rows (FILE * fp, const struct out_header *hdr, double *val,
+		   int max_rows, int *n_rows);
+
+#endif
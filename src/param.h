@@ -1,6 +1,31 @@
+#ifndef PARAM_H
+#define PARAM_H
+
+#include "rate_coeffs.h"
+
+struct network;
+struct trajectory;
+struct instr;
+
 struct param			// parameter struct to be passed to GSL ODE integrators
 {
+  const struct network *net;	// isotopes and reactions in the network
   int n_iso;			// number of isotopes included in network
   double T;			// temperature
   double rho;			// mass density
+  struct rate_state rates;	// all reaction rates at (T, rho)
+  /* if not NULL, T and rho follow this history and the fields above
+   * are just where it was last evaluated (see trajectory.c) */
+  const struct trajectory *traj;
+  int traj_pos;			// lookup cursor for traj, start at 0
+  struct instr *instr;		// counters and timers, or NULL (instrument.h)
+  int jac_ad;			// Jacobian by AD (network_ad.c), not the fill list
+  /* if set, ode_rhs() also works out the energy generation (erg/g/s)
+   * at the y it was called with; it always does if the temperature is
+   * one of the unknowns (see energy.c) */
+  int energy;
+  double eps_nuc;		// released into the gas
+  double eps_nu;		// carried off by neutrinos
 };
+
+#endif
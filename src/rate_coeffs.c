@@ -1,5 +1,11 @@
+#include <stddef.h>
+#include <stdlib.h>
 #include <math.h>
+#include <gsl/gsl_errno.h>
 #include "rate_coeffs.h"
+#include "rate_kernel.h"
+#include "rate_table.h"
+#include "ratelib.h"
 
 /* The subscripts on these rate coefficients are hard-coded for the
  * isotopes in the CNO cycle, as defined in my notes. This is a
@@ -17,6 +23,182 @@
 // i, j = starting products.
 // T = temperature (K)
 
+/* Q-values (MeV) from the atomic mass differences, for working out the
+ * energy generation (energy.c). The beta-decays' include the positron
+ * annihilating, minus the average energy of the neutrino, which leaves
+ * the star; that goes into rate_q_nu instead (Bahcall's values). The
+ * whole CN cycle adds up to 4 p -> He4, 26.73 MeV, of which 1.70 MeV
+ * are neutrinos. */
+const double rate_q[N_RATES] = {
+  [R_C12_P_G_N13] = 1.944,
+  [R_C13_P_G_N14] = 7.551,
+  [R_N14_P_G_O15] = 7.297,
+  [R_N15_P_A_C12] = 4.966,
+  [R_N15_P_G_O16] = 12.127,
+  [R_O16_P_G_F17] = 0.600,
+  [R_O17_P_A_N14] = 1.191,
+  [R_O17_P_G_F18] = 5.607,
+  [R_O18_P_A_N15] = 3.981,
+  [R_N13_E_NU] = 2.221 - 0.707,
+  [R_O15_E_NU] = 2.754 - 0.997,
+  [R_F17_E_NU] = 2.761 - 0.999,
+  [R_F18_E_NU] = 1.656 - 0.383,
+};
+
+const double rate_q_nu[N_RATES] = {
+  [R_N13_E_NU] = 0.707,
+  [R_O15_E_NU] = 0.997,
+  [R_F17_E_NU] = 0.999,
+  [R_F18_E_NU] = 0.383,
+};
+
+/* Mark the rate vector as stale so the next rate_state_update() call
+ * evaluates everything from scratch. Also forgets the rate table, if
+ * there was one. */
+void
+rate_state_init (struct rate_state *rs)
+{
+  int k;
+  rs->valid = 0;
+  rs->T = 0.0;
+  rs->rho = 0.0;
+  rs->table = NULL;
+  rs->dT_valid = 0;
+  rs->lib = NULL;
+  rs->n_rates = N_RATES;
+  rs->lib_lambda = rs->lib_dlambda_dT = NULL;
+  rs->q = rate_q;
+  rs->q_nu = rate_q_nu;
+  // the beta-decay entries never change
+  for (k = 0; k < N_RATES; ++k)
+    rs->dlambda_dT[k] = 0.0;
+}
+
+/* Take the rates from a library from now on: rate r is the library's
+ * reaction r, which is how network_from_ratelib() numbers them. rs has
+ * to have been initialized; the library has to stay open while rs is
+ * used. Returns GSL_SUCCESS or GSL_ENOMEM. */
+int
+rate_state_use_library (struct rate_state *rs, const struct ratelib *lib)
+{
+  const int n = lib->hdr->n_reac;
+
+  rate_state_free (rs);
+  rs->lib_lambda = malloc ((n + 1) * sizeof (double));
+  rs->lib_dlambda_dT = malloc ((n + 1) * sizeof (double));
+  if (rs->lib_lambda == NULL || rs->lib_dlambda_dT == NULL)
+    {
+      rate_state_free (rs);
+      return GSL_ENOMEM;
+    }
+  rs->lib = lib;
+  rs->n_rates = n;
+  rs->q = lib->q;
+  rs->q_nu = lib->q_nu;
+  rs->valid = 0;
+  rs->dT_valid = 0;
+  return GSL_SUCCESS;
+}
+
+// frees what rate_state_use_library() allocated, back to the CNO rates
+void
+rate_state_free (struct rate_state *rs)
+{
+  free (rs->lib_lambda);
+  free (rs->lib_dlambda_dT);
+  rs->lib_lambda = rs->lib_dlambda_dT = NULL;
+  rs->lib = NULL;
+  rs->n_rates = N_RATES;
+  rs->q = rate_q;
+  rs->q_nu = rate_q_nu;
+  rs->valid = 0;
+}
+
+/* The T-dependent rates (lambda[0 ... N_RATES_T - 1]) straight from
+ * the CF88 fits. This is the slow path that rate tables are built
+ * from and checked against. It goes through the rate kernel
+ * (rate_kernel.c), which shares the powers of T9 between the fits;
+ * the lambda_*() functions further down are the same fits one at a
+ * time, the way they're written in CF88, and are what the kernel was
+ * checked against. */
+void
+rate_eval_fits (double T, double lambda[])
+{
+  rate_eval_fits_n (1, &T, lambda, 1, 0);
+}
+
+/* Evaluate every rate at (T, rho), but only if they changed since the
+ * last call. Returns the rate vector, indexed by enum rate_id. None of
+ * the rates actually depend on rho yet but it's cheap to keep track of
+ * it here, so whoever adds screening later doesn't have to. */
+const double *
+rate_state_update (struct rate_state *rs, double T, double rho)
+{
+  if (rs->lib != NULL)
+    {
+      // the library's fits give the derivatives for next to nothing
+      if (!(rs->valid && rs->T == T && rs->rho == rho))
+	ratelib_eval (rs->lib, T, rs->lib_lambda, rs->lib_dlambda_dT);
+      rs->dT_valid = 1;
+      rs->T = T;
+      rs->rho = rho;
+      rs->valid = 1;
+      return rs->lib_lambda;
+    }
+  if (rs->valid && rs->T == T && rs->rho == rho)
+    return rs->lambda;
+
+  /* the table gives us the derivatives for free, so keep them in case
+   * somebody wants them (the Jacobian's dfdt does) */
+  if (rs->table != NULL
+      && rate_table_eval (rs->table, T, rs->lambda, rs->dlambda_dT) == 0)
+    rs->dT_valid = 1;
+  else
+    {
+      rate_eval_fits (T, rs->lambda);
+      rs->dT_valid = 0;
+    }
+  // the beta-decays don't depend on T at all
+  if (!rs->valid)
+    {
+      rs->lambda[R_N13_E_NU] = lambda_N13_e_nu ();
+      rs->lambda[R_O15_E_NU] = lambda_O15_e_nu ();
+      rs->lambda[R_F17_E_NU] = lambda_F17_e_nu ();
+      rs->lambda[R_F18_E_NU] = lambda_F18_e_nu ();
+    }
+
+  rs->T = T;
+  rs->rho = rho;
+  rs->valid = 1;
+  return rs->lambda;
+}
+
+/* d lambda / d T for the rates from the last rate_state_update() call
+ * (the beta-decays' are zero). Comes with the rates if they came from
+ * a table; otherwise we difference the fits, which is slow but only
+ * happens once per temperature. */
+const double *
+rate_state_dT (struct rate_state *rs)
+{
+  int k;
+  if (rs->lib != NULL)
+    return rs->lib_dlambda_dT;
+  if (rs->dT_valid)
+    return rs->dlambda_dT;
+
+  const double dT = 1.0e-5 * rs->T;
+  // both sides in one kernel call: lambda[2 * r] up, lambda[2 * r + 1] down
+  const double T[2] = { rs->T + dT, rs->T - dT };
+  double lambda[2 * N_RATES_T];
+  rate_eval_fits_n (2, T, lambda, 2, 1);
+  for (k = 0; k < N_RATES_T; ++k)
+    rs->dlambda_dT[k] = (lambda[2 * k] - lambda[2 * k + 1]) / (2.0 * dT);
+  for (k = N_RATES_T; k < N_RATES; ++k)
+    rs->dlambda_dT[k] = 0.0;
+  rs->dT_valid = 1;
+  return rs->dlambda_dT;
+}
+
 /* if we call lambda_ij with 3 arguments, it will interpret the 1st
  * argument as i, the 2nd argument as j and the 3rd argument as the
  * temperature */
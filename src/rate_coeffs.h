@@ -1,3 +1,71 @@
+#ifndef RATE_COEFFS_H
+#define RATE_COEFFS_H
+
+/* Indices of each reaction in the precomputed rate vector. The order
+ * doesn't mean anything, but the beta-decays come last since they're
+ * the only ones that don't depend on temperature. */
+enum rate_id
+{
+  R_C12_P_G_N13,
+  R_C13_P_G_N14,
+  R_N14_P_G_O15,
+  R_N15_P_A_C12,
+  R_N15_P_G_O16,
+  R_O16_P_G_F17,
+  R_O17_P_A_N14,
+  R_O17_P_G_F18,
+  R_O18_P_A_N15,
+  R_N13_E_NU,
+  R_O15_E_NU,
+  R_F17_E_NU,
+  R_F18_E_NU,
+  N_RATES
+};
+
+// the temperature-dependent rates are the ones before the beta-decays
+#define N_RATES_T R_N13_E_NU
+
+struct rate_table;
+struct ratelib;
+
+/* All the rates evaluated at one (T, rho). The CF88 fits are expensive
+ * (lots of pow() and exp()) and the integrator calls the RHS and
+ * Jacobian thousands of times at the same temperature, so we evaluate
+ * every rate once and then just read them out of lambda[]. */
+struct rate_state
+{
+  int valid;			// 0 until the first evaluation
+  double T;			// temperature the rates were evaluated at
+  double rho;			// density the rates were evaluated at
+  double lambda[N_RATES];	// rates, indexed by enum rate_id
+  /* if not NULL, the T-dependent rates get interpolated from here
+   * instead of evaluating the fits (see rate_table.c) */
+  const struct rate_table *table;
+  int dT_valid;			// dlambda_dT is up to date with lambda
+  double dlambda_dT[N_RATES];	// d lambda / d T, only if asked for
+  /* if not NULL, the rates come from this library instead (see
+   * ratelib.c), n_rates of them in lib_lambda, and the Q-values too */
+  const struct ratelib *lib;
+  int n_rates;			// N_RATES, or the library's reactions
+  double *lib_lambda, *lib_dlambda_dT;
+  const double *q, *q_nu;	// rate_q and rate_q_nu, or the library's
+};
+
+/* energy released per reaction, MeV, indexed by enum rate_id: what
+ * stays in the gas, and what the neutrino of a beta-decay takes away
+ * (see rate_coeffs.c) */
+extern const double rate_q[N_RATES];
+extern const double rate_q_nu[N_RATES];
+
+void rate_state_init (struct rate_state *rs);
+int rate_state_use_library (struct rate_state *rs,
+			    const struct ratelib *lib);
+void rate_state_free (struct rate_state *rs);
+const double *rate_state_update (struct rate_state *rs, double T,
+				 double rho);
+const double *rate_state_dT (struct rate_state *rs);
+void rate_eval_fits (double T, double lambda[]);
+
 double lambda_N15_P_A_C12 (double T);
 double lambda_O17_P_A_N14 (double T);
 double lambda_O18_P_A_N15 (double T);
@@ -16,3 +84,5 @@ double lambda_F18_e_nu ();
 double lambda_ijT (int i, int j, double T);
 double lambda_ijT_avg (int i, int j, double T, char product);
 double lambda_ij_beta (int i);
+
+#endif
@@ -0,0 +1,184 @@
+#include <math.h>
+#include "rate_coeffs.h"
+#include "rate_kernel.h"
+
+/* The CF88 fits (rate_coeffs.c) again, but written for speed instead
+ * of for reading. Every lambda_*() there works out T9^(1/3), T9^(2/3),
+ * T9^(3/2) and so on with its own pow() calls, about 50 of them for
+ * one rate vector. Here they're done once per temperature, with one
+ * log() and one exp(), and every fit is a sum of terms of the same
+ * shape,
+ *
+ *   c * T9^p * exp(-a / T9^(1/3) - b / T9 - g * T9^2)
+ *     * (1 + q1 T9^(1/3) + q2 T9^(2/3) + q3 T9 + q4 T9^(4/3)
+ *        + q5 T9^(5/3) + q6 T9^3)
+ *
+ * so the powers fold into the exponent and a term costs one exp().
+ * The coefficients live in fit_terms[] below. The two pieces of CF88
+ * that don't fit that shape (the screening-like denominator of
+ * O16(p,g)F17 and the T9A term of O17(p,g)F18) are done by hand.
+ *
+ * The temperatures get processed in blocks, structure-of-arrays, with
+ * the temperature loop innermost and no branches in it. So the
+ * compiler can vectorize every loop here, exp() and log() included,
+ * if it's allowed to call the vector math library: with
+ * -DNATIVE_SIMD=ON this file gets built with -ffast-math for that
+ * (see src/CMakeLists.txt), which is why it lives in a file of its
+ * own and not in rate_coeffs.c. */
+
+// temperatures done at once; the scratch arrays are all this long
+#define RATE_KERNEL_BLOCK 64
+
+struct fit_term
+{
+  int rate;			// enum rate_id this term adds to
+  double c, p, a, b, g;
+  double q[6];			// polynomial, all zero if there isn't one
+};
+
+// the polynomial powers, in the order of fit_term.q
+enum
+{
+  P13, P23, P1, P43, P53, P3, N_POLY
+};
+
+/* Transcribed from the lambda_*() functions in rate_coeffs.c, term by
+ * term and in the same order, which is what the kernel gets checked
+ * against. The fudge factors are folded into c. */
+static const struct fit_term fit_terms[] = {
+  {R_C12_P_G_N13, 2.04e+07, -2.0 / 3.0, 13.690, 0.0, 1.0 / (1.500 * 1.500),
+   {0.030, 1.19, 0.254, 2.06, 1.12, 0.0}},
+  {R_C12_P_G_N13, 1.08e+05, -1.5, 0.0, 4.925, 0.0, {0.0}},
+  {R_C12_P_G_N13, 2.15e+05, -1.5, 0.0, 18.179, 0.0, {0.0}},
+
+  {R_C13_P_G_N14, 8.01e+07, -2.0 / 3.0, 13.717, 0.0, 1.0 / (2.000 * 2.000),
+   {0.030, 0.958, 0.204, 1.39, 0.753, 0.0}},
+  {R_C13_P_G_N14, 1.21e+06, -6.0 / 5.0, 0.0, 5.701, 0.0, {0.0}},
+
+  /* the polynomial in lambda_N14_P_G_O15() has "0.261 * T943 * +0.127
+   * * T953" where CF88 has a plus. That's the T9^3 term; it's wrong,
+   * but it's what every result so far was computed with, so the kernel
+   * has to agree until somebody fixes both */
+  {R_N14_P_G_O15, 4.90e+07, -2.0 / 3.0, 15.202, 0.0, 1.0 / (1.191 * 1.191),
+   {0.027, -0.778, -0.149, 0.0, 0.0, 0.261 * 0.127}},
+  {R_N14_P_G_O15, 2.37e+03, -1.5, 0.0, 3.011, 0.0, {0.0}},
+  {R_N14_P_G_O15, 2.19e+04, 0.0, 0.0, 12.530, 0.0, {0.0}},
+
+  {R_N15_P_A_C12, 1.08e+12, -2.0 / 3.0, 15.251, 0.0, 1.0 / (0.522 * 0.522),
+   {0.027, 2.62, 0.501, 5.36, 2.60, 0.0}},
+  {R_N15_P_A_C12, 1.19e+08, -1.5, 0.0, 3.676, 0.0, {0.0}},
+  {R_N15_P_A_C12, 5.41e+08, -0.5, 0.0, 8.926, 0.0, {0.0}},
+  {R_N15_P_A_C12, 0.5 * 4.72e+08, -1.5, 0.0, 7.721, 0.0, {0.0}},
+  {R_N15_P_A_C12, 2.20e+09, -1.5, 0.0, 11.418, 0.0, {0.0}},
+
+  {R_N15_P_G_O16, 9.78e+08, -2.0 / 3.0, 15.251, 0.0, 1.0 / (0.450 * 0.450),
+   {0.027, 0.219, 0.042, 6.83, 3.32, 0.0}},
+  {R_N15_P_G_O16, 1.11e+04, -1.5, 0.0, 3.328, 0.0, {0.0}},
+  {R_N15_P_G_O16, 1.49e+04, -1.5, 0.0, 4.665, 0.0, {0.0}},
+  {R_N15_P_G_O16, 3.80e+06, -1.5, 0.0, 11.048, 0.0, {0.0}},
+
+  // gets divided by 1 + 2.13 (1 - exp(-0.728 T9^(2/3))) afterwards
+  {R_O16_P_G_F17, 1.50e+08, -2.0 / 3.0, 16.692, 0.0, 0.0, {0.0}},
+
+  {R_O17_P_A_N14, 1.53e+07, -2.0 / 3.0, 16.712, 0.0, 1.0 / (0.565 * 0.565),
+   {0.025, 5.39, 0.940, 13.5, 5.98, 0.0}},
+  {R_O17_P_A_N14, 0.5 * 4.81e+10, 1.0, 16.712, 0.0, 1.0 / (0.040 * 0.040),
+   {0.0}},
+  {R_O17_P_A_N14, 0.5 * 5.05e-05, -1.5, 0.0, 0.723, 0.0, {0.0}},
+  {R_O17_P_A_N14, 0.5 * 1.31e+01, -1.5, 0.0, 1.961, 0.0, {0.0}},
+
+  // plus the T9A term, by hand
+  {R_O17_P_G_F18, 1.51e+08, -2.0 / 3.0, 16.712, 0.0, 0.0,
+   {0.025, -0.051, -8.82e-03, 0.0, 0.0, 0.0}},
+  {R_O17_P_G_F18, 1.56e+05, -1.0, 0.0, 6.272, 0.0, {0.0}},
+  {R_O17_P_G_F18, 0.5 * 1.31e+01, -1.5, 0.0, 1.961, 0.0, {0.0}},
+
+  {R_O18_P_A_N15, 3.63e+11, -2.0 / 3.0, 16.729, 0.0, 1.0 / (1.361 * 1.361),
+   {0.025, 1.88, 0.327, 4.66, 2.06, 0.0}},
+  {R_O18_P_A_N15, 9.90e-14, -1.5, 0.0, 0.231, 0.0, {0.0}},
+  {R_O18_P_A_N15, 2.66e+04, -1.5, 0.0, 1.670, 0.0, {0.0}},
+  {R_O18_P_A_N15, 2.41e+09, -1.5, 0.0, 7.638, 0.0, {0.0}},
+  {R_O18_P_A_N15, 1.46e+09, -1.0, 0.0, 8.310, 0.0, {0.0}},
+};
+
+#define N_FIT_TERMS ((int) (sizeof (fit_terms) / sizeof (fit_terms[0])))
+
+// the rates at up to RATE_KERNEL_BLOCK temperatures, into lam[r][k]
+static void
+eval_block (int n, const double *T,
+	    double lam[N_RATES_T][RATE_KERNEL_BLOCK])
+{
+  double lnT9[RATE_KERNEL_BLOCK], T9[RATE_KERNEL_BLOCK];
+  double inv_T913[RATE_KERNEL_BLOCK], inv_T9[RATE_KERNEL_BLOCK];
+  double T92[RATE_KERNEL_BLOCK];
+  double pw[N_POLY][RATE_KERNEL_BLOCK];
+  int k, m, r;
+
+  /* the only transcendentals that don't belong to a term: everything
+   * else is a product of these */
+  for (k = 0; k < n; ++k)
+    {
+      T9[k] = T[k] / 1.0e+09;
+      lnT9[k] = log (T9[k]);
+      pw[P13][k] = exp (lnT9[k] / 3.0);
+    }
+  for (k = 0; k < n; ++k)
+    {
+      pw[P23][k] = pw[P13][k] * pw[P13][k];
+      pw[P1][k] = T9[k];
+      pw[P43][k] = T9[k] * pw[P13][k];
+      pw[P53][k] = T9[k] * pw[P23][k];
+      pw[P3][k] = T9[k] * T9[k] * T9[k];
+      inv_T913[k] = 1.0 / pw[P13][k];
+      inv_T9[k] = 1.0 / T9[k];
+      T92[k] = T9[k] * T9[k];
+    }
+
+  for (r = 0; r < N_RATES_T; ++r)
+    for (k = 0; k < n; ++k)
+      lam[r][k] = 0.0;
+
+  for (m = 0; m < N_FIT_TERMS; ++m)
+    {
+      const struct fit_term *ft = &fit_terms[m];
+      double *restrict out = lam[ft->rate];
+      for (k = 0; k < n; ++k)
+	{
+	  const double poly = 1.0 + ft->q[P13] * pw[P13][k]
+	    + ft->q[P23] * pw[P23][k] + ft->q[P1] * pw[P1][k]
+	    + ft->q[P43] * pw[P43][k] + ft->q[P53] * pw[P53][k]
+	    + ft->q[P3] * pw[P3][k];
+	  out[k] += ft->c * poly * exp (ft->p * lnT9[k] - ft->a * inv_T913[k]
+					- ft->b * inv_T9[k] - ft->g * T92[k]);
+	}
+    }
+
+  // the bits of CF88 that aren't a sum of terms
+  for (k = 0; k < n; ++k)
+    {
+      const double lnT9A = log (T9[k] / (1.0 + 2.69 * T9[k]));
+      lam[R_O16_P_G_F17][k] /=
+	1.0 + 2.13 * (1.0 - exp (-0.728 * pw[P23][k]));
+      // 7.97e7 T9A^(5/6) / T9^(3/2) exp(-16.712 / T9A^(1/3))
+      lam[R_O17_P_G_F18][k] +=
+	7.97e+07 * exp (5.0 / 6.0 * lnT9A - 1.5 * lnT9[k]
+			- 16.712 * exp (-lnT9A / 3.0));
+    }
+}
+
+void
+rate_eval_fits_n (int n, const double T[], double lambda[],
+		  size_t rate_stride, size_t t_stride)
+{
+  double lam[N_RATES_T][RATE_KERNEL_BLOCK];
+  int k0, k, nb, r;
+
+  for (k0 = 0; k0 < n; k0 += RATE_KERNEL_BLOCK)
+    {
+      nb = n - k0 < RATE_KERNEL_BLOCK ? n - k0 : RATE_KERNEL_BLOCK;
+      eval_block (nb, T + k0, lam);
+      for (r = 0; r < N_RATES_T; ++r)
+	for (k = 0; k < nb; ++k)
+	  lambda[r * rate_stride + (k0 + k) * t_stride] = lam[r][k];
+    }
+}
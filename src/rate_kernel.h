@@ -0,0 +1,15 @@
+#ifndef RATE_KERNEL_H
+#define RATE_KERNEL_H
+
+#include <stddef.h>
+
+/* All the T-dependent CF88 fits (lambda[0 ... N_RATES_T - 1]) at n
+ * temperatures in one go. The rate r at T[k] goes in
+ * lambda[r * rate_stride + k * t_stride], so the same call can fill a
+ * zone-fastest array (rate_stride = number of zones, t_stride = 1),
+ * a temperature-major table (rate_stride = 1, t_stride = N_RATES_T) or
+ * a single rate vector (n = 1, rate_stride = 1). */
+void rate_eval_fits_n (int n, const double T[], double lambda[],
+		       size_t rate_stride, size_t t_stride);
+
+#endif
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <gsl/gsl_errno.h>
+#include "rate_coeffs.h"
+#include "rate_kernel.h"
+#include "rate_table.h"
+
+/* Rate tables. The CF88 fits are a handful of pow() and exp() calls
+ * each, which is fine when T is constant (rate_state_update() only
+ * evaluates them once), but along a trajectory T changes on every RHS
+ * call. So instead we tabulate log(lambda) against log(T), where the
+ * rates are smooth and slowly varying, and interpolate with a cubic
+ * through the 4 nearest nodes. The table is node-major, so one lookup
+ * reads 4 consecutive rows of N_RATES_T doubles, which is a few cache
+ * lines no matter how big the table is.
+ *
+ * The interpolation error goes like (node spacing)^4. Rather than
+ * guessing a spacing, rate_table_build() keeps halving it until the
+ * error measured against the fits themselves, between the nodes where
+ * it's largest, is below the tolerance. */
+
+// rates below this count as zero; keeps log() finite
+#define RATE_TABLE_FLOOR 1.0e-300
+
+// where we start the search for a fine enough grid, and where we give up
+#define RATE_TABLE_MIN_PER_DECADE 25
+#define RATE_TABLE_MAX_PER_DECADE 12800
+
+static int
+fill_table (struct rate_table *tab, double T_min, double T_max,
+	    int per_decade)
+{
+  double *T, *ln_lambda;
+  int k;
+
+  tab->logT_min = log (T_min);
+  tab->logT_max = log (T_max);
+  tab->n = (int) ceil (per_decade * log10 (T_max / T_min)) + 1;
+  if (tab->n < 4)
+    tab->n = 4;
+  tab->dlogT = (tab->logT_max - tab->logT_min) / (tab->n - 1);
+  tab->inv_dlogT = 1.0 / tab->dlogT;
+  free (tab->ln_lambda);
+  tab->ln_lambda = malloc ((size_t) tab->n * N_RATES_T * sizeof (double));
+  if (tab->ln_lambda == NULL)
+    return GSL_ENOMEM;
+
+  T = malloc ((size_t) tab->n * sizeof (double));
+  if (T == NULL)
+    return GSL_ENOMEM;
+
+  /* every node in one kernel call, straight into the table (it's the
+   * same node-major layout), then take the logs in place */
+  for (k = 0; k < tab->n; ++k)
+    T[k] = exp (tab->logT_min + k * tab->dlogT);
+  ln_lambda = tab->ln_lambda;
+  rate_eval_fits_n (tab->n, T, ln_lambda, 1, N_RATES_T);
+  for (k = 0; k < tab->n * N_RATES_T; ++k)
+    ln_lambda[k] = log (ln_lambda[k] > RATE_TABLE_FLOOR ? ln_lambda[k]
+			: RATE_TABLE_FLOOR);
+  free (T);
+  return GSL_SUCCESS;
+}
+
+/* Tabulates the T-dependent rates between T_min and T_max (K), on a
+ * grid fine enough that the interpolated rates are within tol
+ * (relative; <= 0 means RATE_TABLE_TOL) of the fits. If even the
+ * finest grid we're willing to use can't get there, the table is kept
+ * anyway and GSL_ETOL returned, so the caller can decide; the error
+ * we did get is in tab->max_rel_err either way. */
+int
+rate_table_build (struct rate_table *tab, double T_min, double T_max,
+		  double tol)
+{
+  int per_decade, status;
+
+  if (T_min <= 0.0 || T_max <= T_min)
+    return GSL_EINVAL;
+  if (tol <= 0.0)
+    tol = RATE_TABLE_TOL;
+  tab->ln_lambda = NULL;
+
+  for (per_decade = RATE_TABLE_MIN_PER_DECADE;; per_decade *= 2)
+    {
+      status = fill_table (tab, T_min, T_max, per_decade);
+      if (status != GSL_SUCCESS)
+	return status;
+      tab->max_rel_err = rate_table_check (tab, NULL, NULL);
+      if (tab->max_rel_err <= tol)
+	return GSL_SUCCESS;
+      if (per_decade >= RATE_TABLE_MAX_PER_DECADE)
+	return GSL_ETOL;
+    }
+}
+
+void
+rate_table_free (struct rate_table *tab)
+{
+  free (tab->ln_lambda);
+  tab->ln_lambda = NULL;
+  tab->n = 0;
+}
+
+/* The T-dependent rates (lambda[0 ... N_RATES_T - 1]) and their
+ * derivatives with respect to T at T. Returns -1, and leaves lambda
+ * alone, if T is off the table. */
+int
+rate_table_eval (const struct rate_table *tab, double T, double lambda[],
+		 double dlambda_dT[])
+{
+  const double x = log (T);
+  int k, r;
+
+  if (!(x >= tab->logT_min && x <= tab->logT_max))
+    return -1;
+  /* cell [k, k+1] holds x; the cubic goes through nodes k-1 ... k+2,
+   * shifted inwards at the ends of the table */
+  k = (int) ((x - tab->logT_min) * tab->inv_dlogT);
+  if (k < 1)
+    k = 1;
+  if (k > tab->n - 3)
+    k = tab->n - 3;
+  const double s = (x - tab->logT_min) * tab->inv_dlogT - k;
+  const double s2 = s * s;
+  // Lagrange weights for nodes k-1, k, k+1, k+2 and their derivatives
+  const double w0 = -s * (s - 1.0) * (s - 2.0) / 6.0;
+  const double w1 = (s + 1.0) * (s - 1.0) * (s - 2.0) / 2.0;
+  const double w2 = -(s + 1.0) * s * (s - 2.0) / 2.0;
+  const double w3 = (s + 1.0) * s * (s - 1.0) / 6.0;
+  const double d0 = -(3.0 * s2 - 6.0 * s + 2.0) / 6.0;
+  const double d1 = (3.0 * s2 - 4.0 * s - 1.0) / 2.0;
+  const double d2 = -(3.0 * s2 - 2.0 * s - 2.0) / 2.0;
+  const double d3 = (3.0 * s2 - 1.0) / 6.0;
+  const double *p = tab->ln_lambda + (k - 1) * N_RATES_T;
+  // d/dT = (1/T) d/dlogT = (1/T) (1/dlogT) d/ds
+  const double ds_dT = tab->inv_dlogT / T;
+
+  for (r = 0; r < N_RATES_T; ++r)
+    {
+      const double a = p[r], b = p[N_RATES_T + r];
+      const double c = p[2 * N_RATES_T + r], d = p[3 * N_RATES_T + r];
+      lambda[r] = exp (w0 * a + w1 * b + w2 * c + w3 * d);
+      if (dlambda_dT != NULL)
+	dlambda_dT[r] =
+	  lambda[r] * (d0 * a + d1 * b + d2 * c + d3 * d) * ds_dT;
+    }
+  return 0;
+}
+
+/* Largest relative difference between the table and the fits, looked
+ * for at the 1/4, 1/2 and 3/4 points of every cell. Rates that are
+ * below the floor in the fits are skipped: nobody cares whether a rate
+ * is 1e-310 or 0. Optionally says where it was. */
+double
+rate_table_check (const struct rate_table *tab, double *worst_T,
+		  int *worst_rate)
+{
+  double exact[N_RATES_T], interp[N_RATES_T];
+  double worst = 0.0;
+  int k, q, r;
+
+  for (k = 0; k < tab->n - 1; ++k)
+    for (q = 1; q < 4; ++q)
+      {
+	const double T = exp (tab->logT_min + (k + 0.25 * q) * tab->dlogT);
+	rate_eval_fits (T, exact);
+	rate_table_eval (tab, T, interp, NULL);
+	for (r = 0; r < N_RATES_T; ++r)
+	  {
+	    if (fabs (exact[r]) < RATE_TABLE_FLOOR / DBL_EPSILON)
+	      continue;
+	    const double err = fabs (interp[r] / exact[r] - 1.0);
+	    if (err > worst)
+	      {
+		worst = err;
+		if (worst_T != NULL)
+		  *worst_T = T;
+		if (worst_rate != NULL)
+		  *worst_rate = r;
+	      }
+	  }
+      }
+  return worst;
+}
@@ -0,0 +1,32 @@
+#ifndef RATE_TABLE_H
+#define RATE_TABLE_H
+
+/* The temperature-dependent rates tabulated on a grid in log(T), for
+ * runs where T changes all the time (trajectories) and evaluating the
+ * CF88 fits at every new temperature would cost more than the rest of
+ * the integration. See rate_table.c. */
+
+// default bound on the interpolation error, relative
+#define RATE_TABLE_TOL 1.0e-8
+
+struct rate_table
+{
+  double logT_min, logT_max;	// natural log of the table ends
+  double dlogT;			// node spacing
+  double inv_dlogT;
+  int n;			// number of nodes
+  /* log(lambda) at every node, node-major: all N_RATES_T rates of node
+   * k are ln_lambda[k * N_RATES_T ...] */
+  double *ln_lambda;
+  double max_rel_err;		// worst error found by rate_table_check()
+};
+
+int rate_table_build (struct rate_table *tab, double T_min, double T_max,
+		      double tol);
+void rate_table_free (struct rate_table *tab);
+int rate_table_eval (const struct rate_table *tab, double T,
+		     double lambda[], double dlambda_dT[]);
+double rate_table_check (const struct rate_table *tab, double *worst_T,
+			 int *worst_rate);
+
+#endif
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gsl/gsl_errno.h>
+#include "network.h"
+#include "ratelib.h"
+
+/* Every rate in rate_coeffs.c is a function somebody typed in from
+ * CF88, which is fine for 13 of them and hopeless for the few hundred
+ * (or thousand) reactions of a real network. REACLIB has them all in
+ * one form: each rate is a sum of one or more sets of seven numbers,
+ *
+ *   lambda = sum over sets of exp(a0 + a1/T9 + a2/T9^(1/3) + a3 T9^(1/3)
+ *                                 + a4 T9 + a5 T9^(5/3) + a6 ln T9)
+ *
+ * in the same units as ours (1/s, cm^3/mol/s, cm^6/mol^2/s for 1, 2
+ * and 3 reactants). rates2bin turns a REACLIB text file into an image
+ * of the network (see ratelib.h) once, and here we mmap() it: there's
+ * nothing to parse or allocate, so opening a library of thousands of
+ * reactions takes as long as the checks below, microseconds, and the
+ * pages only get read when the rates are first evaluated.
+ *
+ * rates2bin has already divided the rates with identical reactants by
+ * the number of ways to pick them (1/2 for C12 + C12, 1/6 for three
+ * alphas) since our fluxes are just lambda * y_a * y_b. Reverse rates
+ * are used without the partition functions (they're 1 below a few GK)
+ * and electron captures without the rho * Y_e they should be
+ * multiplied by. */
+
+// sets per pass of ratelib_eval(): sized for the stack, not the library
+#define RATELIB_BLOCK 256
+
+/* is the section of n things of size bytes at off inside the image,
+ * and aligned? */
+static int
+section_ok (const struct ratelib_header *hdr, uint64_t off, uint64_t n,
+	    uint64_t size)
+{
+  return off % RATELIB_ALIGN == 0 && off <= hdr->size
+    && n <= (hdr->size - off) / size;
+}
+
+/* Maps the library image at path and checks that it is one, and that
+ * every index in it points somewhere sensible, so a damaged file can't
+ * send the solver off the end of an array. Returns GSL_SUCCESS,
+ * GSL_EFAILED if it can't be opened or mapped, or GSL_EINVAL if it
+ * isn't a library (or is one from another version or byte order). */
+int
+ratelib_open (struct ratelib *lib, const char *path)
+{
+  const struct ratelib_header *hdr;
+  struct stat st;
+  uint32_t r, s, k;
+  int fd, ok;
+
+  memset (lib, 0, sizeof (*lib));
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return GSL_EFAILED;
+  if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof (*hdr))
+    {
+      close (fd);
+      return st.st_size < (off_t) sizeof (*hdr) ? GSL_EINVAL : GSL_EFAILED;
+    }
+  lib->size = st.st_size;
+  lib->image = mmap (NULL, lib->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file, we don't need the descriptor
+  close (fd);
+  if (lib->image == MAP_FAILED)
+    {
+      lib->image = NULL;
+      return GSL_EFAILED;
+    }
+
+  hdr = lib->image;
+  ok = memcmp (hdr->magic, RATELIB_MAGIC, sizeof (hdr->magic)) == 0
+    && hdr->version == RATELIB_VERSION
+    && hdr->byte_order == RATELIB_BYTE_ORDER && hdr->size == lib->size
+    && section_ok (hdr, hdr->off_iso, hdr->n_iso, sizeof (*lib->iso))
+    && section_ok (hdr, hdr->off_reac, hdr->n_reac, sizeof (*lib->reac))
+    && section_ok (hdr, hdr->off_q, hdr->n_reac, sizeof (double))
+    && section_ok (hdr, hdr->off_q_nu, hdr->n_reac, sizeof (double))
+    && section_ok (hdr, hdr->off_set_reac, hdr->n_sets, sizeof (int32_t));
+  for (k = 0; ok && k < RATELIB_N_COEFF; ++k)
+    ok = section_ok (hdr, hdr->off_coeff[k], hdr->n_sets, sizeof (double));
+  if (!ok)
+    {
+      ratelib_close (lib);
+      return GSL_EINVAL;
+    }
+
+  lib->hdr = hdr;
+  lib->iso = (const void *) ((const char *) lib->image + hdr->off_iso);
+  lib->reac = (const void *) ((const char *) lib->image + hdr->off_reac);
+  lib->q = (const void *) ((const char *) lib->image + hdr->off_q);
+  lib->q_nu = (const void *) ((const char *) lib->image + hdr->off_q_nu);
+  lib->set_reac =
+    (const void *) ((const char *) lib->image + hdr->off_set_reac);
+  for (k = 0; k < RATELIB_N_COEFF; ++k)
+    lib->a[k] =
+      (const void *) ((const char *) lib->image + hdr->off_coeff[k]);
+
+  for (r = 0; ok && r < hdr->n_reac; ++r)
+    {
+      const struct ratelib_reac *re = &lib->reac[r];
+      ok = re->n_in >= 1 && re->n_in <= RATELIB_MAX_IN
+	&& re->n_out >= 0 && re->n_out <= RATELIB_MAX_OUT;
+      for (k = 0; ok && k < (uint32_t) re->n_in; ++k)
+	ok = re->in[k] >= 0 && (uint32_t) re->in[k] < hdr->n_iso;
+      for (k = 0; ok && k < (uint32_t) re->n_out; ++k)
+	ok = re->out[k] >= 0 && (uint32_t) re->out[k] < hdr->n_iso;
+    }
+  for (s = 0; ok && s < hdr->n_sets; ++s)
+    ok = lib->set_reac[s] >= 0 && (uint32_t) lib->set_reac[s] < hdr->n_reac;
+  if (!ok)
+    {
+      ratelib_close (lib);
+      return GSL_EINVAL;
+    }
+  return GSL_SUCCESS;
+}
+
+void
+ratelib_close (struct ratelib *lib)
+{
+  if (lib->image != NULL)
+    munmap (lib->image, lib->size);
+  memset (lib, 0, sizeof (*lib));
+}
+
+/* Every reaction's rate at T (K) into lambda, and d lambda / dT into
+ * dlambda_dT, both n_reac long. The sets go through in blocks: first
+ * the exponents for the whole block, straight down the coefficient
+ * arrays (this is the loop that vectorizes), then the exp()s, then
+ * they're added to their reactions. d lambda_s / dT9 is lambda_s times
+ * the derivative of the exponent, so that's nearly free. */
+void
+ratelib_eval (const struct ratelib *lib, double T, double lambda[],
+	      double dlambda_dT[])
+{
+  const int n_reac = lib->hdr->n_reac, n_sets = lib->hdr->n_sets;
+  const double *a0 = lib->a[0], *a1 = lib->a[1], *a2 = lib->a[2];
+  const double *a3 = lib->a[3], *a4 = lib->a[4], *a5 = lib->a[5];
+  const double *a6 = lib->a[6];
+  const double T9 = T * 1.0e-9, T9i = 1.0 / T9, T913 = cbrt (T9);
+  const double T9i13 = 1.0 / T913, T953 = T9 * T913 * T913;
+  const double lnT9 = log (T9);
+  double v[RATELIB_BLOCK], dv[RATELIB_BLOCK];
+  int s0, s, k, n;
+
+  for (k = 0; k < n_reac; ++k)
+    {
+      lambda[k] = 0.0;
+      dlambda_dT[k] = 0.0;
+    }
+  for (s0 = 0; s0 < n_sets; s0 += RATELIB_BLOCK)
+    {
+      n = (n_sets - s0 < RATELIB_BLOCK) ? n_sets - s0 : RATELIB_BLOCK;
+      for (k = 0; k < n; ++k)
+	{
+	  s = s0 + k;
+	  v[k] = a0[s] + a1[s] * T9i + a2[s] * T9i13 + a3[s] * T913
+	    + a4[s] * T9 + a5[s] * T953 + a6[s] * lnT9;
+	  // d(exponent)/dT9, in 1/K below
+	  dv[k] = T9i * (-a1[s] * T9i - a2[s] * T9i13 / 3.0
+			 + a3[s] * T913 / 3.0 + a4[s] * T9
+			 + 5.0 / 3.0 * a5[s] * T953 + a6[s]) * 1.0e-9;
+	}
+      for (k = 0; k < n; ++k)
+	{
+	  v[k] = exp (v[k]);
+	  dv[k] *= v[k];
+	}
+      for (k = 0; k < n; ++k)
+	{
+	  lambda[lib->set_reac[s0 + k]] += v[k];
+	  dlambda_dT[lib->set_reac[s0 + k]] += dv[k];
+	}
+    }
+}
+
+/* The network of the library's isotopes and reactions, with reaction r
+ * using rate r, i.e. lambda[r] from ratelib_eval() (which is what
+ * rate_state_use_library() hands out). Returns GSL_SUCCESS or
+ * GSL_ENOMEM; net is finalized, or freed on failure. */
+int
+network_from_ratelib (struct network *net, const struct ratelib *lib)
+{
+  const struct ratelib_header *hdr = lib->hdr;
+  int status = 0;
+  uint32_t i, r;
+
+  network_init (net);
+  for (i = 0; i < hdr->n_iso; ++i)
+    {
+      char name[NET_NAME_LEN];
+      // the library's names are padded with NULs, but maybe not ended
+      memcpy (name, lib->iso[i].name, NET_NAME_LEN - 1);
+      name[NET_NAME_LEN - 1] = '\0';
+      if (network_add_isotope (net, name, lib->iso[i].Z, lib->iso[i].A,
+			       lib->iso[i].molar_mass) < 0)
+	{
+	  network_free (net);
+	  return GSL_ENOMEM;
+	}
+    }
+  for (r = 0; r < hdr->n_reac; ++r)
+    status |= network_add_reaction (net, r, lib->reac[r].n_in,
+				    lib->reac[r].in, lib->reac[r].n_out,
+				    lib->reac[r].out);
+  if (status < 0 || network_finalize (net) != 0)
+    {
+      network_free (net);
+      return GSL_ENOMEM;
+    }
+  return GSL_SUCCESS;
+}
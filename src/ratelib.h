@@ -0,0 +1,82 @@
+#ifndef RATELIB_H
+#define RATELIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A rate library: the isotopes and reactions of a network with a
+ * REACLIB-style fit for every rate, compiled from text by rates2bin
+ * (rates2bin.c) into a binary image that gets mmap()ed as it is. See
+ * ratelib.c. The image, in host byte order like the checkpoints:
+ *
+ *   struct ratelib_header
+ *   n_iso   struct ratelib_iso
+ *   n_reac  struct ratelib_reac
+ *   n_reac  doubles q, n_reac doubles q_nu (MeV per reaction)
+ *   n_sets  int32 set_reac: the reaction each set belongs to
+ *   RATELIB_N_COEFF arrays of n_sets doubles a0[], a1[], ..., a6[]
+ *
+ * with every section starting on a RATELIB_ALIGN boundary, so the
+ * coefficient loops in ratelib_eval() run on aligned, unit-stride
+ * arrays. The offsets are in the header. */
+
+#define RATELIB_MAGIC "NNRATES\0"
+#define RATELIB_VERSION 1
+#define RATELIB_BYTE_ORDER 0x01020304u
+#define RATELIB_ALIGN 64
+#define RATELIB_NAME_LEN 8
+// the seven a_i of a REACLIB set
+#define RATELIB_N_COEFF 7
+// reactants and products of a reaction, as many as the network takes
+#define RATELIB_MAX_IN 3
+#define RATELIB_MAX_OUT 4
+
+struct ratelib_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;		// RATELIB_BYTE_ORDER as written by the host
+  uint32_t n_iso, n_reac, n_sets, pad;
+  uint64_t size;		// of the whole image, bytes
+  // where each section starts, bytes from the start of the image
+  uint64_t off_iso, off_reac, off_q, off_q_nu, off_set_reac;
+  uint64_t off_coeff[RATELIB_N_COEFF];
+};
+
+struct ratelib_iso
+{
+  char name[RATELIB_NAME_LEN];	// lower-case, as in struct isotope
+  int32_t Z, A;
+  double molar_mass;		// g/mol
+};
+
+struct ratelib_reac
+{
+  int32_t n_in, n_out;
+  int32_t in[RATELIB_MAX_IN];	// isotope indices, repeated if identical
+  int32_t out[RATELIB_MAX_OUT];
+  int32_t chapter;		// REACLIB chapter it came from
+  char label[8];		// REACLIB set label, e.g. "nacr"
+};
+
+struct ratelib
+{
+  void *image;			// the mapping
+  size_t size;
+  const struct ratelib_header *hdr;
+  const struct ratelib_iso *iso;
+  const struct ratelib_reac *reac;
+  const double *q, *q_nu;
+  const int32_t *set_reac;
+  const double *a[RATELIB_N_COEFF];
+};
+
+struct network;
+
+int ratelib_open (struct ratelib *lib, const char *path);
+void ratelib_close (struct ratelib *lib);
+void ratelib_eval (const struct ratelib *lib, double T, double lambda[],
+		   double dlambda_dT[]);
+int network_from_ratelib (struct network *net, const struct ratelib *lib);
+
+#endif
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "ratelib.h"
+
+/* Compiles a REACLIB rate library (the text format from the JINA
+ * REACLIB database, "REACLIB 2" with a chapter number before every
+ * set, or the older one with a chapter heading before all its sets)
+ * into the binary image the solver mmap()s (see ratelib.h):
+ *
+ *   rates2bin reaclib.txt rates.bin
+ *   nuclear_network --network rates.bin ...
+ *
+ * Each set is four lines: the chapter, then the nuclides (six 5-char
+ * fields from column 6, reactants first; the chapter says how many of
+ * each), the set label, resonance and reverse flags and the Q-value,
+ * then the seven coefficients, four and three to a line, 13 chars
+ * each. Consecutive sets with the same nuclides, label and reverse
+ * flag are one rate and get added up. Chapter 10 (four reactants) is
+ * skipped, the network only does three.
+ *
+ * The isotopes are whatever the reactions mention, in order of Z and
+ * then A, so the neutron comes first and H1 next. p, d and t become
+ * h1, h2 and h3 to match the built-in network. REACLIB has no masses,
+ * so the molar mass is taken to be A g/mol, which is good to 1% in the
+ * mass fractions; and no neutrino energies, so q_nu is zero and the
+ * decays' Q-values count the neutrinos as heat. */
+
+// nuclides per chapter: reactants, and products (-1: what's left, ch 8)
+static const int chapter_in[12] = { 0, 1, 1, 1, 2, 2, 2, 2, 3, 3, 4, 1 };
+static const int chapter_out[12] = { 0, 1, 2, 3, 1, 2, 3, 4, -1, 2, 2, 4 };
+
+#define MAX_Z 118
+#define MAX_A 300
+/* room for the longest key add_set() can make: the chapter, six 5-char
+ * nuclides, the 4-char label and the reverse flag */
+#define KEY_LEN 64
+
+static const char *element[MAX_Z + 1] = {
+  "n", "h", "he", "li", "be", "b", "c", "n", "o", "f", "ne", "na", "mg",
+  "al", "si", "p", "s", "cl", "ar", "k", "ca", "sc", "ti", "v", "cr", "mn",
+  "fe", "co", "ni", "cu", "zn", "ga", "ge", "as", "se", "br", "kr", "rb",
+  "sr", "y", "zr", "nb", "mo", "tc", "ru", "rh", "pd", "ag", "cd", "in",
+  "sn", "sb", "te", "i", "xe", "cs", "ba", "la", "ce", "pr", "nd", "pm",
+  "sm", "eu", "gd", "tb", "dy", "ho", "er", "tm", "yb", "lu", "hf", "ta",
+  "w", "re", "os", "ir", "pt", "au", "hg", "tl", "pb", "bi", "po", "at",
+  "rn", "fr", "ra", "ac", "th", "pa", "u", "np", "pu", "am", "cm", "bk",
+  "cf", "es", "fm", "md", "no", "lr", "rf", "db", "sg", "bh", "hs", "mt",
+  "ds", "rg", "cn", "nh", "fl", "mc", "lv", "ts", "og"
+};
+
+// everything read so far, growing as needed
+struct lib_text
+{
+  // isotope index by Z and A, -1 if not seen (yet)
+  int iso_of[MAX_Z + 1][MAX_A + 1];
+  int n_iso;
+  struct ratelib_reac *reac;
+  double *q;
+  char (*key)[KEY_LEN];		// what makes two sets the same rate
+  int n_reac, cap_reac;
+  double *a[RATELIB_N_COEFF];
+  int *set_reac;
+  int n_sets, cap_sets;
+};
+
+/* REACLIB's name for a nuclide -> Z and A. "n" is the neutron, p, d
+ * and t the hydrogens; everything else is an element and a mass
+ * number. Returns 0 or -1 */
+static int
+parse_nuclide (const char *name, int *Z, int *A)
+{
+  char sym[4];
+  int k = 0, z;
+
+  if (strcmp (name, "n") == 0 || strcmp (name, "p") == 0
+      || strcmp (name, "d") == 0 || strcmp (name, "t") == 0)
+    {
+      *Z = name[0] == 'n' ? 0 : 1;
+      *A = name[0] == 'd' ? 2 : name[0] == 't' ? 3 : 1;
+      return 0;
+    }
+  while (isalpha ((unsigned char) name[k]) && k < 3)
+    {
+      sym[k] = name[k];
+      ++k;
+    }
+  sym[k] = '\0';
+  if (k == 0 || !isdigit ((unsigned char) name[k]))
+    return -1;
+  *A = atoi (&name[k]);
+  for (z = 1; z <= MAX_Z; ++z)
+    if (strcmp (sym, element[z]) == 0)
+      break;
+  if (z > MAX_Z || *A < z || *A > MAX_A)
+    return -1;
+  *Z = z;
+  return 0;
+}
+
+/* the 5-char field at col of line, trimmed and lower-cased into out.
+ * empty if the line isn't that long */
+static void
+field (const char *line, int col, int width, char *out)
+{
+  int len = strlen (line), k, n = 0;
+  for (k = col; k < col + width && k < len; ++k)
+    if (!isspace ((unsigned char) line[k]))
+      out[n++] = tolower ((unsigned char) line[k]);
+  out[n] = '\0';
+}
+
+// the 13-char number at col, 0 or -1 if there isn't one
+static int
+number (const char *line, int col, double *x)
+{
+  char buf[14], *end;
+  int len = strlen (line);
+  if (len < col + 1)
+    return -1;
+  memcpy (buf, line + col, 13);
+  buf[13] = '\0';
+  *x = strtod (buf, &end);
+  return end == buf ? -1 : 0;
+}
+
+static int
+grow (struct lib_text *lt)
+{
+  int k;
+  if (lt->n_sets == lt->cap_sets)
+    {
+      lt->cap_sets = lt->cap_sets ? 2 * lt->cap_sets : 1024;
+      for (k = 0; k < RATELIB_N_COEFF; ++k)
+	if ((lt->a[k] = realloc (lt->a[k],
+				 lt->cap_sets * sizeof (double))) == NULL)
+	  return -1;
+      if ((lt->set_reac = realloc (lt->set_reac,
+				   lt->cap_sets * sizeof (int))) == NULL)
+	return -1;
+    }
+  if (lt->n_reac == lt->cap_reac)
+    {
+      lt->cap_reac = lt->cap_reac ? 2 * lt->cap_reac : 512;
+      lt->reac = realloc (lt->reac, lt->cap_reac * sizeof (*lt->reac));
+      lt->q = realloc (lt->q, lt->cap_reac * sizeof (double));
+      lt->key = realloc (lt->key, lt->cap_reac * sizeof (*lt->key));
+      if (lt->reac == NULL || lt->q == NULL || lt->key == NULL)
+	return -1;
+    }
+  return 0;
+}
+
+/* One set: the nuclide line and the two coefficient lines. Returns 0,
+ * 1 if it's been skipped, or -1 if it's broken */
+static int
+add_set (struct lib_text *lt, int chapter, const char *head,
+	 const char *c1, const char *c2)
+{
+  char name[6][8], label[8], key[KEY_LEN];
+  int n_names = 0, n_in, n_out, Z, A, k, j, same;
+  double coeff[RATELIB_N_COEFF], q, ways = 1.0;
+  struct ratelib_reac *re;
+
+  for (k = 0; k < 6; ++k)
+    {
+      field (head, 5 + 5 * k, 5, name[k]);
+      if (name[k][0] != '\0')
+	n_names = k + 1;
+    }
+  field (head, 43, 4, label);
+  if (sscanf (head + (strlen (head) > 52 ? 52 : strlen (head)), "%lf", &q)
+      != 1)
+    return -1;
+  for (k = 0; k < 4; ++k)
+    if (number (c1, 13 * k, &coeff[k]) != 0)
+      return -1;
+  for (k = 0; k < 3; ++k)
+    if (number (c2, 13 * k, &coeff[4 + k]) != 0)
+      return -1;
+
+  n_in = chapter_in[chapter];
+  n_out = chapter_out[chapter] >= 0 ? chapter_out[chapter] : n_names - n_in;
+  if (n_in > RATELIB_MAX_IN)
+    return 1;
+  if (n_out < 1 || n_out > RATELIB_MAX_OUT || n_in + n_out != n_names)
+    return -1;
+
+  // the same rate as the last set?
+  snprintf (key, sizeof (key), "%d %.5s%.5s%.5s%.5s%.5s%.5s %.4s %c",
+	    chapter, name[0], name[1], name[2], name[3], name[4], name[5],
+	    label, strlen (head) > 48 ? head[48] : ' ');
+  same = lt->n_reac > 0 && strcmp (lt->key[lt->n_reac - 1], key) == 0;
+  if (grow (lt) != 0)
+    return -1;
+  if (!same)
+    {
+      re = &lt->reac[lt->n_reac];
+      memset (re, 0, sizeof (*re));
+      re->n_in = n_in;
+      re->n_out = n_out;
+      re->chapter = chapter;
+      memcpy (re->label, label, 4);
+      for (k = 0; k < n_names; ++k)
+	{
+	  if (parse_nuclide (name[k], &Z, &A) != 0)
+	    return -1;
+	  if (lt->iso_of[Z][A] < 0)
+	    lt->iso_of[Z][A] = lt->n_iso++;
+	  // isotope numbers for now, renumbered by Z and A at the end
+	  if (k < n_in)
+	    re->in[k] = Z * (MAX_A + 1) + A;
+	  else
+	    re->out[k - n_in] = Z * (MAX_A + 1) + A;
+	}
+      lt->q[lt->n_reac] = q;
+      strcpy (lt->key[lt->n_reac], key);
+      ++lt->n_reac;
+    }
+  re = &lt->reac[lt->n_reac - 1];
+  /* identical reactants: y_a^2 counts every pair twice, y_a^3 every
+   * triple six times, so divide by m! for each one there's m of */
+  for (k = 0; k < re->n_in; ++k)
+    {
+      int m = 1;
+      for (j = 0; j < k; ++j)
+	m += re->in[j] == re->in[k];
+      ways *= m;
+    }
+  coeff[0] -= log (ways);
+  for (k = 0; k < RATELIB_N_COEFF; ++k)
+    lt->a[k][lt->n_sets] = coeff[k];
+  lt->set_reac[lt->n_sets++] = lt->n_reac - 1;
+  return 0;
+}
+
+// write n bytes of p, then zeros up to the next RATELIB_ALIGN
+static int
+put (FILE * fp, const void *p, size_t n)
+{
+  static const char zero[RATELIB_ALIGN];
+  size_t pad = (RATELIB_ALIGN - n % RATELIB_ALIGN) % RATELIB_ALIGN;
+  return (n > 0 && fwrite (p, 1, n, fp) != n)
+    || (pad > 0 && fwrite (zero, 1, pad, fp) != pad);
+}
+
+static uint64_t
+aligned (uint64_t n)
+{
+  return (n + RATELIB_ALIGN - 1) / RATELIB_ALIGN * RATELIB_ALIGN;
+}
+
+static int
+write_image (const struct lib_text *lt, const char *path)
+{
+  struct ratelib_header hdr;
+  struct ratelib_iso iso[lt->n_iso + 1];
+  int pos[(MAX_Z + 1) * (MAX_A + 1)];
+  int32_t set_reac[lt->n_sets + 1];
+  double *q_nu = calloc (lt->n_reac + 1, sizeof (double));
+  int Z, A, n = 0, r, k, status;
+  FILE *fp;
+
+  if (q_nu == NULL)
+    return -1;
+  // isotopes by Z, then A
+  for (Z = 0; Z <= MAX_Z; ++Z)
+    for (A = 0; A <= MAX_A; ++A)
+      {
+	pos[Z * (MAX_A + 1) + A] = -1;
+	if (lt->iso_of[Z][A] < 0)
+	  continue;
+	memset (&iso[n], 0, sizeof (iso[n]));
+	if (Z == 0)
+	  strcpy (iso[n].name, "n");
+	else
+	  snprintf (iso[n].name, RATELIB_NAME_LEN, "%s%d", element[Z], A);
+	iso[n].Z = Z;
+	iso[n].A = A;
+	iso[n].molar_mass = A;
+	pos[Z * (MAX_A + 1) + A] = n++;
+      }
+  for (r = 0; r < lt->n_reac; ++r)
+    {
+      for (k = 0; k < lt->reac[r].n_in; ++k)
+	lt->reac[r].in[k] = pos[lt->reac[r].in[k]];
+      for (k = 0; k < lt->reac[r].n_out; ++k)
+	lt->reac[r].out[k] = pos[lt->reac[r].out[k]];
+    }
+  for (k = 0; k < lt->n_sets; ++k)
+    set_reac[k] = lt->set_reac[k];
+
+  memset (&hdr, 0, sizeof (hdr));
+  memcpy (hdr.magic, RATELIB_MAGIC, sizeof (hdr.magic));
+  hdr.version = RATELIB_VERSION;
+  hdr.byte_order = RATELIB_BYTE_ORDER;
+  hdr.n_iso = n;
+  hdr.n_reac = lt->n_reac;
+  hdr.n_sets = lt->n_sets;
+  hdr.off_iso = aligned (sizeof (hdr));
+  hdr.off_reac = hdr.off_iso + aligned (n * sizeof (*iso));
+  hdr.off_q = hdr.off_reac + aligned (lt->n_reac * sizeof (*lt->reac));
+  hdr.off_q_nu = hdr.off_q + aligned (lt->n_reac * sizeof (double));
+  hdr.off_set_reac = hdr.off_q_nu + aligned (lt->n_reac * sizeof (double));
+  hdr.off_coeff[0] = hdr.off_set_reac
+    + aligned (lt->n_sets * sizeof (int32_t));
+  for (k = 1; k < RATELIB_N_COEFF; ++k)
+    hdr.off_coeff[k] = hdr.off_coeff[k - 1]
+      + aligned (lt->n_sets * sizeof (double));
+  hdr.size = hdr.off_coeff[RATELIB_N_COEFF - 1]
+    + aligned (lt->n_sets * sizeof (double));
+
+  fp = fopen (path, "wb");
+  if (fp == NULL)
+    {
+      free (q_nu);
+      return -1;
+    }
+  status = put (fp, &hdr, sizeof (hdr))
+    || put (fp, iso, n * sizeof (*iso))
+    || put (fp, lt->reac, lt->n_reac * sizeof (*lt->reac))
+    || put (fp, lt->q, lt->n_reac * sizeof (double))
+    || put (fp, q_nu, lt->n_reac * sizeof (double))
+    || put (fp, set_reac, lt->n_sets * sizeof (int32_t));
+  for (k = 0; k < RATELIB_N_COEFF; ++k)
+    status = status || put (fp, lt->a[k], lt->n_sets * sizeof (double));
+  if (fclose (fp) != 0)
+    status = 1;
+  free (q_nu);
+  printf ("%d isotopes, %d reactions, %d sets, %llu bytes\n", n,
+	  lt->n_reac, lt->n_sets, (unsigned long long) hdr.size);
+  return status ? -1 : 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static struct lib_text lt;
+  char line[4][256];
+  int chapter = 0, n_line = 0, n_skipped = 0, k, Z, A, status = 0;
+  FILE *fp;
+
+  if (argc != 3)
+    {
+      fprintf (stderr, "usage: %s REACLIB_FILE OUTPUT\n", argv[0]);
+      return 1;
+    }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL)
+    {
+      fprintf (stderr, "could not open %s\n", argv[1]);
+      return 1;
+    }
+  for (Z = 0; Z <= MAX_Z; ++Z)
+    for (A = 0; A <= MAX_A; ++A)
+      lt.iso_of[Z][A] = -1;
+
+  while (fgets (line[0], sizeof (line[0]), fp) != NULL)
+    {
+      char *p = line[0];
+      ++n_line;
+      line[0][strcspn (line[0], "\r\n")] = '\0';
+      while (isspace ((unsigned char) *p))
+	++p;
+      if (*p == '\0')
+	continue;
+      // a chapter number, on its own
+      if (strspn (p, "0123456789") == strlen (p))
+	{
+	  chapter = atoi (p);
+	  if (chapter < 1 || chapter > 11)
+	    break;
+	  continue;
+	}
+      // otherwise the first line of a set, with two more to come
+      for (k = 1; k < 3; ++k)
+	{
+	  if (fgets (line[k], sizeof (line[k]), fp) == NULL)
+	    break;
+	  line[k][strcspn (line[k], "\r\n")] = '\0';
+	}
+      n_line += 2;
+      if (k < 3 || chapter == 0)
+	{
+	  status = -1;
+	  break;
+	}
+      status = add_set (&lt, chapter, line[0], line[1], line[2]);
+      if (status < 0)
+	break;
+      n_skipped += status;
+    }
+  fclose (fp);
+  if (status < 0 || chapter < 1 || chapter > 11)
+    {
+      fprintf (stderr, "%s:%d: not a REACLIB set\n", argv[1], n_line);
+      return 1;
+    }
+  if (n_skipped > 0)
+    fprintf (stderr, "skipped %d sets with 4 reactants\n", n_skipped);
+  if (write_image (&lt, argv[2]) != 0)
+    {
+      fprintf (stderr, "could not write %s\n", argv[2]);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include "schedule.h"
+
+/* The stepper takes as many steps as it needs, which has nothing to do
+ * with how many rows anybody wants to look at: a run to 1e22 sec can
+ * take thousands of steps, and plot.py only needs enough points to
+ * draw smooth lines on log-log axes. So instead of writing every step,
+ * main.c can write the abundances at a fixed list of times, either by
+ * interpolating inside the step that crossed each time (dense_hermite
+ * below) or by making the stepper land on each time exactly. */
+
+static int
+schedule_alloc (struct schedule *s, int n)
+{
+  s->n = n;
+  s->t = malloc ((n > 0 ? n : 1) * sizeof (double));
+  return s->t == NULL ? GSL_ENOMEM : GSL_SUCCESS;
+}
+
+// n times from t0 to t1 (both included), evenly spaced in log(t)
+int
+schedule_log (struct schedule *s, double t0, double t1, int n)
+{
+  int i;
+  if (n < 1 || t0 <= 0.0 || t1 < t0)
+    return GSL_EINVAL;
+  if (schedule_alloc (s, n) != GSL_SUCCESS)
+    return GSL_ENOMEM;
+  for (i = 0; i < n; ++i)
+    s->t[i] = (n == 1) ? t1 : t0 * pow (t1 / t0, (double) i / (n - 1));
+  // don't let round-off put the last one past the end of the run
+  s->t[n - 1] = t1;
+  return GSL_SUCCESS;
+}
+
+/* n times evenly spaced after t0, up to and including t1 (t0 itself is
+ * the initial state, which we know already) */
+int
+schedule_linear (struct schedule *s, double t0, double t1, int n)
+{
+  int i;
+  if (n < 1 || t1 <= t0)
+    return GSL_EINVAL;
+  if (schedule_alloc (s, n) != GSL_SUCCESS)
+    return GSL_ENOMEM;
+  for (i = 0; i < n; ++i)
+    s->t[i] = t0 + (t1 - t0) * (i + 1) / n;
+  s->t[n - 1] = t1;
+  return GSL_SUCCESS;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+// a file with one time per line (any order; "#" starts a comment)
+int
+schedule_read (struct schedule *s, const char *path)
+{
+  char line[256];
+  int cap = 64, n = 0;
+  FILE *fp = fopen (path, "r");
+  if (fp == NULL)
+    return GSL_EFAILED;
+  if (schedule_alloc (s, cap) != GSL_SUCCESS)
+    {
+      fclose (fp);
+      return GSL_ENOMEM;
+    }
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      double t;
+      char *hash = strchr (line, '#');
+      if (hash != NULL)
+	*hash = '\0';
+      if (sscanf (line, "%lf", &t) != 1)
+	continue;
+      if (n == cap)
+	{
+	  double *more = realloc (s->t, 2 * cap * sizeof (double));
+	  if (more == NULL)
+	    {
+	      fclose (fp);
+	      schedule_free (s);
+	      return GSL_ENOMEM;
+	    }
+	  s->t = more;
+	  cap *= 2;
+	}
+      s->t[n++] = t;
+    }
+  fclose (fp);
+  qsort (s->t, n, sizeof (double), compare_double);
+  s->n = n;
+  return GSL_SUCCESS;
+}
+
+/* Builds a schedule for a run from t0 to t1 out of a command line
+ * spec: "log:N", "lin:N" or the name of a file of times. Times outside
+ * (t0, t1] and duplicates are dropped, and if there are still more than
+ * max_rows (<= 0 means SCHEDULE_MAX_ROWS) we keep every k-th one, plus
+ * the last. Log schedules start at 1e-8 sec, like plot.py's axes, or
+ * at t0 if that's later. */
+int
+schedule_parse (struct schedule *s, const char *spec, double t0, double t1,
+		int max_rows)
+{
+  int n, i, m, status;
+
+  if (max_rows <= 0)
+    max_rows = SCHEDULE_MAX_ROWS;
+  if (sscanf (spec, "log:%d", &n) == 1)
+    status = schedule_log (s, t0 > 1.0e-8 ? t0 : 1.0e-8, t1,
+			   n < max_rows ? n : max_rows);
+  else if (sscanf (spec, "lin:%d", &n) == 1)
+    status = schedule_linear (s, t0, t1, n < max_rows ? n : max_rows);
+  else
+    status = schedule_read (s, spec);
+  if (status != GSL_SUCCESS)
+    return status;
+
+  for (i = 0, m = 0; i < s->n; ++i)
+    if (s->t[i] > t0 && s->t[i] <= t1 && (m == 0 || s->t[i] > s->t[m - 1]))
+      s->t[m++] = s->t[i];
+  s->n = m;
+  if (m > max_rows)
+    {
+      /* every stride-th of the first m - 1, max_rows - 1 of them at
+       * most, so that with the last one it comes to max_rows */
+      const int keep = max_rows - 1;
+      const int stride = keep > 0 ? (m - 1 + keep - 1) / keep : 1;
+      for (i = 0, n = 0; n < keep && i < m - 1; i += stride)
+	s->t[n++] = s->t[i];
+      s->t[n++] = s->t[m - 1];
+      s->n = n;
+    }
+  if (s->n == 0)
+    {
+      schedule_free (s);
+      return GSL_EINVAL;
+    }
+  return GSL_SUCCESS;
+}
+
+void
+schedule_free (struct schedule *s)
+{
+  free (s->t);
+  s->t = NULL;
+  s->n = 0;
+}
+
+/* Cubic Hermite interpolation inside one step, from the values and
+ * derivatives at both ends: fourth order, the error is at most h^4/384
+ * times the fourth derivative, which is as good as you can do without
+ * knowing what the stepper did in between. The ends are
+ * exact, so --land isn't needed unless the steps are so long
+ * that the interpolant can't follow the solution. */
+void
+dense_hermite (int n, double t0, const double y0[], const double f0[],
+	       double t1, const double y1[], const double f1[], double t,
+	       double y[])
+{
+  const double h = t1 - t0;
+  const double s = (t - t0) / h, s2 = s * s, s3 = s2 * s;
+  const double h00 = 2.0 * s3 - 3.0 * s2 + 1.0;
+  const double h10 = s3 - 2.0 * s2 + s;
+  const double h01 = -2.0 * s3 + 3.0 * s2;
+  const double h11 = s3 - s2;
+  int i;
+  for (i = 0; i < n; ++i)
+    y[i] = h00 * y0[i] + h10 * h * f0[i] + h01 * y1[i] + h11 * h * f1[i];
+}
@@ -0,0 +1,28 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+/* Output schedules: the times at which we actually want to know the
+ * abundances, as opposed to wherever the stepper happened to land.
+ * See schedule.c. */
+
+// default cap on the number of output times
+#define SCHEDULE_MAX_ROWS 10000
+
+struct schedule
+{
+  int n;			// number of output times
+  double *t;			// increasing, all > 0
+};
+
+int schedule_log (struct schedule *s, double t0, double t1, int n);
+int schedule_linear (struct schedule *s, double t0, double t1, int n);
+int schedule_read (struct schedule *s, const char *path);
+int schedule_parse (struct schedule *s, const char *spec, double t0,
+		    double t1, int max_rows);
+void schedule_free (struct schedule *s);
+
+void dense_hermite (int n, double t0, const double y0[], const double f0[],
+		    double t1, const double y1[], const double f1[],
+		    double t, double y[]);
+
+#endif
@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_errno.h>
+#include "sparse_lu.h"
+
+/* Minimum-degree ordering on the symmetrized pattern A + A^T. We
+ * eliminate, one at a time, the node with the fewest neighbors in the
+ * elimination graph; eliminating a node connects all its neighbors to
+ * each other, which is exactly the fill-in LU would produce. Picking
+ * low-degree nodes first keeps that fill small. This is the plain
+ * textbook algorithm (no quotient graph, no supernodes), which is
+ * plenty for reaction networks with a few thousand isotopes and only
+ * ever runs once per network. Returns 0 or -1 if out of memory. */
+static int
+min_degree_order (int n, const int row_ptr[], const int col[], int perm[])
+{
+  int **adj = calloc (n, sizeof (int *));
+  int *deg = calloc (n, sizeof (int));
+  int *cap = calloc (n, sizeof (int));
+  int *mark = malloc (n * sizeof (int));
+  char *done = calloc (n, sizeof (char));
+  int i, j, k, q, step, stamp, status = -1;
+
+  if (adj == NULL || deg == NULL || cap == NULL || mark == NULL
+      || done == NULL)
+    goto out;
+  for (i = 0; i < n; ++i)
+    mark[i] = -1;
+
+  /* add edge i -> j to the adjacency list of i unless it's already
+   * there (mark[] holds the last node whose list was marked) */
+#define ADD_EDGE(a, b)							\
+  do {									\
+    if (deg[a] == cap[a])						\
+      {									\
+	int new_cap = cap[a] > 0 ? 2 * cap[a] : 8;			\
+	int *p = realloc (adj[a], new_cap * sizeof (int));		\
+	if (p == NULL)							\
+	  goto out;							\
+	adj[a] = p;							\
+	cap[a] = new_cap;						\
+      }									\
+    adj[a][deg[a]++] = (b);						\
+  } while (0)
+
+  // symmetrize: an entry (i, j) makes i and j neighbors
+  for (i = 0; i < n; ++i)
+    {
+      for (k = row_ptr[i]; k < row_ptr[i + 1]; ++k)
+	{
+	  j = col[k];
+	  if (j == i)
+	    continue;
+	  ADD_EDGE (i, j);
+	  ADD_EDGE (j, i);
+	}
+    }
+  // remove duplicate edges
+  for (i = 0; i < n; ++i)
+    {
+      q = 0;
+      for (k = 0; k < deg[i]; ++k)
+	{
+	  if (mark[adj[i][k]] != i)
+	    {
+	      mark[adj[i][k]] = i;
+	      adj[i][q++] = adj[i][k];
+	    }
+	}
+      deg[i] = q;
+    }
+
+  stamp = n;
+  for (step = 0; step < n; ++step)
+    {
+      // find the uneliminated node with the smallest degree
+      int v = -1;
+      for (i = 0; i < n; ++i)
+	{
+	  if (!done[i] && (v < 0 || deg[i] < deg[v]))
+	    v = i;
+	}
+      perm[step] = v;
+      done[v] = 1;
+
+      /* connect v's remaining neighbors to each other, and drop v (and
+       * anything else already eliminated) from their lists */
+      for (k = 0; k < deg[v]; ++k)
+	{
+	  const int u = adj[v][k];
+	  if (done[u])
+	    continue;
+	  // a fresh stamp for u's list, so mark[] doesn't need clearing
+	  ++stamp;
+	  q = 0;
+	  for (j = 0; j < deg[u]; ++j)
+	    {
+	      if (!done[adj[u][j]])
+		{
+		  mark[adj[u][j]] = stamp;
+		  adj[u][q++] = adj[u][j];
+		}
+	    }
+	  deg[u] = q;
+	  for (j = 0; j < deg[v]; ++j)
+	    {
+	      const int w = adj[v][j];
+	      if (w != u && !done[w] && mark[w] != stamp)
+		{
+		  mark[w] = stamp;
+		  ADD_EDGE (u, w);
+		}
+	    }
+	}
+    }
+#undef ADD_EDGE
+  status = 0;
+
+out:
+  if (adj != NULL)
+    {
+      for (i = 0; i < n; ++i)
+	free (adj[i]);
+    }
+  free (adj);
+  free (deg);
+  free (cap);
+  free (mark);
+  free (done);
+  return status;
+}
+
+void
+sparse_lu_free (struct sparse_lu *lu)
+{
+  if (lu == NULL)
+    return;
+  free (lu->perm);
+  free (lu->iperm);
+  free (lu->lu_row_ptr);
+  free (lu->lu_col);
+  free (lu->lu_diag);
+  free (lu->lu_val);
+  free (lu->a_map);
+  free (lu->work);
+  free (lu);
+}
+
+/* Symbolic factorization: pick the ordering, then figure out the
+ * pattern of L + U. Row i of the factor has a nonzero in column j if
+ * row i of (permuted) A does, or if some earlier row k < i that row i
+ * depends on (i.e. (i, k) is nonzero) has a nonzero in U at (k, j).
+ * Each row's columns are kept in a sorted linked list so we can walk
+ * them in order while new ones get inserted. */
+struct sparse_lu *
+sparse_lu_alloc (int n, const int row_ptr[], const int col[])
+{
+  struct sparse_lu *lu = calloc (1, sizeof (struct sparse_lu));
+  int *next = NULL, *row_cols = NULL;
+  int i, k, cap_lu;
+
+  if (lu == NULL)
+    return NULL;
+  lu->n = n;
+  lu->nnz = row_ptr[n];
+  lu->perm = malloc (n * sizeof (int));
+  lu->iperm = malloc (n * sizeof (int));
+  lu->lu_row_ptr = malloc ((n + 1) * sizeof (int));
+  lu->lu_diag = malloc (n * sizeof (int));
+  lu->a_map = malloc ((lu->nnz + 1) * sizeof (int));
+  lu->work = calloc (n, sizeof (double));
+  // linked list of columns; index n is the list head
+  next = malloc ((n + 1) * sizeof (int));
+  row_cols = malloc (n * sizeof (int));
+  cap_lu = 2 * lu->nnz + n;
+  lu->lu_col = malloc (cap_lu * sizeof (int));
+  if (lu->perm == NULL || lu->iperm == NULL || lu->lu_row_ptr == NULL
+      || lu->lu_diag == NULL || lu->a_map == NULL || lu->work == NULL
+      || next == NULL || row_cols == NULL || lu->lu_col == NULL)
+    goto fail;
+
+  if (min_degree_order (n, row_ptr, col, lu->perm) != 0)
+    goto fail;
+  for (i = 0; i < n; ++i)
+    lu->iperm[lu->perm[i]] = i;
+
+  lu->lu_row_ptr[0] = 0;
+  for (i = 0; i < n; ++i)
+    {
+      const int orig = lu->perm[i];
+      int len = 0, c, prev;
+
+      // start the list with row i of the permuted A, sorted
+      next[n] = n;
+      for (k = row_ptr[orig]; k < row_ptr[orig + 1]; ++k)
+	{
+	  c = lu->iperm[col[k]];
+	  for (prev = n; next[prev] != n && next[prev] < c;
+	       prev = next[prev])
+	    ;
+	  if (next[prev] != c)
+	    {
+	      next[c] = next[prev];
+	      next[prev] = c;
+	    }
+	}
+      // the diagonal always has to be there
+      for (prev = n; next[prev] != n && next[prev] < i; prev = next[prev])
+	;
+      if (next[prev] != i)
+	{
+	  next[i] = next[prev];
+	  next[prev] = i;
+	}
+
+      // merge in U of every row this one depends on, in order
+      for (c = next[n]; c < i; c = next[c])
+	{
+	  int p;
+	  prev = c;
+	  for (p = lu->lu_diag[c] + 1; p < lu->lu_row_ptr[c + 1]; ++p)
+	    {
+	      const int j = lu->lu_col[p];
+	      while (next[prev] != n && next[prev] < j)
+		prev = next[prev];
+	      if (next[prev] != j)
+		{
+		  next[j] = next[prev];
+		  next[prev] = j;
+		}
+	      prev = j;
+	    }
+	}
+
+      for (c = next[n]; c != n; c = next[c])
+	row_cols[len++] = c;
+      if (lu->lu_row_ptr[i] + len > cap_lu)
+	{
+	  int *p;
+	  while (lu->lu_row_ptr[i] + len > cap_lu)
+	    cap_lu *= 2;
+	  p = realloc (lu->lu_col, cap_lu * sizeof (int));
+	  if (p == NULL)
+	    goto fail;
+	  lu->lu_col = p;
+	}
+      for (k = 0; k < len; ++k)
+	{
+	  lu->lu_col[lu->lu_row_ptr[i] + k] = row_cols[k];
+	  if (row_cols[k] == i)
+	    lu->lu_diag[i] = lu->lu_row_ptr[i] + k;
+	}
+      lu->lu_row_ptr[i + 1] = lu->lu_row_ptr[i] + len;
+    }
+  lu->nnz_lu = lu->lu_row_ptr[n];
+  lu->lu_val = malloc ((lu->nnz_lu + 1) * sizeof (double));
+  if (lu->lu_val == NULL)
+    goto fail;
+
+  // where each entry of A lands in the factor
+  for (i = 0; i < n; ++i)
+    {
+      const int row = lu->iperm[i];
+      for (k = row_ptr[i]; k < row_ptr[i + 1]; ++k)
+	{
+	  const int c = lu->iperm[col[k]];
+	  int lo = lu->lu_row_ptr[row], hi = lu->lu_row_ptr[row + 1] - 1;
+	  while (lo < hi)
+	    {
+	      const int mid = (lo + hi) / 2;
+	      if (lu->lu_col[mid] < c)
+		lo = mid + 1;
+	      else
+		hi = mid;
+	    }
+	  lu->a_map[k] = lo;
+	}
+    }
+
+  free (next);
+  free (row_cols);
+  return lu;
+
+fail:
+  free (next);
+  free (row_cols);
+  sparse_lu_free (lu);
+  return NULL;
+}
+
+/* Numeric factorization of the matrix with nonzeros val[] (in the
+ * pattern given to sparse_lu_alloc). Row by row: scatter the row into
+ * the dense work vector, subtract multiples of the U rows above it,
+ * and gather it back. Only positions in the precomputed pattern are
+ * ever touched, so the cost is proportional to the number of flops.
+ * Returns GSL_ESING if a pivot comes out zero. */
+int
+sparse_lu_factor (struct sparse_lu *lu, const double val[])
+{
+  const int n = lu->n;
+  const int *rp = lu->lu_row_ptr, *lc = lu->lu_col, *ld = lu->lu_diag;
+  double *lv = lu->lu_val, *x = lu->work;
+  int i, k, p;
+
+  memset (lv, 0, lu->nnz_lu * sizeof (double));
+  for (k = 0; k < lu->nnz; ++k)
+    lv[lu->a_map[k]] += val[k];
+
+  for (i = 0; i < n; ++i)
+    {
+      for (p = rp[i]; p < rp[i + 1]; ++p)
+	x[lc[p]] = lv[p];
+      for (p = rp[i]; p < ld[i]; ++p)
+	{
+	  const int kk = lc[p];
+	  const double l_ik = x[kk] / lv[ld[kk]];
+	  int q;
+	  x[kk] = l_ik;
+	  for (q = ld[kk] + 1; q < rp[kk + 1]; ++q)
+	    x[lc[q]] -= l_ik * lv[q];
+	}
+      for (p = rp[i]; p < rp[i + 1]; ++p)
+	lv[p] = x[lc[p]];
+      if (lv[ld[i]] == 0.0)
+	return GSL_ESING;
+    }
+  return GSL_SUCCESS;
+}
+
+/* Solve A x = b with the factorization from sparse_lu_factor(). x and b
+ * can be the same array. */
+void
+sparse_lu_solve (const struct sparse_lu *lu, const double b[], double x[])
+{
+  const int n = lu->n;
+  const int *rp = lu->lu_row_ptr, *lc = lu->lu_col, *ld = lu->lu_diag;
+  const double *lv = lu->lu_val;
+  double *z = lu->work;
+  int i, p;
+
+  // permute, then forward substitution with unit-diagonal L
+  for (i = 0; i < n; ++i)
+    {
+      double sum = b[lu->perm[i]];
+      for (p = rp[i]; p < ld[i]; ++p)
+	sum -= lv[p] * z[lc[p]];
+      z[i] = sum;
+    }
+  // back substitution with U
+  for (i = n - 1; i >= 0; --i)
+    {
+      double sum = z[i];
+      for (p = ld[i] + 1; p < rp[i + 1]; ++p)
+	sum -= lv[p] * z[lc[p]];
+      z[i] = sum / lv[ld[i]];
+    }
+  for (i = 0; i < n; ++i)
+    x[lu->perm[i]] = z[i];
+}
@@ -0,0 +1,46 @@
+#ifndef SPARSE_LU_H
+#define SPARSE_LU_H
+
+/* Sparse LU factorization for matrices whose sparsity pattern never
+ * changes, which is the situation in a reaction network: the
+ * Jacobian's nonzeros are fixed by which reactions exist, only their
+ * values change from step to step. So all the expensive bookkeeping
+ * (a fill-reducing ordering, and working out where the fill-in goes)
+ * happens once in sparse_lu_alloc(), and sparse_lu_factor() only does
+ * the arithmetic.
+ *
+ * Matrices are in compressed sparse row (CSR) format: the nonzeros of
+ * row i are val[row_ptr[i]] ... val[row_ptr[i+1] - 1], in columns
+ * col[row_ptr[i]] ... with columns in increasing order. The pattern
+ * has to include the whole diagonal.
+ *
+ * There's no pivoting beyond the symmetric ordering, so the diagonal
+ * has to stay reasonably large. That's fine for the I - h*gamma*J
+ * matrices the stiff steppers factor. */
+
+struct sparse_lu
+{
+  int n;			// matrix dimension
+  int nnz;			// nonzeros in the original pattern
+  int nnz_lu;			// nonzeros in L + U, including fill-in
+  int *perm;			// perm[k] = original row/column of pivot k
+  int *iperm;			// inverse of perm
+  /* L and U share one CSR pattern in the permuted ordering. L is unit
+   * lower triangular (its diagonal isn't stored); U's diagonal is at
+   * lu_diag[i]. */
+  int *lu_row_ptr;
+  int *lu_col;
+  int *lu_diag;
+  double *lu_val;
+  int *a_map;			// position in lu_val of each original nonzero
+  double *work;			// dense scratch vector, n long
+};
+
+struct sparse_lu *sparse_lu_alloc (int n, const int row_ptr[],
+				   const int col[]);
+void sparse_lu_free (struct sparse_lu *lu);
+int sparse_lu_factor (struct sparse_lu *lu, const double val[]);
+void sparse_lu_solve (const struct sparse_lu *lu, const double b[],
+		      double x[]);
+
+#endif
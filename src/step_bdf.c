@@ -0,0 +1,796 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#include "instrument.h"
+#include "jacobian.h"
+#include "network.h"
+#include "param.h"
+#include "sparse_lu.h"
+#include "step_bdf.h"
+
+/* Backward differentiation formulas, orders 1 to 5, in variable
+ * coefficient form: y_{n+1} is the value at t_{n+1} of the polynomial
+ * through it and the last q accepted points whose derivative there is
+ * f(t_{n+1}, y_{n+1}), i.e.
+ *
+ *   y_{n+1} - gamma * f(t_{n+1}, y_{n+1}) = psi
+ *
+ * with gamma and psi depending on where the last q points are. That's
+ * solved by a simplified Newton iteration starting from the
+ * extrapolation of the last q+1 points (the predictor), with the
+ * matrix I - gamma*J. This is where the savings over the one-step
+ * methods come from: the iteration converges fine with a Jacobian
+ * that's a few steps old, or with a gamma that's a bit off, so most
+ * steps cost 1-3 RHS evaluations and a few sparse solves and nothing
+ * else. The Jacobian is only redone when the iteration fails to
+ * converge with the old one or it's BDF_MAX_JAC_AGE steps old, and the
+ * LU when there's a new Jacobian or gamma has moved by more than
+ * BDF_MAX_DGAMMA.
+ *
+ * The local error estimate is the usual (h / (t_{n+1} - t_{n-q})) *
+ * (corrector - predictor). The order goes up or down by one if the
+ * error estimate for that order would allow a bigger step (the
+ * q+1 estimate comes from how much the corrections change from step
+ * to step, as in LSODE).
+ *
+ * All of this needs the error tolerances, and a GSL stepper only sees
+ * them if it was allocated through a driver (same as GSL's own
+ * msbdf). Inside evolve_apply() the stepper also can't tell an
+ * accepted step from a rejected one directly; it finds out on the next
+ * call: if it starts where the last step ended, that step was
+ * accepted, if it starts again from the same t it wasn't, and anything
+ * else (or a reset) starts the history from scratch.
+ *
+ * It can also carry forward sensitivities s_j = dy/dp_j along with y
+ * (step_bdf_set_sensitivity()), which satisfy the linear ODEs
+ *
+ *   s_j' = J s_j + df/dp_j
+ *
+ * BDF on those has the same gamma, and so the same matrix I - gamma*J,
+ * as y's corrector, which is the point: once y_{n+1} has converged,
+ * each s_j gets a corrector iteration of its own (the staggered
+ * corrector of CVODES) with the Jacobian and LU y's Newton iteration
+ * used, and J and df/dp at y_{n+1} only in the residual. With an old
+ * J that just converges more slowly; if it doesn't converge, J at
+ * y_{n+1} becomes the one the stepper keeps, and gets factored. So a
+ * step costs one more Jacobian, the df/dp and a couple of solves per
+ * parameter. The sensitivities don't take part in the error control;
+ * the step sizes are the ones y needs. */
+
+#define BDF_MAXORD 5
+/* refresh the Jacobian after this many steps even if Newton is happy.
+ * CVODE uses 20, but in the long tail after hydrogen runs out the
+ * steps grow by the maximum factor every time, and a Jacobian from 20
+ * steps (a factor 10^13 in t) back lets a trace of H1, far below the
+ * absolute tolerance, go on burning the CNO isotopes for the rest of
+ * the run */
+#define BDF_MAX_JAC_AGE 5
+// refactor once gamma has moved this far from the factored one
+#define BDF_MAX_DGAMMA 0.3
+#define BDF_MAX_ITER 4
+// Newton stops at this (weighted) size of correction
+#define BDF_NEWTON_TOL 0.03
+// favour keeping the order, as in LSODE
+#define BDF_BIAS_SAME 1.2
+#define BDF_BIAS_DOWN 1.3
+#define BDF_BIAS_UP 1.4
+
+typedef struct
+{
+  size_t dim;
+  const struct network *net;	// network the symbolic LU was done for
+  const gsl_odeiv2_driver *driver;
+  struct sparse_lu *lu;
+  int *diag;			// diagonal positions in the Jacobian pattern
+  double *jac;			// Jacobian nonzeros
+  double *a;			// I - gamma * J
+  int jac_ok, lu_ok;
+  int jac_age;			// accepted steps since the Jacobian
+  double gamma_lu;		// gamma the LU was done with
+  double crate;			// Newton convergence rate estimate
+  /* the last n_hist accepted points, newest first. hist_y holds
+   * BDF_MAXORD + 1 vectors */
+  int n_hist;
+  double hist_t[BDF_MAXORD + 1];
+  double *hist_y;
+  int q;			// order of the next step
+  int n_same;			// steps taken at order q
+  int n_fail;			// rejections in a row
+  int trial;			// the last call produced a step ...
+  double trial_t, trial_h;	// ... ending here, of this size
+  double h_prev;		// size of the last accepted step
+  double *d_trial, *d_prev;	// corrector - predictor, this/last step
+  double *dfdt;			// not used by BDF, but jacobian_sparse() fills it
+  double *f;			// last RHS evaluation
+  double *ypred;
+  double *psi;			// right hand side of the corrector equation
+  double *dz;
+  double *w;			// 1 / error level of each component
+  /* sensitivities, if there are any: n_par vectors of dim at each
+   * point of the history, hist_s like hist_y, and the trial step's */
+  int n_par;
+  step_bdf_dfdp_fn *dfdp_fn;
+  double *hist_s, *s_trial;
+  double *dfdp;			// df/dp, n_par vectors
+  double *sens_jac;		// J at the new y, for the residual
+  double *sens_psi;
+} bdf_state_t;
+
+static void bdf_free (void *vstate);
+
+static void *
+bdf_alloc (size_t dim)
+{
+  bdf_state_t *state = calloc (1, sizeof (bdf_state_t));
+  if (state == NULL)
+    return NULL;
+  state->dim = dim;
+  state->hist_y = malloc ((BDF_MAXORD + 1) * dim * sizeof (double));
+  state->d_trial = malloc (dim * sizeof (double));
+  state->d_prev = malloc (dim * sizeof (double));
+  state->dfdt = malloc (dim * sizeof (double));
+  state->f = malloc (dim * sizeof (double));
+  state->ypred = malloc (dim * sizeof (double));
+  state->psi = malloc (dim * sizeof (double));
+  state->dz = malloc (dim * sizeof (double));
+  state->w = malloc (dim * sizeof (double));
+  if (state->hist_y == NULL || state->d_trial == NULL
+      || state->d_prev == NULL || state->dfdt == NULL || state->f == NULL
+      || state->ypred == NULL || state->psi == NULL || state->dz == NULL
+      || state->w == NULL)
+    {
+      bdf_free (state);
+      return NULL;
+    }
+  state->q = 1;
+  return state;
+}
+
+// same as sbsimp_setup(): the only allocation after bdf_alloc()
+static int
+bdf_setup (bdf_state_t * state, const struct network *net)
+{
+  int i, k;
+  sparse_lu_free (state->lu);
+  free (state->diag);
+  free (state->jac);
+  free (state->a);
+  state->net = NULL;
+  state->jac_ok = state->lu_ok = 0;
+  state->n_hist = 0;
+  state->lu = sparse_lu_alloc (net->n_var, net->jac_row_ptr, net->jac_col);
+  state->diag = malloc (net->n_var * sizeof (int));
+  state->jac = malloc (net->jac_nnz * sizeof (double));
+  state->a = malloc (net->jac_nnz * sizeof (double));
+  if (state->lu == NULL || state->diag == NULL || state->jac == NULL
+      || state->a == NULL)
+    return GSL_ENOMEM;
+  for (i = 0; i < net->n_var; ++i)
+    {
+      for (k = net->jac_row_ptr[i]; k < net->jac_row_ptr[i + 1]; ++k)
+	{
+	  if (net->jac_col[k] == i)
+	    state->diag[i] = k;
+	}
+    }
+  state->net = net;
+  return GSL_SUCCESS;
+}
+
+#define HIST_Y(state, j) (&(state)->hist_y[(j) * (state)->dim])
+#define HIST_S(state, j) \
+  (&(state)->hist_s[(j) * (state)->n_par * (state)->dim])
+
+/* Work out what happened to the last step (see the top of the file)
+ * and bring the history up to date. */
+static void
+bdf_sync (bdf_state_t * state, double t, const double y[])
+{
+  const size_t dim = state->dim;
+  int j;
+
+  if (state->n_hist > 0 && t == state->hist_t[0])
+    {
+      // retrying from the same point: the last step was rejected
+      if (state->trial && ++state->n_fail >= 2 && state->q > 1)
+	{
+	  --state->q;
+	  state->n_same = 0;
+	}
+    }
+  else if (state->n_hist > 0 && state->trial
+	   && fabs (t - state->trial_t) <=
+	   4.0 * DBL_EPSILON * fmax (fabs (t), fabs (state->trial_t)))
+    {
+      // accepted. take y as given, the caller may have touched it up
+      if (state->n_hist < BDF_MAXORD + 1)
+	++state->n_hist;
+      for (j = state->n_hist - 1; j > 0; --j)
+	{
+	  state->hist_t[j] = state->hist_t[j - 1];
+	  memcpy (HIST_Y (state, j), HIST_Y (state, j - 1),
+		  dim * sizeof (double));
+	}
+      state->hist_t[0] = t;
+      memcpy (HIST_Y (state, 0), y, dim * sizeof (double));
+      if (state->n_par > 0)
+	{
+	  const size_t len = state->n_par * dim * sizeof (double);
+	  for (j = state->n_hist - 1; j > 0; --j)
+	    memcpy (HIST_S (state, j), HIST_S (state, j - 1), len);
+	  memcpy (HIST_S (state, 0), state->s_trial, len);
+	}
+      memcpy (state->d_prev, state->d_trial, dim * sizeof (double));
+      state->h_prev = state->trial_h;
+      ++state->n_same;
+      ++state->jac_age;
+      state->n_fail = 0;
+    }
+  else
+    {
+      /* somewhere new: start over at first order. the sensitivities
+       * carry on from the newest ones there are */
+      if (state->n_par > 0 && state->trial)
+	memcpy (HIST_S (state, 0), state->s_trial,
+		state->n_par * dim * sizeof (double));
+      state->n_hist = 1;
+      state->hist_t[0] = t;
+      memcpy (HIST_Y (state, 0), y, dim * sizeof (double));
+      state->q = 1;
+      state->n_same = 0;
+      state->n_fail = 0;
+    }
+  state->trial = 0;
+}
+
+/* The value at tn of the degree k polynomial through the k+1 newest
+ * points of a history whose point j starts at hist + j * stride (dim
+ * of it); there have to be that many. */
+static void
+bdf_extrapolate (const bdf_state_t * state, int k, double tn,
+		 const double hist[], size_t stride, double out[])
+{
+  const size_t dim = state->dim;
+  double c[BDF_MAXORD + 1];
+  size_t i;
+  int j, m;
+
+  for (j = 0; j <= k; ++j)
+    {
+      c[j] = 1.0;
+      for (m = 0; m <= k; ++m)
+	if (m != j)
+	  c[j] *= (tn - state->hist_t[m])
+	    / (state->hist_t[j] - state->hist_t[m]);
+    }
+  for (i = 0; i < dim; ++i)
+    out[i] = 0.0;
+  for (j = 0; j <= k; ++j)
+    {
+      const double *yj = &hist[j * stride];
+      for (i = 0; i < dim; ++i)
+	out[i] += c[j] * yj[i];
+    }
+}
+
+/* The predictor for y: the extrapolation of the k+1 newest points.
+ * With a single point, k = 1 is an Euler step along f. */
+static void
+bdf_predict (const bdf_state_t * state, int k, double tn, double h,
+	     double out[])
+{
+  size_t i;
+  if (state->n_hist == 1)
+    {
+      for (i = 0; i < state->dim; ++i)
+	out[i] = state->hist_y[i] + h * state->f[i];
+      return;
+    }
+  bdf_extrapolate (state, k, tn, state->hist_y, state->dim, out);
+}
+
+// h / (t_{n+1} - t_{n-k}), the factor in the order k error estimate
+static double
+bdf_err_scale (const bdf_state_t * state, int k, double tn, double h)
+{
+  const double t_back = (k < state->n_hist) ? state->hist_t[k]
+    : state->hist_t[0] - h;
+  return h / (tn - t_back);
+}
+
+// weighted max norm, the same one the GSL step size control uses
+static double
+bdf_norm (const bdf_state_t * state, const double v[])
+{
+  double r = 0.0;
+  size_t i;
+  for (i = 0; i < state->dim; ++i)
+    {
+      const double e = fabs (v[i]) * state->w[i];
+      if (e > r)
+	r = e;
+    }
+  return r;
+}
+
+static void
+bdf_weights (bdf_state_t * state, const double y[], const double f[],
+	     double h)
+{
+  gsl_odeiv2_control *c = state->driver->c;
+  size_t i;
+  for (i = 0; i < state->dim; ++i)
+    {
+      double level;
+      gsl_odeiv2_control_errlevel (c, y[i], f[i], h, i, &level);
+      state->w[i] = 1.0 / fmax (level, DBL_MIN);
+    }
+}
+
+static int
+bdf_factor (bdf_state_t * state, double gamma, struct instr *in)
+{
+  const int nnz = state->net->jac_nnz;
+  size_t i;
+  int k, status;
+  INSTR_START (in, t0);
+  for (k = 0; k < nnz; ++k)
+    state->a[k] = -gamma * state->jac[k];
+  for (i = 0; i < state->dim; ++i)
+    state->a[state->diag[i]] += 1.0;
+  status = sparse_lu_factor (state->lu, state->a);
+  INSTR_COUNT (in, n_lu_factor);
+  INSTR_STOP (in, PHASE_LINALG, t0);
+  state->lu_ok = (status == GSL_SUCCESS);
+  state->gamma_lu = gamma;
+  state->crate = 1.0;
+  return status;
+}
+
+/* Newton iteration for z - gamma*f(tn, z) = psi, starting from z.
+ * Returns GSL_SUCCESS once it converges, GSL_FAILURE if it doesn't,
+ * or whatever the RHS returned if that failed. */
+static int
+bdf_newton (bdf_state_t * state, double tn, double gamma, const double psi[],
+	    double z[], const gsl_odeiv2_system * sys, struct instr *in)
+{
+  const size_t dim = state->dim;
+  /* with an out of date gamma the corrections come out too big or too
+   * small by about this much (CVODE does the same) */
+  const double scale = 2.0 / (1.0 + gamma / state->gamma_lu);
+  double del, del_prev = 0.0;
+  size_t i;
+  int m, status;
+
+  for (m = 0; m < BDF_MAX_ITER; ++m)
+    {
+      status = GSL_ODEIV_FN_EVAL (sys, tn, z, state->f);
+      if (status != GSL_SUCCESS)
+	return status;
+      for (i = 0; i < dim; ++i)
+	state->dz[i] = psi[i] + gamma * state->f[i] - z[i];
+      INSTR_START (in, t0);
+      sparse_lu_solve (state->lu, state->dz, state->dz);
+      INSTR_COUNT (in, n_lu_solve);
+      INSTR_STOP (in, PHASE_LINALG, t0);
+      for (i = 0; i < dim; ++i)
+	{
+	  state->dz[i] *= scale;
+	  z[i] += state->dz[i];
+	}
+      del = bdf_norm (state, state->dz);
+      if (m > 0)
+	state->crate = fmax (0.3 * state->crate, del / del_prev);
+      if (del * fmin (1.0, state->crate) <= BDF_NEWTON_TOL)
+	return GSL_SUCCESS;
+      if (m > 0 && del > 2.0 * del_prev)
+	break;
+      del_prev = del;
+    }
+  return GSL_FAILURE;
+}
+
+/* The staggered corrector (see the top of the file): with z = y_{n+1}
+ * converged, solves
+ *
+ *   s_j - gamma * (J s_j + df/dp_j) = psi_j
+ *
+ * for every parameter j into s_trial, J and df/dp at (tn, z), by the
+ * same iteration as bdf_newton() with the LU that's there. Since it's
+ * linear the only question is how fast that converges; if it doesn't
+ * within BDF_MAX_ITER, or starts diverging, J is refactored and that
+ * s_j gets another go. Returns GSL_SUCCESS, GSL_FAILURE if even that
+ * doesn't do it or the LU fails, or what the Jacobian or df/dp
+ * returned. */
+static int
+bdf_sens_correct (bdf_state_t * state, double tn, double gamma,
+		  const double alpha[], int q, const double z[],
+		  const gsl_odeiv2_system * sys, struct instr *in)
+{
+  const size_t dim = state->dim;
+  const struct network *net = state->net;
+  const size_t stride = state->n_par * dim;
+  double scale, rate, del, del_prev = 0.0;
+  size_t i;
+  int j, k, m, p, status, refactored = 0;
+
+  status = jacobian_sparse (tn, z, state->sens_jac, state->dfdt,
+			    sys->params);
+  if (status == GSL_SUCCESS)
+    status = state->dfdp_fn (tn, z, state->dfdp, sys->params);
+  if (status != GSL_SUCCESS)
+    return status;
+
+  for (j = 0; j < state->n_par; ++j)
+    {
+      double *s = &state->s_trial[j * dim];
+      const double *dfdp = &state->dfdp[j * dim];
+
+      for (i = 0; i < dim; ++i)
+	state->sens_psi[i] = 0.0;
+      for (k = 0; k < q; ++k)
+	{
+	  const double *sk = HIST_S (state, k) + j * dim;
+	  for (i = 0; i < dim; ++i)
+	    state->sens_psi[i] -= gamma * alpha[k] * sk[i];
+	}
+      // no f for s at the first point, so no Euler step: just s_n
+      if (state->n_hist == 1)
+	memcpy (s, HIST_S (state, 0) + j * dim, dim * sizeof (double));
+      else
+	bdf_extrapolate (state, q, tn, HIST_S (state, 0) + j * dim, stride,
+			 s);
+
+      scale = 2.0 / (1.0 + gamma / state->gamma_lu);
+      rate = 1.0;
+      for (m = 0;; ++m)
+	{
+	  for (i = 0; i < dim; ++i)
+	    {
+	      double js = 0.0;
+	      for (p = net->jac_row_ptr[i]; p < net->jac_row_ptr[i + 1]; ++p)
+		js += state->sens_jac[p] * s[net->jac_col[p]];
+	      state->dz[i] = state->sens_psi[i] + gamma * (js + dfdp[i]) - s[i];
+	    }
+	  INSTR_START (in, t0);
+	  sparse_lu_solve (state->lu, state->dz, state->dz);
+	  INSTR_COUNT (in, n_lu_solve);
+	  INSTR_STOP (in, PHASE_LINALG, t0);
+	  for (i = 0; i < dim; ++i)
+	    {
+	      state->dz[i] *= scale;
+	      s[i] += state->dz[i];
+	    }
+	  del = bdf_norm (state, state->dz);
+	  if (m > 0)
+	    rate = fmax (0.3 * rate, del / del_prev);
+	  if (del * fmin (1.0, rate) <= BDF_NEWTON_TOL)
+	    break;
+	  if (m + 1 < BDF_MAX_ITER && (m == 0 || del <= 2.0 * del_prev))
+	    {
+	      del_prev = del;
+	      continue;
+	    }
+	  // too slow: J at z, from here on, and carry on from this s
+	  if (refactored)
+	    return GSL_FAILURE;
+	  memcpy (state->jac, state->sens_jac,
+		  net->jac_nnz * sizeof (double));
+	  state->jac_ok = 1;
+	  state->jac_age = 0;
+	  if (bdf_factor (state, gamma, in) != GSL_SUCCESS)
+	    return GSL_FAILURE;
+	  refactored = 1;
+	  scale = 1.0;
+	  rate = 1.0;
+	  m = -1;
+	}
+    }
+  return GSL_SUCCESS;
+}
+
+static int
+bdf_apply (void *vstate, size_t dim, double t, double h, double y[],
+	   double yerr[], const double dydt_in[], double dydt_out[],
+	   const gsl_odeiv2_system * sys)
+{
+  bdf_state_t *state = (bdf_state_t *) vstate;
+  const struct param *params = (const struct param *) sys->params;
+  struct instr *in = params->instr;
+  const double tn = t + h;
+  double alpha[BDF_MAXORD], alpha0 = 0.0, gamma;
+  double *z = yerr;		// the new y lives here until the very end
+  size_t i;
+  int j, m, q, status, fresh_jac = 0;
+
+  // no driver, no tolerances
+  if (state->driver == NULL)
+    return GSL_EFAULT;
+  if (state->net != params->net)
+    {
+      status = bdf_setup (state, params->net);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+  bdf_sync (state, t, y);
+  if (state->n_hist == 1)
+    {
+      // the first step's predictor is an Euler step
+      status = GSL_ODEIV_FN_EVAL (sys, t, y, state->f);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+  q = state->q;
+
+  /* corrector coefficients: the derivative at tn of the Lagrange
+   * polynomials through tn and the q newest points */
+  for (j = 0; j < q; ++j)
+    {
+      alpha0 += 1.0 / (tn - state->hist_t[j]);
+      alpha[j] = 1.0 / (state->hist_t[j] - tn);
+      for (m = 0; m < q; ++m)
+	if (m != j)
+	  alpha[j] *= (tn - state->hist_t[m])
+	    / (state->hist_t[j] - state->hist_t[m]);
+    }
+  gamma = 1.0 / alpha0;
+
+  bdf_predict (state, q, tn, h, state->ypred);
+  bdf_weights (state, state->ypred, state->f, h);
+
+  if (!state->jac_ok || state->jac_age >= BDF_MAX_JAC_AGE)
+    {
+      status = jacobian_sparse (tn, state->ypred, state->jac, state->dfdt,
+				sys->params);
+      if (status != GSL_SUCCESS)
+	return status;
+      state->jac_ok = fresh_jac = 1;
+      state->jac_age = 0;
+      state->lu_ok = 0;
+    }
+  if (!state->lu_ok
+      || fabs (gamma / state->gamma_lu - 1.0) > BDF_MAX_DGAMMA)
+    {
+      if (bdf_factor (state, gamma, in) != GSL_SUCCESS)
+	return GSL_FAILURE;
+    }
+
+  for (i = 0; i < dim; ++i)
+    state->psi[i] = 0.0;
+  for (j = 0; j < q; ++j)
+    {
+      const double *yj = HIST_Y (state, j);
+      for (i = 0; i < dim; ++i)
+	state->psi[i] -= gamma * alpha[j] * yj[i];
+    }
+
+  memcpy (z, state->ypred, dim * sizeof (double));
+  status = bdf_newton (state, tn, gamma, state->psi, z, sys, in);
+  if (status == GSL_FAILURE && !fresh_jac)
+    {
+      // maybe it's the old Jacobian. try once more with a new one
+      status = jacobian_sparse (tn, state->ypred, state->jac, state->dfdt,
+				sys->params);
+      if (status != GSL_SUCCESS)
+	return status;
+      state->jac_age = 0;
+      if (bdf_factor (state, gamma, in) != GSL_SUCCESS)
+	return GSL_FAILURE;
+      memcpy (z, state->ypred, dim * sizeof (double));
+      status = bdf_newton (state, tn, gamma, state->psi, z, sys, in);
+    }
+  /* GSL_FAILURE makes evolve_apply() try again with half the step;
+   * with the same h we'd just fail again */
+  if (status != GSL_SUCCESS)
+    return status;
+  bdf_weights (state, z, state->f, h);
+  if (state->n_par > 0)
+    {
+      status = bdf_sens_correct (state, tn, gamma, alpha, q, z, sys, in);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+
+  /* error estimates. d_trial is corrector - predictor; the order q-1
+   * estimate uses the lower degree predictor, and the order q+1 one
+   * the change in d since the last step */
+  for (i = 0; i < dim; ++i)
+    state->d_trial[i] = z[i] - state->ypred[i];
+  const double s_q = bdf_err_scale (state, q, tn, h);
+  double e_q = s_q * bdf_norm (state, state->d_trial);
+  int q_next = q;
+
+  if (e_q <= 1.0 && state->n_same >= q + 1)
+    {
+      double best = BDF_BIAS_SAME * pow (fmax (e_q, DBL_MIN),
+					  1.0 / (q + 1));
+      if (q > 1)
+	{
+	  // z - P_{q-1}, in dz
+	  bdf_predict (state, q - 1, tn, h, state->dz);
+	  for (i = 0; i < dim; ++i)
+	    state->dz[i] = z[i] - state->dz[i];
+	  const double e =
+	    bdf_err_scale (state, q - 1, tn, h) * bdf_norm (state, state->dz);
+	  const double r = BDF_BIAS_DOWN * pow (fmax (e, DBL_MIN), 1.0 / q);
+	  if (e <= 1.0 && r < best)
+	    {
+	      best = r;
+	      q_next = q - 1;
+	    }
+	}
+      if (q < BDF_MAXORD && state->n_hist >= q + 2)
+	{
+	  const double ratio = pow (h / state->h_prev, q + 1);
+	  for (i = 0; i < dim; ++i)
+	    state->dz[i] = (state->d_trial[i] - ratio * state->d_prev[i])
+	      / (q + 2);
+	  const double e = bdf_norm (state, state->dz);
+	  const double r = BDF_BIAS_UP * pow (fmax (e, DBL_MIN),
+					      1.0 / (q + 2));
+	  if (e <= 1.0 && r < best)
+	    {
+	      best = r;
+	      q_next = q + 1;
+	    }
+	}
+    }
+
+  /* nothing can fail any more: the new y goes out, and yerr (which z
+   * was using) gets the error estimate for the order we're going on
+   * with, since that's what GSL will size the next step by */
+  memcpy (y, z, dim * sizeof (double));
+  if (q_next == q)
+    for (i = 0; i < dim; ++i)
+      yerr[i] = s_q * state->d_trial[i];
+  else if (q_next == q - 1)
+    {
+      const double s = bdf_err_scale (state, q - 1, tn, h);
+      bdf_predict (state, q - 1, tn, h, state->dz);
+      for (i = 0; i < dim; ++i)
+	yerr[i] = s * (y[i] - state->dz[i]);
+    }
+  else
+    {
+      const double ratio = pow (h / state->h_prev, q + 1);
+      for (i = 0; i < dim; ++i)
+	yerr[i] = (state->d_trial[i] - ratio * state->d_prev[i]) / (q + 2);
+    }
+  if (q_next != q)
+    {
+      state->q = q_next;
+      state->n_same = 0;
+    }
+  // f at the last Newton iterate, which is within the Newton tolerance
+  if (dydt_out != NULL)
+    memcpy (dydt_out, state->f, dim * sizeof (double));
+  state->trial = 1;
+  state->trial_t = tn;
+  state->trial_h = h;
+  return GSL_SUCCESS;
+}
+
+#undef HIST_Y
+#undef HIST_S
+
+static int
+bdf_set_driver (void *vstate, const gsl_odeiv2_driver * d)
+{
+  bdf_state_t *state = (bdf_state_t *) vstate;
+  state->driver = d;
+  return GSL_SUCCESS;
+}
+
+static int
+bdf_reset (void *vstate, size_t dim)
+{
+  bdf_state_t *state = (bdf_state_t *) vstate;
+  state->n_hist = 0;
+  state->trial = 0;
+  state->jac_ok = state->lu_ok = 0;
+  state->q = 1;
+  return GSL_SUCCESS;
+}
+
+static unsigned int
+bdf_order (void *vstate)
+{
+  bdf_state_t *state = (bdf_state_t *) vstate;
+  return state->q;
+}
+
+static void
+bdf_free (void *vstate)
+{
+  bdf_state_t *state = (bdf_state_t *) vstate;
+  sparse_lu_free (state->lu);
+  free (state->diag);
+  free (state->jac);
+  free (state->a);
+  free (state->hist_y);
+  free (state->d_trial);
+  free (state->d_prev);
+  free (state->dfdt);
+  free (state->f);
+  free (state->ypred);
+  free (state->psi);
+  free (state->dz);
+  free (state->w);
+  free (state->hist_s);
+  free (state->s_trial);
+  free (state->dfdp);
+  free (state->sens_jac);
+  free (state->sens_psi);
+  free (state);
+}
+
+static const gsl_odeiv2_step_type bdf_type = {
+  "bdf",			// name
+  0,				// can't use dydt_in
+  0,				// dydt_out is only as good as the Newton iteration
+  &bdf_alloc,
+  &bdf_apply,
+  &bdf_set_driver,
+  &bdf_reset,
+  &bdf_order,
+  &bdf_free
+};
+
+const gsl_odeiv2_step_type *step_bdf = &bdf_type;
+
+/* Carries the sensitivities dy/dp_j of n_par parameters along with y
+ * from now on, starting from zero: dfdp(t, y, out, params) fills out
+ * with n_par vectors of df/dp_j, and the sensitivities are in
+ * step_bdf_sensitivity(). s has to be a bdf stepper on a network,
+ * which this needs already (it's the pattern of J). Returns
+ * GSL_SUCCESS, GSL_EINVAL if s isn't, or GSL_ENOMEM. */
+int
+step_bdf_set_sensitivity (gsl_odeiv2_step * s, int n_par,
+			  step_bdf_dfdp_fn * dfdp, const struct network *net)
+{
+  bdf_state_t *state;
+  const size_t len = (size_t) n_par * s->dimension;
+
+  if (s->type != step_bdf || n_par < 1 || net->n_var != s->dimension)
+    return GSL_EINVAL;
+  state = (bdf_state_t *) s->state;
+  if (state->net != net && bdf_setup (state, net) != GSL_SUCCESS)
+    return GSL_ENOMEM;
+  free (state->hist_s);
+  free (state->s_trial);
+  free (state->dfdp);
+  free (state->sens_jac);
+  free (state->sens_psi);
+  state->hist_s = calloc ((BDF_MAXORD + 1) * len, sizeof (double));
+  state->s_trial = calloc (len, sizeof (double));
+  state->dfdp = malloc (len * sizeof (double));
+  state->sens_jac = malloc (net->jac_nnz * sizeof (double));
+  state->sens_psi = malloc (s->dimension * sizeof (double));
+  state->n_par = 0;
+  if (state->hist_s == NULL || state->s_trial == NULL
+      || state->dfdp == NULL || state->sens_jac == NULL
+      || state->sens_psi == NULL)
+    return GSL_ENOMEM;
+  state->n_par = n_par;
+  state->dfdp_fn = dfdp;
+  return GSL_SUCCESS;
+}
+
+/* The sensitivities that go with the y the last step returned (or the
+ * one the stepper started from), n_par vectors of dim: dy_i/dp_j is
+ * [j * dim + i]. Like y, the caller may change them between steps, and
+ * the next step starts from what's there. NULL without sensitivities. */
+double *
+step_bdf_sensitivity (gsl_odeiv2_step * s)
+{
+  bdf_state_t *state;
+  if (s->type != step_bdf)
+    return NULL;
+  state = (bdf_state_t *) s->state;
+  if (state->n_par == 0)
+    return NULL;
+  return state->trial ? state->s_trial : state->hist_s;
+}
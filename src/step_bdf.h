@@ -0,0 +1,27 @@
+#ifndef STEP_BDF_H
+#define STEP_BDF_H
+
+#include <gsl/gsl_odeiv2.h>
+
+/* Variable order (1-5), variable step BDF on the sparse Jacobian and
+ * sparse LU solver, keeping the Jacobian and its factorization for as
+ * many steps as the Newton iteration allows. Only works on systems
+ * whose params are a struct param, and like GSL's msbdf it needs to
+ * be allocated through a gsl_odeiv2_driver, which is where it gets
+ * the error tolerances from. */
+extern const gsl_odeiv2_step_type *step_bdf;
+
+struct network;
+
+/* Forward sensitivities w.r.t. n_par parameters, integrated along with
+ * y (see step_bdf.c). The function fills dfdp with df/dp_j for every
+ * j, n_par vectors as long as y, e.g. rate_derivatives() (jacobian.h)
+ * for the log of every rate. */
+typedef int step_bdf_dfdp_fn (double t, const double y[], double dfdp[],
+			      void *params);
+int step_bdf_set_sensitivity (gsl_odeiv2_step * s, int n_par,
+			      step_bdf_dfdp_fn * dfdp,
+			      const struct network *net);
+double *step_bdf_sensitivity (gsl_odeiv2_step * s);
+
+#endif
@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#include "instrument.h"
+#include "jacobian.h"
+#include "network.h"
+#include "param.h"
+#include "sparse_lu.h"
+#include "step_ros4.h"
+
+/* A Kaps-Rentrop (Rosenbrock) stepper with Shampine's (1982)
+ * coefficients, see "Numerical Recipes" 16.6: 4 stages, 4th order,
+ * with an embedded 3rd order solution for the error estimate. This is
+ * what Timmes (1999) found to be the cheapest of the stiff integrators
+ * for networks at moderate accuracy. Each step needs one Jacobian, one LU
+ * factorization of I - gamma*h*J, 2 RHS evaluations and 4 solves, and
+ * unlike the extrapolation steppers (bsimp, sbsimp) that's it: no
+ * sequence of substeps.
+ *
+ * The method is only 4th order with the exact Jacobian at the start
+ * of the step, so it can't keep an old one around like the BDF stepper
+ * does: every accepted step lands on a new (t, y), and the next one
+ * starts with a new Jacobian and LU whatever h is. The one thing that
+ * does get reused is the Jacobian after a rejected step, when GSL
+ * calls us again from the same t and y with a smaller h; only the LU
+ * gets redone then. */
+
+// Shampine's parameters
+#define ROS4_GAM (1.0 / 2.0)
+#define ROS4_A21 2.0
+#define ROS4_A31 (48.0 / 25.0)
+#define ROS4_A32 (6.0 / 25.0)
+#define ROS4_C21 -8.0
+#define ROS4_C31 (372.0 / 25.0)
+#define ROS4_C32 (12.0 / 5.0)
+#define ROS4_C41 (-112.0 / 125.0)
+#define ROS4_C42 (-54.0 / 125.0)
+#define ROS4_C43 (-2.0 / 5.0)
+#define ROS4_B1 (19.0 / 9.0)
+#define ROS4_B2 (1.0 / 2.0)
+#define ROS4_B3 (25.0 / 108.0)
+#define ROS4_B4 (125.0 / 108.0)
+#define ROS4_E1 (17.0 / 54.0)
+#define ROS4_E2 (7.0 / 36.0)
+#define ROS4_E3 0.0
+#define ROS4_E4 (125.0 / 108.0)
+#define ROS4_C1X (1.0 / 2.0)
+#define ROS4_C2X (-3.0 / 2.0)
+#define ROS4_C3X (121.0 / 50.0)
+#define ROS4_C4X (29.0 / 250.0)
+#define ROS4_A2X 1.0
+#define ROS4_A3X (3.0 / 5.0)
+
+typedef struct
+{
+  size_t dim;
+  const struct network *net;	// network the symbolic LU was done for
+  struct sparse_lu *lu;
+  int *diag;			// diagonal positions in the Jacobian pattern
+  double *jac;			// Jacobian nonzeros
+  double *a;			// I - gamma * h * J
+  double *dfdt;
+  /* what jac and the LU were computed for. jac_ok/lu_ok are cleared
+   * by reset, so nothing carries over into an unrelated integration */
+  int jac_ok, lu_ok;
+  double t_jac, h_lu;
+  double *y_jac;
+  double *f0;			// dy/dt at the start of the step
+  double *ytmp;
+  double *g1, *g2, *g3, *g4;	// the stages
+} ros4_state_t;
+
+static void ros4_free (void *vstate);
+
+static void *
+ros4_alloc (size_t dim)
+{
+  ros4_state_t *state = calloc (1, sizeof (ros4_state_t));
+  if (state == NULL)
+    return NULL;
+  state->dim = dim;
+  state->dfdt = malloc (dim * sizeof (double));
+  state->y_jac = malloc (dim * sizeof (double));
+  state->f0 = malloc (dim * sizeof (double));
+  state->ytmp = malloc (dim * sizeof (double));
+  state->g1 = malloc (dim * sizeof (double));
+  state->g2 = malloc (dim * sizeof (double));
+  state->g3 = malloc (dim * sizeof (double));
+  state->g4 = malloc (dim * sizeof (double));
+  if (state->dfdt == NULL || state->y_jac == NULL || state->f0 == NULL
+      || state->ytmp == NULL || state->g1 == NULL || state->g2 == NULL
+      || state->g3 == NULL || state->g4 == NULL)
+    {
+      ros4_free (state);
+      return NULL;
+    }
+  return state;
+}
+
+// same as sbsimp_setup(): the only allocation after ros4_alloc()
+static int
+ros4_setup (ros4_state_t * state, const struct network *net)
+{
+  int i, k;
+  sparse_lu_free (state->lu);
+  free (state->diag);
+  free (state->jac);
+  free (state->a);
+  state->net = NULL;
+  state->jac_ok = state->lu_ok = 0;
+  state->lu = sparse_lu_alloc (net->n_var, net->jac_row_ptr, net->jac_col);
+  state->diag = malloc (net->n_var * sizeof (int));
+  state->jac = malloc (net->jac_nnz * sizeof (double));
+  state->a = malloc (net->jac_nnz * sizeof (double));
+  if (state->lu == NULL || state->diag == NULL || state->jac == NULL
+      || state->a == NULL)
+    return GSL_ENOMEM;
+  for (i = 0; i < net->n_var; ++i)
+    {
+      for (k = net->jac_row_ptr[i]; k < net->jac_row_ptr[i + 1]; ++k)
+	{
+	  if (net->jac_col[k] == i)
+	    state->diag[i] = k;
+	}
+    }
+  state->net = net;
+  return GSL_SUCCESS;
+}
+
+// solve (I - gamma*h*J) x = gamma*h*b in place
+static void
+ros4_solve (ros4_state_t * state, double gh, double b[], struct instr *in)
+{
+  size_t i;
+  INSTR_START (in, t0);
+  for (i = 0; i < state->dim; ++i)
+    b[i] *= gh;
+  sparse_lu_solve (state->lu, b, b);
+  INSTR_COUNT (in, n_lu_solve);
+  INSTR_STOP (in, PHASE_LINALG, t0);
+}
+
+static int
+ros4_apply (void *vstate, size_t dim, double t, double h, double y[],
+	    double yerr[], const double dydt_in[], double dydt_out[],
+	    const gsl_odeiv2_system * sys)
+{
+  ros4_state_t *state = (ros4_state_t *) vstate;
+  const struct param *params = (const struct param *) sys->params;
+  struct instr *in = params->instr;
+  const double gh = ROS4_GAM * h;
+  double *dfdt = state->dfdt, *ytmp = state->ytmp;
+  double *g1 = state->g1, *g2 = state->g2, *g3 = state->g3, *g4 = state->g4;
+  size_t i;
+  int k, status;
+
+  if (state->net != params->net)
+    {
+      status = ros4_setup (state, params->net);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+
+  if (dydt_in != NULL)
+    memcpy (state->f0, dydt_in, dim * sizeof (double));
+  else
+    {
+      status = GSL_ODEIV_FN_EVAL (sys, t, y, state->f0);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+
+  /* a new Jacobian unless this is a retry from the same point, which
+   * is the only time we get called twice with the same t and y */
+  if (!state->jac_ok || t != state->t_jac
+      || memcmp (y, state->y_jac, dim * sizeof (double)) != 0)
+    {
+      status = jacobian_sparse (t, y, state->jac, dfdt, sys->params);
+      if (status != GSL_SUCCESS)
+	return status;
+      state->jac_ok = 1;
+      state->lu_ok = 0;
+      state->t_jac = t;
+      memcpy (state->y_jac, y, dim * sizeof (double));
+    }
+  /* and a new LU whenever J or h changed, i.e. on every call except
+   * an exact repeat. that keeps a stale factorization from ever being
+   * used; it doesn't save any factorizations */
+  if (!state->lu_ok || h != state->h_lu)
+    {
+      const int nnz = state->net->jac_nnz;
+      INSTR_START (in, t0);
+      for (k = 0; k < nnz; ++k)
+	state->a[k] = -gh * state->jac[k];
+      for (i = 0; i < dim; ++i)
+	state->a[state->diag[i]] += 1.0;
+      status = sparse_lu_factor (state->lu, state->a);
+      INSTR_COUNT (in, n_lu_factor);
+      INSTR_STOP (in, PHASE_LINALG, t0);
+      state->lu_ok = (status == GSL_SUCCESS);
+      state->h_lu = h;
+      // let GSL try a smaller step
+      if (status != GSL_SUCCESS)
+	return GSL_FAILURE;
+    }
+
+  for (i = 0; i < dim; ++i)
+    g1[i] = state->f0[i] + h * ROS4_C1X * dfdt[i];
+  ros4_solve (state, gh, g1, in);
+
+  for (i = 0; i < dim; ++i)
+    ytmp[i] = y[i] + ROS4_A21 * g1[i];
+  status = GSL_ODEIV_FN_EVAL (sys, t + ROS4_A2X * h, ytmp, g2);
+  if (status != GSL_SUCCESS)
+    return status;
+  for (i = 0; i < dim; ++i)
+    g2[i] += h * ROS4_C2X * dfdt[i] + ROS4_C21 * g1[i] / h;
+  ros4_solve (state, gh, g2, in);
+
+  for (i = 0; i < dim; ++i)
+    ytmp[i] = y[i] + ROS4_A31 * g1[i] + ROS4_A32 * g2[i];
+  status = GSL_ODEIV_FN_EVAL (sys, t + ROS4_A3X * h, ytmp, g3);
+  if (status != GSL_SUCCESS)
+    return status;
+  // the 4th stage is at the same point as the 3rd
+  for (i = 0; i < dim; ++i)
+    g4[i] = g3[i] + h * ROS4_C4X * dfdt[i]
+      + (ROS4_C41 * g1[i] + ROS4_C42 * g2[i]) / h;
+  for (i = 0; i < dim; ++i)
+    g3[i] += h * ROS4_C3X * dfdt[i]
+      + (ROS4_C31 * g1[i] + ROS4_C32 * g2[i]) / h;
+  ros4_solve (state, gh, g3, in);
+  for (i = 0; i < dim; ++i)
+    g4[i] += ROS4_C43 * g3[i] / h;
+  ros4_solve (state, gh, g4, in);
+
+  for (i = 0; i < dim; ++i)
+    ytmp[i] = y[i] + ROS4_B1 * g1[i] + ROS4_B2 * g2[i] + ROS4_B3 * g3[i]
+      + ROS4_B4 * g4[i];
+  // y has to stay untouched if the step fails
+  if (dydt_out != NULL)
+    {
+      status = GSL_ODEIV_FN_EVAL (sys, t + h, ytmp, dydt_out);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+  for (i = 0; i < dim; ++i)
+    {
+      yerr[i] = ROS4_E1 * g1[i] + ROS4_E2 * g2[i] + ROS4_E3 * g3[i]
+	+ ROS4_E4 * g4[i];
+      y[i] = ytmp[i];
+    }
+  return GSL_SUCCESS;
+}
+
+static int
+ros4_set_driver (void *vstate, const gsl_odeiv2_driver * d)
+{
+  return GSL_SUCCESS;
+}
+
+static int
+ros4_reset (void *vstate, size_t dim)
+{
+  ros4_state_t *state = (ros4_state_t *) vstate;
+  state->jac_ok = state->lu_ok = 0;
+  return GSL_SUCCESS;
+}
+
+static unsigned int
+ros4_order (void *vstate)
+{
+  // the error estimate is the local error of the 3rd order solution
+  return 4;
+}
+
+static void
+ros4_free (void *vstate)
+{
+  ros4_state_t *state = (ros4_state_t *) vstate;
+  sparse_lu_free (state->lu);
+  free (state->diag);
+  free (state->jac);
+  free (state->a);
+  free (state->dfdt);
+  free (state->y_jac);
+  free (state->f0);
+  free (state->ytmp);
+  free (state->g1);
+  free (state->g2);
+  free (state->g3);
+  free (state->g4);
+  free (state);
+}
+
+static const gsl_odeiv2_step_type ros4_type = {
+  "ros4",			// name
+  1,				// can use dydt_in
+  1,				// gives exact dydt_out
+  &ros4_alloc,
+  &ros4_apply,
+  &ros4_set_driver,
+  &ros4_reset,
+  &ros4_order,
+  &ros4_free
+};
+
+const gsl_odeiv2_step_type *step_ros4 = &ros4_type;
@@ -0,0 +1,11 @@
+#ifndef STEP_ROS4_H
+#define STEP_ROS4_H
+
+#include <gsl/gsl_odeiv2.h>
+
+/* Kaps-Rentrop 4th order Rosenbrock method with an embedded 3rd order
+ * error estimate, on the sparse Jacobian and sparse LU solver. Only
+ * works on systems whose params are a struct param. */
+extern const gsl_odeiv2_step_type *step_ros4;
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#include "jacobian.h"
+#include "network.h"
+#include "param.h"
+#include "instrument.h"
+#include "sparse_lu.h"
+#include "step_sbsimp.h"
+
+/* A sparse version of GSL's bsimp stepper. bsimp is the same method
+ * (Bader & Deuflhard's semi-implicit midpoint rule plus Richardson
+ * extrapolation, see "Numerical Recipes" 17.5), but it works on the
+ * dense Jacobian and does a dense O(n^3) LU decomposition for every
+ * substep sequence, which is most of the run time once the network
+ * gets big. Here the Jacobian only has its nonzeros, and the LU
+ * solver (sparse_lu.c) works out the ordering and fill-in once per
+ * network and afterwards only redoes the arithmetic.
+ *
+ * GSL's evolve/control framework doesn't care what's inside a
+ * stepper, so this plugs straight into gsl_odeiv2_evolve_apply() in
+ * place of gsl_odeiv2_step_bsimp.
+ *
+ * Unlike bsimp we don't adapt the extrapolation order; we always use
+ * the first SBSIMP_K entries of the substep sequence and let the
+ * controller pick the step size. */
+
+#define SBSIMP_K 4
+
+// number of substeps for each column of the extrapolation table
+static const int sbsimp_seq[SBSIMP_K] = { 2, 6, 10, 14 };
+
+typedef struct
+{
+  size_t dim;
+  const struct network *net;	// network the symbolic LU was done for
+  struct sparse_lu *lu;
+  int *diag;			// diagonal positions in the Jacobian pattern
+  double *jac;			// Jacobian nonzeros at the start of the step
+  double *a;			// I - h_sub * J
+  double *dfdt;
+  double *f0;			// dy/dt at the start of the step
+  double *yk;			// midpoint rule state
+  double *del;
+  double *tmp;
+  double *tab;			// extrapolation table, SBSIMP_K^2 * dim
+} sbsimp_state_t;
+
+static void sbsimp_free (void *vstate);
+
+static void *
+sbsimp_alloc (size_t dim)
+{
+  sbsimp_state_t *state = calloc (1, sizeof (sbsimp_state_t));
+  if (state == NULL)
+    return NULL;
+  state->dim = dim;
+  state->dfdt = malloc (dim * sizeof (double));
+  state->f0 = malloc (dim * sizeof (double));
+  state->yk = malloc (dim * sizeof (double));
+  state->del = malloc (dim * sizeof (double));
+  state->tmp = malloc (dim * sizeof (double));
+  state->tab = malloc (SBSIMP_K * SBSIMP_K * dim * sizeof (double));
+  if (state->dfdt == NULL || state->f0 == NULL || state->yk == NULL
+      || state->del == NULL || state->tmp == NULL || state->tab == NULL)
+    {
+      sbsimp_free (state);
+      return NULL;
+    }
+  return state;
+}
+
+/* (re)do the symbolic factorization for a new network. this is the
+ * only place the stepper allocates after sbsimp_alloc() */
+static int
+sbsimp_setup (sbsimp_state_t * state, const struct network *net)
+{
+  int i, k;
+  sparse_lu_free (state->lu);
+  free (state->diag);
+  free (state->jac);
+  free (state->a);
+  state->net = NULL;
+  state->lu = sparse_lu_alloc (net->n_var, net->jac_row_ptr, net->jac_col);
+  state->diag = malloc (net->n_var * sizeof (int));
+  state->jac = malloc (net->jac_nnz * sizeof (double));
+  state->a = malloc (net->jac_nnz * sizeof (double));
+  if (state->lu == NULL || state->diag == NULL || state->jac == NULL
+      || state->a == NULL)
+    return GSL_ENOMEM;
+  for (i = 0; i < net->n_var; ++i)
+    {
+      for (k = net->jac_row_ptr[i]; k < net->jac_row_ptr[i + 1]; ++k)
+	{
+	  if (net->jac_col[k] == i)
+	    state->diag[i] = k;
+	}
+    }
+  state->net = net;
+  return GSL_SUCCESS;
+}
+
+/* One pass of the semi-implicit midpoint rule from t to t + h with
+ * n_sub substeps, starting from y0. The result goes in y_out. */
+static int
+sbsimp_midpoint (sbsimp_state_t * state, double t, double h, int n_sub,
+		 const double y0[], double y_out[],
+		 const gsl_odeiv2_system * sys)
+{
+  const size_t dim = state->dim;
+  const int nnz = state->net->jac_nnz;
+  const double h_sub = h / n_sub;
+  struct instr *in = ((const struct param *) sys->params)->instr;
+  double t_k = t;
+  size_t i;
+  int k, s, status;
+
+  // factor I - h_sub * J. the pattern is the same every time
+  INSTR_START (in, t0);
+  for (k = 0; k < nnz; ++k)
+    state->a[k] = -h_sub * state->jac[k];
+  for (i = 0; i < dim; ++i)
+    state->a[state->diag[i]] += 1.0;
+  status = sparse_lu_factor (state->lu, state->a);
+  INSTR_COUNT (in, n_lu_factor);
+  // one solve for the first substep and one for each of the others
+  INSTR_ADD (in, n_lu_solve, n_sub + 1);
+  if (status != GSL_SUCCESS)
+    return GSL_FAILURE;
+
+  // first substep
+  for (i = 0; i < dim; ++i)
+    state->del[i] = h_sub * (state->f0[i] + h_sub * state->dfdt[i]);
+  sparse_lu_solve (state->lu, state->del, state->del);
+  INSTR_STOP (in, PHASE_LINALG, t0);
+  for (i = 0; i < dim; ++i)
+    state->yk[i] = y0[i] + state->del[i];
+
+  // the rest of the substeps
+  for (s = 1; s <= n_sub; ++s)
+    {
+      t_k += h_sub;
+      status = GSL_ODEIV_FN_EVAL (sys, t_k, state->yk, state->tmp);
+      if (status != GSL_SUCCESS)
+	return status;
+      for (i = 0; i < dim; ++i)
+	state->tmp[i] = h_sub * state->tmp[i] - state->del[i];
+      INSTR_START (in, t1);
+      sparse_lu_solve (state->lu, state->tmp, state->tmp);
+      INSTR_STOP (in, PHASE_LINALG, t1);
+      if (s < n_sub)
+	{
+	  for (i = 0; i < dim; ++i)
+	    {
+	      state->del[i] += 2.0 * state->tmp[i];
+	      state->yk[i] += state->del[i];
+	    }
+	}
+      else
+	{
+	  // the last one is a smoothing step
+	  for (i = 0; i < dim; ++i)
+	    y_out[i] = state->yk[i] + state->tmp[i];
+	}
+    }
+  return GSL_SUCCESS;
+}
+
+static int
+sbsimp_apply (void *vstate, size_t dim, double t, double h, double y[],
+	      double yerr[], const double dydt_in[], double dydt_out[],
+	      const gsl_odeiv2_system * sys)
+{
+  sbsimp_state_t *state = (sbsimp_state_t *) vstate;
+  const struct param *params = (const struct param *) sys->params;
+  double *T = state->tab;
+  size_t i;
+  int j, m, status;
+
+  if (state->net != params->net)
+    {
+      status = sbsimp_setup (state, params->net);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+
+  if (dydt_in != NULL)
+    memcpy (state->f0, dydt_in, dim * sizeof (double));
+  else
+    {
+      status = GSL_ODEIV_FN_EVAL (sys, t, y, state->f0);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+  status = jacobian_sparse (t, y, state->jac, state->dfdt, sys->params);
+  if (status != GSL_SUCCESS)
+    return status;
+
+  /* build the extrapolation table. row j is the midpoint result with
+   * sbsimp_seq[j] substeps, extrapolated to zero step size (in h^2)
+   * using the rows above it (Neville's algorithm) */
+#define TAB(j, m) (&T[((j) * SBSIMP_K + (m)) * dim])
+  for (j = 0; j < SBSIMP_K; ++j)
+    {
+      status = sbsimp_midpoint (state, t, h, sbsimp_seq[j], y, TAB (j, 0),
+				sys);
+      if (status != GSL_SUCCESS)
+	return status;
+      for (m = 1; m <= j; ++m)
+	{
+	  const double ratio = (double) sbsimp_seq[j] / sbsimp_seq[j - m];
+	  const double fac = 1.0 / (ratio * ratio - 1.0);
+	  const double *cur = TAB (j, m - 1), *prev = TAB (j - 1, m - 1);
+	  double *out = TAB (j, m);
+	  for (i = 0; i < dim; ++i)
+	    out[i] = cur[i] + (cur[i] - prev[i]) * fac;
+	}
+    }
+
+  /* the best estimate is the bottom-right corner of the table, and the
+   * error estimate is how much it differs from the next-lower order.
+   * y only gets overwritten once nothing else can fail, since GSL wants
+   * it untouched if the step fails */
+  if (dydt_out != NULL)
+    {
+      status = GSL_ODEIV_FN_EVAL (sys, t + h, TAB (SBSIMP_K - 1,
+						   SBSIMP_K - 1), dydt_out);
+      if (status != GSL_SUCCESS)
+	return status;
+    }
+  for (i = 0; i < dim; ++i)
+    {
+      const double best = TAB (SBSIMP_K - 1, SBSIMP_K - 1)[i];
+      yerr[i] = best - TAB (SBSIMP_K - 1, SBSIMP_K - 2)[i];
+      y[i] = best;
+    }
+#undef TAB
+  return GSL_SUCCESS;
+}
+
+static int
+sbsimp_set_driver (void *vstate, const gsl_odeiv2_driver * d)
+{
+  return GSL_SUCCESS;
+}
+
+static int
+sbsimp_reset (void *vstate, size_t dim)
+{
+  return GSL_SUCCESS;
+}
+
+static unsigned int
+sbsimp_order (void *vstate)
+{
+  /* the error estimate is the local error of the order 2(K-1)
+   * extrapolation */
+  return 2 * (SBSIMP_K - 1);
+}
+
+static void
+sbsimp_free (void *vstate)
+{
+  sbsimp_state_t *state = (sbsimp_state_t *) vstate;
+  sparse_lu_free (state->lu);
+  free (state->diag);
+  free (state->jac);
+  free (state->a);
+  free (state->dfdt);
+  free (state->f0);
+  free (state->yk);
+  free (state->del);
+  free (state->tmp);
+  free (state->tab);
+  free (state);
+}
+
+static const gsl_odeiv2_step_type sbsimp_type = {
+  "sbsimp",			// name
+  1,				// can use dydt_in
+  1,				// gives exact dydt_out
+  &sbsimp_alloc,
+  &sbsimp_apply,
+  &sbsimp_set_driver,
+  &sbsimp_reset,
+  &sbsimp_order,
+  &sbsimp_free
+};
+
+const gsl_odeiv2_step_type *step_sbsimp = &sbsimp_type;
@@ -0,0 +1,11 @@
+#ifndef STEP_SBSIMP_H
+#define STEP_SBSIMP_H
+
+#include <gsl/gsl_odeiv2.h>
+
+/* Bader-Deuflhard semi-implicit extrapolation, like GSL's bsimp, but
+ * with the sparse Jacobian and sparse LU solver. Only works on systems
+ * whose params are a struct param. */
+extern const gsl_odeiv2_step_type *step_sbsimp;
+
+#endif
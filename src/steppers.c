@@ -0,0 +1,35 @@
+#include <string.h>
+#include <gsl/gsl_odeiv2.h>
+#include "step_bdf.h"
+#include "step_ros4.h"
+#include "step_sbsimp.h"
+#include "steppers.h"
+
+/* bsimp:  GSL's Bulirsch-Stoer, dense Jacobian and LU (the default)
+ * sbsimp: the same method, sparse (step_sbsimp.c)
+ * ros4:   4th order Rosenbrock, sparse (step_ros4.c)
+ * bdf:    variable order BDF with Jacobian reuse, sparse (step_bdf.c)
+ * msbdf:  GSL's variable order BDF, dense */
+const char *const stepper_names = "bsimp|sbsimp|ros4|bdf|msbdf";
+
+const gsl_odeiv2_step_type *
+stepper_by_name (const char *name)
+{
+  if (strcmp (name, "bsimp") == 0)
+    return gsl_odeiv2_step_bsimp;
+  if (strcmp (name, "sbsimp") == 0)
+    return step_sbsimp;
+  if (strcmp (name, "ros4") == 0)
+    return step_ros4;
+  if (strcmp (name, "bdf") == 0)
+    return step_bdf;
+  if (strcmp (name, "msbdf") == 0)
+    return gsl_odeiv2_step_msbdf;
+  return NULL;
+}
+
+int
+stepper_counts_linalg (const gsl_odeiv2_step_type * type)
+{
+  return type == step_sbsimp || type == step_ros4 || type == step_bdf;
+}
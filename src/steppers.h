@@ -0,0 +1,20 @@
+#ifndef STEPPERS_H
+#define STEPPERS_H
+
+#include <gsl/gsl_odeiv2.h>
+
+/* The stiff steppers that can be picked at run time, by name. They all
+ * go through the same gsl_odeiv2 evolve/control machinery, and have to
+ * be allocated with a gsl_odeiv2_driver (gsl_odeiv2_driver_alloc_*)
+ * since msbdf and bdf take their tolerances from it. */
+
+// "bsimp|sbsimp|..." for usage messages
+extern const char *const stepper_names;
+
+// NULL if there's no stepper called name
+const gsl_odeiv2_step_type *stepper_by_name (const char *name);
+/* whether the stepper is one of ours, which count and time their LU
+ * work (instrument.h); GSL's can't be looked into */
+int stepper_counts_linalg (const gsl_odeiv2_step_type * type);
+
+#endif
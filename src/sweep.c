@@ -0,0 +1,913 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#include "checkpoint.h"
+#include "equilibrium.h"
+#include "event.h"
+#include "instrument.h"
+#include "jacobian.h"
+#include "network.h"
+#include "ode_rhs.h"
+#include "output.h"
+#include "param.h"
+#include "rate_coeffs.h"
+#include "schedule.h"
+#include "sweep.h"
+
+// the columns before the isotopes' in the output
+#define SWEEP_N_HEAD 11
+
+/* Parameter sweeps: the same network integrated from many starting
+ * points, one independent problem per point, spread over a pool of
+ * threads.
+ *
+ * The grid file has one keyword per line, "#" starts a comment:
+ *
+ *   T       1.0e7  5.0e7  9  log   # K
+ *   rho     10     1000   3  log   # g/cm^3
+ *   x_h1    0.7    0.99   3        # initial mass fractions
+ *   x_c12   0.01   0.01   1
+ *   t_stop  1.0e22                 # sec
+ *   eps_abs 1.0e-8
+ *   eps_rel 0.0
+ *   stop    h1 < 1e-3              # see event.c
+ *
+ * Axes take min, max, number of points and an optional "log"; anything
+ * left out keeps the value main.c uses for a single run. A point ends
+ * at t_stop, or sooner, at the first "stop" event it hits (there can
+ * be several), and the time it ended at is in its "t_end" column: with
+ * "stop h1 < 1e-3", that's how long the H1 lasts at every point, and
+ * no time goes on the 1e22 sec of nothing much after it runs out.
+ *
+ * How long a point takes depends a lot on where it is (hot points burn
+ * out fast, cold ones crawl), so handing every thread a fixed slice of
+ * the grid leaves most of them idle at the end. Instead each worker
+ * gets its own queue of points, works through it from the back, and
+ * once it's empty steals points from the front of somebody else's
+ * queue. Neighbouring points cost about the same, so the initial
+ * queues are contiguous slices of the grid.
+ *
+ * The network is shared (read-only); everything that gets written
+ * during an integration (rates, the GSL driver with its step, control
+ * and evolve, counters) belongs to one worker.
+ *
+ * Besides the final abundances, every point gets its step count, GSL
+ * status, rejected steps, RHS and Jacobian calls (0 if built without
+ * instrumentation) and wall time, so the expensive corners of the grid
+ * stand out, and the time it ended at.
+ *
+ * With equilibrium set, a point isn't integrated at all: the CNO
+ * isotopes get their equilibrium abundances (equilibrium.c) with the
+ * starting H1, and "steps" counts the Newton and pseudo-transient
+ * iterations that took; t_end is 0.
+ *
+ * A big sweep can take longer than a batch job is allowed to run, so
+ * with a checkpoint file every point gets appended to it as soon as
+ * it's done: a struct ckpt_header (checkpoint.h), the grid as
+ * SWEEP_GRID_DESC doubles, then one struct sweep_record followed by
+ * n_iso final mass fractions per finished point, in whatever order
+ * they finished. A restarted sweep reads that back and only runs the
+ * points that aren't in it. A record cut short by the crash is simply
+ * dropped, and that point done again. */
+
+// give up on a point after this many steps
+#define SWEEP_MAX_STEPS 1000000
+
+struct sweep_queue
+{
+  pthread_mutex_t lock;
+  long head, tail;		// points [head, tail) are still to do
+};
+
+/* T, rho, x_h1, x_c12 as {min, max, n, log}, then t_stop, the number
+ * of stop events and {a, b, dir, value} for each of them */
+#define SWEEP_GRID_DESC (18 + 4 * EVENT_MAX)
+
+// one finished point in the checkpoint file
+struct sweep_record
+{
+  int64_t k;
+  int32_t status;
+  int32_t pad;
+  int64_t n_steps, n_rejected, n_rhs, n_jac;
+  double seconds;
+  double t_end;
+};
+
+// what a worker integrates one point after another with
+struct sweep_point
+{
+  const struct sweep_grid *grid;
+  const struct network *net;
+  int equilibrium;
+  struct param params;
+  struct instr instr;
+  gsl_odeiv2_system sys;
+  gsl_odeiv2_driver *driver;	// NULL for equilibrium
+};
+
+struct sweep_shared
+{
+  const struct sweep_grid *grid;
+  const struct network *net;
+  const gsl_odeiv2_step_type *step_type;
+  int jac_ad;			// see struct param
+  int equilibrium;		// solve for the CNO equilibrium instead
+  int n_threads;
+  struct sweep_queue *queue;	// positions in todo
+  long *todo;			// the points still to do
+  struct sweep_result *result;
+  double *x;			// final mass fractions, n_iso per point
+  FILE *ckpt;			// finished points go here, or NULL
+  pthread_mutex_t ckpt_lock;
+  int ckpt_status;		// first error writing it
+};
+
+struct sweep_worker
+{
+  struct sweep_shared *shared;
+  int id;
+  int status;
+  long n_done;			// points it finished
+};
+
+void
+sweep_grid_default (struct sweep_grid *grid)
+{
+  const struct sweep_axis T = { 25.0e+06, 25.0e+06, 1, 0 };
+  const struct sweep_axis rho = { 150.0, 150.0, 1, 0 };
+  const struct sweep_axis x_h1 = { 0.99, 0.99, 1, 0 };
+  const struct sweep_axis x_c12 = { 0.01, 0.01, 1, 0 };
+  grid->T = T;
+  grid->rho = rho;
+  grid->x_h1 = x_h1;
+  grid->x_c12 = x_c12;
+  grid->t_stop = 1.0e+22;
+  grid->eps_abs = 1.0e-8;
+  grid->eps_rel = 0.0;
+  grid->events.n = 0;
+}
+
+static int
+read_axis (const char *rest, struct sweep_axis *axis)
+{
+  char flag[8] = "";
+  int n = sscanf (rest, "%lf %lf %d %7s", &axis->min, &axis->max,
+		  &axis->n, flag);
+  if (n < 3 || axis->n < 1)
+    return -1;
+  axis->log = (n == 4 && strcmp (flag, "log") == 0);
+  if (n == 4 && !axis->log && strcmp (flag, "lin") != 0)
+    return -1;
+  if (axis->log && (axis->min <= 0.0 || axis->max <= 0.0))
+    return -1;
+  return 0;
+}
+
+/* Reads the grid file at path (see above); the isotopes of its stop
+ * events are looked up in net. */
+int
+sweep_read_grid (const char *path, const struct network *net,
+		 struct sweep_grid *grid)
+{
+  FILE *fp = fopen (path, "r");
+  char line[256];
+  int line_no = 0;
+
+  if (fp == NULL)
+    return GSL_EFAILED;
+  sweep_grid_default (grid);
+
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      char key[16];
+      int used, bad = 0;
+      char *hash = strchr (line, '#');
+      ++line_no;
+      if (hash != NULL)
+	*hash = '\0';
+      if (sscanf (line, "%15s%n", key, &used) != 1)
+	continue;		// blank or comment
+      const char *rest = line + used;
+
+      if (strcmp (key, "T") == 0)
+	bad = read_axis (rest, &grid->T);
+      else if (strcmp (key, "rho") == 0)
+	bad = read_axis (rest, &grid->rho);
+      else if (strcmp (key, "x_h1") == 0)
+	bad = read_axis (rest, &grid->x_h1);
+      else if (strcmp (key, "x_c12") == 0)
+	bad = read_axis (rest, &grid->x_c12);
+      else if (strcmp (key, "t_stop") == 0)
+	bad = (sscanf (rest, "%lf", &grid->t_stop) != 1);
+      else if (strcmp (key, "eps_abs") == 0)
+	bad = (sscanf (rest, "%lf", &grid->eps_abs) != 1);
+      else if (strcmp (key, "eps_rel") == 0)
+	bad = (sscanf (rest, "%lf", &grid->eps_rel) != 1);
+      else if (strcmp (key, "stop") == 0)
+	bad = (event_parse (&grid->events, net, 1, rest) != GSL_SUCCESS);
+      else
+	bad = 1;
+
+      if (bad)
+	{
+	  fprintf (stderr, "%s:%d: can't make sense of this line\n", path,
+		   line_no);
+	  fclose (fp);
+	  return GSL_EINVAL;
+	}
+    }
+  fclose (fp);
+  return GSL_SUCCESS;
+}
+
+long
+sweep_n_points (const struct sweep_grid *grid)
+{
+  return (long) grid->T.n * grid->rho.n * grid->x_h1.n * grid->x_c12.n;
+}
+
+double
+sweep_axis_value (const struct sweep_axis *axis, int i)
+{
+  if (axis->n == 1)
+    return axis->min;
+  double f = (double) i / (axis->n - 1);
+  if (axis->log)
+    return axis->min * pow (axis->max / axis->min, f);
+  return axis->min + f * (axis->max - axis->min);
+}
+
+/* point index -> (T, rho, X(H1), X(C12)); X(C12) varies fastest, T
+ * slowest */
+static void
+point_values (const struct sweep_grid *grid, long k, double *T,
+	      double *rho, double *x_h1, double *x_c12)
+{
+  *x_c12 = sweep_axis_value (&grid->x_c12, k % grid->x_c12.n);
+  k /= grid->x_c12.n;
+  *x_h1 = sweep_axis_value (&grid->x_h1, k % grid->x_h1.n);
+  k /= grid->x_h1.n;
+  *rho = sweep_axis_value (&grid->rho, k % grid->rho.n);
+  k /= grid->rho.n;
+  *T = sweep_axis_value (&grid->T, k);
+}
+
+/* next position in todo for worker id: its own queue first, then
+ * everybody else's */
+static long
+next_point (struct sweep_shared *sh, int id)
+{
+  long k = -1;
+  int i;
+
+  struct sweep_queue *own = &sh->queue[id];
+  pthread_mutex_lock (&own->lock);
+  if (own->head < own->tail)
+    k = --own->tail;
+  pthread_mutex_unlock (&own->lock);
+  if (k >= 0)
+    return k;
+
+  /* Nothing new ever gets queued, so once a full pass over the other
+   * queues comes up empty, we're done. */
+  for (i = 1; i < sh->n_threads && k < 0; ++i)
+    {
+      struct sweep_queue *victim = &sh->queue[(id + i) % sh->n_threads];
+      pthread_mutex_lock (&victim->lock);
+      if (victim->head < victim->tail)
+	k = victim->head++;
+      pthread_mutex_unlock (&victim->lock);
+    }
+  return k;
+}
+
+// T, rho and the starting abundances of point k, same as main.c's
+static void
+start_point (const struct sweep_point *p, struct param *params, long k,
+	     double y[])
+{
+  const struct network *net = p->net;
+  const int h1 = network_find_isotope (net, "h1");
+  const int c12 = network_find_isotope (net, "c12");
+  double x_h1, x_c12;
+  int i;
+
+  point_values (p->grid, k, &params->T, &params->rho, &x_h1, &x_c12);
+  for (i = 0; i < net->n_iso; ++i)
+    y[i] = 1.0e-20 * (params->rho / net->iso[i].molar_mass);
+  y[h1] = x_h1 * (params->rho / net->iso[h1].molar_mass);
+  y[c12] = x_c12 * (params->rho / net->iso[c12].molar_mass);
+}
+
+static int
+equilibrium_point (struct sweep_point *p, long k, struct sweep_result *r,
+		   double x[])
+{
+  const struct network *net = p->net;
+  struct param *params = &p->params;
+  const int n_iso = net->n_iso;
+  double y[n_iso];
+  struct equil_stats eq;
+  int i, status;
+
+  start_point (p, params, k, y);
+  instr_reset (params->instr);
+  status = equilibrium_solve (params, y, &eq);
+  for (i = 0; i < n_iso; ++i)
+    x[i] = y[i] / (params->rho / net->iso[i].molar_mass);
+  r->n_steps = eq.n_newton + eq.n_ptc;
+  r->status = status;
+  r->t_end = 0.0;
+  r->n_rejected = 0;
+  r->n_rhs = params->instr->n_rhs;
+  r->n_jac = params->instr->n_jac;
+  r->seconds = instr_now () - params->instr->t_start;
+  return status;
+}
+
+static int
+integrate_point (struct sweep_point *p, long k, struct sweep_result *r,
+		 double x[])
+{
+  const struct network *net = p->net;
+  const double t_stop = p->grid->t_stop;
+  struct param *params = &p->params;
+  gsl_odeiv2_driver *driver = p->driver;
+  const struct event_list *events = &p->grid->events;
+  const int n_iso = net->n_iso;
+  double y[n_iso], y_prev[n_iso], f_prev[n_iso], f_now[n_iso];
+  double y_end[n_iso], to_x[n_iso];
+  double t_now = 0.0, t_prev, h = 1.0e-8;
+  int i, status = GSL_SUCCESS;
+  long n_steps = 0;
+
+  start_point (p, params, k, y);
+  for (i = 0; i < n_iso; ++i)
+    to_x[i] = net->iso[i].molar_mass / params->rho;
+  instr_reset (params->instr);
+  gsl_odeiv2_driver_reset (driver);
+  while (t_now < t_stop)
+    {
+      if (n_steps == SWEEP_MAX_STEPS)
+	{
+	  status = GSL_EMAXITER;
+	  break;
+	}
+      t_prev = t_now;
+      if (events->n > 0)
+	memcpy (y_prev, y, sizeof (y));
+      status = gsl_odeiv2_evolve_apply (driver->e, driver->c, driver->s,
+					driver->sys, &t_now, t_stop, &h, y);
+      if (status != GSL_SUCCESS)
+	break;
+      ++n_steps;
+      for (i = 0; i < n_iso; ++i)
+	{
+	  if (y[i] / (params->rho / net->iso[i].molar_mass) < 1.0e-20)
+	    y[i] = 0.0;
+	}
+      // they're all stop events, so the first one ends the point
+      if (events->n > 0 && event_crossed (events, y_prev, y, to_x))
+	{
+	  int which[EVENT_MAX];
+	  double t_hit[EVENT_MAX];
+	  ode_rhs_uncounted (t_prev, y_prev, f_prev, params);
+	  ode_rhs_uncounted (t_now, y, f_now, params);
+	  event_locate (events, t_prev, y_prev, f_prev, t_now, y, f_now, to_x,
+			which, t_hit);
+	  memcpy (y_end, y, sizeof (y));
+	  dense_hermite (n_iso, t_prev, y_prev, f_prev, t_now, y_end, f_now,
+			 t_hit[0], y);
+	  t_now = t_hit[0];
+	  break;
+	}
+    }
+
+  for (i = 0; i < n_iso; ++i)
+    x[i] = y[i] / (params->rho / net->iso[i].molar_mass);
+  r->n_steps = n_steps;
+  r->status = status;
+  r->t_end = t_now;
+  r->n_rejected = driver->e->failed_steps;
+  r->n_rhs = params->instr->n_rhs;
+  r->n_jac = params->instr->n_jac;
+  r->seconds = instr_now () - params->instr->t_start;
+  return status;
+}
+
+/* Everything one worker (a thread here, or an MPI rank, sweep_mpi.c)
+ * needs to run points of the grid: its own rates, counters and GSL
+ * driver, on the shared network. Returns NULL if memory runs out. */
+struct sweep_point *
+sweep_point_alloc (const struct sweep_grid *grid, const struct network *net,
+		   const gsl_odeiv2_step_type *step_type, int jac_ad,
+		   int equilibrium)
+{
+  struct sweep_point *p = malloc (sizeof (struct sweep_point));
+  if (p == NULL)
+    return NULL;
+  p->grid = grid;
+  p->net = net;
+  p->equilibrium = equilibrium;
+  p->params.net = net;
+  p->params.n_iso = net->n_iso;
+  p->params.traj = NULL;
+  p->params.traj_pos = 0;
+  // counters only, no step history
+  instr_init (&p->instr, 0);
+  p->params.instr = &p->instr;
+  p->params.jac_ad = jac_ad;
+  p->params.energy = 0;
+  rate_state_init (&p->params.rates);
+
+  p->sys.function = ode_rhs;
+  p->sys.jacobian = jacobian;
+  p->sys.dimension = net->n_iso;
+  p->sys.params = &p->params;
+  // the equilibrium solver doesn't need an integrator
+  p->driver = NULL;
+  if (!equilibrium)
+    {
+      p->driver = gsl_odeiv2_driver_alloc_y_new (&p->sys, step_type, 1.0e-8,
+						 grid->eps_abs,
+						 grid->eps_rel);
+      if (p->driver == NULL)
+	{
+	  sweep_point_free (p);
+	  return NULL;
+	}
+    }
+  return p;
+}
+
+void
+sweep_point_free (struct sweep_point *p)
+{
+  if (p->driver != NULL)
+    gsl_odeiv2_driver_free (p->driver);
+  instr_free (&p->instr);
+  free (p);
+}
+
+/* Runs point k of the grid: its cost into r and the final mass
+ * fractions into x (n_iso of them). Returns the GSL status the point
+ * ended with, which is also r->status. */
+int
+sweep_point_run (struct sweep_point *p, long k, struct sweep_result *r,
+		 double x[])
+{
+  if (p->equilibrium)
+    return equilibrium_point (p, k, r, x);
+  return integrate_point (p, k, r, x);
+}
+
+/* One finished point as it goes into a checkpoint (or an MPI shard): a
+ * struct sweep_record, then the n_iso mass fractions. Returns
+ * GSL_SUCCESS or GSL_EFAILED. */
+int
+sweep_write_record (FILE * fp, long k, const struct sweep_result *r,
+		    const double x[], int n_iso)
+{
+  struct sweep_record rec;
+
+  memset (&rec, 0, sizeof (rec));
+  rec.k = k;
+  rec.status = r->status;
+  rec.n_steps = r->n_steps;
+  rec.n_rejected = r->n_rejected;
+  rec.n_rhs = r->n_rhs;
+  rec.n_jac = r->n_jac;
+  rec.seconds = r->seconds;
+  rec.t_end = r->t_end;
+  if (fwrite (&rec, sizeof (rec), 1, fp) != 1
+      || fwrite (x, sizeof (double), n_iso, fp) != (size_t) n_iso)
+    return GSL_EFAILED;
+  return GSL_SUCCESS;
+}
+
+/* The next record sweep_write_record() wrote: the point into *k, its
+ * cost into r and its mass fractions into x. Returns GSL_EOF at the end
+ * of the file, including a record that got cut short, or GSL_EINVAL if
+ * the point isn't on a grid of n_points. */
+int
+sweep_read_record (FILE * fp, long n_points, int n_iso, long *k,
+		   struct sweep_result *r, double x[])
+{
+  struct sweep_record rec;
+
+  if (fread (&rec, sizeof (rec), 1, fp) != 1)
+    return GSL_EOF;
+  if (rec.k < 0 || rec.k >= n_points)
+    return GSL_EINVAL;
+  if (fread (x, sizeof (double), n_iso, fp) != (size_t) n_iso)
+    return GSL_EOF;
+  *k = rec.k;
+  r->status = rec.status;
+  r->n_steps = rec.n_steps;
+  r->n_rejected = rec.n_rejected;
+  r->n_rhs = rec.n_rhs;
+  r->n_jac = rec.n_jac;
+  r->seconds = rec.seconds;
+  r->t_end = rec.t_end;
+  return GSL_SUCCESS;
+}
+
+// append point k to the checkpoint, and make sure it gets to the disk
+static void
+log_point (struct sweep_shared *sh, long k)
+{
+  const int n_iso = sh->net->n_iso;
+
+  pthread_mutex_lock (&sh->ckpt_lock);
+  if (sweep_write_record (sh->ckpt, k, &sh->result[k], sh->x + k * n_iso,
+			  n_iso) != GSL_SUCCESS || fflush (sh->ckpt) != 0)
+    {
+      if (sh->ckpt_status == GSL_SUCCESS)
+	sh->ckpt_status = GSL_EFAILED;
+    }
+  pthread_mutex_unlock (&sh->ckpt_lock);
+}
+
+static void
+grid_desc (const struct sweep_grid *grid, double desc[SWEEP_GRID_DESC])
+{
+  const struct sweep_axis *axis[4] =
+    { &grid->T, &grid->rho, &grid->x_h1, &grid->x_c12 };
+  int a;
+  for (a = 0; a < 4; ++a)
+    {
+      desc[4 * a] = axis[a]->min;
+      desc[4 * a + 1] = axis[a]->max;
+      desc[4 * a + 2] = axis[a]->n;
+      desc[4 * a + 3] = axis[a]->log;
+    }
+  desc[16] = grid->t_stop;
+  // a different stop event is a different sweep, too
+  for (a = 17; a < SWEEP_GRID_DESC; ++a)
+    desc[a] = 0.0;
+  desc[17] = grid->events.n;
+  for (a = 0; a < grid->events.n; ++a)
+    {
+      const struct event *ev = &grid->events.ev[a];
+      desc[18 + 4 * a] = ev->a;
+      desc[18 + 4 * a + 1] = ev->b;
+      desc[18 + 4 * a + 2] = ev->dir;
+      desc[18 + 4 * a + 3] = ev->value;
+    }
+}
+
+/* Starts a new checkpoint file at path, or with restart, reads back
+ * the points an earlier run of the same sweep finished (done[k] gets
+ * set for them) and positions the file after the last one. Returns
+ * NULL, with a message, if the file can't be used. */
+static FILE *
+open_log (struct sweep_shared *sh, const char *path, int restart,
+	  char done[])
+{
+  const int n_iso = sh->net->n_iso;
+  const long n_points = sweep_n_points (sh->grid);
+  struct ckpt_header hdr, want;
+  double desc[SWEEP_GRID_DESC], want_desc[SWEEP_GRID_DESC];
+  struct sweep_result r;
+  double x[n_iso];
+  const char *why = NULL;
+  FILE *fp;
+  int64_t end;
+  long k, n_done = 0;
+  int i;
+
+  // an equilibrium sweep is its own kind of "stepper"
+  ckpt_header_init (&want, CKPT_SWEEP, n_iso,
+		    sh->equilibrium ? "equilibrium" : sh->step_type->name,
+		    sh->grid->eps_abs, sh->grid->eps_rel);
+  grid_desc (sh->grid, want_desc);
+  if (!restart)
+    {
+      fp = fopen (path, "wb");
+      if (fp == NULL || ckpt_write_header (fp, &want) != GSL_SUCCESS
+	  || fwrite (want_desc, sizeof (double), SWEEP_GRID_DESC, fp)
+	  != SWEEP_GRID_DESC || fflush (fp) != 0)
+	{
+	  fprintf (stderr, "could not write checkpoint %s\n", path);
+	  if (fp != NULL)
+	    fclose (fp);
+	  return NULL;
+	}
+      return fp;
+    }
+
+  fp = fopen (path, "r+b");
+  if (fp == NULL)
+    why = "unreadable";
+  else if (ckpt_read_header (fp, &hdr) != GSL_SUCCESS
+	   || hdr.kind != CKPT_SWEEP
+	   || fread (desc, sizeof (double), SWEEP_GRID_DESC, fp)
+	   != SWEEP_GRID_DESC)
+    why = "not a checkpoint of a sweep";
+  else if (hdr.n_iso != want.n_iso)
+    why = "different network";
+  else if (strcmp (hdr.stepper, want.stepper) != 0)
+    why = "different stepper";
+  else if (hdr.eps_abs != want.eps_abs || hdr.eps_rel != want.eps_rel)
+    why = "different tolerances";
+  else
+    for (i = 0; i < SWEEP_GRID_DESC; ++i)
+      if (desc[i] != want_desc[i])
+	why = "different grid";
+
+  // everything up to the first incomplete record
+  end = why == NULL ? ftello (fp) : 0;
+  while (why == NULL
+	 && sweep_read_record (fp, n_points, n_iso, &k, &r, x)
+	 == GSL_SUCCESS)
+    {
+      sh->result[k] = r;
+      memcpy (sh->x + k * n_iso, x, sizeof (x));
+      if (!done[k])
+	++n_done;
+      done[k] = 1;
+      end = ftello (fp);
+    }
+  if (why == NULL && (ftruncate (fileno (fp), end) != 0
+		      || fseeko (fp, end, SEEK_SET) != 0))
+    why = "can't append to it";
+  if (why != NULL)
+    {
+      fprintf (stderr, "can't restart from %s: %s\n", path, why);
+      if (fp != NULL)
+	fclose (fp);
+      return NULL;
+    }
+  printf ("%18s %ld of %ld points done\n", "RESTART:", n_done, n_points);
+  return fp;
+}
+
+static void *
+sweep_worker_main (void *arg)
+{
+  struct sweep_worker *w = arg;
+  struct sweep_shared *sh = w->shared;
+  const int n_iso = sh->net->n_iso;
+  struct sweep_point *p;
+  long k;
+
+  p = sweep_point_alloc (sh->grid, sh->net, sh->step_type, sh->jac_ad,
+			 sh->equilibrium);
+  if (p == NULL)
+    {
+      w->status = GSL_ENOMEM;
+      return NULL;
+    }
+  while ((k = next_point (sh, w->id)) >= 0)
+    {
+      k = sh->todo[k];
+      sweep_point_run (p, k, &sh->result[k], sh->x + k * n_iso);
+      if (sh->ckpt != NULL)
+	log_point (sh, k);
+      ++w->n_done;
+    }
+  sweep_point_free (p);
+  return NULL;
+}
+
+static int
+write_results (const struct sweep_grid *grid, const struct network *net,
+	       long n_points, const struct sweep_result result[],
+	       const double x_all[], const char *out_path)
+{
+  double T, rho, x_h1, x_c12;
+  long k;
+  int i;
+  FILE *fp = fopen (out_path, "w");
+  if (fp == NULL)
+    return GSL_EFAILED;
+
+  fprintf (fp, "%15s %15s %15s %15s %10s %6s %10s %10s %10s %11s %15s",
+	   "T", "rho", "x_h1_0", "x_c12_0", "steps", "status", "rejected",
+	   "rhs", "jac", "seconds", "t_end");
+  for (i = 0; i < net->n_iso; ++i)
+    fprintf (fp, " %15s", net->iso[i].name);
+  fprintf (fp, "\n");
+
+  for (k = 0; k < n_points; ++k)
+    {
+      const double *x = x_all + k * net->n_iso;
+      point_values (grid, k, &T, &rho, &x_h1, &x_c12);
+      const struct sweep_result *r = &result[k];
+      fprintf (fp, "%15.4e %15.4e %15.4e %15.4e %10ld %6d %10ld %10ld %10ld "
+	       "%11.4e %15.4e", T, rho, x_h1, x_c12, r->n_steps, r->status,
+	       r->n_rejected, r->n_rhs, r->n_jac, r->seconds, r->t_end);
+      for (i = 0; i < net->n_iso; ++i)
+	fprintf (fp, " %15.4e", x[i]);
+      fprintf (fp, "\n");
+    }
+  return fclose (fp) == 0 ? GSL_SUCCESS : GSL_EFAILED;
+}
+
+/* the same table in the binary format (output.h), every column a
+ * double, for sweeps too big to want to parse */
+static int
+write_results_binary (const struct sweep_grid *grid,
+		      const struct network *net, long n_points,
+		      const struct sweep_result result[],
+		      const double x_all[], const char *out_path)
+{
+  static const char *const head[SWEEP_N_HEAD] = {
+    "T", "rho", "x_h1_0", "x_c12_0", "steps", "status", "rejected", "rhs",
+    "jac", "seconds", "t_end"
+  };
+  const int n_col = SWEEP_N_HEAD + net->n_iso;
+  const char *name[n_col];
+  double row[n_col];
+  struct out_writer *out;
+  long k;
+  int i, status = GSL_SUCCESS;
+
+  for (i = 0; i < SWEEP_N_HEAD; ++i)
+    name[i] = head[i];
+  for (i = 0; i < net->n_iso; ++i)
+    name[SWEEP_N_HEAD + i] = net->iso[i].name;
+  out = out_open (out_path, n_col, name, SWEEP_N_HEAD, net->n_iso, 0.0, 0.0,
+		  0);
+  if (out == NULL)
+    return GSL_EFAILED;
+  for (k = 0; k < n_points && status == GSL_SUCCESS; ++k)
+    {
+      const struct sweep_result *r = &result[k];
+      point_values (grid, k, &row[0], &row[1], &row[2], &row[3]);
+      row[4] = r->n_steps;
+      row[5] = r->status;
+      row[6] = r->n_rejected;
+      row[7] = r->n_rhs;
+      row[8] = r->n_jac;
+      row[9] = r->seconds;
+      row[10] = r->t_end;
+      for (i = 0; i < net->n_iso; ++i)
+	row[SWEEP_N_HEAD + i] = x_all[k * net->n_iso + i];
+      status = out_append (out, row);
+    }
+  if (out_close (out) != GSL_SUCCESS)
+    status = GSL_EFAILED;
+  return status;
+}
+
+/* The results of every point, result[k] and n_iso mass fractions at
+ * x + k * n_iso, in grid order to out_path: as a text table, or if
+ * binary, in the results.bin format (see output.h). Returns GSL_SUCCESS
+ * or GSL_EFAILED. */
+int
+sweep_write_results (const struct sweep_grid *grid,
+		     const struct network *net, long n_points,
+		     const struct sweep_result result[], const double x[],
+		     const char *out_path, int binary)
+{
+  if (binary)
+    return write_results_binary (grid, net, n_points, result, x, out_path);
+  return write_results (grid, net, n_points, result, x, out_path);
+}
+
+/* Integrates every point of the grid from t = 0 to grid->t_stop, or
+ * its first stop event, on n_threads threads (<= 0 means one per
+ * core), with the Jacobian by AD if jac_ad (see jacobian.c), or with
+ * equilibrium, solves for the CNO equilibrium at each point instead,
+ * and writes them to out_path in grid order, whichever thread did them
+ * (as text, or if binary, in the results.bin format, see output.h). A
+ * point that fails doesn't stop the sweep; its GSL status goes in the
+ * "status" column. With a ckpt_path, finished points are logged there as they
+ * come in, and with restart, the points already in it are skipped.
+ * Returns GSL_SUCCESS, GSL_ENOMEM or GSL_EFAILED (couldn't start the
+ * threads or write the files). */
+int
+sweep_run (const struct sweep_grid *grid, const struct network *net,
+	   const gsl_odeiv2_step_type *step_type, int jac_ad,
+	   int equilibrium, int n_threads, const char *out_path,
+	   int binary, const char *ckpt_path, int restart)
+{
+  struct sweep_shared sh;
+  struct sweep_worker *worker = NULL;
+  pthread_t *thread = NULL;
+  char *finished = NULL;
+  const long n_points = sweep_n_points (grid);
+  long k, n_todo = 0, n_done = 0;
+  int i, n_started = 0, status = GSL_SUCCESS;
+
+  if (network_find_isotope (net, "h1") < 0
+      || network_find_isotope (net, "c12") < 0)
+    return GSL_EINVAL;
+
+  if (n_threads <= 0)
+    n_threads = (int) sysconf (_SC_NPROCESSORS_ONLN);
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  sh.grid = grid;
+  sh.net = net;
+  sh.step_type = step_type;
+  sh.jac_ad = jac_ad;
+  sh.equilibrium = equilibrium;
+  sh.queue = NULL;
+  sh.ckpt = NULL;
+  sh.ckpt_status = GSL_SUCCESS;
+  sh.todo = malloc (n_points * sizeof (long));
+  sh.result = calloc (n_points, sizeof (struct sweep_result));
+  sh.x = calloc (n_points * net->n_iso, sizeof (double));
+  finished = calloc (n_points, 1);
+  if (sh.todo == NULL || sh.result == NULL || sh.x == NULL
+      || finished == NULL)
+    {
+      status = GSL_ENOMEM;
+      goto done;
+    }
+  if (ckpt_path != NULL)
+    {
+      sh.ckpt = open_log (&sh, ckpt_path, restart, finished);
+      if (sh.ckpt == NULL)
+	{
+	  status = GSL_EFAILED;
+	  goto done;
+	}
+    }
+  for (k = 0; k < n_points; ++k)
+    if (!finished[k])
+      sh.todo[n_todo++] = k;
+
+  if (n_threads > n_todo)
+    n_threads = (int) n_todo;
+  if (n_threads < 1)
+    n_threads = 1;		// nothing left to do, but keep it simple
+  sh.n_threads = n_threads;
+  sh.queue = malloc (n_threads * sizeof (struct sweep_queue));
+  worker = malloc (n_threads * sizeof (struct sweep_worker));
+  thread = malloc (n_threads * sizeof (pthread_t));
+  if (sh.queue == NULL || worker == NULL || thread == NULL)
+    {
+      status = GSL_ENOMEM;
+      goto done;
+    }
+
+  // contiguous slices of the grid to start with
+  pthread_mutex_init (&sh.ckpt_lock, NULL);
+  for (i = 0; i < n_threads; ++i)
+    {
+      pthread_mutex_init (&sh.queue[i].lock, NULL);
+      sh.queue[i].head = n_todo * i / n_threads;
+      sh.queue[i].tail = n_todo * (i + 1) / n_threads;
+    }
+
+  for (i = 0; i < n_threads; ++i)
+    {
+      worker[i].shared = &sh;
+      worker[i].id = i;
+      worker[i].status = GSL_SUCCESS;
+      worker[i].n_done = 0;
+      if (pthread_create (&thread[i], NULL, sweep_worker_main, &worker[i])
+	  != 0)
+	break;
+      ++n_started;
+    }
+  /* if some threads didn't start, or couldn't get the memory for a
+   * point and quit, the others steal their points, so the sweep still
+   * finishes as long as one of them works. it's only an error if some
+   * points didn't get done */
+  for (i = 0; i < n_started; ++i)
+    pthread_join (thread[i], NULL);
+  for (i = 0; i < n_threads; ++i)
+    pthread_mutex_destroy (&sh.queue[i].lock);
+  pthread_mutex_destroy (&sh.ckpt_lock);
+
+  if (n_started == 0)
+    status = GSL_EFAILED;
+  for (i = 0; i < n_started; ++i)
+    n_done += worker[i].n_done;
+  if (status == GSL_SUCCESS && n_done < n_todo)
+    {
+      // e.g. none of them got their memory
+      status = GSL_EFAILED;
+      for (i = 0; i < n_started && status == GSL_EFAILED; ++i)
+	if (worker[i].status != GSL_SUCCESS)
+	  status = worker[i].status;
+    }
+  if (status == GSL_SUCCESS)
+    status = sh.ckpt_status;
+  if (status == GSL_SUCCESS)
+    status = sweep_write_results (grid, net, n_points, sh.result, sh.x,
+				  out_path, binary);
+
+done:
+  if (sh.ckpt != NULL && fclose (sh.ckpt) != 0 && status == GSL_SUCCESS)
+    status = GSL_EFAILED;
+  free (sh.todo);
+  free (finished);
+  free (sh.queue);
+  free (sh.result);
+  free (sh.x);
+  free (worker);
+  free (thread);
+  return status;
+}
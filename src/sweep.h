@@ -0,0 +1,74 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <gsl/gsl_odeiv2.h>
+#include "event.h"
+
+/* Runs the network over a grid of (T, rho, X(H1), X(C12)) points on
+ * several threads and writes the final abundances of every point to
+ * one file. See sweep.c for the grid file format. */
+
+struct network;
+struct sweep_point;
+
+struct sweep_axis
+{
+  double min, max;
+  int n;			// number of points, >= 1
+  int log;			// space the points logarithmically
+};
+
+struct sweep_grid
+{
+  struct sweep_axis T, rho, x_h1, x_c12;
+  double t_stop;
+  double eps_abs, eps_rel;
+  struct event_list events;	// "stop" lines: a point can end sooner
+};
+
+// how one point went
+struct sweep_result
+{
+  long n_steps;
+  int status;
+  // what it cost, to spot the pathological points
+  long n_rejected, n_rhs, n_jac;
+  double seconds;
+  double t_end;			// t_stop, or when it hit a stop event
+};
+
+void sweep_grid_default (struct sweep_grid *grid);
+int sweep_read_grid (const char *path, const struct network *net,
+		     struct sweep_grid *grid);
+long sweep_n_points (const struct sweep_grid *grid);
+double sweep_axis_value (const struct sweep_axis *axis, int i);
+int sweep_run (const struct sweep_grid *grid, const struct network *net,
+	       const gsl_odeiv2_step_type *step_type, int jac_ad,
+	       int equilibrium, int n_threads, const char *out_path,
+	       int binary, const char *ckpt_path, int restart);
+
+// the pieces sweep_run() is made of, for other ways of farming it out
+struct sweep_point *sweep_point_alloc (const struct sweep_grid *grid,
+				       const struct network *net,
+				       const gsl_odeiv2_step_type *step_type,
+				       int jac_ad, int equilibrium);
+void sweep_point_free (struct sweep_point *p);
+int sweep_point_run (struct sweep_point *p, long k, struct sweep_result *r,
+		     double x[]);
+int sweep_write_record (FILE * fp, long k, const struct sweep_result *r,
+			const double x[], int n_iso);
+int sweep_read_record (FILE * fp, long n_points, int n_iso, long *k,
+		       struct sweep_result *r, double x[]);
+int sweep_write_results (const struct sweep_grid *grid,
+			 const struct network *net, long n_points,
+			 const struct sweep_result result[], const double x[],
+			 const char *out_path, int binary);
+
+#ifdef NN_MPI
+int sweep_run_mpi (const struct sweep_grid *grid, const struct network *net,
+		   const gsl_odeiv2_step_type *step_type, int jac_ad,
+		   int equilibrium, const char *out_path, int binary);
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <gsl/gsl_errno.h>
+#include "network.h"
+#include "sweep.h"
+
+/* The same sweep as sweep_run(), over MPI instead of threads, for grids
+ * too big for one node:
+ *
+ *   mpirun -np 64 nuclear_network_mpi --sweep grid.txt --mpi
+ *
+ * Rank 0 is the master: it hands out the grid a few points at a time
+ * and does nothing else. Every other rank is a worker that asks for
+ * points, runs them (sweep_point_run(), one at a time) and asks for
+ * more. A hot point can be done in a hundredth of the time a cold one
+ * takes, so a fixed share of the grid per rank would leave most of them
+ * waiting for the slowest. The number of points handed out at once
+ * starts at a quarter of a fair share of what's left, with at most
+ * SWEEP_MPI_MAX_CHUNK, and drops to 1 towards the end. That keeps
+ * the messages rare while the grid is big, and the last ones small.
+ * Neighbouring points cost about the same, so a chunk is a run of
+ * consecutive points.
+ *
+ * Every worker appends its finished points to its own shard,
+ * OUTPUT.RANK, in the sweep checkpoint's record format
+ * (sweep_write_record()), so nothing but "more, please" and "these"
+ * goes over the network. Once every worker has closed its shard, the
+ * master merges them into OUTPUT in grid order, the same file
+ * sweep_run() would have written, and deletes them. That needs a file
+ * system all the ranks can see, which a cluster's scratch space is. If
+ * the merge fails, the shards are left where they are.
+ *
+ * With one rank there's nobody to hand anything to, and it's just
+ * sweep_run() on the cores of that node. */
+
+// never hand out more points than this at once
+#define SWEEP_MPI_MAX_CHUNK 64
+
+enum
+{
+  TAG_ASK,			// worker -> master: an int, its status so far
+  TAG_WORK			// master -> worker: long[2] first point and count
+};
+
+// OUTPUT.RANK
+static void
+shard_path (char *path, size_t len, const char *out_path, int rank)
+{
+  snprintf (path, len, "%s.%d", out_path, rank);
+}
+
+// hands out the grid until every worker has been told to stop
+static int
+master (long n_points, int n_ranks)
+{
+  long next = 0, work[2];
+  int n_running = n_ranks - 1, status = GSL_SUCCESS, w_status;
+  MPI_Status st;
+
+  while (n_running > 0)
+    {
+      MPI_Recv (&w_status, 1, MPI_INT, MPI_ANY_SOURCE, TAG_ASK,
+		MPI_COMM_WORLD, &st);
+      if (w_status != GSL_SUCCESS && status == GSL_SUCCESS)
+	status = w_status;
+      work[0] = next;
+      work[1] = (n_points - next) / (4 * (n_ranks - 1));
+      if (work[1] > SWEEP_MPI_MAX_CHUNK)
+	work[1] = SWEEP_MPI_MAX_CHUNK;
+      if (work[1] < 1)
+	work[1] = 1;
+      /* a worker that's failed gets nothing more, and nor does anybody
+       * once there's nothing left */
+      if (next >= n_points || w_status != GSL_SUCCESS)
+	work[1] = 0;
+      next += work[1];
+      if (work[1] == 0)
+	--n_running;
+      MPI_Send (work, 2, MPI_LONG, st.MPI_SOURCE, TAG_WORK, MPI_COMM_WORLD);
+    }
+  return status;
+}
+
+/* asks for points and runs them into its shard until there are no
+ * more. Returns GSL_SUCCESS, or what went wrong with the shard */
+static int
+worker (const struct sweep_grid *grid, const struct network *net,
+	const gsl_odeiv2_step_type *step_type, int jac_ad, int equilibrium,
+	const char *path)
+{
+  const int n_iso = net->n_iso;
+  struct sweep_point *p;
+  struct sweep_result r;
+  double x[n_iso];
+  long work[2], k;
+  int status = GSL_SUCCESS;
+  FILE *fp;
+
+  p = sweep_point_alloc (grid, net, step_type, jac_ad, equilibrium);
+  fp = fopen (path, "wb");
+  if (p == NULL)
+    status = GSL_ENOMEM;
+  else if (fp == NULL)
+    {
+      fprintf (stderr, "could not write %s\n", path);
+      status = GSL_EFAILED;
+    }
+  for (;;)
+    {
+      MPI_Send (&status, 1, MPI_INT, 0, TAG_ASK, MPI_COMM_WORLD);
+      MPI_Recv (work, 2, MPI_LONG, 0, TAG_WORK, MPI_COMM_WORLD,
+		MPI_STATUS_IGNORE);
+      if (work[1] == 0)
+	break;
+      for (k = work[0]; k < work[0] + work[1]; ++k)
+	{
+	  sweep_point_run (p, k, &r, x);
+	  if (sweep_write_record (fp, k, &r, x, n_iso) != GSL_SUCCESS)
+	    status = GSL_EFAILED;
+	}
+    }
+  if (fp != NULL && fclose (fp) != 0 && status == GSL_SUCCESS)
+    status = GSL_EFAILED;
+  if (p != NULL)
+    sweep_point_free (p);
+  return status;
+}
+
+/* reads every shard back into result and x (n_iso per point) and
+ * writes the lot out. Returns GSL_SUCCESS, GSL_ENOMEM, or GSL_EFAILED
+ * if a shard is unreadable or a point is missing */
+static int
+merge (const struct sweep_grid *grid, const struct network *net,
+       long n_points, int n_ranks, const char *out_path, int binary)
+{
+  const int n_iso = net->n_iso;
+  const size_t len = strlen (out_path) + 16;
+  struct sweep_result *result = malloc (n_points * sizeof (*result));
+  double *x = malloc (n_points * n_iso * sizeof (double));
+  char *done = calloc (n_points, 1);
+  char path[len];
+  long k, n_done = 0;
+  int rank, status = GSL_SUCCESS;
+  struct sweep_result r;
+  double x_k[n_iso];
+  FILE *fp;
+
+  if (result == NULL || x == NULL || done == NULL)
+    status = GSL_ENOMEM;
+  for (rank = 1; rank < n_ranks && status == GSL_SUCCESS; ++rank)
+    {
+      shard_path (path, len, out_path, rank);
+      fp = fopen (path, "rb");
+      if (fp == NULL)
+	{
+	  fprintf (stderr, "could not read %s\n", path);
+	  status = GSL_EFAILED;
+	  break;
+	}
+      while ((status = sweep_read_record (fp, n_points, n_iso, &k, &r, x_k))
+	     == GSL_SUCCESS)
+	{
+	  result[k] = r;
+	  memcpy (x + k * n_iso, x_k, sizeof (x_k));
+	  n_done += !done[k];
+	  done[k] = 1;
+	}
+      fclose (fp);
+      if (status == GSL_EOF)
+	status = GSL_SUCCESS;
+      else
+	fprintf (stderr, "%s is corrupt\n", path);
+    }
+  if (status == GSL_SUCCESS && n_done != n_points)
+    {
+      fprintf (stderr, "the shards only have %ld of %ld points\n", n_done,
+	       n_points);
+      status = GSL_EFAILED;
+    }
+  if (status == GSL_SUCCESS)
+    status = sweep_write_results (grid, net, n_points, result, x, out_path,
+				  binary);
+  for (rank = 1; rank < n_ranks && status == GSL_SUCCESS; ++rank)
+    {
+      shard_path (path, len, out_path, rank);
+      remove (path);
+    }
+  free (result);
+  free (x);
+  free (done);
+  return status;
+}
+
+/* sweep_run() over every rank of MPI_COMM_WORLD (see above), without
+ * the checkpoints: the shards are written as the points finish, but
+ * nothing reads them back yet. Initializes and finalizes MPI itself.
+ * Every rank gets the same status back: GSL_SUCCESS, GSL_ENOMEM or
+ * GSL_EFAILED (a shard or the output couldn't be written). */
+int
+sweep_run_mpi (const struct sweep_grid *grid, const struct network *net,
+	       const gsl_odeiv2_step_type *step_type, int jac_ad,
+	       int equilibrium, const char *out_path, int binary)
+{
+  const long n_points = sweep_n_points (grid);
+  const size_t len = strlen (out_path) + 16;
+  char path[len];
+  int rank, n_ranks, status, failed;
+
+  if (network_find_isotope (net, "h1") < 0
+      || network_find_isotope (net, "c12") < 0)
+    return GSL_EINVAL;
+  MPI_Init (NULL, NULL);
+  MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+  MPI_Comm_size (MPI_COMM_WORLD, &n_ranks);
+  if (n_ranks == 1)
+    {
+      status = sweep_run (grid, net, step_type, jac_ad, equilibrium, 0,
+			  out_path, binary, NULL, 0);
+      MPI_Finalize ();
+      return status;
+    }
+
+  if (rank == 0)
+    status = master (n_points, n_ranks);
+  else
+    {
+      shard_path (path, len, out_path, rank);
+      status = worker (grid, net, step_type, jac_ad, equilibrium, path);
+    }
+  // the shards are all closed once everybody's got here
+  failed = status != GSL_SUCCESS;
+  MPI_Allreduce (MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_LOR,
+		 MPI_COMM_WORLD);
+  if (rank == 0)
+    {
+      status = failed ? GSL_EFAILED
+	: merge (grid, net, n_points, n_ranks, out_path, binary);
+      if (status == GSL_SUCCESS)
+	printf ("%18s %ld points on %d workers\n", "MPI SWEEP:", n_points,
+		n_ranks - 1);
+    }
+  MPI_Bcast (&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Finalize ();
+  return status;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_errno.h>
+#include "trajectory.h"
+
+/* Trajectories are read from text files with one sample per line,
+ *
+ *   t  T  rho        # sec, K, g/cm^3
+ *
+ * in increasing t ("#" starts a comment). In between the samples, log
+ * T and log rho are interpolated linearly in t, i.e. T and rho change
+ * exponentially, which is what they do in an expansion or a
+ * contraction anyway, and never goes negative. The derivatives that
+ * come with it are what the Jacobian's dfdt needs. They jump at the
+ * samples, and a step across a jump can look converged when it isn't,
+ * so main.c ends a step at every sample. */
+
+int
+trajectory_read (struct trajectory *traj, const char *path)
+{
+  char line[256];
+  int cap = 256, n = 0;
+  FILE *fp = fopen (path, "r");
+
+  if (fp == NULL)
+    return GSL_EFAILED;
+  traj->t = malloc (cap * sizeof (double));
+  traj->ln_T = malloc (cap * sizeof (double));
+  traj->ln_rho = malloc (cap * sizeof (double));
+  if (traj->t == NULL || traj->ln_T == NULL || traj->ln_rho == NULL)
+    goto nomem;
+
+  while (fgets (line, sizeof (line), fp) != NULL)
+    {
+      double t, T, rho;
+      char *hash = strchr (line, '#');
+      if (hash != NULL)
+	*hash = '\0';
+      if (sscanf (line, "%lf %lf %lf", &t, &T, &rho) != 3)
+	continue;
+      if (T <= 0.0 || rho <= 0.0 || (n > 0 && t <= traj->t[n - 1]))
+	{
+	  fprintf (stderr, "%s: samples need T, rho > 0 and increasing t\n",
+		   path);
+	  fclose (fp);
+	  trajectory_free (traj);
+	  return GSL_EINVAL;
+	}
+      if (n == cap)
+	{
+	  double *t_more = realloc (traj->t, 2 * cap * sizeof (double));
+	  if (t_more != NULL)
+	    traj->t = t_more;
+	  double *T_more = realloc (traj->ln_T, 2 * cap * sizeof (double));
+	  if (T_more != NULL)
+	    traj->ln_T = T_more;
+	  double *rho_more = realloc (traj->ln_rho, 2 * cap * sizeof (double));
+	  if (rho_more != NULL)
+	    traj->ln_rho = rho_more;
+	  if (t_more == NULL || T_more == NULL || rho_more == NULL)
+	    goto nomem;
+	  cap *= 2;
+	}
+      traj->t[n] = t;
+      traj->ln_T[n] = log (T);
+      traj->ln_rho[n] = log (rho);
+      ++n;
+    }
+  fclose (fp);
+  traj->n = n;
+  if (n < 2)
+    {
+      trajectory_free (traj);
+      return GSL_EINVAL;
+    }
+  return GSL_SUCCESS;
+
+nomem:
+  fclose (fp);
+  trajectory_free (traj);
+  return GSL_ENOMEM;
+}
+
+void
+trajectory_free (struct trajectory *traj)
+{
+  free (traj->t);
+  free (traj->ln_T);
+  free (traj->ln_rho);
+  traj->t = traj->ln_T = traj->ln_rho = NULL;
+  traj->n = 0;
+}
+
+/* T, rho and their logarithmic time derivatives at time t. Outside the
+ * trajectory they stay at the first/last sample. *pos is where the
+ * last lookup ended up; the integrator mostly moves forward by a
+ * little, so we start looking from there (and it has to live with
+ * the caller, not in the trajectory, so that several threads can
+ * share one). Start it at 0. */
+void
+trajectory_eval (const struct trajectory *traj, int *pos, double t,
+		 double *T, double *rho, double *dlnT_dt, double *dlnrho_dt)
+{
+  int k = *pos;
+
+  if (t <= traj->t[0] || t >= traj->t[traj->n - 1])
+    {
+      k = (t <= traj->t[0]) ? 0 : traj->n - 1;
+      *T = exp (traj->ln_T[k]);
+      *rho = exp (traj->ln_rho[k]);
+      *dlnT_dt = *dlnrho_dt = 0.0;
+      return;
+    }
+  // find k with t[k] <= t < t[k+1]
+  if (k < 0 || k > traj->n - 2)
+    k = 0;
+  while (t < traj->t[k])
+    --k;
+  while (t >= traj->t[k + 1])
+    ++k;
+  *pos = k;
+
+  const double dt = traj->t[k + 1] - traj->t[k];
+  const double f = (t - traj->t[k]) / dt;
+  *dlnT_dt = (traj->ln_T[k + 1] - traj->ln_T[k]) / dt;
+  *dlnrho_dt = (traj->ln_rho[k + 1] - traj->ln_rho[k]) / dt;
+  *T = exp (traj->ln_T[k] + f * (traj->ln_T[k + 1] - traj->ln_T[k]));
+  *rho = exp (traj->ln_rho[k] + f * (traj->ln_rho[k + 1] - traj->ln_rho[k]));
+}
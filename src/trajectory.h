@@ -0,0 +1,21 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+/* A thermodynamic history: T(t) and rho(t) at a list of times, e.g.
+ * a tracer particle from a hydro run. See trajectory.c. */
+
+struct trajectory
+{
+  int n;			// number of samples, >= 2
+  double *t;			// sec, increasing
+  double *ln_T;			// log of T (K) at each sample
+  double *ln_rho;		// log of rho (g/cm^3) at each sample
+};
+
+int trajectory_read (struct trajectory *traj, const char *path);
+void trajectory_free (struct trajectory *traj);
+void trajectory_eval (const struct trajectory *traj, int *pos, double t,
+		      double *T, double *rho, double *dlnT_dt,
+		      double *dlnrho_dt);
+
+#endif